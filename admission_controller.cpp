@@ -0,0 +1,62 @@
+#include "admission_controller.hpp"
+
+#include "query_proto_converter.hpp"
+
+#include <algorithm>
+
+AdmissionController::AdmissionController(const std::size_t max_queue_depth, const std::size_t workers)
+    : max_queue_depth_{std::max<std::size_t>(max_queue_depth, 1)}
+    , workers_{std::max<std::size_t>(workers, 1)} {}
+
+grpc::Status AdmissionController::admit(const std::size_t queue_depth, const std::chrono::system_clock::time_point deadline) {
+    if (queue_depth >= max_queue_depth_) {
+        rejected_queue_full_.fetch_add(1, std::memory_order_relaxed);
+        return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "Too many pending requests");
+    }
+
+    if (deadline != NO_DEADLINE) {
+        std::chrono::duration<double, std::milli> mean_handling_time{};
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            mean_handling_time = mean_handling_time_;
+        }
+        // Every worker takes a query off the queue in turn, so the query starts once the workers
+        // got through the rounds of those ahead of it
+        const auto wait = std::chrono::duration_cast<std::chrono::system_clock::duration>(
+            mean_handling_time * static_cast<double>(queue_depth / workers_));
+        if (deadline <= std::chrono::system_clock::now() + wait) {
+            rejected_deadline_.fetch_add(1, std::memory_order_relaxed);
+            return grpc::Status(grpc::StatusCode::DEADLINE_EXCEEDED, "Deadline passes before the query would start");
+        }
+    }
+
+    admitted_.fetch_add(1, std::memory_order_relaxed);
+    return grpc::Status::OK;
+}
+
+void AdmissionController::record_handling_time(const std::chrono::steady_clock::duration handling_time) {
+    const std::chrono::duration<double, std::milli> handling_ms = handling_time;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (mean_handling_time_.count() == 0.0) {
+        mean_handling_time_ = handling_ms;
+    } else {
+        mean_handling_time_ += HANDLING_TIME_WEIGHT * (handling_ms - mean_handling_time_);
+    }
+}
+
+void AdmissionController::record_expired() {
+    expired_.fetch_add(1, std::memory_order_relaxed);
+}
+
+AdmissionStatistics AdmissionController::get_statistics() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return AdmissionStatistics{
+        .max_queue_depth = max_queue_depth_,
+        .mean_handling_ms = mean_handling_time_.count(),
+        .admitted = admitted_.load(std::memory_order_relaxed),
+        .rejected_queue_full = rejected_queue_full_.load(std::memory_order_relaxed),
+        .rejected_deadline = rejected_deadline_.load(std::memory_order_relaxed),
+        .expired = expired_.load(std::memory_order_relaxed),
+    };
+}
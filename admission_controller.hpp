@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#include <grpcpp/grpcpp.h>
+
+// Weight of the latest handling time in the moving average of them
+constexpr double HANDLING_TIME_WEIGHT = 0.125;
+
+struct AdmissionStatistics {
+    std::size_t max_queue_depth = 0;
+    // Moving average of how long a request worker takes with a query
+    double mean_handling_ms = 0.0;
+    std::uint64_t admitted = 0;
+    // Turned away with RESOURCE_EXHAUSTED, max_queue_depth queries waiting already
+    std::uint64_t rejected_queue_full = 0;
+    // Turned away with DEADLINE_EXCEEDED, the deadline passing before a worker would get to them
+    std::uint64_t rejected_deadline = 0;
+    // Queries and results given up on after they were admitted, their deadline having passed
+    std::uint64_t expired = 0;
+};
+
+// Decides whether a rank takes on a query, from the queries waiting ahead of it and how long the
+// request workers take with one. A rank under load turns queries away at once, so that their
+// senders back off or their clients hear of it, rather than queueing work that is only done
+// once nobody waits for it anymore.
+class AdmissionController {
+public:
+    // At most max_queue_depth queries wait at once, for up to workers request workers
+    AdmissionController(std::size_t max_queue_depth, std::size_t workers);
+
+    AdmissionController(const AdmissionController&) = delete;
+    AdmissionController& operator=(const AdmissionController&) = delete;
+
+    // OK when a query with deadline may wait behind queue_depth others, RESOURCE_EXHAUSTED when
+    // max_queue_depth wait already and DEADLINE_EXCEEDED when the deadline passes before the
+    // workers would get to the query at their current pace
+    grpc::Status admit(std::size_t queue_depth, std::chrono::system_clock::time_point deadline);
+    // A request worker took handling_time with a query
+    void record_handling_time(std::chrono::steady_clock::duration handling_time);
+    // An admitted query, or results of one, was given up on at its deadline
+    void record_expired();
+
+    AdmissionStatistics get_statistics() const;
+
+private:
+    const std::size_t max_queue_depth_;
+    const std::size_t workers_;
+
+    mutable std::mutex mutex_;
+    // Guarded by the mutex, zero until a query was handled
+    std::chrono::duration<double, std::milli> mean_handling_time_{0.0};
+    std::atomic<std::uint64_t> admitted_{0};
+    std::atomic<std::uint64_t> rejected_queue_full_{0};
+    std::atomic<std::uint64_t> rejected_deadline_{0};
+    std::atomic<std::uint64_t> expired_{0};
+};
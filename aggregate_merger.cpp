@@ -0,0 +1,95 @@
+#include "aggregate_merger.hpp"
+
+#include <algorithm>
+
+AggregateMerger::AggregateMerger(const std::uint32_t rank, const std::size_t max_tracked_requests)
+  : rank_{rank}
+  , max_tracked_requests_{max_tracked_requests}
+{}
+
+void AggregateMerger::register_request(const QueryRequest& query_request) {
+    if (!query_request.query.get_aggregation().has_value()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto [it, inserted] = pending_aggregates_.try_emplace(query_request.id, PendingAggregate{
+        .requested_by = std::nullopt,
+        .aggregates = {},
+        .aggregated_ranks = {},
+        .num_children_answered = 0,
+        .num_children = std::nullopt,
+        .deadline = query_request.deadline,
+    });
+    if (!inserted) {
+        return;
+    }
+
+    tracked_ids_.push_back(query_request.id);
+    if (tracked_ids_.size() > max_tracked_requests_) {
+        pending_aggregates_.erase(tracked_ids_.front());
+        tracked_ids_.pop_front();
+    }
+}
+
+bool AggregateMerger::merges(const std::size_t id) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_aggregates_.contains(id);
+}
+
+std::optional<QueryResponse> AggregateMerger::merge(const QueryResponse& query_response) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = pending_aggregates_.find(query_response.id);
+    if (it == pending_aggregates_.end()) {
+        return query_response;
+    }
+    PendingAggregate& pending_aggregate = it->second;
+
+    if (query_response.aggregates.has_value()) {
+        pending_aggregate.aggregates.merge(*query_response.aggregates);
+    }
+    pending_aggregate.aggregated_ranks.insert(pending_aggregate.aggregated_ranks.end(),
+                                              query_response.aggregated_ranks.begin(),
+                                              query_response.aggregated_ranks.end());
+    if (query_response.results_from == rank_) {
+        pending_aggregate.requested_by = query_response.requested_by;
+    } else {
+        ++pending_aggregate.num_children_answered;
+    }
+
+    return take_if_complete(query_response.id);
+}
+
+std::optional<QueryResponse> AggregateMerger::set_num_children(const std::size_t id, const std::size_t num_children) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = pending_aggregates_.find(id);
+    if (it == pending_aggregates_.end()) {
+        return std::nullopt;
+    }
+
+    it->second.num_children = num_children;
+    return take_if_complete(id);
+}
+
+std::optional<QueryResponse> AggregateMerger::take_if_complete(const std::size_t id) {
+    auto it = pending_aggregates_.find(id);
+    PendingAggregate& pending_aggregate = it->second;
+    if (!pending_aggregate.requested_by.has_value() || !pending_aggregate.num_children.has_value() ||
+        pending_aggregate.num_children_answered < *pending_aggregate.num_children) {
+        return std::nullopt;
+    }
+
+    QueryResponse query_response = {
+        .id = id,
+        .requested_by = std::move(*pending_aggregate.requested_by),
+        .results_from = rank_,
+        .collisions = {},
+        .aggregates = std::move(pending_aggregate.aggregates),
+        .aggregated_ranks = std::move(pending_aggregate.aggregated_ranks),
+        .deadline = pending_aggregate.deadline,
+    };
+
+    pending_aggregates_.erase(it);
+    tracked_ids_.erase(std::find(tracked_ids_.begin(), tracked_ids_.end(), id));
+    return query_response;
+}
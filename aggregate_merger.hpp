@@ -0,0 +1,55 @@
+#pragma once
+
+#include "collision_proto_converter.hpp"
+#include "query_proto_converter.hpp"
+
+#include "collision_manager/collision_aggregate.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+// Merges the partial aggregates of a rank and of the ranks it forwarded an aggregation query to,
+// so that each rank sends a single response up the overlay. A rank that already had the query
+// rejects it as a duplicate, so the ranks that accepted it from this one are exactly the ranks
+// whose merged responses come back here.
+class AggregateMerger {
+public:
+    AggregateMerger(std::uint32_t rank, std::size_t max_tracked_requests);
+
+    // Starts collecting the partial aggregates of query_request, if its query has an aggregation
+    void register_request(const QueryRequest& query_request);
+    bool merges(std::size_t id) const;
+    // Folds in the response of this rank or of one that accepted the query from it. Returns the
+    // merged response once this rank and all of those have answered, and responses to queries it
+    // does not merge as they are.
+    std::optional<QueryResponse> merge(const QueryResponse& query_response);
+    // Sets how many ranks accepted the query from this one, once it has been forwarded to all
+    std::optional<QueryResponse> set_num_children(std::size_t id, std::size_t num_children);
+
+private:
+    struct PendingAggregate {
+        // Taken from the response of this rank, which routes the merged response
+        std::optional<std::vector<std::uint32_t>> requested_by;
+        AggregateTable aggregates;
+        std::vector<std::uint32_t> aggregated_ranks;
+        std::size_t num_children_answered;
+        std::optional<std::size_t> num_children;
+        // That of the query, carried on by the merged response
+        std::chrono::system_clock::time_point deadline;
+    };
+
+    std::optional<QueryResponse> take_if_complete(std::size_t id);
+
+    std::uint32_t rank_;
+    std::size_t max_tracked_requests_;
+    mutable std::mutex mutex_;
+    std::unordered_map<std::size_t, PendingAggregate> pending_aggregates_;
+    // Ids in the order they were registered, the oldest is forgotten once there are too many
+    std::deque<std::size_t> tracked_ids_;
+};
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstddef>
+
+// Linking allocation_counter.cpp into a program replaces the global operator new and delete of it
+// with ones that count every allocation, so that benchmarks can report how many an iteration makes.
+// They are defined in a translation unit of their own, so that no caller sees the malloc and free
+// behind them and the compiler cannot pair a new with a mismatched free.
+
+// Allocations made through operator new since the program started
+std::size_t num_allocations();
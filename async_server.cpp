@@ -1,7 +1,12 @@
+#include "admission_controller.hpp"
+#include "aggregate_merger.hpp"
 #include "collision_query_service_impl.hpp"
 #include "collision_proto_converter.hpp"
+#include "cursor_table.hpp"
 #include "query_proto_converter.hpp"
-#include "ring_buffer.hpp"
+#include "mpmc_queue.hpp"
+#include "top_k_merger.hpp"
+#include "worker_pool.hpp"
 #include "yaml_parser.hpp"
 #include "myconfig.hpp"
 
@@ -9,6 +14,7 @@
 
 #include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <iostream>
 #include <memory>
@@ -29,20 +35,27 @@ std::uint32_t rank;
 MyConfig*  myconfig = MyConfig::getInstance();
 Config config;
 
-std::mutex pendingRequestsMutex{};
-PendingRequestsRingbuffer pendingRequests{};
-std::condition_variable pendingRequestsConditionVariable{};
-
-std::mutex pendingResponsesMutex{};
-PendingResponsesRingbuffer pendingResponses{};
-std::condition_variable pendingResponsesConditionVariable{};
+PendingRequestsQueue pendingRequests{};
+PendingResponsesQueue pendingResponses{};
 
 std::mutex pendingClientRequestsMutex{};
 
-std::vector<std::thread> requestWorkers{};
-std::vector<std::thread> responseWorkers{};
+// Created in main() with the worker counts of the config
+std::unique_ptr<WorkerPool<QueryRequest>> requestWorkers{};
+std::unique_ptr<WorkerPool<QueryResponse>> responseWorkers{};
+// Created in main() with the queue depth of the config and the most request workers
+std::unique_ptr<AdmissionController> admissionController{};
+// Started in main() at rank 0, the only rank answering clients
+std::jthread expirySweeper{};
 
 std::unordered_map<std::size_t, GetCollisionsClientRequest> pendingClientRequestsMap{};
+
+// Rows of limited queries are trimmed by every rank they pass through
+TopKMerger topKMerger{2 * MAX_CONCURRENT_REQUESTS};
+// Aggregates of aggregation queries are merged by every rank they pass through
+std::unique_ptr<AggregateMerger> aggregateMerger{};
+// Cursors of paged queries, kept between the pages asked for
+CursorTable cursorTable{MAX_OPEN_CURSORS, CURSOR_TIME_TO_LIVE};
 std::unordered_map<std::size_t, StreamCollisionsClientRequest> pendingStreamRequestsMap{};
 
 grpc::Status queryPeer(const std::string peer_address, const QueryRequest& query_request)
@@ -54,16 +67,23 @@ grpc::Status queryPeer(const std::string peer_address, const QueryRequest& query
         std::shared_ptr<grpc::Channel> channel = grpc::CreateChannel(peer_address, grpc::InsecureChannelCredentials());
         std::unique_ptr<collision_proto::CollisionQueryService::Stub> stub = collision_proto::CollisionQueryService::NewStub(channel);
 
-        Empty response;
-        grpc::ClientContext clientContext;
+        // A peer with a full queue turns the query away until its workers made room
+        for (std::chrono::milliseconds backoff{1}; ; backoff = std::min(2 * backoff, MAX_RESEND_BACKOFF)) {
+            Empty response;
+            grpc::ClientContext clientContext;
 
-        // Set a deadline (e.g., 2 seconds from now)
-        auto deadline = std::chrono::system_clock::now() + std::chrono::seconds(2);
-        clientContext.set_deadline(deadline);
+            // The peer has as long as the query has left
+            clientContext.set_deadline(query_request.deadline);
 
-        status = stub->SendRequest(&clientContext, request, &response);
+            status = stub->SendRequest(&clientContext, request, &response);
+            if (status.error_code() != grpc::StatusCode::RESOURCE_EXHAUSTED ||
+                deadline_passed(query_request.deadline - backoff)) {
+                break;
+            }
+            std::this_thread::sleep_for(backoff);
+        }
 
-        if (!status.ok())
+        if (!status.ok() && status.error_code() != grpc::StatusCode::ALREADY_EXISTS)
         {
             std::cerr << "Error querying peer: " << status.error_message() << std::endl;
         }
@@ -76,21 +96,32 @@ grpc::Status queryPeer(const std::string peer_address, const QueryRequest& query
 
 grpc::Status sendResults(const std::string peer_address, const QueryResponse& query_response)
 {
-    collision_proto::QueryResponse response = CollisionProtoConverter::serialize(query_response);
+    // Each response worker reuses the block of its arena for every batch it sends
+    thread_local QueryResponseArena arena(RESPONSE_ARENA_BLOCK_SIZE);
+    collision_proto::QueryResponse* response = arena.reset();
+    // Ranks send each other columns whatever format the client asked for
+    CollisionProtoConverter::serialize(query_response, *response, collision_proto::RESPONSE_COLUMNS);
 
     grpc::Status status = Status(grpc::StatusCode::UNKNOWN, "UNKNOWN");
     try {
         std::shared_ptr<grpc::Channel> channel = grpc::CreateChannel(peer_address, grpc::InsecureChannelCredentials());
         std::unique_ptr<collision_proto::CollisionQueryService::Stub> stub = collision_proto::CollisionQueryService::NewStub(channel);
 
-        Empty empty;
-        grpc::ClientContext clientContext;
+        // A parent with a full queue turns the batch away until its workers made room
+        for (std::chrono::milliseconds backoff{1}; ; backoff = std::min(2 * backoff, MAX_RESEND_BACKOFF)) {
+            Empty empty;
+            grpc::ClientContext clientContext;
 
-        // Set a deadline (e.g., 2 seconds from now)
-        auto deadline = std::chrono::system_clock::now() + std::chrono::seconds(2);
-        clientContext.set_deadline(deadline);
+            // Nobody waits for the batch past the deadline of its query
+            clientContext.set_deadline(query_response.deadline);
 
-        status = stub->ReceiveResponse(&clientContext, response, &empty);
+            status = stub->ReceiveResponse(&clientContext, *response, &empty);
+            if (status.error_code() != grpc::StatusCode::RESOURCE_EXHAUSTED ||
+                deadline_passed(query_response.deadline - backoff)) {
+                break;
+            }
+            std::this_thread::sleep_for(backoff);
+        }
         if (!status.ok())
         {
             std::cerr << "Error sending results: " << status.error_message() << std::endl;
@@ -102,59 +133,141 @@ grpc::Status sendResults(const std::string peer_address, const QueryResponse& qu
     return status;
 }
 
-QueryRequest wait_for_new_query_request(std::uint32_t id) {
-    std::unique_lock<std::mutex> lock(pendingRequestsMutex);
-    pendingRequestsConditionVariable.wait(lock, []() { return !pendingRequests.is_empty(); });
+// The queues are never closed, so popping only ends without a value once the worker is retired
+std::optional<QueryRequest> wait_for_new_query_request(std::uint32_t id, const std::stop_token& stop_token) {
+    return pendingRequests.pop(stop_token);
+}
 
-    QueryRequest&& query_request = pendingRequests.pop();
-    return query_request;
+std::optional<QueryResponse> wait_for_new_query_response(std::uint32_t id, const std::stop_token& stop_token) {
+    return pendingResponses.pop(stop_token);
 }
 
-QueryResponse wait_for_new_query_response(std::uint32_t id) {
-    std::unique_lock<std::mutex> lock(pendingResponsesMutex);
-    pendingResponsesConditionVariable.wait(lock, []() { return !pendingResponses.is_empty(); });
+// Rows are pushed a batch at a time, so a rank with many of them waits for room in the
+// queue instead of overrunning it
+void push_pending_response(QueryResponse&& query_response) {
+    pendingResponses.push(std::move(query_response));
+}
 
-    QueryResponse&& query_response = pendingResponses.pop();
-    return query_response;
+// Answers the clients whose deadline passed with DEADLINE_EXCEEDED, the results they wait for no
+// longer come as every rank gives up on them. Returns the earliest deadline of those left.
+std::chrono::system_clock::time_point fail_expired_client_requests() {
+    std::chrono::system_clock::time_point earliest_deadline = NO_DEADLINE;
+
+    std::lock_guard<std::mutex> lock(pendingClientRequestsMutex);
+    for (auto map_it = pendingClientRequestsMap.begin(); map_it != pendingClientRequestsMap.end();) {
+        if (!deadline_passed(map_it->second.deadline)) {
+            earliest_deadline = std::min(earliest_deadline, map_it->second.deadline);
+            ++map_it;
+            continue;
+        }
+
+        GetCollisionsCallData* getCollisionsCallData = dynamic_cast<GetCollisionsCallData*>(map_it->second.call_data_base);
+        if (getCollisionsCallData != nullptr) {
+            getCollisionsCallData->FailRequest(map_it->first, Status(grpc::StatusCode::DEADLINE_EXCEEDED, "Deadline exceeded"));
+        }
+        admissionController->record_expired();
+        map_it = pendingClientRequestsMap.erase(map_it);
+    }
+
+    return earliest_deadline;
+}
+
+// Runs on a thread of its own at rank 0, answering the clients whose results did not come in time
+// once the earliest deadline among them passed
+void sweep_expired_client_requests(const std::stop_token& stop_token) {
+    std::mutex sweep_mutex;
+    std::condition_variable_any sweep_cv;
+
+    while (!stop_token.stop_requested()) {
+        const std::chrono::system_clock::time_point earliest_deadline = fail_expired_client_requests();
+        const std::chrono::system_clock::time_point next_sweep =
+            std::min(earliest_deadline, std::chrono::system_clock::now() + MAX_EXPIRY_SWEEP_INTERVAL);
+
+        std::unique_lock<std::mutex> lock(sweep_mutex);
+        sweep_cv.wait_until(lock, stop_token, next_sweep, []() { return false; });
+    }
 }
 
-void handle_pending_requests(std::uint32_t id, std::uint32_t rank) {
-    while (true) {
-        QueryRequest query_request = wait_for_new_query_request(id);
-        query_request.requested_by.push_back(rank);
+void handle_pending_request(std::uint32_t id, std::uint32_t rank, QueryRequest& query_request) {
+    if (deadline_passed(query_request.deadline)) {
+        std::cout << "RequestWorker " << id << " is dropping expired query: " << query_request.id << std::endl;
+        admissionController->record_expired();
+        return;
+    }
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    query_request.requested_by.push_back(rank);
+    topKMerger.register_request(query_request);
+    aggregateMerger->register_request(query_request);
 
-        std::cout << "RequestWorker " << id << " is handling query: " << query_request.id << std::endl;
+    std::cout << "RequestWorker " << id << " is handling query: " << query_request.id << std::endl;
 
+    // Aggregates wait for those of the ranks that take the query from this one
+    const bool aggregates = query_request.query.get_aggregation().has_value();
+    if (aggregates) {
         QueryResponse query_response = {
             .id = query_request.id,
             .requested_by = query_request.requested_by,
             .results_from = rank,
-            .collisions = collision_manager->search(query_request.query),
+            .collisions = {},
+            .aggregates = collision_manager->aggregate(query_request.query),
+            .aggregated_ranks = {rank},
+            .deadline = query_request.deadline,
         };
+        aggregateMerger->merge(query_response);
+    }
 
-        {
-            std::lock_guard<std::mutex> lock(pendingResponsesMutex);
-            pendingResponses.push(query_response);
-            pendingResponsesConditionVariable.notify_one();
+    grpc::Status status;
+
+    std::size_t num_children = 0;
+    for (const auto& neighbour : myconfig->getLogicalNeighbors()){
+            status = queryPeer(neighbour, query_request);
+            if (status.ok()) {
+                ++num_children;
+            } else if (status.error_code() != grpc::StatusCode::ALREADY_EXISTS) {
+                // TODO
+                std::cout << "Issue" << std::endl; 
+            }
+            std::cout << "RequestWorker " << id << " has processed query: " << query_request.id << std::endl;
+    }
 
-            std::cout << "Added response from: '" << static_cast<char>('A' + query_response.results_from) <<
-                         "' with id: '" << query_response.id << "' to the pendingResponses ringbuffer" << std::endl;
+    if (aggregates) {
+        std::optional<QueryResponse> merged_response = aggregateMerger->set_num_children(query_request.id, num_children);
+        if (merged_response.has_value()) {
+            push_pending_response(std::move(*merged_response));
         }
-
-        grpc::Status status;
-
-        for (const auto& neighbour : myconfig->getLogicalNeighbors()){
-                status = queryPeer(neighbour, query_request);
-                if (!status.ok()) {
-                    // TODO
-                    std::cout << "Issue" << std::endl; 
-                }
-                std::cout << "RequestWorker " << id << " has processed query: " << query_request.id << std::endl;
+    } else if (query_request.page_size > 0) {
+        // A page is a single batch of at most page_size rows of this rank
+        push_pending_response(next_page(*collision_manager, cursorTable, query_request, rank));
+    } else {
+        // The children search their own rows meanwhile, and each batch goes out as soon as it is copied
+        CollisionCursor cursor = collision_manager->open_cursor(query_request.query, RESPONSE_BATCH_SIZE);
+        for (std::uint32_t batch = 0; cursor.has_next(); ++batch) {
+            push_pending_response({
+                .id = query_request.id,
+                .requested_by = query_request.requested_by,
+                .results_from = rank,
+                .collisions = cursor.next(),
+                .aggregates = std::nullopt,
+                .aggregated_ranks = {},
+                .batch = batch,
+                .num_batches = static_cast<std::uint32_t>(cursor.num_batches()),
+                .fields = cursor.get_fields(),
+                .deadline = query_request.deadline,
+            });
         }
+
+        std::cout << "Added " << cursor.num_batches() << " responses from: '" << static_cast<char>('A' + rank) <<
+                     "' with id: '" << query_request.id << "' to the pendingResponses queue" << std::endl;
     }
+
+    admissionController->record_handling_time(std::chrono::steady_clock::now() - start);
 }
 
 void handle_client_pending_responses(std::uint32_t worker_id, std::uint32_t process_rank, const QueryResponse& query_response) {
+    // Batches of the same query are handled by several response workers at once
+    std::lock_guard<std::mutex> lock(pendingClientRequestsMutex);
+
     auto map_it = pendingClientRequestsMap.find(query_response.id);
 
     if (map_it == pendingClientRequestsMap.end()) {
@@ -164,7 +277,10 @@ void handle_client_pending_responses(std::uint32_t worker_id, std::uint32_t proc
 
     GetCollisionsClientRequest& client_request = map_it->second;
 
-    auto rank_it = std::find(client_request.ranks.begin(), client_request.ranks.end(), query_response.results_from);
+    // Merged aggregates answer for every rank they cover
+    const std::vector<std::uint32_t> response_ranks = query_response.aggregates.has_value() ? query_response.aggregated_ranks
+                                                                                            : std::vector<std::uint32_t>{query_response.results_from};
+    auto rank_it = std::find_first_of(client_request.ranks.begin(), client_request.ranks.end(), response_ranks.begin(), response_ranks.end());
 
     if (rank_it != client_request.ranks.end()) {
         std::cout << "ResponseWorker " << worker_id << " sees rank has already been processed for client_request with id: "
@@ -173,7 +289,19 @@ void handle_client_pending_responses(std::uint32_t worker_id, std::uint32_t proc
     }
 
     client_request.collisions.insert(client_request.collisions.end(), query_response.collisions.begin(), query_response.collisions.end());
-    client_request.ranks.push_back(query_response.results_from);
+    // A rank is done with the last of its batches, which may arrive in any order
+    if (++client_request.num_batches_received[query_response.results_from] == query_response.num_batches) {
+        client_request.ranks.insert(client_request.ranks.end(), response_ranks.begin(), response_ranks.end());
+    }
+    // The request is resumed under the id of its first page while any rank has rows left
+    merge_resume_tokens(client_request.resume_token, query_response.resume_token);
+    client_request.cursor_expired |= query_response.cursor_expired;
+    if (query_response.aggregates.has_value()) {
+        if (!client_request.aggregates.has_value()) {
+            client_request.aggregates.emplace();
+        }
+        client_request.aggregates->merge(*query_response.aggregates);
+    }
 
     // TODO: check if all ranks present better using yaml config to find out how many processes exist
     if (client_request.ranks.size() == myconfig->getTotalNumberofProcess()) {
@@ -184,70 +312,100 @@ void handle_client_pending_responses(std::uint32_t worker_id, std::uint32_t proc
             return;
         }
 
-        getCollisionsCallData->CompleteRequest(query_response.id, client_request.collisions);
+        if (client_request.cursor_expired) {
+            getCollisionsCallData->FailRequest(query_response.id, Status(grpc::StatusCode::NOT_FOUND, "Cursor expired"));
+        } else {
+            keep_top_collisions(client_request.collisions, client_request.order, client_request.limit);
+            getCollisionsCallData->CompleteRequest(query_response.id, client_request.collisions, client_request.fields,
+                                                   client_request.aggregates, client_request.resume_token);
+        }
         pendingClientRequestsMap.erase(map_it);
     }
 }
 
-void handle_pending_responses(std::uint32_t worker_id, std::uint32_t process_rank) {
+void handle_pending_response(std::uint32_t worker_id, std::uint32_t process_rank, QueryResponse& query_response) {
+    std::cout << "ResponseWorker " << worker_id << " is handling query: " << query_response.id << std::endl;
 
-    
-    while (true) {
-        QueryResponse query_response = wait_for_new_query_response(worker_id);
+    if (deadline_passed(query_response.deadline)) {
+        std::cout << "ResponseWorker " << worker_id << " is dropping results of expired query: " << query_response.id << std::endl;
+        admissionController->record_expired();
+        return;
+    }
 
-        std::cout << "ResponseWorker " << worker_id << " is handling query: " << query_response.id << std::endl;
+    topKMerger.merge(query_response);
 
-        if (process_rank == 0) {
-            handle_client_pending_responses(worker_id, process_rank, query_response);
-            continue;
+    if (query_response.results_from != process_rank && aggregateMerger->merges(query_response.id)) {
+        std::optional<QueryResponse> merged_response = aggregateMerger->merge(query_response);
+        if (!merged_response.has_value()) {
+            return;
         }
+        query_response = std::move(*merged_response);
+    }
+
+    if (process_rank == 0) {
+        handle_client_pending_responses(worker_id, process_rank, query_response);
+        return;
+    }
 
-        std::uint32_t parent_rank = *(query_response.requested_by.end() - 2);
-        //int parent_port = 50051 + parent_rank;
-        //std::string parent_server_address = "127.0.0.1:" + std::to_string(parent_port);
-        std::string parent_server_address = config.getaddress(parent_rank);
+    std::uint32_t parent_rank = *(query_response.requested_by.end() - 2);
+    //int parent_port = 50051 + parent_rank;
+    //std::string parent_server_address = "127.0.0.1:" + std::to_string(parent_port);
+    std::string parent_server_address = config.getaddress(parent_rank);
 
-        std::cout << "Parent server address is: " << parent_server_address << std::endl;
+    std::cout << "Parent server address is: " << parent_server_address << std::endl;
 
-        grpc::Status status = sendResults(parent_server_address, query_response);
+    grpc::Status status = sendResults(parent_server_address, query_response);
 
-        std::cout << "ResponseWorker " << worker_id << " has processed query: " << query_response.id << std::endl;
-    }
+    std::cout << "ResponseWorker " << worker_id << " has processed query: " << query_response.id << std::endl;
 }
 
 int main(int argc, char** argv) {
     rank = myconfig->getRank();
+    aggregateMerger = std::make_unique<AggregateMerger>(rank, 2 * MAX_CONCURRENT_REQUESTS);
+
+    const std::size_t min_workers = myconfig->getMinWorkers();
+    requestWorkers = std::make_unique<WorkerPool<QueryRequest>>(
+        "request workers",
+        WorkerPoolOptions{.min_workers = min_workers, .max_workers = static_cast<std::size_t>(myconfig->getRequestWorkers())},
+        wait_for_new_query_request,
+        [](std::uint32_t id, QueryRequest& query_request) { handle_pending_request(id, rank, query_request); },
+        []() { return pendingRequests.size_approx(); });
+    responseWorkers = std::make_unique<WorkerPool<QueryResponse>>(
+        "response workers",
+        WorkerPoolOptions{.min_workers = min_workers, .max_workers = static_cast<std::size_t>(myconfig->getResponseWorkers())},
+        wait_for_new_query_response,
+        [](std::uint32_t id, QueryResponse& query_response) { handle_pending_response(id, rank, query_response); },
+        []() { return pendingResponses.size_approx(); });
+    // Turned away are at the latest the queries that no longer fit in the queue
+    const std::size_t admission_queue_depth = static_cast<std::size_t>(myconfig->getAdmissionQueueDepth());
+    admissionController = std::make_unique<AdmissionController>(
+        admission_queue_depth > 0 ? std::min(admission_queue_depth, MAX_CONCURRENT_REQUESTS) : MAX_CONCURRENT_REQUESTS,
+        requestWorkers->get_statistics().max_workers);
+    if (rank == 0) {
+        expirySweeper = std::jthread(sweep_expired_client_requests);
+    }
 
     CollisionQueryServiceImpl service{rank,
-                                      pendingRequestsMutex,
+                                      *collision_manager,
                                       pendingClientRequestsMutex,
-                                      pendingResponsesMutex,
                                       pendingRequests,
                                       pendingResponses,
-                                      pendingRequestsConditionVariable,
-                                      pendingResponsesConditionVariable,
                                       pendingClientRequestsMap,
-                                      pendingStreamRequestsMap};
-
-    for (int i = 0; i < 4; ++i) {
-        requestWorkers.push_back(std::thread(handle_pending_requests, i, rank));
-    }
-
-    for (int i = 0; i < 4; ++i) {
-        responseWorkers.push_back(std::thread(handle_pending_responses, i, rank));
-    }
+                                      pendingStreamRequestsMap,
+                                      *admissionController,
+                                      {requestWorkers.get(), responseWorkers.get()}};
 
     //int port = 50051 + rank; // 50051, 50052, 50053, etc.
     std::string server_addresss = myconfig->getIP() + ":" + std::to_string(myconfig->getPortNumber());
-    service.Run(server_addresss);
-
-    for (auto& worker : requestWorkers) {
-        worker.join();
-    }
+    service.Run(server_addresss, myconfig->getCompletionQueues());
 
-    for (auto& worker : responseWorkers) {
-        worker.join();
+    // Stopped first, as it answers clients through the calls of the service
+    if (expirySweeper.joinable()) {
+        expirySweeper.request_stop();
+        expirySweeper.join();
     }
+    requestWorkers->stop();
+    responseWorkers->stop();
 
     return 0;
 }
@@ -1,8 +1,13 @@
+#include "admission_controller.hpp"
+#include "aggregate_merger.hpp"
 #include "collision_query_service_impl.hpp"
 #include "collision_proto_converter.hpp"
+#include "cursor_table.hpp"
 #include "query_proto_converter.hpp"
-#include "ring_buffer.hpp"
+#include "mpmc_queue.hpp"
+#include "top_k_merger.hpp"
 #include "shared_memory_manager.hpp"
+#include "worker_pool.hpp"
 #include "yaml_parser.hpp"
 #include "myconfig.hpp"
 
@@ -10,6 +15,7 @@
 
 #include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <iostream>
 #include <memory>
@@ -26,23 +32,30 @@
 const std::string CSV_FILE = std::string("../Motor_Vehicle_Collisions_-_Crashes_20250123.csv");
 static std::unique_ptr<CollisionManager> collision_manager = std::make_unique<CollisionManager>(CSV_FILE);
 
-std::mutex pendingRequestsMutex{};
 std::mutex pendingClientRequestsMutex{};
-std::mutex pendingResponsesMutex{};
 
-PendingRequestsRingbuffer pendingRequests{};
-PendingResponsesRingbuffer pendingResponses{};
-
-std::condition_variable pendingRequestsConditionVariable{};
-std::condition_variable pendingResponsesConditionVariable{};
+PendingRequestsQueue pendingRequests{};
+PendingResponsesQueue pendingResponses{};
 
 std::atomic<bool> worker_stop_flag(false);
 
-std::vector<std::thread> requestWorkers{};
-std::vector<std::thread> responseWorkers{};
-std::vector<std::thread> shmResponseWorkers{};
+// Created in main() with the worker counts of the config
+std::unique_ptr<WorkerPool<QueryRequest>> requestWorkers{};
+std::unique_ptr<WorkerPool<QueryResponse>> responseWorkers{};
+std::unique_ptr<WorkerPool<SharedMemoryQueryResponse>> shmResponseWorkers{};
+// Created in main() with the queue depth of the config and the most request workers
+std::unique_ptr<AdmissionController> admissionController{};
+// Started in main() at rank 0, the only rank answering clients
+std::jthread expirySweeper{};
 
 std::unordered_map<std::size_t, GetCollisionsClientRequest> pendingClientRequestsMap{};
+
+// Rows of limited queries are trimmed by every rank they pass through
+TopKMerger topKMerger{2 * MAX_CONCURRENT_REQUESTS};
+// Aggregates of aggregation queries are merged by every rank they pass through
+std::unique_ptr<AggregateMerger> aggregateMerger{};
+// Cursors of paged queries, kept between the pages asked for
+CursorTable cursorTable{MAX_OPEN_CURSORS, CURSOR_TIME_TO_LIVE};
 std::unordered_map<std::size_t, StreamCollisionsClientRequest> pendingStreamRequestsMap{};
 
 SharedMemoryManager* shared_memory_manager = nullptr;
@@ -66,16 +79,23 @@ grpc::Status queryPeer(const std::string peer_address, const QueryRequest& query
         std::shared_ptr<grpc::Channel> channel = grpc::CreateChannel(peer_address, grpc::InsecureChannelCredentials());
         std::unique_ptr<collision_proto::CollisionQueryService::Stub> stub = collision_proto::CollisionQueryService::NewStub(channel);
 
-        Empty response;
-        grpc::ClientContext clientContext;
+        // A peer with a full queue turns the query away until its workers made room
+        for (std::chrono::milliseconds backoff{1}; ; backoff = std::min(2 * backoff, MAX_RESEND_BACKOFF)) {
+            Empty response;
+            grpc::ClientContext clientContext;
 
-        // Set a deadline (e.g., 2 seconds from now)
-        auto deadline = std::chrono::system_clock::now() + std::chrono::seconds(2);
-        clientContext.set_deadline(deadline);
+            // The peer has as long as the query has left
+            clientContext.set_deadline(query_request.deadline);
 
-        status = stub->SendRequest(&clientContext, request, &response);
+            status = stub->SendRequest(&clientContext, request, &response);
+            if (status.error_code() != grpc::StatusCode::RESOURCE_EXHAUSTED ||
+                deadline_passed(query_request.deadline - backoff)) {
+                break;
+            }
+            std::this_thread::sleep_for(backoff);
+        }
 
-        if (!status.ok())
+        if (!status.ok() && status.error_code() != grpc::StatusCode::ALREADY_EXISTS)
         {
             std::cerr << "Error querying peer: " << status.error_message() << std::endl;
         }
@@ -88,21 +108,32 @@ grpc::Status queryPeer(const std::string peer_address, const QueryRequest& query
 
 grpc::Status sendResults(const std::string peer_address, const QueryResponse& query_response)
 {
-    collision_proto::QueryResponse response = CollisionProtoConverter::serialize(query_response);
+    // Each response worker reuses the block of its arena for every batch it sends
+    thread_local QueryResponseArena arena(RESPONSE_ARENA_BLOCK_SIZE);
+    collision_proto::QueryResponse* response = arena.reset();
+    // Ranks send each other columns whatever format the client asked for
+    CollisionProtoConverter::serialize(query_response, *response, collision_proto::RESPONSE_COLUMNS);
 
     grpc::Status status = Status(grpc::StatusCode::UNKNOWN, "UNKNOWN");
     try {
         std::shared_ptr<grpc::Channel> channel = grpc::CreateChannel(peer_address, grpc::InsecureChannelCredentials());
         std::unique_ptr<collision_proto::CollisionQueryService::Stub> stub = collision_proto::CollisionQueryService::NewStub(channel);
 
-        Empty empty;
-        grpc::ClientContext clientContext;
+        // A parent with a full queue turns the batch away until its workers made room
+        for (std::chrono::milliseconds backoff{1}; ; backoff = std::min(2 * backoff, MAX_RESEND_BACKOFF)) {
+            Empty empty;
+            grpc::ClientContext clientContext;
 
-        // Set a deadline (e.g., 2 seconds from now)
-        auto deadline = std::chrono::system_clock::now() + std::chrono::seconds(2);
-        clientContext.set_deadline(deadline);
+            // Nobody waits for the batch past the deadline of its query
+            clientContext.set_deadline(query_response.deadline);
 
-        status = stub->ReceiveResponse(&clientContext, response, &empty);
+            status = stub->ReceiveResponse(&clientContext, *response, &empty);
+            if (status.error_code() != grpc::StatusCode::RESOURCE_EXHAUSTED ||
+                deadline_passed(query_response.deadline - backoff)) {
+                break;
+            }
+            std::this_thread::sleep_for(backoff);
+        }
         if (!status.ok())
         {
             std::cerr << "Error sending results: " << status.error_message() << std::endl;
@@ -114,32 +145,37 @@ grpc::Status sendResults(const std::string peer_address, const QueryResponse& qu
     return status;
 }
 
-std::optional<QueryRequest> wait_for_new_query_request(std::uint32_t id) {
-    std::unique_lock<std::mutex> lock(pendingRequestsMutex);
-    pendingRequestsConditionVariable.wait(lock, []() { return !pendingRequests.is_empty() || worker_stop_flag.load(); });
-
+// cleanup_worker_threads() closes the queues, which wakes the waiting workers, and whatever is
+// left in them is dropped. Popping also ends without a value once the worker is retired.
+std::optional<QueryRequest> wait_for_new_query_request(std::uint32_t id, const std::stop_token& stop_token) {
+    std::optional<QueryRequest> query_request = pendingRequests.pop(stop_token);
     if (worker_stop_flag.load()) {
         std::cout << "RequestWorker: " << id << " stopping due to stop flag set." << std::endl;
         return {};
     }
 
-    return {pendingRequests.pop()};
+    return query_request;
 }
 
-std::optional<QueryResponse> wait_for_new_query_response(std::uint32_t id) {
-    std::unique_lock<std::mutex> lock(pendingResponsesMutex);
-    pendingResponsesConditionVariable.wait(lock, []() { return !pendingResponses.is_empty() || worker_stop_flag.load(); });
-
+std::optional<QueryResponse> wait_for_new_query_response(std::uint32_t id, const std::stop_token& stop_token) {
+    std::optional<QueryResponse> query_response = pendingResponses.pop(stop_token);
     if (worker_stop_flag.load()) {
         std::cout << "ResponseWorker: " << id << " stopping due to stop flag set." << std::endl;
         return {};
     }
 
-    return {pendingResponses.pop()};
+    return query_response;
 }
 
-std::optional<SharedMemoryQueryResponse> wait_for_new_shared_memory_query_response(std::uint32_t id, std::uint32_t rank) {
-    while (!worker_stop_flag.load()) {
+// Rows are pushed a batch at a time, so a rank with many of them waits for room in the
+// queue instead of overrunning it
+void push_pending_response(QueryResponse&& query_response) {
+    pendingResponses.push(std::move(query_response));
+}
+
+std::optional<SharedMemoryQueryResponse> wait_for_new_shared_memory_query_response(std::uint32_t id, std::uint32_t rank,
+                                                                                    const std::stop_token& stop_token) {
+    while (!worker_stop_flag.load() && !stop_token.stop_requested()) {
         if (!shared_memory_manager->has_results()) {
             std::this_thread::sleep_for(std::chrono::milliseconds(1));
             continue;
@@ -157,54 +193,159 @@ std::optional<SharedMemoryQueryResponse> wait_for_new_shared_memory_query_respon
     return {};
 }
 
-void handle_pending_requests(std::uint32_t worker_id, std::uint32_t rank) {
-    
-   
-    while (!worker_stop_flag.load()) {
-        std::optional<QueryRequest> maybe_query_request = wait_for_new_query_request(worker_id);
-        if (!maybe_query_request.has_value()) {
+// Answers the clients whose deadline passed with DEADLINE_EXCEEDED, the results they wait for no
+// longer come as every rank gives up on them. Returns the earliest deadline of those left.
+std::chrono::system_clock::time_point fail_expired_client_requests() {
+    // Requests every rank answered are completed by the response worker that saw the last answer,
+    // which lets go of the mutex meanwhile
+    const std::size_t num_ranks = static_cast<std::size_t>(myconfig->getTotalNumberofProcess());
+    std::chrono::system_clock::time_point earliest_deadline = NO_DEADLINE;
+
+    std::unique_lock<std::mutex> lock(pendingClientRequestsMutex);
+    for (auto client_map_it = pendingClientRequestsMap.begin(); client_map_it != pendingClientRequestsMap.end();) {
+        if (client_map_it->second.ranks.size() == num_ranks) {
+            ++client_map_it;
+            continue;
+        }
+        if (!deadline_passed(client_map_it->second.deadline)) {
+            earliest_deadline = std::min(earliest_deadline, client_map_it->second.deadline);
+            ++client_map_it;
             continue;
         }
-        QueryRequest& query_request = maybe_query_request.value();
 
-        query_request.requested_by.push_back(rank);
+        GetCollisionsCallData* getCollisionsCallData = dynamic_cast<GetCollisionsCallData*>(client_map_it->second.call_data_base);
+        if (getCollisionsCallData != nullptr) {
+            getCollisionsCallData->FailRequest(client_map_it->first, Status(grpc::StatusCode::DEADLINE_EXCEEDED, "Deadline exceeded"));
+        }
+        admissionController->record_expired();
+        client_map_it = pendingClientRequestsMap.erase(client_map_it);
+    }
+
+    // A stream being written to is left to a later sweep. Taken out of the map, a stream gets no
+    // more writes, and its write mutex is free once the last write completed.
+    while (true) {
+        auto stream_map_it = std::find_if(pendingStreamRequestsMap.begin(), pendingStreamRequestsMap.end(), [num_ranks](const auto& entry) {
+            return deadline_passed(entry.second.deadline) && entry.second.num_writers == 0 && entry.second.ranks.size() < num_ranks;
+        });
+        if (stream_map_it == pendingStreamRequestsMap.end()) {
+            break;
+        }
 
-        std::cout << "RequestWorker " << worker_id << " is handling query: " << query_request.id << std::endl;
+        auto stream_request = pendingStreamRequestsMap.extract(stream_map_it);
+        admissionController->record_expired();
+        lock.unlock();
+        StreamCollisionsCallData* streamCollisionsCallData = dynamic_cast<StreamCollisionsCallData*>(stream_request.mapped().call_data_base);
+        if (streamCollisionsCallData != nullptr) {
+            std::lock_guard<std::mutex> finish_lock(stream_request.mapped().write_mutex);
+            streamCollisionsCallData->Finish(stream_request.key(), Status(grpc::StatusCode::DEADLINE_EXCEEDED, "Deadline exceeded"));
+        }
+        lock.lock();
+    }
 
+    for (const auto& [id, stream_request] : pendingStreamRequestsMap) {
+        if (!deadline_passed(stream_request.deadline)) {
+            earliest_deadline = std::min(earliest_deadline, stream_request.deadline);
+        }
+    }
+
+    return earliest_deadline;
+}
+
+// Runs on a thread of its own at rank 0, answering the clients whose results did not come in time
+// once the earliest deadline among them passed
+void sweep_expired_client_requests(const std::stop_token& stop_token) {
+    std::mutex sweep_mutex;
+    std::condition_variable_any sweep_cv;
+
+    while (!stop_token.stop_requested()) {
+        const std::chrono::system_clock::time_point earliest_deadline = fail_expired_client_requests();
+        const std::chrono::system_clock::time_point next_sweep =
+            std::min(earliest_deadline, std::chrono::system_clock::now() + MAX_EXPIRY_SWEEP_INTERVAL);
+
+        std::unique_lock<std::mutex> lock(sweep_mutex);
+        sweep_cv.wait_until(lock, stop_token, next_sweep, []() { return false; });
+    }
+}
+
+void handle_pending_request(std::uint32_t worker_id, std::uint32_t rank, QueryRequest& query_request) {
+    if (deadline_passed(query_request.deadline)) {
+        std::cout << "RequestWorker " << worker_id << " is dropping expired query: " << query_request.id << std::endl;
+        admissionController->record_expired();
+        return;
+    }
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    query_request.requested_by.push_back(rank);
+    topKMerger.register_request(query_request);
+    aggregateMerger->register_request(query_request);
+
+    std::cout << "RequestWorker " << worker_id << " is handling query: " << query_request.id << std::endl;
+
+    // Aggregates wait for those of the ranks that take the query from this one
+    const bool aggregates = query_request.query.get_aggregation().has_value();
+    if (aggregates) {
         QueryResponse query_response = {
             .id = query_request.id,
             .requested_by = query_request.requested_by,
             .results_from = rank,
-            .collisions = collision_manager->search(query_request.query),
+            .collisions = {},
+            .aggregates = collision_manager->aggregate(query_request.query),
+            .aggregated_ranks = {rank},
+            .deadline = query_request.deadline,
         };
+        aggregateMerger->merge(query_response);
+    }
 
-        {
-            std::lock_guard<std::mutex> lock(pendingResponsesMutex);
-            pendingResponses.push(query_response);
-            pendingResponsesConditionVariable.notify_one();
-
-            std::cout << "Added response from: '" << static_cast<char>('A' + query_response.results_from) <<
-                         "' with id: '" << query_response.id << "' to the pendingResponses ringbuffer" << std::endl;
-        }
+    std::size_t num_children = 0;
+    for (const auto& neighbour : myconfig->getLogicalNeighbors()){
+        grpc::Status status;
 
-        for (const auto& neighbour : myconfig->getLogicalNeighbors()){
-            grpc::Status status;
+        //int child_port = 50051 + child_rank;
+        //std::string child_server_address = "127.0.0.1:" + std::to_string(child_port);
 
-            //int child_port = 50051 + child_rank;
-            //std::string child_server_address = "127.0.0.1:" + std::to_string(child_port);
+        std::cout << "Child server address is: " << neighbour << std::endl;
 
-            std::cout << "Child server address is: " << neighbour << std::endl;
+        status = queryPeer(neighbour, query_request);
+        if (status.ok()) {
+            ++num_children;
+        } else {
+            // TODO
+        }
+    }
 
-            status = queryPeer(neighbour, query_request);
-            if (!status.ok()) {
-                // TODO
-            }
+    if (aggregates) {
+        std::optional<QueryResponse> merged_response = aggregateMerger->set_num_children(query_request.id, num_children);
+        if (merged_response.has_value()) {
+            push_pending_response(std::move(*merged_response));
+        }
+    } else if (query_request.page_size > 0) {
+        // A page is a single batch of at most page_size rows of this rank
+        push_pending_response(next_page(*collision_manager, cursorTable, query_request, rank));
+    } else {
+        // The children search their own rows meanwhile, and each batch goes out as soon as it is copied
+        CollisionCursor cursor = collision_manager->open_cursor(query_request.query, RESPONSE_BATCH_SIZE);
+        for (std::uint32_t batch = 0; cursor.has_next(); ++batch) {
+            push_pending_response({
+                .id = query_request.id,
+                .requested_by = query_request.requested_by,
+                .results_from = rank,
+                .collisions = cursor.next(),
+                .aggregates = std::nullopt,
+                .aggregated_ranks = {},
+                .batch = batch,
+                .num_batches = static_cast<std::uint32_t>(cursor.num_batches()),
+                .fields = cursor.get_fields(),
+                .deadline = query_request.deadline,
+            });
         }
 
-        std::cout << "RequestWorker " << worker_id << " has processed query: " << query_request.id << std::endl;
+        std::cout << "Added " << cursor.num_batches() << " responses from: '" << static_cast<char>('A' + rank) <<
+                     "' with id: '" << query_request.id << "' to the pendingResponses queue" << std::endl;
     }
 
-    std::cout << "RequestWorker: " << worker_id << " stopped." << std::endl;
+    admissionController->record_handling_time(std::chrono::steady_clock::now() - start);
+
+    std::cout << "RequestWorker " << worker_id << " has processed query: " << query_request.id << std::endl;
 }
 
 void handle_client_pending_responses(std::uint32_t worker_id, std::uint32_t process_rank, const QueryResponse& query_response) {
@@ -220,26 +361,44 @@ void handle_client_pending_responses(std::uint32_t worker_id, std::uint32_t proc
     }
 
     std::vector<std::uint32_t>* ranks = nullptr;
+    std::unordered_map<std::uint32_t, std::uint32_t>* num_batches_received = nullptr;
     if (client_map_it != pendingClientRequestsMap.end()) {
         GetCollisionsClientRequest& client_request = client_map_it->second;
         ranks = &client_request.ranks;
+        num_batches_received = &client_request.num_batches_received;
     } else {
         StreamCollisionsClientRequest& stream_request = stream_map_it->second;
         ranks = &stream_request.ranks;
+        num_batches_received = &stream_request.num_batches_received;
     }
 
-    auto rank_it = std::find(ranks->begin(), ranks->end(), query_response.results_from);
+    // Merged aggregates answer for every rank they cover
+    const std::vector<std::uint32_t> response_ranks = query_response.aggregates.has_value() ? query_response.aggregated_ranks
+                                                                                            : std::vector<std::uint32_t>{query_response.results_from};
+    auto rank_it = std::find_first_of(ranks->begin(), ranks->end(), response_ranks.begin(), response_ranks.end());
     if (rank_it != ranks->end()) {
         std::cout << "ResponseWorker " << worker_id << " sees rank has already been processed for client_request with id: "
                   << query_response.id << std::endl;
         return;
     }
 
-    ranks->push_back(query_response.results_from);
+    // A rank is done with the last of its batches, which may arrive in any order
+    if (++(*num_batches_received)[query_response.results_from] == query_response.num_batches) {
+        ranks->insert(ranks->end(), response_ranks.begin(), response_ranks.end());
+    }
 
     if (client_map_it != pendingClientRequestsMap.end()) {
         GetCollisionsClientRequest& client_request = client_map_it->second;
         client_request.collisions.insert(client_request.collisions.end(), query_response.collisions.begin(), query_response.collisions.end());
+        // The request is resumed under the id of its first page while any rank has rows left
+        merge_resume_tokens(client_request.resume_token, query_response.resume_token);
+        client_request.cursor_expired |= query_response.cursor_expired;
+        if (query_response.aggregates.has_value()) {
+            if (!client_request.aggregates.has_value()) {
+                client_request.aggregates.emplace();
+            }
+            client_request.aggregates->merge(*query_response.aggregates);
+        }
 
         // TODO: check if all ranks present better using yaml config to find out how many processes exist
         if (ranks->size() == myconfig->getTotalNumberofProcess()) {
@@ -250,8 +409,15 @@ void handle_client_pending_responses(std::uint32_t worker_id, std::uint32_t proc
                 return;
             }
 
+            keep_top_collisions(client_request.collisions, client_request.order, client_request.limit);
+
             lock.unlock();
-            getCollisionsCallData->CompleteRequest(query_response.id, client_request.collisions);
+            if (client_request.cursor_expired) {
+                getCollisionsCallData->FailRequest(query_response.id, Status(grpc::StatusCode::NOT_FOUND, "Cursor expired"));
+            } else {
+                getCollisionsCallData->CompleteRequest(query_response.id, client_request.collisions, client_request.fields,
+                                                       client_request.aggregates, client_request.resume_token);
+            }
             lock.lock();
 
             pendingClientRequestsMap.erase(client_map_it);
@@ -265,11 +431,33 @@ void handle_client_pending_responses(std::uint32_t worker_id, std::uint32_t proc
             return;
         }
 
+        const bool is_complete = ranks->size() == myconfig->getTotalNumberofProcess();
+        if (stream_request.order.has_value()) {
+            // The order is only known once every rank has answered
+            stream_request.collisions.insert(stream_request.collisions.end(), query_response.collisions.begin(), query_response.collisions.end());
+            if (!is_complete) {
+                return;
+            }
+            keep_top_collisions(stream_request.collisions, stream_request.order, stream_request.limit);
+        }
+
+        ++stream_request.num_writers;
         lock.unlock();
         std::unique_lock<std::mutex> write_lock(stream_map_it->second.write_mutex);
-        streamCollisionsCallData->Write(query_response.id, query_response.results_from, query_response.collisions, std::move(write_lock));
+        streamCollisionsCallData->Write(query_response.id, query_response.results_from,
+                                        stream_request.order.has_value() ? stream_request.collisions : query_response.collisions,
+                                        stream_request.fields,
+                                        std::move(write_lock),
+                                        query_response.aggregates);
+        lock.lock();
+        --stream_request.num_writers;
+        stream_request.writers_done_cv.notify_all();
+
+        if (is_complete) {
+            // Batches counted before the last one may still be on their way to Write
+            stream_request.writers_done_cv.wait(lock, [&stream_request]() { return stream_request.num_writers == 0; });
+            lock.unlock();
 
-        if (ranks->size() == myconfig->getTotalNumberofProcess()) {
             std::unique_lock<std::mutex> finish_lock(stream_map_it->second.write_mutex);
             streamCollisionsCallData->Finish(query_response.id);
             finish_lock.unlock();
@@ -280,100 +468,96 @@ void handle_client_pending_responses(std::uint32_t worker_id, std::uint32_t proc
     }
 }
 
-void handle_pending_responses(std::uint32_t worker_id, std::uint32_t process_rank) {
-    
-    while (!worker_stop_flag.load()) {
-        std::optional<QueryResponse> maybe_query_response = wait_for_new_query_response(worker_id);
-        if (!maybe_query_response.has_value()) {
-            continue;
-        }
-        QueryResponse& query_response = maybe_query_response.value();
+void handle_pending_response(std::uint32_t worker_id, std::uint32_t process_rank, QueryResponse& query_response) {
+    std::cout << "ResponseWorker " << worker_id << " is handling response: " << query_response.id
+              << " from: " << query_response.results_from << std::endl;
 
-        std::cout << "ResponseWorker " << worker_id << " is handling response: " << query_response.id
-                  << " from: " << query_response.results_from << std::endl;
+    if (deadline_passed(query_response.deadline)) {
+        std::cout << "ResponseWorker " << worker_id << " is dropping results of expired query: " << query_response.id << std::endl;
+        admissionController->record_expired();
+        return;
+    }
 
-        if (process_rank == 0) {
-            handle_client_pending_responses(worker_id, process_rank, query_response);
-            continue;
+    topKMerger.merge(query_response);
+
+    if (query_response.results_from != process_rank && aggregateMerger->merges(query_response.id)) {
+        std::optional<QueryResponse> merged_response = aggregateMerger->merge(query_response);
+        if (!merged_response.has_value()) {
+            return;
         }
+        query_response = std::move(*merged_response);
+    }
 
-        
-        std::uint32_t parent_rank = *(query_response.requested_by.end() - 2);
-        if (myconfig->isSameNodeProcess(parent_rank)) {
-            shared_memory_manager->send_results(parent_rank, query_response);
-        } else {
-            //int parent_port = 50051 + parent_rank;
-            //std::string parent_server_address = "127.0.0.1:" + std::to_string(parent_port);
+    if (process_rank == 0) {
+        handle_client_pending_responses(worker_id, process_rank, query_response);
+        return;
+    }
 
-            std::string parent_server_address = config.getaddress(parent_rank);
-            std::cout << "Parent server address is: " << parent_server_address << std::endl;
+    
+    std::uint32_t parent_rank = *(query_response.requested_by.end() - 2);
+    // Responses larger than a shared memory block, which only aggregates can be, go over gRPC
+    if (!myconfig->isSameNodeProcess(parent_rank) || !shared_memory_manager->send_results(parent_rank, query_response)) {
+        //int parent_port = 50051 + parent_rank;
+        //std::string parent_server_address = "127.0.0.1:" + std::to_string(parent_port);
 
-            grpc::Status status = sendResults(parent_server_address, query_response);
-        }
+        std::string parent_server_address = config.getaddress(parent_rank);
+        std::cout << "Parent server address is: " << parent_server_address << std::endl;
 
-        std::cout << "ResponseWorker " << worker_id << " has processed response: " << query_response.id << std::endl;
+        grpc::Status status = sendResults(parent_server_address, query_response);
     }
 
-    std::cout << "ResponseWorker: " << worker_id << " stopped." << std::endl;
+    std::cout << "ResponseWorker " << worker_id << " has processed response: " << query_response.id << std::endl;
 }
 
-void handle_shared_memory_pending_responses(std::uint32_t worker_id, std::uint32_t process_rank) {
-    
-    
-    while (!worker_stop_flag.load()) {
-        std::optional<SharedMemoryQueryResponse> maybe_query_response = wait_for_new_shared_memory_query_response(worker_id, process_rank);
-        if (!maybe_query_response.has_value()) {
-            continue;
-        }
-        SharedMemoryQueryResponse& shared_memory_query_response = maybe_query_response.value();
-
-        std::size_t id = shared_memory_query_response.id;
-        std::uint32_t results_from = shared_memory_query_response.results_from;
+void handle_shared_memory_pending_response(std::uint32_t worker_id, std::uint32_t process_rank,
+                                            SharedMemoryQueryResponse& shared_memory_query_response) {
+    std::size_t id = shared_memory_query_response.id;
+    std::uint32_t results_from = shared_memory_query_response.results_from;
 
-        std::cout << "SharedMemoryResponseWorker " << worker_id << " is handling response: " << id
-                  << " from: " << results_from << std::endl;
+    std::cout << "SharedMemoryResponseWorker " << worker_id << " is handling response: " << id
+              << " from: " << results_from << std::endl;
 
-        std::uint32_t parent_rank = *(shared_memory_query_response.requested_by.begin() + shared_memory_query_response.requested_by_size - 2);
-        if (process_rank != 0 && myconfig->isSameNodeProcess(parent_rank)) {
-            shared_memory_manager->send_results(parent_rank, shared_memory_query_response);
-        } else {
-            // convert to QueryResponse and push it to self
-            QueryResponse query_response = shared_memory_manager->deserialize(shared_memory_query_response);
-            {
-                std::lock_guard<std::mutex> lock(pendingResponsesMutex);
-                pendingResponses.push(query_response);
-                pendingResponsesConditionVariable.notify_one();
-
-                std::cout << "SharedMemoryResponseWorker added response from: '" << static_cast<char>('A' + query_response.results_from) <<
-                             "' with id: '" << query_response.id << "' to the pendingResponses ringbuffer" << std::endl;
-            }
-        }
+    std::uint32_t parent_rank = *(shared_memory_query_response.requested_by.begin() + shared_memory_query_response.requested_by_size - 2);
+    // Responses to trim go through the response workers instead of straight to the parent
+    if (process_rank != 0 && myconfig->isSameNodeProcess(parent_rank) && !topKMerger.merges(id) && !aggregateMerger->merges(id)) {
+        shared_memory_manager->send_results(parent_rank, shared_memory_query_response);
+    } else {
+        // convert to QueryResponse and push it to self
+        QueryResponse query_response = shared_memory_manager->deserialize(shared_memory_query_response);
+        push_pending_response(std::move(query_response));
 
-        std::cout << "SharedMemoryResponseWorker " << worker_id << " has processed response from: " << results_from
-                  << " with id: " << id << std::endl;
+        std::cout << "SharedMemoryResponseWorker added response from: '" << static_cast<char>('A' + results_from) <<
+                     "' with id: '" << id << "' to the pendingResponses queue" << std::endl;
     }
 
-    std::cout << "SharedMemoryResponseWorker: " << worker_id << " stopped." << std::endl;
+    std::cout << "SharedMemoryResponseWorker " << worker_id << " has processed response from: " << results_from
+              << " with id: " << id << std::endl;
 }
 
 void cleanup_worker_threads() {
+    // Stopped first, as it answers clients through the calls of the service
+    if (expirySweeper.joinable()) {
+        expirySweeper.request_stop();
+        expirySweeper.join();
+    }
+
     worker_stop_flag.store(true);
-    pendingRequestsConditionVariable.notify_all();
-    pendingResponsesConditionVariable.notify_all();
+    pendingRequests.close();
+    pendingResponses.close();
 
     std::cout << "Joining request worker threads" << std::endl;
-    for (auto& worker : requestWorkers) {
-        worker.join();
+    if (requestWorkers) {
+        requestWorkers->stop();
     }
 
     std::cout << "Joining response worker threads" << std::endl;
-    for (auto& worker : responseWorkers) {
-        worker.join();
+    if (responseWorkers) {
+        responseWorkers->stop();
     }
 
     std::cout << "Joining shm response worker threads" << std::endl;
-    for (auto& worker : shmResponseWorkers) {
-        worker.join();
+    if (shmResponseWorkers) {
+        shmResponseWorkers->stop();
     }
 }
 
@@ -414,38 +598,59 @@ int main(int argc, char** argv) {
 //    signal(SIGSEGV, handle_signal);
 
     rank = myconfig->getRank();
+    aggregateMerger = std::make_unique<AggregateMerger>(rank, 2 * MAX_CONCURRENT_REQUESTS);
 
-    std::size_t max_num_collisions_each_rank = static_cast<std::size_t>(5 * std::ceil(static_cast<double>(
-        collision_manager->get_num_collisions()) / 5));
-    std::size_t block_size = sizeof(Collision) * max_num_collisions_each_rank;
+    // A block holds one batch of rows, and the free list's link to the next block, so the pool
+    // is shared by many responses at once
+    std::size_t block_size = sizeof(std::size_t) + sizeof(Collision) * RESPONSE_BATCH_SIZE;
 
     shared_memory_manager = new SharedMemoryManager(rank, block_size);
 
+    const std::size_t min_workers = myconfig->getMinWorkers();
+    requestWorkers = std::make_unique<WorkerPool<QueryRequest>>(
+        "request workers",
+        WorkerPoolOptions{.min_workers = min_workers, .max_workers = static_cast<std::size_t>(myconfig->getRequestWorkers())},
+        wait_for_new_query_request,
+        [](std::uint32_t worker_id, QueryRequest& query_request) { handle_pending_request(worker_id, rank, query_request); },
+        []() { return pendingRequests.size_approx(); });
+    responseWorkers = std::make_unique<WorkerPool<QueryResponse>>(
+        "response workers",
+        WorkerPoolOptions{.min_workers = min_workers, .max_workers = static_cast<std::size_t>(myconfig->getResponseWorkers())},
+        wait_for_new_query_response,
+        [](std::uint32_t worker_id, QueryResponse& query_response) { handle_pending_response(worker_id, rank, query_response); },
+        []() { return pendingResponses.size_approx(); });
+    // Shared memory only tells whether results wait, not how many
+    shmResponseWorkers = std::make_unique<WorkerPool<SharedMemoryQueryResponse>>(
+        "shared memory response workers",
+        WorkerPoolOptions{.min_workers = min_workers, .max_workers = static_cast<std::size_t>(myconfig->getSharedMemoryWorkers())},
+        [](std::uint32_t worker_id, const std::stop_token& stop_token) {
+            return wait_for_new_shared_memory_query_response(worker_id, rank, stop_token);
+        },
+        [](std::uint32_t worker_id, SharedMemoryQueryResponse& shared_memory_query_response) {
+            handle_shared_memory_pending_response(worker_id, rank, shared_memory_query_response);
+        },
+        []() -> std::size_t { return shared_memory_manager->has_results() ? 1 : 0; });
+    // Turned away are at the latest the queries that no longer fit in the queue
+    const std::size_t admission_queue_depth = static_cast<std::size_t>(myconfig->getAdmissionQueueDepth());
+    admissionController = std::make_unique<AdmissionController>(
+        admission_queue_depth > 0 ? std::min(admission_queue_depth, MAX_CONCURRENT_REQUESTS) : MAX_CONCURRENT_REQUESTS,
+        requestWorkers->get_statistics().max_workers);
+    if (rank == 0) {
+        expirySweeper = std::jthread(sweep_expired_client_requests);
+    }
+
     CollisionQueryServiceImpl service{rank,
-                                      pendingRequestsMutex,
+                                      *collision_manager,
                                       pendingClientRequestsMutex,
-                                      pendingResponsesMutex,
                                       pendingRequests,
                                       pendingResponses,
-                                      pendingRequestsConditionVariable,
-                                      pendingResponsesConditionVariable,
                                       pendingClientRequestsMap,
-                                      pendingStreamRequestsMap};
-
-    for (int i = 0; i < 4; ++i) {
-        requestWorkers.push_back(std::thread(handle_pending_requests, i, rank));
-    }
-
-    for (int i = 0; i < 4; ++i) {
-        responseWorkers.push_back(std::thread(handle_pending_responses, i, rank));
-    }
-
-    for (int i = 0; i < 1; ++i) {
-        shmResponseWorkers.push_back(std::thread(handle_shared_memory_pending_responses, i, rank));
-    }
+                                      pendingStreamRequestsMap,
+                                      *admissionController,
+                                      {requestWorkers.get(), responseWorkers.get(), shmResponseWorkers.get()}};
 
     std::string server_addresss = myconfig->getIP() + ":" + std::to_string(myconfig->getPortNumber());
-    service.Run(server_addresss);
+    service.Run(server_addresss, myconfig->getCompletionQueues());
 
     cleanup_worker_threads();
     cleanup_shared_memory();
@@ -5,21 +5,41 @@
 #include <iostream>
 #include <thread>
 #include <chrono>
+#include <optional>
 #include "myconfig.hpp"
 
 using google::protobuf::Empty;
 int MASTER = 0;
 
-void RunClient(bool stream) {
-
-    Config config;
-    // Set Master process IP
-    std::string target_str = config.getIP(MASTER) + ":" + std::to_string(config.getPortNumber(MASTER));
-    std::shared_ptr<grpc::Channel> channel = grpc::CreateChannel(target_str, grpc::InsecureChannelCredentials());
-    std::unique_ptr<collision_proto::CollisionQueryService::Stub> stub = collision_proto::CollisionQueryService::NewStub(channel);
-
+collision_proto::QueryRequest CreateRequest(bool any, std::optional<std::size_t> top, bool aggregate, bool brief, bool count) {
     Query query = Query::create(CollisionField::BOROUGH, QueryType::EQUALS, "BROOKLYN")
         .add(CollisionField::ZIP_CODE, QueryType::EQUALS, static_cast<uint32_t>(11233));
+    if (any) {
+        // Either the query above, or any collision in the Bronx without anyone injured
+        query = Query::any_of({
+            query,
+            Query::create(CollisionField::BOROUGH, QueryType::EQUALS, "BRONX")
+                .add(Query::negate(Query::create(CollisionField::NUMBER_OF_PERSONS_INJURED, QueryType::GREATER_THAN, static_cast<std::uint8_t>(0)))),
+        });
+    }
+    if (top.has_value()) {
+        // Only the most recent collisions
+        query.order_by(CollisionField::CRASH_DATE, SortDirection::DESCENDING).set_limit(*top);
+    }
+    if (aggregate) {
+        // Number of collisions and persons injured per borough and month
+        query.aggregate({
+            .group_by = {{CollisionField::BOROUGH}, {CollisionField::CRASH_DATE, DateBucket::MONTH}},
+            .aggregates = {{AggregateFunction::COUNT}, {AggregateFunction::SUM, CollisionField::NUMBER_OF_PERSONS_INJURED}},
+        });
+    } else if (count) {
+        // Only how many collisions match
+        query.count_only();
+    }
+    if (brief) {
+        // Only when, where and which collision
+        query.select({CollisionField::CRASH_DATE, CollisionField::BOROUGH, CollisionField::ZIP_CODE, CollisionField::COLLISION_ID});
+    }
 
     QueryRequest query_request = {
         .id = 1,
@@ -27,14 +47,34 @@ void RunClient(bool stream) {
         .query = query,
     };
 
-    collision_proto::QueryRequest request = QueryProtoConverter::serialize(query_request);
+    return QueryProtoConverter::serialize(query_request);
+}
+
+void RunClient(bool stream, bool any, std::optional<std::size_t> top, bool aggregate, bool brief, bool count, bool columns,
+               std::optional<std::size_t> page, std::optional<std::chrono::milliseconds> deadline) {
+
+    Config config;
+    // Set Master process IP
+    std::string target_str = config.getIP(MASTER) + ":" + std::to_string(config.getPortNumber(MASTER));
+    std::shared_ptr<grpc::Channel> channel = grpc::CreateChannel(target_str, grpc::InsecureChannelCredentials());
+    std::unique_ptr<collision_proto::CollisionQueryService::Stub> stub = collision_proto::CollisionQueryService::NewStub(channel);
+
+    collision_proto::QueryRequest request = CreateRequest(any, top, aggregate, brief, count);
+    if (columns) {
+        request.set_response_format(collision_proto::RESPONSE_COLUMNS);
+    }
 
     collision_proto::QueryResponse response;
     grpc::ClientContext context;
+    // The ranks give up on the query once the deadline passed, a page has it anew
+    if (deadline.has_value()) {
+        context.set_deadline(std::chrono::system_clock::now() + *deadline);
+    }
 
     std::cout << "Sending query" << std::endl;
 
     std::vector<Collision> collisions{};
+    AggregateTable aggregates{};
 
     grpc::Status status;
     if (stream) {
@@ -45,6 +85,9 @@ void RunClient(bool stream) {
         while (reader->Read(&response)) {
             QueryResponse query_response = CollisionProtoConverter::deserialize(response);
             collisions.insert(collisions.end(), query_response.collisions.begin(), query_response.collisions.end());
+            if (query_response.aggregates.has_value()) {
+                aggregates.merge(*query_response.aggregates);
+            }
 
             std::cout << "Received streaming response number: " << num_responses << std::endl;
             ++num_responses;
@@ -52,14 +95,52 @@ void RunClient(bool stream) {
 
         status = reader->Finish();
     } else {
-        status = stub->GetCollisions(&context, request, &response);
+        if (page.has_value()) {
+            request.set_page_size(*page);
+        }
 
-        QueryResponse query_response = CollisionProtoConverter::deserialize(response);
-        collisions.insert(collisions.end(), query_response.collisions.begin(), query_response.collisions.end());
+        // Each page resumes where the one before stopped, until no rank has rows left
+        for (std::size_t num_pages = 0; ; ++num_pages) {
+            grpc::ClientContext page_context;
+            if (deadline.has_value()) {
+                page_context.set_deadline(std::chrono::system_clock::now() + *deadline);
+            }
+            status = stub->GetCollisions(&page_context, request, &response);
+            if (!status.ok()) {
+                break;
+            }
+
+            QueryResponse query_response = CollisionProtoConverter::deserialize(response);
+            collisions.insert(collisions.end(), query_response.collisions.begin(), query_response.collisions.end());
+            if (query_response.aggregates.has_value()) {
+                aggregates.merge(*query_response.aggregates);
+            }
+
+            if (page.has_value()) {
+                std::cout << "Received page number: " << num_pages << " Collision size " << query_response.collisions.size() << std::endl;
+            }
+            if (response.resume_token().empty()) {
+                break;
+            }
+            request.set_resume_token(response.resume_token());
+        }
     }
 
     if (status.ok()) {
         std::cout << "Collision size "<< collisions.size() << std::endl;
+        if (aggregate) {
+            std::cout << "Aggregate groups " << aggregates.groups.size() << std::endl;
+            for (const auto& [key, values] : aggregates.groups) {
+                for (const std::optional<std::string>& value : key) {
+                    std::cout << value.value_or("NULL") << " ";
+                }
+                std::cout << ": count " << values.at(0).result(AggregateFunction::COUNT).value_or(0)
+                          << " injured " << values.at(1).result(AggregateFunction::SUM).value_or(0) << std::endl;
+            }
+        }
+        if (count && !aggregate && !aggregates.groups.empty()) {
+            std::cout << "Count " << aggregates.groups.begin()->second.at(0).count << std::endl;
+        }
 /*
         for (const Collision& collision  : collisions) {
             std::cout << "Name : " << collision.borough.value().c_str() << " Zip_code : " << collision.zip_code.value() << std::endl;
@@ -71,17 +152,147 @@ void RunClient(bool stream) {
     }
 }
 
+void RunStatisticsClient() {
+    Config config;
+
+    // Statistics are kept per rank, so ask every process for its own
+    for (int rank = 0; rank < config.getTotalWorkers(); ++rank) {
+        std::string target_str = config.getIP(rank) + ":" + std::to_string(config.getPortNumber(rank));
+        std::shared_ptr<grpc::Channel> channel = grpc::CreateChannel(target_str, grpc::InsecureChannelCredentials());
+        std::unique_ptr<collision_proto::CollisionQueryService::Stub> stub = collision_proto::CollisionQueryService::NewStub(channel);
+
+        collision_proto::StatisticsRequest request;
+        collision_proto::StatisticsResponse response;
+        grpc::ClientContext context;
+
+        grpc::Status status = stub->GetStatistics(&context, request, &response);
+        if (!status.ok()) {
+            std::cerr << "RPC Error from rank " << rank << ": " << status.error_code() << ": " << status.error_message() << std::endl;
+            continue;
+        }
+
+        std::cout << "Rank " << response.rank() << " rows " << response.row_count() << std::endl;
+        std::cout << "  query cache hits " << response.query_cache().hits()
+                  << " misses " << response.query_cache().misses()
+                  << " evictions " << response.query_cache().evictions()
+                  << " entries " << response.query_cache().entries()
+                  << " bytes " << response.query_cache().bytes() << "/" << response.query_cache().capacity_bytes() << std::endl;
+        for (const collision_proto::WorkerPoolStatistics& worker_pool : response.worker_pools()) {
+            std::cout << "  " << worker_pool.name() << " workers " << worker_pool.workers()
+                      << " (" << worker_pool.min_workers() << "-" << worker_pool.max_workers() << ")"
+                      << " busy " << worker_pool.busy_workers()
+                      << " queued " << worker_pool.queue_depth()
+                      << " utilization " << worker_pool.utilization()
+                      << " handled " << worker_pool.handled()
+                      << " grown " << worker_pool.grown()
+                      << " shrunk " << worker_pool.shrunk() << std::endl;
+        }
+        if (response.has_admission()) {
+            const collision_proto::AdmissionStatistics& admission = response.admission();
+            std::cout << "  admission max_queue_depth " << admission.max_queue_depth()
+                      << " mean_handling_ms " << admission.mean_handling_ms()
+                      << " admitted " << admission.admitted()
+                      << " rejected_queue_full " << admission.rejected_queue_full()
+                      << " rejected_deadline " << admission.rejected_deadline()
+                      << " expired " << admission.expired() << std::endl;
+        }
+        for (const collision_proto::ColumnStatistics& column : response.columns()) {
+            std::cout << "  " << collision_proto::QueryFields_Name(column.field())
+                      << " distinct " << column.distinct_count()
+                      << " null_fraction " << column.null_fraction()
+                      << " histogram_bounds " << column.histogram_bounds_size()
+                      << " most_common_values " << column.most_common_values_size() << std::endl;
+        }
+    }
+}
+
+void RunExplainClient(bool any, std::optional<std::size_t> top) {
+    Config config;
+    collision_proto::QueryRequest request = CreateRequest(any, top, false, false, false);
+
+    // Each rank plans the query against its own partition
+    for (int rank = 0; rank < config.getTotalWorkers(); ++rank) {
+        std::string target_str = config.getIP(rank) + ":" + std::to_string(config.getPortNumber(rank));
+        std::shared_ptr<grpc::Channel> channel = grpc::CreateChannel(target_str, grpc::InsecureChannelCredentials());
+        std::unique_ptr<collision_proto::CollisionQueryService::Stub> stub = collision_proto::CollisionQueryService::NewStub(channel);
+
+        collision_proto::ExplainResponse response;
+        grpc::ClientContext context;
+
+        grpc::Status status = stub->ExplainQuery(&context, request, &response);
+        if (!status.ok()) {
+            std::cerr << "RPC Error from rank " << rank << ": " << status.error_code() << ": " << status.error_message() << std::endl;
+            continue;
+        }
+
+        std::cout << "Rank " << response.rank() << " rows " << response.row_count()
+                  << " estimated_rows " << response.estimated_rows()
+                  << " estimated_cost " << response.estimated_cost()
+                  << (response.evaluates_expression() ? " expression" : "") << std::endl;
+        for (const collision_proto::PlanStep& step : response.steps()) {
+            std::cout << "  " << collision_proto::AccessPath_Name(step.access_path())
+                      << " condition " << step.condition_index()
+                      << " " << collision_proto::QueryFields_Name(step.field())
+                      << " " << collision_proto::QueryType_Name(step.type());
+            if (step.has_upper_condition_index()) {
+                std::cout << " and condition " << step.upper_condition_index() << " LESS_THAN";
+            }
+            std::cout << " selectivity " << step.selectivity()
+                      << " estimated_rows " << step.estimated_rows() << std::endl;
+        }
+    }
+}
+
 int main(int argc, char *argv[]) {
     bool stream = false;
+    bool statistics = false;
+    bool explain = false;
+    bool any = false;
+    std::optional<std::size_t> top{};
+    bool aggregate = false;
+    bool brief = false;
+    bool count = false;
+    bool columns = false;
+    std::optional<std::size_t> page{};
+    std::optional<std::chrono::milliseconds> deadline{};
 
     for (int i = 1; i < argc; ++i) {
         std::string arg = argv[i];
         if (arg == "--stream") {
             stream = true;
-            break; // Found it, no need to continue
+        } else if (arg == "--stats") {
+            statistics = true;
+        } else if (arg == "--explain") {
+            explain = true;
+        } else if (arg == "--any") {
+            any = true;
+        } else if (arg == "--top" && i + 1 < argc) {
+            top = std::stoul(argv[++i]);
+        } else if (arg == "--aggregate") {
+            aggregate = true;
+        } else if (arg == "--brief") {
+            brief = true;
+        } else if (arg == "--count") {
+            count = true;
+        } else if (arg == "--columns") {
+            columns = true;
+        } else if (arg == "--page" && i + 1 < argc) {
+            page = std::stoul(argv[++i]);
+        } else if (arg == "--deadline" && i + 1 < argc) {
+            deadline = std::chrono::milliseconds(std::stoul(argv[++i]));
         }
     }
 
-    RunClient(stream);
+    if (statistics) {
+        RunStatisticsClient();
+        return 0;
+    }
+
+    if (explain) {
+        RunExplainClient(any, top);
+        return 0;
+    }
+
+    RunClient(stream, any, top, aggregate, brief, count, columns, page, deadline);
     return 0;
 }
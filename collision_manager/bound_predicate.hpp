@@ -0,0 +1,338 @@
+#pragma once
+
+#include "column_kernels.hpp"
+#include "fixed_string.hpp"
+#include "query.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+constexpr std::size_t NUM_QUERY_TYPES = static_cast<std::size_t>(QueryType::IN) + 1;
+
+template<class T>
+constexpr bool is_string_column = std::is_same_v<T, CollisionString>;
+
+template<class T>
+constexpr bool supports_query_type(const QueryType type) {
+    switch(type) {
+    case QueryType::HAS_VALUE:
+    case QueryType::EQUALS:
+    case QueryType::IN:
+        return true;
+    case QueryType::LESS_THAN:
+    case QueryType::GREATER_THAN:
+        return !is_string_column<T>;
+    case QueryType::CONTAINS:
+        return is_string_column<T>;
+    default:
+        return false;
+    }
+}
+
+constexpr std::size_t COLLISION_STRING_CAPACITY = sizeof(CollisionString::data) - 1;
+static_assert(COLLISION_STRING_CAPACITY % 16 == 0, "fold_ascii_case works on 16 byte blocks");
+
+// Writes value with its ASCII letters lower cased to folded, which holds COLLISION_STRING_CAPACITY
+// bytes, and returns the folded string. Like ::tolower in the C locale, only A-Z change.
+inline std::string_view fold_ascii_case(const CollisionString& value, char* folded) {
+#if defined(__SSE2__)
+    // Bytes above 127 are negative as signed chars, so they never fall inside A-Z
+    const __m128i before_a = _mm_set1_epi8('A' - 1);
+    const __m128i after_z = _mm_set1_epi8('Z' + 1);
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    for (std::size_t offset = 0; offset < value.length; offset += 16) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(value.data + offset));
+        const __m128i is_upper = _mm_and_si128(_mm_cmpgt_epi8(bytes, before_a), _mm_cmplt_epi8(bytes, after_z));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(folded + offset), _mm_or_si128(bytes, _mm_and_si128(is_upper, case_bit)));
+    }
+#else
+    for (std::size_t offset = 0; offset < value.length; ++offset) {
+        const char byte = value.data[offset];
+        folded[offset] = byte >= 'A' && byte <= 'Z' ? byte | 0x20 : byte;
+    }
+#endif
+    return {folded, value.length};
+}
+
+// Key of a value for set membership, ordered like the values. Dates and times become whole
+// numbers, so that they can share the bitset of the integer columns, and strings are looked up
+// without a copy.
+template<class T>
+auto membership_key(const T& value) {
+    if constexpr (std::is_same_v<T, std::chrono::year_month_day>) {
+        return static_cast<std::int64_t>(std::chrono::sys_days{value}.time_since_epoch().count());
+    } else if constexpr (std::is_same_v<T, std::chrono::hh_mm_ss<std::chrono::minutes>>) {
+        return static_cast<std::int64_t>(std::chrono::duration_cast<std::chrono::minutes>(value.to_duration()).count());
+    } else if constexpr (is_string_column<T>) {
+        return std::string_view(value.data, value.length);
+    } else {
+        return value;
+    }
+}
+
+// Widest range of integer keys kept in a bitset, 8 KiB of bits. Wider ranges go to a hash set.
+constexpr std::uint64_t VALUE_SET_MAX_BITSET_RANGE = std::uint64_t{1} << 16;
+
+struct TransparentStringHash {
+    using is_transparent = void;
+
+    std::size_t operator()(const std::string_view value) const {
+        return std::hash<std::string_view>{}(value);
+    }
+};
+
+// The values of an IN. Integer keys spanning a small range, which covers every uint8 count, the
+// zip codes and the times of day, are bits of a bitset starting at the smallest key. Other keys
+// are kept in a hash set, strings in one that is probed with a std::string_view.
+template<class T>
+class ValueSet {
+public:
+    using Key = decltype(membership_key(std::declval<T>()));
+
+    ValueSet() = default;
+
+    // Folds the string values when case_insensitive, the probed strings must then be folded too
+    ValueSet(const std::vector<Value>& values, const bool case_insensitive) {
+        std::vector<Key> keys{};
+        for (const Value& value : values) {
+            const T& item = std::get<T>(value);
+            if constexpr (is_string_column<T>) {
+                alignas(16) char folded[COLLISION_STRING_CAPACITY];
+                keys_.emplace(case_insensitive ? fold_ascii_case(item, folded) : membership_key(item));
+            } else {
+                keys.push_back(membership_key(item));
+            }
+        }
+
+        if constexpr (std::is_integral_v<Key>) {
+            const auto [min_key, max_key] = std::minmax_element(keys.begin(), keys.end());
+            if (min_key != keys.end() && static_cast<std::uint64_t>(*max_key - *min_key) < VALUE_SET_MAX_BITSET_RANGE) {
+                min_key_ = *min_key;
+                bits_.assign(static_cast<std::uint64_t>(*max_key - *min_key) / 64 + 1, 0);
+                for (const Key key : keys) {
+                    const std::uint64_t offset = static_cast<std::uint64_t>(key - min_key_);
+                    bits_[offset / 64] |= std::uint64_t{1} << (offset % 64);
+                }
+                return;
+            }
+        }
+        if constexpr (!is_string_column<T>) {
+            keys_.insert(keys.begin(), keys.end());
+        }
+    }
+
+    bool contains(const Key key) const {
+        if constexpr (std::is_integral_v<Key>) {
+            if (!bits_.empty()) {
+                // Keys below the smallest one wrap around to a huge offset
+                const std::uint64_t offset = static_cast<std::uint64_t>(key - min_key_);
+                return offset / 64 < bits_.size() && (bits_[offset / 64] >> (offset % 64) & 1) != 0;
+            }
+        }
+        return keys_.contains(key);
+    }
+
+private:
+    using KeySet = std::conditional_t<is_string_column<T>,
+                                      std::unordered_set<std::string, TransparentStringHash, std::equal_to<>>,
+                                      std::unordered_set<Key>>;
+
+    Key min_key_{};
+    std::vector<std::uint64_t> bits_;
+    KeySet keys_;
+};
+
+// What a predicate compares the rows with, the single query value or the values of an IN
+template<class T>
+struct PredicateOperand {
+    T value{};
+    ValueSet<T> values;
+};
+
+// Whether one value of a column matches a query value. Everything that is fixed for the whole
+// query is a template parameter, so the per row work is only the comparison itself.
+template<class T, QueryType Type, bool CaseInsensitive>
+bool evaluate(const std::optional<T>& value, const PredicateOperand<T>& operand) {
+    if constexpr (Type == QueryType::HAS_VALUE) {
+        return value.has_value();
+    } else {
+        if (!value.has_value()) {
+            return false;
+        }
+
+        if constexpr (is_string_column<T>) {
+            // The query values were already folded when the predicate was bound
+            const std::string_view needle(operand.value.data, operand.value.length);
+            std::string_view haystack((*value).data, (*value).length);
+            if constexpr (CaseInsensitive) {
+                if constexpr (Type == QueryType::EQUALS) {
+                    if (haystack.size() != needle.size()) {
+                        return false;
+                    }
+                }
+                alignas(16) char folded[COLLISION_STRING_CAPACITY];
+                haystack = fold_ascii_case(*value, folded);
+            }
+
+            if constexpr (Type == QueryType::EQUALS) {
+                return haystack == needle;
+            } else if constexpr (Type == QueryType::IN) {
+                return operand.values.contains(haystack);
+            } else {
+                return haystack.find(needle) != std::string_view::npos;
+            }
+        } else if constexpr (Type == QueryType::IN) {
+            return operand.values.contains(membership_key(*value));
+        } else {
+            const T& query_value = operand.value;
+            const auto key = [](const T& item) {
+                if constexpr (std::is_same_v<T, std::chrono::hh_mm_ss<std::chrono::minutes>>) {
+                    return item.to_duration();
+                } else {
+                    return item;
+                }
+            };
+
+            if constexpr (Type == QueryType::EQUALS) {
+                return key(*value) == key(query_value);
+            } else if constexpr (Type == QueryType::LESS_THAN) {
+                return key(*value) < key(query_value);
+            } else {
+                return key(*value) > key(query_value);
+            }
+        }
+    }
+}
+
+// Clears the bits in matches[start_word, end_word) of the rows that do not match
+template<class T, QueryType Type, bool Invert, bool CaseInsensitive>
+void match_words(const std::vector<std::optional<T>>& items,
+                 const PredicateOperand<T>& operand,
+                 const std::size_t start_word,
+                 const std::size_t end_word,
+                 std::uint64_t* matches) {
+    for (std::size_t word = start_word; word < end_word; ++word) {
+        // Only the rows still set need checking
+        for (std::uint64_t remaining = matches[word]; remaining != 0; remaining &= remaining - 1) {
+            const int bit = std::countr_zero(remaining);
+            if (evaluate<T, Type, CaseInsensitive>(items[word * ROWS_PER_MATCH_WORD + bit], operand) == Invert) {
+                matches[word] &= ~(std::uint64_t{1} << bit);
+            }
+        }
+    }
+}
+
+// Moves the rows in row_ids that match to the front, keeping their order, and returns how many
+template<class T, QueryType Type, bool Invert, bool CaseInsensitive>
+std::size_t match_rows(const std::vector<std::optional<T>>& items, const PredicateOperand<T>& operand, std::span<std::uint32_t> row_ids) {
+    const auto matched_end = std::remove_if(row_ids.begin(), row_ids.end(), [&items, &operand](const std::uint32_t row) {
+        return evaluate<T, Type, CaseInsensitive>(items[row], operand) == Invert;
+    });
+    return matched_end - row_ids.begin();
+}
+
+template<class T>
+void unsupported_match_words(const std::vector<std::optional<T>>&, const PredicateOperand<T>&, std::size_t, std::size_t, std::uint64_t*) {
+    throw std::runtime_error("Unsupported QueryType for field");
+}
+
+template<class T>
+std::size_t unsupported_match_rows(const std::vector<std::optional<T>>&, const PredicateOperand<T>&, std::span<std::uint32_t>) {
+    throw std::runtime_error("Unsupported QueryType for field");
+}
+
+template<class T>
+struct PredicateFunctions {
+    void (*match_words)(const std::vector<std::optional<T>>&, const PredicateOperand<T>&, std::size_t, std::size_t, std::uint64_t*);
+    std::size_t (*match_rows)(const std::vector<std::optional<T>>&, const PredicateOperand<T>&, std::span<std::uint32_t>);
+};
+
+template<class T, std::size_t Index>
+constexpr PredicateFunctions<T> predicate_functions() {
+    constexpr QueryType type = static_cast<QueryType>(Index / 4);
+    constexpr bool invert = Index / 2 % 2 == 1;
+    // Only string columns fold case, the other columns share the instantiation without it
+    constexpr bool case_insensitive = Index % 2 == 1 && is_string_column<T>;
+
+    if constexpr (supports_query_type<T>(type)) {
+        return {&match_words<T, type, invert, case_insensitive>, &match_rows<T, type, invert, case_insensitive>};
+    } else {
+        return {&unsupported_match_words<T>, &unsupported_match_rows<T>};
+    }
+}
+
+template<class T, std::size_t... Indexes>
+constexpr std::array<PredicateFunctions<T>, sizeof...(Indexes)> make_predicate_table(std::index_sequence<Indexes...>) {
+    return {predicate_functions<T, Indexes>()...};
+}
+
+// Every specialization for a column type, indexed by QueryType, invert_match and case_insensitive
+template<class T>
+constexpr std::array<PredicateFunctions<T>, NUM_QUERY_TYPES * 4> PREDICATE_TABLE =
+    make_predicate_table<T>(std::make_index_sequence<NUM_QUERY_TYPES * 4>{});
+
+// A FieldQuery bound once to the specialization for its column type, QueryType and flags. The
+// query value is extracted from the variant, and folded for a case insensitive match, up front,
+// and the values of an IN are put into a ValueSet.
+template<class T>
+class BoundPredicate {
+public:
+    explicit BoundPredicate(const FieldQuery& query)
+      : functions_{PREDICATE_TABLE<T>[static_cast<std::size_t>(query.get_type()) * 4 +
+                                      query.invert_match() * 2 + query.case_insensitive()]},
+        operand_{bind_value(query), bind_values(query)}
+    {}
+
+    void match_words(const std::vector<std::optional<T>>& items,
+                     const std::size_t start_word,
+                     const std::size_t end_word,
+                     std::uint64_t* matches) const {
+        functions_.match_words(items, operand_, start_word, end_word, matches);
+    }
+
+    std::size_t match_rows(const std::vector<std::optional<T>>& items, std::span<std::uint32_t> row_ids) const {
+        return functions_.match_rows(items, operand_, row_ids);
+    }
+
+private:
+    static T bind_value(const FieldQuery& query) {
+        if (query.get_type() == QueryType::HAS_VALUE || query.get_type() == QueryType::IN) {
+            return T{};
+        }
+
+        const T& query_value = std::get<T>(query.get_value());
+        if constexpr (is_string_column<T>) {
+            if (query.case_insensitive()) {
+                alignas(16) char folded[COLLISION_STRING_CAPACITY];
+                return CollisionString(fold_ascii_case(query_value, folded));
+            }
+        }
+        return query_value;
+    }
+
+    static ValueSet<T> bind_values(const FieldQuery& query) {
+        if (query.get_type() != QueryType::IN) {
+            return {};
+        }
+        return ValueSet<T>(query.get_values(), query.case_insensitive());
+    }
+
+    PredicateFunctions<T> functions_;
+    PredicateOperand<T> operand_;
+};
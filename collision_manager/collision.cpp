@@ -1,7 +1,10 @@
 #include "collision.hpp"
 
+#include "bound_predicate.hpp"
 #include "query.hpp"
 
+#include <algorithm>
+#include <bit>
 #include <chrono>
 #include <iostream>
 #include <format>
@@ -10,231 +13,104 @@
 #include <optional>
 #include <string>
 
+// Checks query, bounded above by upper_query if set, with the SIMD kernels. Returns false when
+// there is no kernel for the predicate, which then has to go through a BoundPredicate.
 template<class T>
-bool equals_is_less_than(const FieldQuery& query, const std::optional<T>& value) {
-    const QueryType& type = query.get_type();
-    const T& query_value = std::get<T>(query.get_value());
-
-    if (!value.has_value()) {
-        return false;
-    }
-
-    if constexpr (std::is_same_v<float, T> || std::is_same_v<std::size_t, T> || std::is_same_v<std::chrono::year_month_day, T> ||
-                  std::is_same_v<std::uint8_t, T> || std::is_same_v<std::uint32_t, T>) {
-        switch(type) {
-        case QueryType::EQUALS:
-            return *value < query_value;
-        default:
-            throw std::runtime_error("Unsupported QueryType for float/std::size_t/std::chrono::year_month_day/std::uint8_t/std::uint32_t");
-        }
-    }
-
-    throw std::runtime_error("Unsupported value type");
-}
-
-template<class T>
-bool do_match(const FieldQuery& query, const std::optional<T>& value) {
-    const QueryType& type = query.get_type();
-
-    if (type == QueryType::HAS_VALUE) {
-        return value.has_value();
-    }
-
-    if (!value.has_value()) {
-        return false;
-    }
-
-    const T& query_value = std::get<T>(query.get_value());
-
-    if constexpr (std::is_same_v<float, T> || std::is_same_v<std::size_t, T> || std::is_same_v<std::chrono::year_month_day, T> ||
-                  std::is_same_v<std::uint8_t, T> || std::is_same_v<std::uint32_t, T>) {
-        switch(type) {
-        case QueryType::EQUALS:
-            return *value == query_value;
-        case QueryType::LESS_THAN:
-            return *value < query_value;
-        case QueryType::GREATER_THAN:
-            return *value > query_value;
-        case QueryType::CONTAINS:
-        default:
-            throw std::runtime_error("Unsupported QueryType for float/std::size_t/std::chrono::year_month_day/std::uint8_t/std::uint32_t");
+bool match_dense_field(const FieldQuery& query,
+                       const FieldQuery* upper_query,
+                       const DenseColumn<T>& column,
+                       const std::size_t start_word,
+                       const std::size_t end_word,
+                       std::span<std::uint64_t> matches) {
+    CompareOp op{};
+    T lower{};
+    T upper{};
+
+    if (upper_query != nullptr) {
+        if (query.get_type() != QueryType::GREATER_THAN || upper_query->get_type() != QueryType::LESS_THAN ||
+            query.invert_match() || upper_query->invert_match()) {
+            return false;
         }
-    } else if constexpr (std::is_same_v<std::chrono::hh_mm_ss<std::chrono::minutes>, T>) {
-        switch(type) {
+        op = CompareOp::BETWEEN;
+        lower = std::get<T>(query.get_value());
+        upper = std::get<T>(upper_query->get_value());
+    } else {
+        switch(query.get_type()) {
+        case QueryType::HAS_VALUE:
+            for (std::size_t word = start_word; word < end_word; ++word) {
+                matches[word] &= query.invert_match() ? ~column.validity[word] : column.validity[word];
+            }
+            return true;
         case QueryType::EQUALS:
-            return (*value).to_duration() == query_value.to_duration();
+            op = CompareOp::EQUALS;
+            lower = std::get<T>(query.get_value());
+            break;
         case QueryType::LESS_THAN:
-            return (*value).to_duration() < query_value.to_duration();
+            op = CompareOp::LESS_THAN;
+            upper = std::get<T>(query.get_value());
+            break;
         case QueryType::GREATER_THAN:
-            return (*value).to_duration() > query_value.to_duration();
-        case QueryType::CONTAINS:
-        default:
-            throw std::runtime_error("Unsupported QueryType for std::chrono::hh_mm_ss");
-        }
-    } else if constexpr (std::is_same_v<std::string, T> || std::is_same_v<CollisionString, T>) {
-        std::string first_value;
-        std::string second_value;
-        if constexpr (std::is_same_v<std::string, T>) {
-            first_value = *value;
-            second_value = query_value;
-        } else if constexpr (std::is_same_v<CollisionString, T>) {
-            first_value = std::string((*value).data, (*value).length);
-            second_value = std::string(query_value.data, query_value.length);
-        }
-
-        if (query.case_insensitive()) {
-            std::transform(first_value.begin(), first_value.end(), first_value.begin(), ::tolower);
-            std::transform(second_value.begin(), second_value.end(), second_value.begin(), ::tolower);
-        }
-
-        switch(type) {
-        case QueryType::EQUALS:
-            return first_value == second_value;
+            op = CompareOp::GREATER_THAN;
+            lower = std::get<T>(query.get_value());
+            break;
         case QueryType::CONTAINS:
-            return first_value.find(second_value) != std::string::npos;
-        case QueryType::LESS_THAN:
-        case QueryType::GREATER_THAN:
+        case QueryType::IN:
         default:
-            throw std::runtime_error("Unsupported QueryType for std::string");
+            return false;
         }
-    } else {
-        static_assert(false, "Unsupported type, Only float, std::size_t, std::string, std::chrono::year_month_day, and std::chrono::hh_mm_ss, std::uint8_t, std::uint32_t types are allowed.");
     }
 
-    return false;
+    match_dense_column(column, op, lower, upper, query.invert_match(), start_word, end_word, matches.data());
+    return true;
 }
 
 template<class T>
-void match_field(const FieldQuery& query,
-                 const std::size_t start_index,
-                 const std::size_t end_index,
-                 const std::vector<T>& items,
-                 std::span<std::uint8_t>& matches_span) {
-    std::uint8_t* matches = matches_span.data();
-    for (std::size_t index = 0; index < matches_span.size(); ++index) {
-        if (*matches) {
-            bool match = do_match(query, items[start_index + index]);
-            match = query.invert_match() ? !match : match;
-            if (!match) {
-                *matches = false;
-            }
-        }
-        ++matches;
-    }
-}
+IndexSlices match_indexed_field(const FieldQuery& query,
+                                const SortedIndex<T>& index) {
+    const std::span<const std::uint32_t> values = index.values();
 
-// Start: AI Generated Binary Search Code
-// ======================================
-template<class T>
-const std::uint32_t* binary_search_find_first_lower_match(const FieldQuery& query,
-                                                          const std::size_t start_index,
-                                                          const std::size_t end_index,
-                                                          const std::vector<T>& items,
-                                                          const std::vector<std::uint32_t>& items_index) {
-    int low = start_index;
-    int high = end_index - 1;
-    const std::uint32_t* result = nullptr;
-
-    while (low <= high) {
-        int mid = low + (high - low) / 2;
-
-        if (do_match(query, items[items_index[mid]])) {
-            result = &items_index[mid];
-            high = mid - 1;
-        } else {
-            if (query.get_type() == QueryType::EQUALS) {
-                if (equals_is_less_than(query, items[items_index[mid]])) {
-                    low = mid + 1;
-                } else {
-                    high = mid - 1;
-                }
-            } else if (query.get_type() == QueryType::LESS_THAN) {
-                high = mid - 1;
-            } else {
-                low = mid + 1;
-            }
-        }
+    if (query.get_type() == QueryType::HAS_VALUE) {
+        return {values};
     }
 
-    return result;
-}
-
-template<class T>
-const std::uint32_t* binary_search_find_last_upper_match(const FieldQuery& query,
-                                                         const std::size_t start_index,
-                                                         const std::size_t end_index,
-                                                         const std::vector<T>& items,
-                                                         const std::vector<std::uint32_t>& items_index) {
-    int low = start_index;
-    int high = end_index - 1;
-    const std::uint32_t* result = nullptr;
-
-    while (low <= high) {
-        int mid = low + (high - low) / 2;
-
-        if (do_match(query, items[items_index[mid]])) {
-            result = &items_index[mid];
-            low = mid + 1;
-        } else {
-            if (query.get_type() == QueryType::EQUALS) {
-                if (equals_is_less_than(query, items[items_index[mid]])) {
-                    low = mid + 1;
-                } else {
-                    high = mid - 1;
+    if (query.get_type() == QueryType::IN) {
+        // Each distinct value is its own run of the index, visited in index order
+        std::vector<T> query_values{};
+        for (const Value& value : query.get_values()) {
+            query_values.push_back(std::get<T>(value));
+        }
+        std::sort(query_values.begin(), query_values.end(), [](const T& first, const T& second) {
+            return index_key(first) < index_key(second);
+        });
+
+        IndexSlices slices{};
+        std::size_t end = 0;
+        for (const T& query_value : query_values) {
+            const std::size_t lower_bound = index.lower_bound(query_value);
+            if (lower_bound >= end) {
+                end = index.upper_bound(query_value);
+                if (end > lower_bound) {
+                    slices.push_back(values.subspan(lower_bound, end - lower_bound));
                 }
-            } else if (query.get_type() == QueryType::LESS_THAN) {
-                high = mid - 1;
-            } else {
-                low = mid + 1;
             }
         }
+        return slices;
     }
 
-    return result;
-}
-// End: AI Generated Binary Search Code
-// ====================================
-
-template<class T>
-void match_indexed_field(const FieldQuery& query,
-                         const std::size_t start_index,
-                         const std::size_t end_index,
-                         const std::vector<T>& items,
-                         const std::vector<std::uint32_t>& items_index,
-                         std::span<std::uint8_t>& matches_span) {
-
-    std::uint8_t* matches = matches_span.data();
-
-    // Using binary search we find the indexes of the first and last matching items.
-    // We therefore know that everything outside this range is not a match, and do not need
-    // to call match on every single item anymore.
-
-    const std::uint32_t* lower_bound = binary_search_find_first_lower_match(
-        query, start_index, end_index, items, items_index
-    );
-    const std::uint32_t* upper_bound = binary_search_find_last_upper_match(
-        query, start_index, end_index, items, items_index
-    );
-
-    // If either lower or upper bound are null then unmatch all indexes
-    if (lower_bound == nullptr || upper_bound == nullptr) {
-        for (std::size_t index = 0; index < end_index - start_index; ++index) {
-            *(matches + items_index[index + start_index]) = false;
-        }
-        return;
-    }
-
-    const std::uint32_t lower_bound_index = lower_bound - &(items_index.begin() + start_index)[0];
-    const std::uint32_t upper_bound_index = upper_bound - &(items_index.begin() + start_index)[0] + 1;
-
-    // Unmatch anything before lower_bound
-    for (std::size_t index = 0; index < lower_bound_index; ++index) {
-        *(matches + items_index[index + start_index]) = false;
+    // Every other match lives in one contiguous slice of the sorted index
+    const T& query_value = std::get<T>(query.get_value());
+    switch(query.get_type()) {
+    case QueryType::EQUALS: {
+        const std::size_t lower_bound = index.lower_bound(query_value);
+        return {values.subspan(lower_bound, index.upper_bound(query_value) - lower_bound)};
     }
-
-    // Unmatch anything after upper_bound
-    for (std::size_t index = upper_bound_index; index < end_index - start_index; ++index) {
-        *(matches + items_index[index + start_index]) = false;
+    case QueryType::LESS_THAN:
+        return {values.first(index.lower_bound(query_value))};
+    case QueryType::GREATER_THAN:
+        return {values.subspan(index.upper_bound(query_value))};
+    case QueryType::CONTAINS:
+    default:
+        throw std::runtime_error("Unsupported QueryType for indexed field");
     }
 }
 
@@ -243,6 +119,8 @@ IndexedCollisions::IndexedCollisions(Collisions& collisions)
 {
     init_proxies();
     init_indexes();
+    init_dense_columns();
+    init_statistics();
 }
 
 IndexedCollisions::IndexedCollisions()
@@ -296,22 +174,6 @@ void IndexedCollisions::init_proxies() {
     }
 }
 
-template<class T>
-void init_index(T& vec_data, std::vector<uint32_t>& sorted_indexes) {
-    sorted_indexes = std::vector<uint32_t>(vec_data.size());
-    std::iota(sorted_indexes.begin(), sorted_indexes.end(), 0);
-    std::sort(sorted_indexes.begin(), sorted_indexes.end(), [&vec_data, &sorted_indexes](const uint32_t first, const uint32_t second) {
-        if (!vec_data[first].has_value() && !vec_data[second].has_value()) {
-            return false;
-        } else if (!vec_data[first].has_value()) {
-            return false;
-        } else if (!vec_data[second].has_value()) {
-            return true;
-        } else {
-            return vec_data[first].value() < vec_data[second].value();
-        }});
-}
-
 void IndexedCollisions::init_indexes() {
     #pragma omp parallel
     {
@@ -319,139 +181,152 @@ void IndexedCollisions::init_indexes() {
         {
             #pragma omp task
             {
-                init_index(collisions_.crash_dates, sorted_crash_dates);
+                sorted_crash_dates = SortedIndex(collisions_.crash_dates);
             }
             #pragma omp task
             {
-                init_index(collisions_.zip_codes, sorted_zip_codes);
+                sorted_zip_codes = SortedIndex(collisions_.zip_codes);
             }
             #pragma omp task
             {
-                init_index(collisions_.latitudes, sorted_latitudes);
+                sorted_latitudes = SortedIndex(collisions_.latitudes);
             }
             #pragma omp task
             {
-                init_index(collisions_.longitudes, sorted_longitudes);
+                sorted_longitudes = SortedIndex(collisions_.longitudes);
             }
             #pragma omp task
             {
-                init_index(collisions_.numbers_of_persons_injured, sorted_numbers_of_persons_injured);
+                sorted_numbers_of_persons_injured = SortedIndex(collisions_.numbers_of_persons_injured);
             }
             #pragma omp task
             {
-                init_index(collisions_.numbers_of_persons_killed, sorted_numbers_of_persons_killed);
+                sorted_numbers_of_persons_killed = SortedIndex(collisions_.numbers_of_persons_killed);
             }
             #pragma omp task
             {
-                init_index(collisions_.numbers_of_pedestrians_injured, sorted_numbers_of_pedestrians_injured);
+                sorted_numbers_of_pedestrians_injured = SortedIndex(collisions_.numbers_of_pedestrians_injured);
             }
             #pragma omp task
             {
-                init_index(collisions_.numbers_of_pedestrians_killed, sorted_numbers_of_pedestrians_killed);
+                sorted_numbers_of_pedestrians_killed = SortedIndex(collisions_.numbers_of_pedestrians_killed);
             }
             #pragma omp task
             {
-                init_index(collisions_.numbers_of_cyclist_injured, sorted_numbers_of_cyclist_injured);
+                sorted_numbers_of_cyclist_injured = SortedIndex(collisions_.numbers_of_cyclist_injured);
             }
             #pragma omp task
             {
-                init_index(collisions_.numbers_of_cyclist_killed, sorted_numbers_of_cyclist_killed);
+                sorted_numbers_of_cyclist_killed = SortedIndex(collisions_.numbers_of_cyclist_killed);
             }
             #pragma omp task
             {
-                init_index(collisions_.numbers_of_motorist_injured, sorted_numbers_of_motorist_injured);
+                sorted_numbers_of_motorist_injured = SortedIndex(collisions_.numbers_of_motorist_injured);
             }
             #pragma omp task
             {
-                init_index(collisions_.numbers_of_motorist_killed, sorted_numbers_of_motorist_killed);
+                sorted_numbers_of_motorist_killed = SortedIndex(collisions_.numbers_of_motorist_killed);
             }
             #pragma omp task
             {
-                init_index(collisions_.collision_ids, sorted_collision_ids);
+                sorted_collision_ids = SortedIndex(collisions_.collision_ids);
             }
         }
     }
 
 // TODO: support crash_times (requires converting all entries to durations for sorting comparisons to work)
-//    init_index(collisions_.crash_times, sorted_crash_times);
+//    sorted_crash_times = SortedIndex(collisions_.crash_times);
+}
+
+void IndexedCollisions::init_dense_columns() {
+    dense_zip_codes = DenseColumn(collisions_.zip_codes);
+    dense_latitudes = DenseColumn(collisions_.latitudes);
+    dense_longitudes = DenseColumn(collisions_.longitudes);
+    dense_numbers_of_persons_injured = DenseColumn(collisions_.numbers_of_persons_injured);
+    dense_numbers_of_persons_killed = DenseColumn(collisions_.numbers_of_persons_killed);
+    dense_numbers_of_pedestrians_injured = DenseColumn(collisions_.numbers_of_pedestrians_injured);
+    dense_numbers_of_pedestrians_killed = DenseColumn(collisions_.numbers_of_pedestrians_killed);
+    dense_numbers_of_cyclist_injured = DenseColumn(collisions_.numbers_of_cyclist_injured);
+    dense_numbers_of_cyclist_killed = DenseColumn(collisions_.numbers_of_cyclist_killed);
+    dense_numbers_of_motorist_injured = DenseColumn(collisions_.numbers_of_motorist_injured);
+    dense_numbers_of_motorist_killed = DenseColumn(collisions_.numbers_of_motorist_killed);
+    dense_collision_ids = DenseColumn(collisions_.collision_ids);
+}
+
+void IndexedCollisions::init_statistics() {
+    for (std::size_t field = 0; field < static_cast<std::size_t>(CollisionField::UNDEFINED); ++field) {
+        const CollisionField name = static_cast<CollisionField>(field);
+        visit_column(name, [this, &name](const auto& items, const auto&) {
+            statistics_.set(analyze_column(name, items));
+        });
+    }
+}
+
+void IndexedCollisions::append(const Collisions& collisions) {
+    collisions_.combine(collisions);
+
+    init_proxies();
+    init_indexes();
+    init_dense_columns();
+    init_statistics();
+}
+
+std::optional<IndexSlices> IndexedCollisions::match_index(const FieldQuery& query) const {
+    // An inverted match is the complement of the slices, which is not contiguous in the index
+    if (query.invert_match()) {
+        return std::nullopt;
+    }
+
+    return visit_column(query.get_name(), [&query](const auto& items, const auto& items_index)
+                                              -> std::optional<IndexSlices> {
+        if constexpr (std::is_same_v<std::decay_t<decltype(items_index)>, std::nullptr_t>) {
+            return std::nullopt;
+        } else {
+            return match_indexed_field(query, items_index);
+        }
+    });
+}
+
+std::size_t IndexedCollisions::match_rows(const FieldQuery& query,
+                                          std::span<std::uint32_t> row_ids,
+                                          const FieldQuery* upper_query) const {
+    return visit_column(query.get_name(), [&query, &row_ids, upper_query](const auto& items, const auto&) -> std::size_t {
+        using T = typename std::decay_t<decltype(items)>::value_type::value_type;
+        const std::size_t num_matches = BoundPredicate<T>(query).match_rows(items, row_ids);
+        if (upper_query == nullptr) {
+            return num_matches;
+        }
+        return BoundPredicate<T>(*upper_query).match_rows(items, row_ids.first(num_matches));
+    });
 }
 
 void IndexedCollisions::match(const FieldQuery& query,
                        const std::size_t start_index,
                        const std::size_t end_index,
-                       std::span<std::uint8_t> matches) const {
-    const CollisionField& name = query.get_name();
-
-    std::span<std::uint8_t> matches_span;
-    if (is_indexed_field(name)) {
-        // Send whole matches vector to match function
-        // because the indexes can reference anywhere in the global collisions
-        matches_span = matches;
-    } else {
-        // Send subset of matches vector to match function
-        // because the indexes operated on will be inside the chunk only
-        matches_span = {matches.data() + start_index, end_index - start_index};
-    }
-
-    if (name == CollisionField::CRASH_DATE) {
-        match_indexed_field(query, start_index, end_index, collisions_.crash_dates, sorted_crash_dates, matches_span);
-    } else if (name == CollisionField::CRASH_TIME) {
-        match_field(query, start_index, end_index, collisions_.crash_times, matches_span);
-    } else if (name == CollisionField::BOROUGH) {
-        match_field(query, start_index, end_index, collisions_.boroughs, matches_span);
-    } else if (name == CollisionField::ZIP_CODE) {
-        match_indexed_field(query, start_index, end_index, collisions_.zip_codes, sorted_zip_codes, matches_span);
-    } else if (name == CollisionField::LATITUDE) {
-        match_indexed_field(query, start_index, end_index, collisions_.latitudes, sorted_latitudes, matches_span);
-    } else if (name == CollisionField::LONGITUDE) {
-        match_indexed_field(query, start_index, end_index, collisions_.longitudes, sorted_longitudes, matches_span);
-    } else if (name == CollisionField::LOCATION) {
-        match_field(query, start_index, end_index, collisions_.locations, matches_span);
-    } else if (name == CollisionField::ON_STREET_NAME) {
-        match_field(query, start_index, end_index, collisions_.on_street_names, matches_span);
-    } else if (name == CollisionField::CROSS_STREET_NAME) {
-        match_field(query, start_index, end_index, collisions_.cross_street_names, matches_span);
-    } else if (name == CollisionField::OFF_STREET_NAME) {
-        match_field(query, start_index, end_index, collisions_.off_street_names, matches_span);
-    } else if (name == CollisionField::NUMBER_OF_PERSONS_INJURED) {
-        match_indexed_field(query, start_index, end_index, collisions_.numbers_of_persons_injured, sorted_numbers_of_persons_injured, matches_span);
-    } else if (name == CollisionField::NUMBER_OF_PERSONS_KILLED) {
-        match_indexed_field(query, start_index, end_index, collisions_.numbers_of_persons_killed, sorted_numbers_of_persons_killed, matches_span);
-    } else if (name == CollisionField::NUMBER_OF_PEDESTRIANS_INJURED) {
-        match_indexed_field(query, start_index, end_index, collisions_.numbers_of_pedestrians_injured, sorted_numbers_of_pedestrians_injured, matches_span);
-    } else if (name == CollisionField::NUMBER_OF_PEDESTRIANS_KILLED) {
-        match_indexed_field(query, start_index, end_index, collisions_.numbers_of_pedestrians_killed, sorted_numbers_of_pedestrians_killed, matches_span);
-    } else if (name == CollisionField::NUMBER_OF_CYCLIST_INJURED) {
-        match_indexed_field(query, start_index, end_index, collisions_.numbers_of_cyclist_injured, sorted_numbers_of_cyclist_injured, matches_span);
-    } else if (name == CollisionField::NUMBER_OF_CYCLIST_KILLED) {
-        match_indexed_field(query, start_index, end_index, collisions_.numbers_of_cyclist_killed, sorted_numbers_of_cyclist_killed, matches_span);
-    } else if (name == CollisionField::NUMBER_OF_MOTORIST_INJURED) {
-        match_indexed_field(query, start_index, end_index, collisions_.numbers_of_motorist_injured, sorted_numbers_of_motorist_injured, matches_span);
-    } else if (name == CollisionField::NUMBER_OF_MOTORIST_KILLED) {
-        match_indexed_field(query, start_index, end_index, collisions_.numbers_of_motorist_killed, sorted_numbers_of_motorist_killed, matches_span);
-    } else if (name == CollisionField::CONTRIBUTING_FACTOR_VEHICLE_1) {
-        match_field(query, start_index, end_index, collisions_.contributing_factor_vehicles_1, matches_span);
-    } else if (name == CollisionField::CONTRIBUTING_FACTOR_VEHICLE_2) {
-        match_field(query, start_index, end_index, collisions_.contributing_factor_vehicles_2, matches_span);
-    } else if (name == CollisionField::CONTRIBUTING_FACTOR_VEHICLE_3) {
-        match_field(query, start_index, end_index, collisions_.contributing_factor_vehicles_3, matches_span);
-    } else if (name == CollisionField::CONTRIBUTING_FACTOR_VEHICLE_4) {
-        match_field(query, start_index, end_index, collisions_.contributing_factor_vehicles_4, matches_span);
-    } else if (name == CollisionField::CONTRIBUTING_FACTOR_VEHICLE_5) {
-        match_field(query, start_index, end_index, collisions_.contributing_factor_vehicles_5, matches_span);
-    } else if (name == CollisionField::COLLISION_ID) {
-        match_indexed_field(query, start_index, end_index, collisions_.collision_ids, sorted_collision_ids, matches_span);
-    } else if (name == CollisionField::VEHICLE_TYPE_CODE_1) {
-        match_field(query, start_index, end_index, collisions_.vehicle_type_codes_1, matches_span);
-    } else if (name == CollisionField::VEHICLE_TYPE_CODE_2) {
-        match_field(query, start_index, end_index, collisions_.vehicle_type_codes_2, matches_span);
-    } else if (name == CollisionField::VEHICLE_TYPE_CODE_3) {
-        match_field(query, start_index, end_index, collisions_.vehicle_type_codes_3, matches_span);
-    } else if (name == CollisionField::VEHICLE_TYPE_CODE_4) {
-        match_field(query, start_index, end_index, collisions_.vehicle_type_codes_4, matches_span);
-    } else if (name == CollisionField::VEHICLE_TYPE_CODE_5) {
-        match_field(query, start_index, end_index, collisions_.vehicle_type_codes_5, matches_span);
+                       std::span<std::uint64_t> matches,
+                       const FieldQuery* upper_query) const {
+    // Only operate on the words of the matches that belong to this range of rows
+    const std::size_t start_word = start_index / ROWS_PER_MATCH_WORD;
+    const std::size_t end_word = match_words(end_index);
+
+    const bool matched = visit_dense_column(query.get_name(), [&](const auto& column) {
+        if constexpr (std::is_same_v<std::decay_t<decltype(column)>, std::nullptr_t>) {
+            return false;
+        } else {
+            return match_dense_field(query, upper_query, column, start_word, end_word, matches);
+        }
+    });
+    if (matched) {
+        return;
     }
+
+    visit_column(query.get_name(), [&](const auto& items, const auto&) {
+        using T = typename std::decay_t<decltype(items)>::value_type::value_type;
+        BoundPredicate<T>(query).match_words(items, start_word, end_word, matches.data());
+        if (upper_query != nullptr) {
+            BoundPredicate<T>(*upper_query).match_words(items, start_word, end_word, matches.data());
+        }
+    });
 }
 
 std::ostream& operator<<(std::ostream& os, const CollisionProxy& collision) {
@@ -588,7 +463,7 @@ void Collisions::combine(const Collisions& other) {
     size_ = crash_dates.size();
 }
 
-std::size_t Collisions::size() {
+std::size_t Collisions::size() const {
     return size_;
 }
 
@@ -625,3 +500,99 @@ Collision collision_proxy_to_collision(const CollisionProxy& proxy) {
     collision.vehicle_type_code_5 = *proxy.vehicle_type_code_5;
     return collision;
 }
+
+Collision collision_proxy_to_collision(const CollisionProxy& proxy, const FieldMask& fields) {
+    if (fields.all()) {
+        return collision_proxy_to_collision(proxy);
+    }
+
+    Collision collision{};
+    if (fields.test(static_cast<std::size_t>(CollisionField::CRASH_DATE))) {
+        collision.crash_date = *proxy.crash_date;
+    }
+    if (fields.test(static_cast<std::size_t>(CollisionField::CRASH_TIME))) {
+        collision.crash_time = *proxy.crash_time;
+    }
+    if (fields.test(static_cast<std::size_t>(CollisionField::BOROUGH))) {
+        collision.borough = *proxy.borough;
+    }
+    if (fields.test(static_cast<std::size_t>(CollisionField::ZIP_CODE))) {
+        collision.zip_code = *proxy.zip_code;
+    }
+    if (fields.test(static_cast<std::size_t>(CollisionField::LATITUDE))) {
+        collision.latitude = *proxy.latitude;
+    }
+    if (fields.test(static_cast<std::size_t>(CollisionField::LONGITUDE))) {
+        collision.longitude = *proxy.longitude;
+    }
+    if (fields.test(static_cast<std::size_t>(CollisionField::LOCATION))) {
+        collision.location = *proxy.location;
+    }
+    if (fields.test(static_cast<std::size_t>(CollisionField::ON_STREET_NAME))) {
+        collision.on_street_name = *proxy.on_street_name;
+    }
+    if (fields.test(static_cast<std::size_t>(CollisionField::CROSS_STREET_NAME))) {
+        collision.cross_street_name = *proxy.cross_street_name;
+    }
+    if (fields.test(static_cast<std::size_t>(CollisionField::OFF_STREET_NAME))) {
+        collision.off_street_name = *proxy.off_street_name;
+    }
+    if (fields.test(static_cast<std::size_t>(CollisionField::NUMBER_OF_PERSONS_INJURED))) {
+        collision.number_of_persons_injured = *proxy.number_of_persons_injured;
+    }
+    if (fields.test(static_cast<std::size_t>(CollisionField::NUMBER_OF_PERSONS_KILLED))) {
+        collision.number_of_persons_killed = *proxy.number_of_persons_killed;
+    }
+    if (fields.test(static_cast<std::size_t>(CollisionField::NUMBER_OF_PEDESTRIANS_INJURED))) {
+        collision.number_of_pedestrians_injured = *proxy.number_of_pedestrians_injured;
+    }
+    if (fields.test(static_cast<std::size_t>(CollisionField::NUMBER_OF_PEDESTRIANS_KILLED))) {
+        collision.number_of_pedestrians_killed = *proxy.number_of_pedestrians_killed;
+    }
+    if (fields.test(static_cast<std::size_t>(CollisionField::NUMBER_OF_CYCLIST_INJURED))) {
+        collision.number_of_cyclist_injured = *proxy.number_of_cyclist_injured;
+    }
+    if (fields.test(static_cast<std::size_t>(CollisionField::NUMBER_OF_CYCLIST_KILLED))) {
+        collision.number_of_cyclist_killed = *proxy.number_of_cyclist_killed;
+    }
+    if (fields.test(static_cast<std::size_t>(CollisionField::NUMBER_OF_MOTORIST_INJURED))) {
+        collision.number_of_motorist_injured = *proxy.number_of_motorist_injured;
+    }
+    if (fields.test(static_cast<std::size_t>(CollisionField::NUMBER_OF_MOTORIST_KILLED))) {
+        collision.number_of_motorist_killed = *proxy.number_of_motorist_killed;
+    }
+    if (fields.test(static_cast<std::size_t>(CollisionField::CONTRIBUTING_FACTOR_VEHICLE_1))) {
+        collision.contributing_factor_vehicle_1 = *proxy.contributing_factor_vehicle_1;
+    }
+    if (fields.test(static_cast<std::size_t>(CollisionField::CONTRIBUTING_FACTOR_VEHICLE_2))) {
+        collision.contributing_factor_vehicle_2 = *proxy.contributing_factor_vehicle_2;
+    }
+    if (fields.test(static_cast<std::size_t>(CollisionField::CONTRIBUTING_FACTOR_VEHICLE_3))) {
+        collision.contributing_factor_vehicle_3 = *proxy.contributing_factor_vehicle_3;
+    }
+    if (fields.test(static_cast<std::size_t>(CollisionField::CONTRIBUTING_FACTOR_VEHICLE_4))) {
+        collision.contributing_factor_vehicle_4 = *proxy.contributing_factor_vehicle_4;
+    }
+    if (fields.test(static_cast<std::size_t>(CollisionField::CONTRIBUTING_FACTOR_VEHICLE_5))) {
+        collision.contributing_factor_vehicle_5 = *proxy.contributing_factor_vehicle_5;
+    }
+    if (fields.test(static_cast<std::size_t>(CollisionField::COLLISION_ID))) {
+        collision.collision_id = *proxy.collision_id;
+    }
+    if (fields.test(static_cast<std::size_t>(CollisionField::VEHICLE_TYPE_CODE_1))) {
+        collision.vehicle_type_code_1 = *proxy.vehicle_type_code_1;
+    }
+    if (fields.test(static_cast<std::size_t>(CollisionField::VEHICLE_TYPE_CODE_2))) {
+        collision.vehicle_type_code_2 = *proxy.vehicle_type_code_2;
+    }
+    if (fields.test(static_cast<std::size_t>(CollisionField::VEHICLE_TYPE_CODE_3))) {
+        collision.vehicle_type_code_3 = *proxy.vehicle_type_code_3;
+    }
+    if (fields.test(static_cast<std::size_t>(CollisionField::VEHICLE_TYPE_CODE_4))) {
+        collision.vehicle_type_code_4 = *proxy.vehicle_type_code_4;
+    }
+    if (fields.test(static_cast<std::size_t>(CollisionField::VEHICLE_TYPE_CODE_5))) {
+        collision.vehicle_type_code_5 = *proxy.vehicle_type_code_5;
+    }
+    return collision;
+}
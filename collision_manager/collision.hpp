@@ -1,13 +1,18 @@
 #pragma once
 
+#include "collision_statistics.hpp"
+#include "column_kernels.hpp"
 #include "fixed_string.hpp"
 #include "query.hpp"
+#include "sorted_index.hpp"
 
 #include <chrono>
 #include <iostream>
 #include <format>
 #include <optional>
+#include <span>
 #include <string>
+#include <vector>
 
 
 struct Collision {
@@ -107,7 +112,7 @@ struct Collisions {
 
     void add(const Collision& collision);
     void combine(const Collisions& other);
-    std::size_t size();
+    std::size_t size() const;
 
 private:
     std::size_t size_;
@@ -126,31 +131,246 @@ public:
     std::vector<CollisionProxy*> proxy_ptrs_;
 
     // Sorted indexes by various fields for fast queries
-    std::vector<std::uint32_t> sorted_crash_dates;
-    std::vector<std::uint32_t> sorted_crash_times;
-    std::vector<std::uint32_t> sorted_zip_codes;
-    std::vector<std::uint32_t> sorted_latitudes;
-    std::vector<std::uint32_t> sorted_longitudes;
-    std::vector<std::uint32_t> sorted_numbers_of_persons_injured;
-    std::vector<std::uint32_t> sorted_numbers_of_persons_killed;
-    std::vector<std::uint32_t> sorted_numbers_of_pedestrians_injured;
-    std::vector<std::uint32_t> sorted_numbers_of_pedestrians_killed;
-    std::vector<std::uint32_t> sorted_numbers_of_cyclist_injured;
-    std::vector<std::uint32_t> sorted_numbers_of_cyclist_killed;
-    std::vector<std::uint32_t> sorted_numbers_of_motorist_injured;
-    std::vector<std::uint32_t> sorted_numbers_of_motorist_killed;
-    std::vector<std::uint32_t> sorted_collision_ids;
+    SortedIndex<std::chrono::year_month_day> sorted_crash_dates;
+    SortedIndex<std::uint32_t> sorted_zip_codes;
+    SortedIndex<float> sorted_latitudes;
+    SortedIndex<float> sorted_longitudes;
+    SortedIndex<std::uint8_t> sorted_numbers_of_persons_injured;
+    SortedIndex<std::uint8_t> sorted_numbers_of_persons_killed;
+    SortedIndex<std::uint8_t> sorted_numbers_of_pedestrians_injured;
+    SortedIndex<std::uint8_t> sorted_numbers_of_pedestrians_killed;
+    SortedIndex<std::uint8_t> sorted_numbers_of_cyclist_injured;
+    SortedIndex<std::uint8_t> sorted_numbers_of_cyclist_killed;
+    SortedIndex<std::uint8_t> sorted_numbers_of_motorist_injured;
+    SortedIndex<std::uint8_t> sorted_numbers_of_motorist_killed;
+    SortedIndex<std::size_t> sorted_collision_ids;
 
+    // Copies of the numeric columns without std::optional, for scanning them with SIMD kernels
+    DenseColumn<std::uint32_t> dense_zip_codes;
+    DenseColumn<float> dense_latitudes;
+    DenseColumn<float> dense_longitudes;
+    DenseColumn<std::uint8_t> dense_numbers_of_persons_injured;
+    DenseColumn<std::uint8_t> dense_numbers_of_persons_killed;
+    DenseColumn<std::uint8_t> dense_numbers_of_pedestrians_injured;
+    DenseColumn<std::uint8_t> dense_numbers_of_pedestrians_killed;
+    DenseColumn<std::uint8_t> dense_numbers_of_cyclist_injured;
+    DenseColumn<std::uint8_t> dense_numbers_of_cyclist_killed;
+    DenseColumn<std::uint8_t> dense_numbers_of_motorist_injured;
+    DenseColumn<std::uint8_t> dense_numbers_of_motorist_killed;
+    DenseColumn<std::size_t> dense_collision_ids;
+
+    // Per column statistics, refreshed whenever rows are added
+    CollisionStatistics statistics_;
+
+    // Adds rows and rebuilds the proxies, indexes and statistics over the combined data
+    void append(const Collisions& collisions);
+
+    // Clears the bits in matches of the rows in [start_index, end_index) that do not match query.
+    // matches holds one bit per row, see match_words(), and start_index must be a multiple of
+    // ROWS_PER_MATCH_WORD. When upper_query is set, rows must also match it, a GREATER_THAN query
+    // and a LESS_THAN upper_query on a numeric column are checked together as one BETWEEN.
     void match(const FieldQuery& query,
                const std::size_t start_index,
                const std::size_t end_index,
-               std::span<std::uint8_t> matches) const;
+               std::span<std::uint64_t> matches,
+               const FieldQuery* upper_query = nullptr) const;
+
+    // Returns the slices of the sorted index holding exactly the rows that match query, a single
+    // slice unless query is an IN, or std::nullopt if query cannot be answered from an index
+    std::optional<IndexSlices> match_index(const FieldQuery& query) const;
+
+    // Moves the rows in row_ids that match query, and upper_query if set, to the front,
+    // keeping their order, and returns how many there are
+    std::size_t match_rows(const FieldQuery& query,
+                           std::span<std::uint32_t> row_ids,
+                           const FieldQuery* upper_query = nullptr) const;
+
+    // Calls func(column, sorted_index) with the column backing name.
+    // sorted_index is nullptr for fields that are not indexed.
+    template<class Func>
+    decltype(auto) visit_column(const CollisionField& name, Func&& func) const;
+
+    // Calls func(dense_column) with the dense copy of name, or with nullptr for fields
+    // that have none
+    template<class Func>
+    decltype(auto) visit_dense_column(const CollisionField& name, Func&& func) const;
 
 private:
     void init_proxies();
     void init_indexes();
+    void init_dense_columns();
+    void init_statistics();
     const CollisionProxy index_to_collision(const std::size_t index);
 };
 
+template<class Func>
+decltype(auto) IndexedCollisions::visit_column(const CollisionField& name, Func&& func) const {
+    switch(name) {
+    case CollisionField::CRASH_DATE:
+        return func(collisions_.crash_dates, sorted_crash_dates);
+    case CollisionField::CRASH_TIME:
+        return func(collisions_.crash_times, nullptr);
+    case CollisionField::BOROUGH:
+        return func(collisions_.boroughs, nullptr);
+    case CollisionField::ZIP_CODE:
+        return func(collisions_.zip_codes, sorted_zip_codes);
+    case CollisionField::LATITUDE:
+        return func(collisions_.latitudes, sorted_latitudes);
+    case CollisionField::LONGITUDE:
+        return func(collisions_.longitudes, sorted_longitudes);
+    case CollisionField::LOCATION:
+        return func(collisions_.locations, nullptr);
+    case CollisionField::ON_STREET_NAME:
+        return func(collisions_.on_street_names, nullptr);
+    case CollisionField::CROSS_STREET_NAME:
+        return func(collisions_.cross_street_names, nullptr);
+    case CollisionField::OFF_STREET_NAME:
+        return func(collisions_.off_street_names, nullptr);
+    case CollisionField::NUMBER_OF_PERSONS_INJURED:
+        return func(collisions_.numbers_of_persons_injured, sorted_numbers_of_persons_injured);
+    case CollisionField::NUMBER_OF_PERSONS_KILLED:
+        return func(collisions_.numbers_of_persons_killed, sorted_numbers_of_persons_killed);
+    case CollisionField::NUMBER_OF_PEDESTRIANS_INJURED:
+        return func(collisions_.numbers_of_pedestrians_injured, sorted_numbers_of_pedestrians_injured);
+    case CollisionField::NUMBER_OF_PEDESTRIANS_KILLED:
+        return func(collisions_.numbers_of_pedestrians_killed, sorted_numbers_of_pedestrians_killed);
+    case CollisionField::NUMBER_OF_CYCLIST_INJURED:
+        return func(collisions_.numbers_of_cyclist_injured, sorted_numbers_of_cyclist_injured);
+    case CollisionField::NUMBER_OF_CYCLIST_KILLED:
+        return func(collisions_.numbers_of_cyclist_killed, sorted_numbers_of_cyclist_killed);
+    case CollisionField::NUMBER_OF_MOTORIST_INJURED:
+        return func(collisions_.numbers_of_motorist_injured, sorted_numbers_of_motorist_injured);
+    case CollisionField::NUMBER_OF_MOTORIST_KILLED:
+        return func(collisions_.numbers_of_motorist_killed, sorted_numbers_of_motorist_killed);
+    case CollisionField::CONTRIBUTING_FACTOR_VEHICLE_1:
+        return func(collisions_.contributing_factor_vehicles_1, nullptr);
+    case CollisionField::CONTRIBUTING_FACTOR_VEHICLE_2:
+        return func(collisions_.contributing_factor_vehicles_2, nullptr);
+    case CollisionField::CONTRIBUTING_FACTOR_VEHICLE_3:
+        return func(collisions_.contributing_factor_vehicles_3, nullptr);
+    case CollisionField::CONTRIBUTING_FACTOR_VEHICLE_4:
+        return func(collisions_.contributing_factor_vehicles_4, nullptr);
+    case CollisionField::CONTRIBUTING_FACTOR_VEHICLE_5:
+        return func(collisions_.contributing_factor_vehicles_5, nullptr);
+    case CollisionField::COLLISION_ID:
+        return func(collisions_.collision_ids, sorted_collision_ids);
+    case CollisionField::VEHICLE_TYPE_CODE_1:
+        return func(collisions_.vehicle_type_codes_1, nullptr);
+    case CollisionField::VEHICLE_TYPE_CODE_2:
+        return func(collisions_.vehicle_type_codes_2, nullptr);
+    case CollisionField::VEHICLE_TYPE_CODE_3:
+        return func(collisions_.vehicle_type_codes_3, nullptr);
+    case CollisionField::VEHICLE_TYPE_CODE_4:
+        return func(collisions_.vehicle_type_codes_4, nullptr);
+    case CollisionField::VEHICLE_TYPE_CODE_5:
+        return func(collisions_.vehicle_type_codes_5, nullptr);
+    case CollisionField::UNDEFINED:
+    default:
+        throw std::runtime_error("Unknown CollisionField was provided!");
+    }
+}
+
+template<class Func>
+decltype(auto) IndexedCollisions::visit_dense_column(const CollisionField& name, Func&& func) const {
+    switch(name) {
+    case CollisionField::ZIP_CODE:
+        return func(dense_zip_codes);
+    case CollisionField::LATITUDE:
+        return func(dense_latitudes);
+    case CollisionField::LONGITUDE:
+        return func(dense_longitudes);
+    case CollisionField::NUMBER_OF_PERSONS_INJURED:
+        return func(dense_numbers_of_persons_injured);
+    case CollisionField::NUMBER_OF_PERSONS_KILLED:
+        return func(dense_numbers_of_persons_killed);
+    case CollisionField::NUMBER_OF_PEDESTRIANS_INJURED:
+        return func(dense_numbers_of_pedestrians_injured);
+    case CollisionField::NUMBER_OF_PEDESTRIANS_KILLED:
+        return func(dense_numbers_of_pedestrians_killed);
+    case CollisionField::NUMBER_OF_CYCLIST_INJURED:
+        return func(dense_numbers_of_cyclist_injured);
+    case CollisionField::NUMBER_OF_CYCLIST_KILLED:
+        return func(dense_numbers_of_cyclist_killed);
+    case CollisionField::NUMBER_OF_MOTORIST_INJURED:
+        return func(dense_numbers_of_motorist_injured);
+    case CollisionField::NUMBER_OF_MOTORIST_KILLED:
+        return func(dense_numbers_of_motorist_killed);
+    case CollisionField::COLLISION_ID:
+        return func(dense_collision_ids);
+    default:
+        return func(nullptr);
+    }
+}
+
+// Calls func(member) with the pointer to the member of Collision backing name
+template<class Func>
+decltype(auto) visit_collision_member(const CollisionField& name, Func&& func) {
+    switch(name) {
+    case CollisionField::CRASH_DATE:
+        return func(&Collision::crash_date);
+    case CollisionField::CRASH_TIME:
+        return func(&Collision::crash_time);
+    case CollisionField::BOROUGH:
+        return func(&Collision::borough);
+    case CollisionField::ZIP_CODE:
+        return func(&Collision::zip_code);
+    case CollisionField::LATITUDE:
+        return func(&Collision::latitude);
+    case CollisionField::LONGITUDE:
+        return func(&Collision::longitude);
+    case CollisionField::LOCATION:
+        return func(&Collision::location);
+    case CollisionField::ON_STREET_NAME:
+        return func(&Collision::on_street_name);
+    case CollisionField::CROSS_STREET_NAME:
+        return func(&Collision::cross_street_name);
+    case CollisionField::OFF_STREET_NAME:
+        return func(&Collision::off_street_name);
+    case CollisionField::NUMBER_OF_PERSONS_INJURED:
+        return func(&Collision::number_of_persons_injured);
+    case CollisionField::NUMBER_OF_PERSONS_KILLED:
+        return func(&Collision::number_of_persons_killed);
+    case CollisionField::NUMBER_OF_PEDESTRIANS_INJURED:
+        return func(&Collision::number_of_pedestrians_injured);
+    case CollisionField::NUMBER_OF_PEDESTRIANS_KILLED:
+        return func(&Collision::number_of_pedestrians_killed);
+    case CollisionField::NUMBER_OF_CYCLIST_INJURED:
+        return func(&Collision::number_of_cyclist_injured);
+    case CollisionField::NUMBER_OF_CYCLIST_KILLED:
+        return func(&Collision::number_of_cyclist_killed);
+    case CollisionField::NUMBER_OF_MOTORIST_INJURED:
+        return func(&Collision::number_of_motorist_injured);
+    case CollisionField::NUMBER_OF_MOTORIST_KILLED:
+        return func(&Collision::number_of_motorist_killed);
+    case CollisionField::CONTRIBUTING_FACTOR_VEHICLE_1:
+        return func(&Collision::contributing_factor_vehicle_1);
+    case CollisionField::CONTRIBUTING_FACTOR_VEHICLE_2:
+        return func(&Collision::contributing_factor_vehicle_2);
+    case CollisionField::CONTRIBUTING_FACTOR_VEHICLE_3:
+        return func(&Collision::contributing_factor_vehicle_3);
+    case CollisionField::CONTRIBUTING_FACTOR_VEHICLE_4:
+        return func(&Collision::contributing_factor_vehicle_4);
+    case CollisionField::CONTRIBUTING_FACTOR_VEHICLE_5:
+        return func(&Collision::contributing_factor_vehicle_5);
+    case CollisionField::COLLISION_ID:
+        return func(&Collision::collision_id);
+    case CollisionField::VEHICLE_TYPE_CODE_1:
+        return func(&Collision::vehicle_type_code_1);
+    case CollisionField::VEHICLE_TYPE_CODE_2:
+        return func(&Collision::vehicle_type_code_2);
+    case CollisionField::VEHICLE_TYPE_CODE_3:
+        return func(&Collision::vehicle_type_code_3);
+    case CollisionField::VEHICLE_TYPE_CODE_4:
+        return func(&Collision::vehicle_type_code_4);
+    case CollisionField::VEHICLE_TYPE_CODE_5:
+        return func(&Collision::vehicle_type_code_5);
+    case CollisionField::UNDEFINED:
+    default:
+        throw std::runtime_error("Unknown CollisionField was provided!");
+    }
+}
+
 Collision collision_proxy_to_collision(const CollisionProxy& proxy);
+// Copies only the fields in fields, the others are left unset
+Collision collision_proxy_to_collision(const CollisionProxy& proxy, const FieldMask& fields);
 std::ostream& operator<<(std::ostream& os, const CollisionProxy& collision);
@@ -0,0 +1,196 @@
+#include "collision_aggregate.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <format>
+#include <stdexcept>
+#include <type_traits>
+
+void AggregateValue::add(const double value) {
+    ++count;
+    sum += value;
+    min = std::min(min.value_or(value), value);
+    max = std::max(max.value_or(value), value);
+}
+
+void AggregateValue::merge(const AggregateValue& other) {
+    count += other.count;
+    sum += other.sum;
+    if (other.min.has_value()) {
+        min = std::min(min.value_or(*other.min), *other.min);
+    }
+    if (other.max.has_value()) {
+        max = std::max(max.value_or(*other.max), *other.max);
+    }
+}
+
+std::optional<double> AggregateValue::result(const AggregateFunction function) const {
+    switch (function) {
+        case AggregateFunction::COUNT:
+            return static_cast<double>(count);
+        case AggregateFunction::SUM:
+            return count > 0 ? std::optional(sum) : std::nullopt;
+        case AggregateFunction::MIN:
+            return min;
+        case AggregateFunction::MAX:
+            return max;
+        default:
+            throw std::runtime_error("Unknown AggregateFunction was provided!");
+    }
+}
+
+void AggregateTable::merge(const AggregateTable& other) {
+    for (const auto& [key, values] : other.groups) {
+        auto [it, inserted] = groups.try_emplace(key, values);
+        if (!inserted) {
+            for (std::size_t index = 0; index < values.size(); ++index) {
+                it->second[index].merge(values[index]);
+            }
+        }
+    }
+}
+
+namespace {
+
+template<class T>
+auto group_value(const T& value, const DateBucket bucket) {
+    if constexpr (std::is_same_v<T, std::chrono::year_month_day>) {
+        switch (bucket) {
+            case DateBucket::MONTH:
+                return static_cast<std::int64_t>(static_cast<int>(value.year()) * 12 + static_cast<unsigned>(value.month()) - 1);
+            case DateBucket::YEAR:
+                return static_cast<std::int64_t>(static_cast<int>(value.year()));
+            default:
+                return static_cast<std::int64_t>(std::chrono::sys_days{value}.time_since_epoch().count());
+        }
+    } else if constexpr (std::is_same_v<T, std::chrono::hh_mm_ss<std::chrono::minutes>>) {
+        return static_cast<std::int64_t>(std::chrono::duration_cast<std::chrono::minutes>(value.to_duration()).count());
+    } else if constexpr (std::is_same_v<T, CollisionString>) {
+        return std::string_view(value.data, value.length);
+    } else if constexpr (std::is_floating_point_v<T>) {
+        return static_cast<double>(value);
+    } else {
+        return static_cast<std::int64_t>(value);
+    }
+}
+
+std::string format_date_group(const std::int64_t value, const DateBucket bucket) {
+    switch (bucket) {
+        case DateBucket::MONTH:
+            return std::format("{:04}-{:02}", value / 12, value % 12 + 1);
+        case DateBucket::YEAR:
+            return std::format("{:04}", value);
+        default: {
+            const std::chrono::year_month_day date{std::chrono::sys_days{std::chrono::days{value}}};
+            return std::format("{:04}-{:02}-{:02}", static_cast<int>(date.year()),
+                               static_cast<unsigned>(date.month()), static_cast<unsigned>(date.day()));
+        }
+    }
+}
+
+}
+
+AggregateBuilder::AggregateBuilder(const IndexedCollisions& indexed_collisions, const Aggregation& aggregation)
+  : aggregation_{aggregation}
+{
+    if (aggregation_.group_by.size() > MAX_GROUP_BY_FIELDS) {
+        throw std::invalid_argument("Too many group_by fields provided for aggregation!");
+    }
+
+    for (const GroupByField& group_by : aggregation_.group_by) {
+        indexed_collisions.visit_column(group_by.field, [this, &group_by](const auto& items, const auto&) {
+            using T = typename std::decay_t<decltype(items)>::value_type::value_type;
+            group_values_.push_back([&items, bucket = group_by.bucket](const std::uint32_t row) -> GroupValue {
+                const std::optional<T>& item = items[row];
+                if (!item.has_value()) {
+                    return std::monostate{};
+                }
+                return group_value(*item, bucket);
+            });
+        });
+    }
+
+    for (const AggregateSpec& spec : aggregation_.aggregates) {
+        if (spec.field == CollisionField::UNDEFINED) {
+            accumulators_.push_back([](const std::uint32_t, AggregateValue& value) {
+                ++value.count;
+            });
+            continue;
+        }
+
+        indexed_collisions.visit_column(spec.field, [this, &spec](const auto& items, const auto&) {
+            using T = typename std::decay_t<decltype(items)>::value_type::value_type;
+            if constexpr (std::is_arithmetic_v<T>) {
+                if (spec.function != AggregateFunction::COUNT) {
+                    accumulators_.push_back([&items](const std::uint32_t row, AggregateValue& value) {
+                        if (items[row].has_value()) {
+                            value.add(static_cast<double>(*items[row]));
+                        }
+                    });
+                    return;
+                }
+            }
+            accumulators_.push_back([&items](const std::uint32_t row, AggregateValue& value) {
+                if (items[row].has_value()) {
+                    ++value.count;
+                }
+            });
+        });
+    }
+}
+
+std::size_t AggregateBuilder::GroupValuesHash::operator()(const GroupValues& values) const {
+    std::size_t hash = 0;
+    for (const GroupValue& value : values) {
+        hash = hash * 31 + std::hash<GroupValue>{}(value);
+    }
+    return hash;
+}
+
+void AggregateBuilder::add_row(const std::uint32_t row) {
+    GroupValues key{};
+    for (std::size_t index = 0; index < group_values_.size(); ++index) {
+        key[index] = group_values_[index](row);
+    }
+
+    auto [it, inserted] = groups_.try_emplace(key);
+    if (inserted) {
+        it->second.resize(accumulators_.size());
+    }
+    for (std::size_t index = 0; index < accumulators_.size(); ++index) {
+        accumulators_[index](row, it->second[index]);
+    }
+}
+
+AggregateTable AggregateBuilder::finish() const {
+    AggregateTable table{};
+    if (aggregation_.group_by.empty()) {
+        table.groups[GroupKey{}].resize(accumulators_.size());
+    }
+
+    for (const auto& [values, aggregates] : groups_) {
+        GroupKey key{};
+        for (std::size_t index = 0; index < aggregation_.group_by.size(); ++index) {
+            const GroupByField& group_by = aggregation_.group_by[index];
+            key.push_back(std::visit([&group_by](const auto& value) -> std::optional<std::string> {
+                using V = std::decay_t<decltype(value)>;
+                if constexpr (std::is_same_v<V, std::monostate>) {
+                    return std::nullopt;
+                } else if constexpr (std::is_same_v<V, std::string_view>) {
+                    return std::string(value);
+                } else if constexpr (std::is_same_v<V, double>) {
+                    return std::format("{}", value);
+                } else if (field_to_value_type(group_by.field) == FieldValueType::DATE) {
+                    return format_date_group(value, group_by.bucket);
+                } else if (field_to_value_type(group_by.field) == FieldValueType::TIME) {
+                    return std::format("{:02}:{:02}", value / 60, value % 60);
+                } else {
+                    return std::to_string(value);
+                }
+            }, values[index]));
+        }
+
+        table.groups[key] = aggregates;
+    }
+    return table;
+}
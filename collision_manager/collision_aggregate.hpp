@@ -0,0 +1,66 @@
+#pragma once
+
+#include "collision.hpp"
+#include "query.hpp"
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+// Running count, sum, minimum and maximum of the values of one aggregate. Values of different
+// rows, threads or ranks merge in any order into the value of all of them.
+struct AggregateValue {
+    std::uint64_t count = 0;
+    double sum = 0;
+    std::optional<double> min;
+    std::optional<double> max;
+
+    void add(const double value);
+    void merge(const AggregateValue& other);
+    // The value of function, unset for SUM, MIN and MAX of no values
+    std::optional<double> result(const AggregateFunction function) const;
+};
+
+// Values of the group_by fields of a group as text, unset for rows without a value. Crash dates
+// are YYYY-MM-DD, YYYY-MM or YYYY by their bucket and crash times HH:MM.
+using GroupKey = std::vector<std::optional<std::string>>;
+
+// Aggregates of each group, in the order of the aggregates of the Aggregation
+struct AggregateTable {
+    std::map<GroupKey, std::vector<AggregateValue>> groups;
+
+    void merge(const AggregateTable& other);
+};
+
+// Folds rows of a table into the aggregates of their group. Groups are keyed by the raw values
+// while folding, and only turned into text once per group by finish().
+class AggregateBuilder {
+public:
+    // Takes an aggregation as accepted by Query::aggregate()
+    AggregateBuilder(const IndexedCollisions& indexed_collisions, const Aggregation& aggregation);
+
+    void add_row(const std::uint32_t row);
+    // Every group seen so far, or one group of empty aggregates without group_by fields
+    AggregateTable finish() const;
+
+private:
+    // Date as days, months or years by the bucket, time as minutes and integers as themselves
+    using GroupValue = std::variant<std::monostate, std::int64_t, double, std::string_view>;
+    using GroupValues = std::array<GroupValue, MAX_GROUP_BY_FIELDS>;
+
+    struct GroupValuesHash {
+        std::size_t operator()(const GroupValues& values) const;
+    };
+
+    Aggregation aggregation_;
+    std::vector<std::function<GroupValue(std::uint32_t)>> group_values_;
+    std::vector<std::function<void(std::uint32_t, AggregateValue&)>> accumulators_;
+    std::unordered_map<GroupValues, std::vector<AggregateValue>, GroupValuesHash> groups_;
+};
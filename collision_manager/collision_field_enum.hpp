@@ -2,6 +2,8 @@
 
 #include "fixed_string.hpp"
 
+#include <bitset>
+#include <cstddef>
 #include <stdexcept>
 
 using CollisionString = FixedString<64>;
@@ -39,6 +41,15 @@ enum class CollisionField {
     UNDEFINED // Sentinel for error handling
 };
 
+constexpr std::size_t NUM_COLLISION_FIELDS = static_cast<std::size_t>(CollisionField::UNDEFINED);
+
+// Set of fields, bit i standing for the CollisionField of value i
+using FieldMask = std::bitset<NUM_COLLISION_FIELDS>;
+
+inline FieldMask all_fields() {
+    return FieldMask{}.set();
+}
+
 inline bool is_indexed_field(CollisionField field) {
     switch (field) {
         case CollisionField::CRASH_DATE:
@@ -1,18 +1,35 @@
 #include "collision_manager.hpp"
 
+#include "collision_aggregate.hpp"
+#include "collision_order.hpp"
 #include "collision_parser.hpp"
+#include "collision_wire_format.hpp"
 #include "query.hpp"
+#include "query_cache.hpp"
+#include "query_planner.hpp"
+#include "task_scheduler.hpp"
 #include "../myconfig.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cmath>
 #include <fstream>
 #include <cstring>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <stdexcept>
 #include <string>
+#include <utility>
 
 #include <omp.h>
 
 
 
 
-CollisionManager::CollisionManager(const std::string& filename) {
+CollisionManager::CollisionManager(const std::string& filename)
+  : num_threads_{omp_get_max_threads()}
+{
     CollisionParser parser{filename};
 
     try {
@@ -27,6 +44,9 @@ CollisionManager::CollisionManager(const std::string& filename) {
             return;
         }
 
+        set_num_threads(myconfig->getSearchThreads());
+        set_query_cache_capacity(myconfig->getQueryCacheBytes());
+
         int totalRecords = parser.getTotalRecords();
 
         int totalPartitions = myconfig->getTotalNumberofProcess();
@@ -48,11 +68,15 @@ CollisionManager::CollisionManager(const std::string& filename) {
     }
 }
 
-CollisionManager::CollisionManager(Collisions& collisions) {
+CollisionManager::CollisionManager(Collisions& collisions)
+  : num_threads_{omp_get_max_threads()}
+{
     this->indexed_collisions_ = IndexedCollisions(collisions);
 }
 
-CollisionManager::CollisionManager(const std::vector<Collision>& collisions_list) {
+CollisionManager::CollisionManager(const std::vector<Collision>& collisions_list)
+  : num_threads_{omp_get_max_threads()}
+{
     Collisions collisions{};
     for (const Collision& collision : collisions_list) {
         collisions.add(collision);
@@ -72,55 +96,584 @@ const std::size_t CollisionManager::get_num_collisions() {
     return indexed_collisions_.collisions_.size();
 }
 
-const std::vector<Collision> CollisionManager::search(const Query& query) {
-    const std::vector<CollisionProxy*> collision_proxy_results = searchOpenMp(query);
+const CollisionStatistics& CollisionManager::get_statistics() const {
+    return indexed_collisions_.statistics_;
+}
+
+int CollisionManager::get_num_threads() const {
+    return num_threads_;
+}
+
+void CollisionManager::set_num_threads(const int num_threads) {
+    num_threads_ = num_threads > 0 ? num_threads : omp_get_max_threads();
+}
+
+QueryPlan CollisionManager::explain(const Query& query) const {
+    return QueryPlanner(indexed_collisions_).plan(query);
+}
+
+void CollisionManager::append(const std::vector<Collision>& collisions_list) {
+    Collisions collisions{};
+    for (const Collision& collision : collisions_list) {
+        collisions.add(collision);
+    }
+    indexed_collisions_.append(collisions);
+    query_cache_.clear();
+}
+
+void CollisionManager::set_query_cache_capacity(const std::size_t capacity_bytes) {
+    query_cache_.set_capacity(capacity_bytes);
+}
+
+QueryCacheStatistics CollisionManager::get_query_cache_statistics() const {
+    return query_cache_.get_statistics();
+}
+
+namespace {
 
-    std::vector<Collision> collision_results{};
-    for (CollisionProxy* proxy : collision_proxy_results) {
-        collision_results.push_back(collision_proxy_to_collision(*proxy));
+std::vector<Collision> to_collisions(const std::span<CollisionProxy* const> proxies, const FieldMask& fields) {
+    std::vector<Collision> collisions{};
+    collisions.reserve(proxies.size());
+    for (const CollisionProxy* proxy : proxies) {
+        collisions.push_back(collision_proxy_to_collision(*proxy, fields));
     }
+    return collisions;
+}
+}
+
+const std::vector<Collision> CollisionManager::search(const Query& query) {
+    const std::string key = "R" + canonical_query_key(query);
+    if (const std::shared_ptr<const CachedResult> cached = query_cache_.get(key)) {
+        return std::get<std::vector<Collision>>(*cached);
+    }
+
+    std::vector<Collision> collision_results = to_collisions(searchOpenMp(query), query.get_result_fields());
+    query_cache_.put(key, std::make_shared<const CachedResult>(collision_results), collision_results.size() * sizeof(Collision));
     return collision_results;
 }
 
+CollisionCursor CollisionManager::open_cursor(const Query& query, const std::size_t batch_size) {
+    if (batch_size == 0) {
+        throw std::invalid_argument("Batch size of 0 provided to open_cursor!");
+    }
+
+    const std::string key = "R" + canonical_query_key(query);
+    std::shared_ptr<const CachedResult> cached = query_cache_.get(key);
+    if (cached == nullptr) {
+        std::vector<CollisionProxy*> results = searchOpenMp(query);
+        if (results.size() > batch_size) {
+            return CollisionCursor(std::move(results), query.get_result_fields(), nullptr, batch_size);
+        }
+
+        // The single batch is copied whole anyway
+        std::vector<Collision> collision_results = to_collisions(results, query.get_result_fields());
+        const std::size_t bytes = collision_results.size() * sizeof(Collision);
+        cached = std::make_shared<const CachedResult>(std::move(collision_results));
+        query_cache_.put(key, cached, bytes);
+    }
+    return CollisionCursor({}, query.get_result_fields(), std::shared_ptr<const std::vector<Collision>>(cached, &std::get<std::vector<Collision>>(*cached)), batch_size);
+}
+
+CollisionCursor::CollisionCursor(std::vector<CollisionProxy*> proxies,
+                                 const FieldMask& fields,
+                                 std::shared_ptr<const std::vector<Collision>> collisions,
+                                 const std::size_t batch_size)
+  : proxies_{std::move(proxies)},
+    fields_{fields},
+    collisions_{std::move(collisions)},
+    batch_size_{batch_size}
+{}
+
+std::size_t CollisionCursor::size() const {
+    return collisions_ != nullptr ? collisions_->size() : proxies_.size();
+}
+
+std::size_t CollisionCursor::num_batches() const {
+    return std::max<std::size_t>(1, (size() + batch_size_ - 1) / batch_size_);
+}
+
+const FieldMask& CollisionCursor::get_fields() const {
+    return fields_;
+}
+
+bool CollisionCursor::has_next() const {
+    return num_returned_batches_ < num_batches();
+}
+
+std::vector<Collision> CollisionCursor::next() {
+    if (!has_next()) {
+        throw std::runtime_error("No batch left in the collision cursor!");
+    }
+
+    const std::size_t start_index = num_returned_batches_++ * batch_size_;
+    const std::size_t end_index = std::min(size(), start_index + batch_size_);
+    if (collisions_ != nullptr) {
+        return std::vector<Collision>(collisions_->begin() + start_index, collisions_->begin() + end_index);
+    }
+    return to_collisions(std::span(proxies_).subspan(start_index, end_index - start_index), fields_);
+}
+
+namespace {
+
+// Below this many rows a task costs more to hand to another thread than it saves
+constexpr std::size_t MIN_ROWS_PER_TASK = 4096;
+// Above this many rows a task keeps a thread from the tasks of concurrent searches for too long
+constexpr std::size_t MAX_ROWS_PER_TASK = 65536;
+// Tasks a search is split into for each of its threads, so that a thread done early steals more
+constexpr std::size_t TASKS_PER_THREAD = 4;
+// 512 rows are one cache line of match words
+constexpr std::size_t TASK_ROWS_ALIGNMENT = 8 * ROWS_PER_MATCH_WORD;
+
+// Rows per task of a search over num_items rows or row ids on up to num_threads threads. A
+// multiple of 512, so that no two tasks write to the same cache line of the match words or of a
+// row id array.
+std::size_t task_rows(const std::size_t num_items, const std::size_t num_threads) {
+    const std::size_t rows = (num_items + TASKS_PER_THREAD * num_threads - 1) / (TASKS_PER_THREAD * num_threads);
+    const std::size_t aligned_rows = (rows + TASK_ROWS_ALIGNMENT - 1) / TASK_ROWS_ALIGNMENT * TASK_ROWS_ALIGNMENT;
+    return std::clamp(aligned_rows, MIN_ROWS_PER_TASK, MAX_ROWS_PER_TASK);
+}
+
+std::size_t num_tasks(const std::size_t num_items, const std::size_t rows_per_task) {
+    return (num_items + rows_per_task - 1) / rows_per_task;
+}
+
+const FieldQuery* upper_query(const std::vector<FieldQuery>& field_queries, const PlanStep& step) {
+    return step.upper_query_index.has_value() ? &field_queries[*step.upper_query_index] : nullptr;
+}
+
+// Levels of AND/OR/NOT above the conditions
+std::size_t expression_depth(const QueryExpression& expression) {
+    std::size_t depth = 0;
+    for (const QueryExpression& child : expression.children) {
+        depth = std::max(depth, expression_depth(child) + 1);
+    }
+    return depth;
+}
+
+// Clears the bits in matches of the rows in [start_index, end_index) that do not match expression.
+// Only rows still set are evaluated: an AND stops once no row is left and an OR evaluates each
+// operand only on the rows no earlier operand matched. scratch holds two bitmaps of every row for
+// each level of the expression.
+void match_expression(const IndexedCollisions& indexed_collisions,
+                      const std::vector<FieldQuery>& field_queries,
+                      const QueryExpression& expression,
+                      const std::size_t start_index,
+                      const std::size_t end_index,
+                      std::span<std::uint64_t> matches,
+                      std::span<std::vector<std::uint64_t>> scratch) {
+    const std::size_t start_word = start_index / ROWS_PER_MATCH_WORD;
+    const std::size_t end_word = match_words(end_index);
+    const auto any_left = [&matches, start_word, end_word]() {
+        return std::any_of(matches.begin() + start_word, matches.begin() + end_word, [](const std::uint64_t word) {
+            return word != 0;
+        });
+    };
+
+    switch(expression.op) {
+    case QueryOperator::CONDITION:
+        indexed_collisions.match(field_queries.at(expression.condition_index), start_index, end_index, matches);
+        break;
+    case QueryOperator::AND:
+        for (const QueryExpression& child : expression.children) {
+            if (!any_left()) {
+                break;
+            }
+            match_expression(indexed_collisions, field_queries, child, start_index, end_index, matches, scratch.subspan(2));
+        }
+        break;
+    case QueryOperator::OR: {
+        // matches keeps the rows no operand has matched yet, matched collects the others
+        std::vector<std::uint64_t>& matched = scratch[0];
+        std::vector<std::uint64_t>& operand = scratch[1];
+        std::fill(matched.begin() + start_word, matched.begin() + end_word, 0);
+        for (const QueryExpression& child : expression.children) {
+            if (!any_left()) {
+                break;
+            }
+            std::copy(matches.begin() + start_word, matches.begin() + end_word, operand.begin() + start_word);
+            match_expression(indexed_collisions, field_queries, child, start_index, end_index, operand, scratch.subspan(2));
+            for (std::size_t word = start_word; word < end_word; ++word) {
+                matched[word] |= operand[word];
+                matches[word] &= ~operand[word];
+            }
+        }
+        std::copy(matched.begin() + start_word, matched.begin() + end_word, matches.begin() + start_word);
+        break;
+    }
+    case QueryOperator::NOT: {
+        std::vector<std::uint64_t>& operand = scratch[0];
+        std::copy(matches.begin() + start_word, matches.begin() + end_word, operand.begin() + start_word);
+        match_expression(indexed_collisions, field_queries, expression.children.front(), start_index, end_index, operand, scratch.subspan(2));
+        for (std::size_t word = start_word; word < end_word; ++word) {
+            matches[word] &= ~operand[word];
+        }
+        break;
+    }
+    default:
+        throw std::runtime_error("Unknown query expression operator!");
+    }
+}
+
+
+// Whether the first rows in the order of a sorted index are found sooner by walking the index,
+// checking each row against the results, than by sorting the results. With the results spread
+// evenly, the walk passes num_rows / num_results rows for each row it keeps.
+bool walks_sorted_index(const std::size_t limit, const std::size_t num_results, const std::size_t num_rows) {
+    return num_results > 0 &&
+        static_cast<double>(limit) * num_rows / num_results < num_results * std::log2(limit + 1.0);
+}
+
+// The results that come first when walking index in direction, at least limit of them unless
+// there are fewer, and every result tied with the last one, which a sort then breaks
+template<class T>
+std::vector<CollisionProxy*> top_results_from_index(const std::vector<std::optional<T>>& items,
+                                                    const SortedIndex<T>& index,
+                                                    const SortDirection direction,
+                                                    const std::size_t limit,
+                                                    const std::vector<CollisionProxy*>& results,
+                                                    CollisionProxy* proxies) {
+    std::vector<std::uint64_t> is_result(match_words(items.size()), 0);
+    for (const CollisionProxy* proxy : results) {
+        const std::size_t row = proxy - proxies;
+        is_result[row / ROWS_PER_MATCH_WORD] |= std::uint64_t{1} << (row % ROWS_PER_MATCH_WORD);
+    }
+
+    // Rows with a value in the direction of the query, then the rows without one
+    const std::span<const std::uint32_t> rows = index.rows();
+    const std::size_t num_values = index.values().size();
+    const auto row_at = [&rows, num_values, direction](const std::size_t position) {
+        return direction == SortDirection::DESCENDING && position < num_values ? rows[num_values - 1 - position] : rows[position];
+    };
+
+    std::vector<CollisionProxy*> top_results{};
+    for (std::size_t position = 0; position < rows.size(); ++position) {
+        const std::uint32_t row = row_at(position);
+        if (top_results.size() >= limit &&
+            compare_order_values(items[row], items[top_results.back() - proxies], direction) != 0) {
+            break;
+        }
+        if ((is_result[row / ROWS_PER_MATCH_WORD] >> (row % ROWS_PER_MATCH_WORD) & 1) != 0) {
+            top_results.push_back(proxies + row);
+        }
+    }
+    return top_results;
+}
+}
+
 const std::vector<CollisionProxy*> CollisionManager::searchOpenMp(const Query& query) {
-    const std::vector<FieldQuery>& field_queries = query.get();
-    std::vector<CollisionProxy*> results;
+    std::vector<CollisionProxy*> results = search_matches(query);
+    if (query.get_order().has_value() || query.get_limit().has_value()) {
+        select_top_results(query, results);
+    }
+    return results;
+}
+
+std::vector<std::uint32_t> CollisionManager::search_rows(const Query& query) {
+    const std::vector<CollisionProxy*> results = searchOpenMp(query);
+    const CollisionProxy* proxies = indexed_collisions_.proxies_.data();
+
+    std::vector<std::uint32_t> rows(results.size());
+    for (std::size_t index = 0; index < results.size(); ++index) {
+        rows[index] = static_cast<std::uint32_t>(results[index] - proxies);
+    }
+    return rows;
+}
 
-    unsigned long num_threads = 1;
-    std::vector<std::vector<CollisionProxy*>> thread_local_results(num_threads);
+void CollisionManager::serialize_rows(const std::span<const std::uint32_t> rows, const FieldMask& fields, std::string& output) const {
+    CollisionWireWriter(indexed_collisions_, fields).append_rows(rows, output);
+}
+
+// The rows matching a query, in the ranges of rows its tasks matched. A range is either a span of
+// row ids or a span of words of the match bitmap, and starts at position() among every matching
+// row in row order, so that ranges are consumed as tasks again, each writing its own part of the
+// results.
+class CollisionManager::MatchedRows {
+public:
+    MatchedRows() = default;
+    // The cached rows of rows, which must hold a std::vector<std::uint32_t>, in ranges for up to
+    // num_threads threads
+    MatchedRows(std::shared_ptr<const CachedResult> rows, const std::size_t num_threads)
+      : cached_rows_{std::move(rows)} {
+        const std::vector<std::uint32_t>& row_ids = std::get<std::vector<std::uint32_t>>(*cached_rows_);
+        const std::size_t rows_per_task = task_rows(row_ids.size(), num_threads);
+        for (std::size_t start_index = 0; start_index < row_ids.size(); start_index += rows_per_task) {
+            row_ranges_.push_back(std::span(row_ids).subspan(start_index, std::min(rows_per_task, row_ids.size() - start_index)));
+            offsets_.push_back(offsets_.back() + row_ranges_.back().size());
+        }
+    }
 
-    // Initialize all matches to true initialially
-    std::uint8_t* matches_data = new std::uint8_t[indexed_collisions_.collisions_.size()];
-    std::span matches = {matches_data, indexed_collisions_.collisions_.size()};
-    memset(matches.data(), 1, matches.size());
+    // Matching rows over every range
+    std::size_t size() const {
+        return offsets_.back();
+    }
 
-    #pragma omp parallel num_threads(1)
-    {
-        int thread_id = omp_get_thread_num();
-        int num_threads = omp_get_num_threads();
+    std::size_t num_ranges() const {
+        return offsets_.size() - 1;
+    }
 
-        int chunk_size = indexed_collisions_.collisions_.size() / num_threads;
-        int start_index = thread_id * chunk_size;
-        int end_index = (thread_id == num_threads - 1) ? indexed_collisions_.collisions_.size() : start_index + chunk_size;
+    std::size_t position(const std::size_t range) const {
+        return offsets_[range];
+    }
 
-        for (const FieldQuery& field_query : field_queries) {
-            indexed_collisions_.match(field_query, start_index, end_index, matches);
+    // Calls visit(row) for each row of range in row order
+    template<class Visit>
+    void for_each_row(const std::size_t range, const Visit& visit) const {
+        if (!row_ranges_.empty()) {
+            for (const std::uint32_t row : row_ranges_[range]) {
+                visit(row);
+            }
+            return;
         }
 
-        #pragma omp barrier
+        const auto [start_word, end_word] = word_ranges_[range];
+        for (std::size_t word = start_word; word < end_word; ++word) {
+            for (std::uint64_t remaining = matches_[word]; remaining != 0; remaining &= remaining - 1) {
+                visit(static_cast<std::uint32_t>(word * ROWS_PER_MATCH_WORD + std::countr_zero(remaining)));
+            }
+        }
+    }
+
+private:
+    friend class CollisionManager;
+
+    // Turns the number of matches of each range, in offsets_[range + 1], into positions
+    void sum_offsets() {
+        std::partial_sum(offsets_.begin(), offsets_.end(), offsets_.begin());
+    }
+
+    // Row ids the row ranges point into, owned or cached
+    std::vector<std::uint32_t> row_ids_;
+    std::shared_ptr<const CachedResult> cached_rows_;
+    std::vector<std::span<const std::uint32_t>> row_ranges_;
+    // One bit per row, see match_words(), and the words of each range
+    std::vector<std::uint64_t> matches_;
+    std::vector<std::pair<std::size_t, std::size_t>> word_ranges_;
+    std::vector<std::size_t> offsets_{0};
+};
+
+void CollisionManager::run_tasks(const std::size_t num_tasks, const std::function<void(std::size_t)>& task) const {
+    TaskScheduler::instance().parallel_for(num_tasks, num_threads_, task);
+}
+
+CollisionManager::MatchedRows CollisionManager::matched_rows(const Query& query) {
+    if (!query_cache_.enabled()) {
+        return match_rows(query);
+    }
+
+    const std::string key = "M" + canonical_conditions_key(query);
+    if (std::shared_ptr<const CachedResult> cached = query_cache_.get(key)) {
+        return MatchedRows(std::move(cached), num_threads_);
+    }
+
+    // Each range copies its matching rows into place, and the copy is what the caller consumes
+    const MatchedRows matched = match_rows(query);
+    std::vector<std::uint32_t> rows(matched.size());
+    run_tasks(matched.num_ranges(), [&matched, &rows](const std::size_t range) {
+        std::size_t position = matched.position(range);
+        matched.for_each_row(range, [&rows, &position](const std::uint32_t row) {
+            rows[position++] = row;
+        });
+    });
+
+    const std::size_t bytes = rows.size() * sizeof(std::uint32_t);
+    std::shared_ptr<const CachedResult> cached = std::make_shared<const CachedResult>(std::move(rows));
+    query_cache_.put(key, cached, bytes);
+    return MatchedRows(std::move(cached), num_threads_);
+}
+
+CollisionManager::MatchedRows CollisionManager::match_rows(const Query& query) const {
+    const std::vector<FieldQuery>& field_queries = query.get();
+    const std::size_t num_rows = indexed_collisions_.collisions_.size();
 
-        for (std::size_t index = 0; index < end_index - start_index; ++index) {
-            if (matches[index + start_index]) {
-                thread_local_results[thread_id].push_back(&indexed_collisions_.proxies_.at(start_index + index));
+    // Index steps are resolved once by the planner. Tasks then only run filter steps, each on
+    // its own range of the candidate rows or of the matches. A query that is not a plain
+    // conjunction is evaluated as a whole over every row instead.
+    const std::optional<QueryExpression> expression = query.is_conjunction() ? std::nullopt : std::optional(query.get_expression());
+    const QueryPlan plan = expression.has_value() ? QueryPlan{} : QueryPlanner(indexed_collisions_).plan(query);
+    std::span<const PlanStep> filter_steps = plan.steps;
+    MatchedRows matched{};
+    std::vector<std::uint64_t>& matches = matched.matches_;
+
+    if (plan.uses_index()) {
+        const IndexSlices& slices = plan.steps.front().index_slices;
+        const std::size_t slice_size = num_slice_rows(slices);
+        filter_steps = filter_steps.subspan(1);
+
+        // A small slice bounds the result, so its rows become the candidates and the remaining
+        // steps only have to be checked against those candidates instead of every row.
+        if (sorts_index_slice(slice_size, num_rows)) {
+            std::vector<std::uint32_t>& row_ids = matched.row_ids_;
+            row_ids.reserve(slice_size);
+            for (const std::span<const std::uint32_t> slice : slices) {
+                row_ids.insert(row_ids.end(), slice.begin(), slice.end());
             }
+            std::sort(row_ids.begin(), row_ids.end());
+
+            const std::size_t rows_per_task = task_rows(row_ids.size(), num_threads_);
+            matched.row_ranges_.resize(num_tasks(row_ids.size(), rows_per_task));
+            matched.offsets_.assign(matched.row_ranges_.size() + 1, 0);
+            run_tasks(matched.row_ranges_.size(), [&](const std::size_t task) {
+                const std::size_t start_index = task * rows_per_task;
+                std::span<std::uint32_t> candidates = std::span(row_ids).subspan(start_index, std::min(rows_per_task, row_ids.size() - start_index));
+                for (const PlanStep& step : filter_steps) {
+                    if (candidates.empty()) {
+                        break;
+                    }
+                    candidates = candidates.first(indexed_collisions_.match_rows(field_queries[step.query_index], candidates,
+                                                                                 upper_query(field_queries, step)));
+                }
+                matched.row_ranges_[task] = candidates;
+                matched.offsets_[task + 1] = candidates.size();
+            });
+            matched.sum_offsets();
+            return matched;
+        }
+
+        // A large slice is marked in the matches instead, which the remaining steps scan
+        matches.assign(match_words(num_rows), 0);
+        for (const std::span<const std::uint32_t> slice : slices) {
+            const std::size_t rows_per_task = task_rows(slice.size(), num_threads_);
+            run_tasks(num_tasks(slice.size(), rows_per_task), [&matches, slice, rows_per_task](const std::size_t task) {
+                const std::size_t end_index = std::min(slice.size(), (task + 1) * rows_per_task);
+                for (std::size_t index = task * rows_per_task; index < end_index; ++index) {
+                    const std::uint32_t row = slice[index];
+                    // Rows of a slice are in value order, so tasks share words
+                    std::atomic_ref<std::uint64_t>(matches[row / ROWS_PER_MATCH_WORD])
+                        .fetch_or(std::uint64_t{1} << (row % ROWS_PER_MATCH_WORD), std::memory_order_relaxed);
+                }
+            });
+        }
+    } else {
+        // Every row starts out matching, the bits past the last row stay clear
+        matches.assign(match_words(num_rows), ~std::uint64_t{0});
+        if (num_rows % ROWS_PER_MATCH_WORD != 0) {
+            matches.back() = (std::uint64_t{1} << (num_rows % ROWS_PER_MATCH_WORD)) - 1;
         }
     }
 
-    for (const auto& local_results : thread_local_results) {
-        results.insert(results.end(), local_results.begin(), local_results.end());
+    std::vector<std::vector<std::uint64_t>> scratch{};
+    if (expression.has_value()) {
+        scratch.assign(2 * expression_depth(*expression), std::vector<std::uint64_t>(matches.size()));
     }
 
-    delete[] matches_data;
+    const std::size_t rows_per_task = task_rows(num_rows, num_threads_);
+    matched.word_ranges_.resize(num_tasks(num_rows, rows_per_task));
+    matched.offsets_.assign(matched.word_ranges_.size() + 1, 0);
+    run_tasks(matched.word_ranges_.size(), [&](const std::size_t task) {
+        const std::size_t start_index = task * rows_per_task;
+        const std::size_t end_index = std::min(num_rows, start_index + rows_per_task);
+        const std::size_t start_word = start_index / ROWS_PER_MATCH_WORD;
+        const std::size_t end_word = match_words(end_index);
+        if (expression.has_value()) {
+            match_expression(indexed_collisions_, field_queries, *expression, start_index, end_index, matches, scratch);
+        }
+        for (const PlanStep& step : filter_steps) {
+            indexed_collisions_.match(field_queries[step.query_index], start_index, end_index, matches, upper_query(field_queries, step));
+        }
 
+        std::size_t num_matches = 0;
+        for (std::size_t word = start_word; word < end_word; ++word) {
+            num_matches += std::popcount(matches[word]);
+        }
+        matched.word_ranges_[task] = {start_word, end_word};
+        matched.offsets_[task + 1] = num_matches;
+    });
+    matched.sum_offsets();
+    return matched;
+}
+
+std::vector<CollisionProxy*> CollisionManager::search_matches(const Query& query) {
+    const MatchedRows matched = matched_rows(query);
+    std::vector<CollisionProxy*> results(matched.size());
+    run_tasks(matched.num_ranges(), [this, &matched, &results](const std::size_t range) {
+        std::size_t position = matched.position(range);
+        matched.for_each_row(range, [this, &results, &position](const std::uint32_t row) {
+            results[position++] = &indexed_collisions_.proxies_[row];
+        });
+    });
     return results;
 }
+
+AggregateTable CollisionManager::aggregate(const Query& query) {
+    if (!query.get_aggregation().has_value()) {
+        throw std::invalid_argument("Query without an aggregation provided to aggregate!");
+    }
+
+    if (query.is_count_only()) {
+        const std::uint64_t num_matches = count(query);
+        AggregateTable table{};
+        table.groups[GroupKey{}].assign(query.get_aggregation()->aggregates.size(), AggregateValue{.count = num_matches});
+        return table;
+    }
+
+    // Each range is folded on its own, the partial aggregates are merged afterwards
+    const MatchedRows matched = matched_rows(query);
+    std::vector<std::optional<AggregateBuilder>> builders(matched.num_ranges());
+    run_tasks(matched.num_ranges(), [this, &query, &matched, &builders](const std::size_t range) {
+        AggregateBuilder& builder = builders[range].emplace(indexed_collisions_, *query.get_aggregation());
+        matched.for_each_row(range, [&builder](const std::uint32_t row) {
+            builder.add_row(row);
+        });
+    });
+
+    AggregateTable table = AggregateBuilder(indexed_collisions_, *query.get_aggregation()).finish();
+    for (const std::optional<AggregateBuilder>& builder : builders) {
+        if (builder.has_value()) {
+            table.merge(builder->finish());
+        }
+    }
+    return table;
+}
+
+std::size_t CollisionManager::count(const Query& query) {
+    if (query_cache_.enabled()) {
+        if (const std::shared_ptr<const CachedResult> cached = query_cache_.get("M" + canonical_conditions_key(query))) {
+            return std::get<std::vector<std::uint32_t>>(*cached).size();
+        }
+    }
+
+    // A query the index answers on its own matches exactly the rows of the slices
+    const QueryPlan plan = query.is_conjunction() ? QueryPlanner(indexed_collisions_).plan(query) : QueryPlan{};
+    if (plan.uses_index() && plan.steps.size() == 1) {
+        return num_slice_rows(plan.steps.front().index_slices);
+    }
+
+    // Each task counts the bits of its range of the matches, no row is visited
+    return match_rows(query).size();
+}
+
+
+void CollisionManager::select_top_results(const Query& query, std::vector<CollisionProxy*>& results) {
+    const std::size_t limit = std::min(query.get_limit().value_or(results.size()), results.size());
+    if (!query.get_order().has_value()) {
+        results.resize(limit);
+        return;
+    }
+
+    const QueryOrder& order = *query.get_order();
+    const std::size_t num_rows = indexed_collisions_.collisions_.size();
+    CollisionProxy* proxies = indexed_collisions_.proxies_.data();
+
+    indexed_collisions_.visit_column(order.field, [&](const auto& items, const auto& items_index) {
+        const auto& collision_ids = indexed_collisions_.collisions_.collision_ids;
+        const auto sorts_before = [&](const CollisionProxy* first, const CollisionProxy* second) {
+            const int comparison = compare_order_values(items[first - proxies], items[second - proxies], order.direction);
+            if (comparison != 0) {
+                return comparison < 0;
+            }
+            return compare_order_values(collision_ids[first - proxies], collision_ids[second - proxies], SortDirection::ASCENDING) < 0;
+        };
+
+        if constexpr (!std::is_same_v<std::decay_t<decltype(items_index)>, std::nullptr_t>) {
+            if (walks_sorted_index(limit, results.size(), num_rows)) {
+                results = top_results_from_index(items, items_index, order.direction, limit, results, proxies);
+                std::sort(results.begin(), results.end(), sorts_before);
+                results.resize(limit);
+                return;
+            }
+        }
+
+        std::partial_sort(results.begin(), results.begin() + limit, results.end(), sorts_before);
+        results.resize(limit);
+    });
+}
@@ -1,11 +1,54 @@
 #pragma once
 
 #include "collision.hpp"
+#include "collision_aggregate.hpp"
 #include "query.hpp"
+#include "query_cache.hpp"
+#include "query_planner.hpp"
 
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
 #include <string>
+#include <variant>
+#include <vector>
 
 
+// Memory a CollisionManager keeps cached query results in, unless configured otherwise
+constexpr std::size_t DEFAULT_QUERY_CACHE_BYTES = 64 << 20;
+
+// Results of a query handed out a batch at a time, so that only one batch of them is copied into
+// Collision at once. Holds pointers into the table of the CollisionManager that opened it, so it
+// must not outlive it or be used across an append().
+class CollisionCursor {
+public:
+    // Results over every batch
+    std::size_t size() const;
+    // Batches next() returns, at least one
+    std::size_t num_batches() const;
+    bool has_next() const;
+    // The next batch_size results, fewer in the last batch, which is empty when nothing matched
+    std::vector<Collision> next();
+    // The fields the results carry, see Query::get_result_fields()
+    const FieldMask& get_fields() const;
+
+private:
+    friend class CollisionManager;
+
+    CollisionCursor(std::vector<CollisionProxy*> proxies,
+                    const FieldMask& fields,
+                    std::shared_ptr<const std::vector<Collision>> collisions,
+                    const std::size_t batch_size);
+
+    // Results still to copy, unless they were already copied into collisions
+    std::vector<CollisionProxy*> proxies_;
+    FieldMask fields_;
+    std::shared_ptr<const std::vector<Collision>> collisions_;
+    std::size_t batch_size_;
+    std::size_t num_returned_batches_ = 0;
+};
+
 class CollisionManager {
 
 public:
@@ -15,7 +58,38 @@ public:
     const std::string& get_initialization_error();
     const std::size_t get_num_collisions();
     const std::vector<Collision> search(const Query& query);
+    // Matching rows in row order, or in the order of the query, up to its limit
     const std::vector<CollisionProxy*> searchOpenMp(const Query& query);
+    // Row ids of the results of searchOpenMp(), in the same order
+    std::vector<std::uint32_t> search_rows(const Query& query);
+    // Appends rows as the collision field of a collision_proto::QueryResponse in the protobuf
+    // wire format, copying only fields straight from the table, see CollisionWireWriter
+    void serialize_rows(const std::span<const std::uint32_t> rows, const FieldMask& fields, std::string& output) const;
+    // The results of search() in batches of batch_size, throws std::invalid_argument for a
+    // batch_size of 0. Results that fit in one batch are cached like those of search().
+    CollisionCursor open_cursor(const Query& query, const std::size_t batch_size);
+    // Aggregates of the rows matching query, throws std::invalid_argument for a query without
+    // an aggregation. A query that is Query::is_count_only() is answered by count().
+    AggregateTable aggregate(const Query& query);
+    // Number of rows matching the conditions of query, counted from the matches or the index
+    // without visiting the rows. The order, limit and aggregation of query are ignored.
+    std::size_t count(const Query& query);
+    const CollisionStatistics& get_statistics() const;
+    // The plan searchOpenMp would run for query, without running it
+    QueryPlan explain(const Query& query) const;
+
+    // Most threads a single search runs on, 0 means as many as OpenMP provides. Searches run as
+    // tasks of TaskScheduler::instance(), so concurrent searches share its threads.
+    int get_num_threads() const;
+    void set_num_threads(const int num_threads);
+
+    // Ingests more rows, must not run concurrently with searches. Drops every cached result.
+    void append(const std::vector<Collision>& collisions);
+
+    // Matching rows and search() results of recent queries are cached within capacity_bytes, so
+    // that a repeated query does not search again. 0 disables the cache.
+    void set_query_cache_capacity(const std::size_t capacity_bytes);
+    QueryCacheStatistics get_query_cache_statistics() const;
 
     friend class CollisionManagerTest;
 
@@ -23,6 +97,25 @@ private:
     CollisionManager(Collisions& collisions);
     CollisionManager(const std::vector<Collision>& collisions);
 
+    class MatchedRows;
+
+    // Calls task(index) for every index in [0, num_tasks) on up to num_threads_ threads
+    void run_tasks(const std::size_t num_tasks, const std::function<void(std::size_t)>& task) const;
+    // The rows matching the conditions of query, from the query cache when they are in it, and
+    // added to it otherwise
+    MatchedRows matched_rows(const Query& query);
+    // matched_rows() evaluating the conditions of query in row range tasks, without the cache
+    MatchedRows match_rows(const Query& query) const;
+    // Every row matching the conditions of query, in row order
+    std::vector<CollisionProxy*> search_matches(const Query& query);
+    // Sorts results by the order of query, if it has one, and keeps up to its limit
+    void select_top_results(const Query& query, std::vector<CollisionProxy*>& results);
+
     std::string initialization_error_;
     IndexedCollisions indexed_collisions_;
+    int num_threads_;
+    // Matching rows keyed by the canonical conditions, and search() results keyed by the
+    // canonical query, in one budget
+    using CachedResult = std::variant<std::vector<std::uint32_t>, std::vector<Collision>>;
+    QueryCache<CachedResult> query_cache_{DEFAULT_QUERY_CACHE_BYTES};
 };
@@ -15,6 +15,8 @@ public:
     {
         if (collision_manager.get() == nullptr) {
             collision_manager = std::make_unique<CollisionManager>(std::string("../Motor_Vehicle_Collisions_-_Crashes_20250123.csv"));
+            // Every iteration repeats its query, which would only measure the query cache
+            collision_manager->set_query_cache_capacity(0);
         }
     }
 };
@@ -218,6 +220,123 @@ BENCHMARK_DEFINE_F(CollisionManagerBenchmark, SearchRangeofCoordinates_DateRange
     }
 }
 
+// Scan of a string column and an index driven query with a wide slice, on 1 to 8 threads
+BENCHMARK_DEFINE_F(CollisionManagerBenchmark, SearchStringFieldThreads)(benchmark::State& state) {
+    Query query = Query::create(CollisionField::ON_STREET_NAME, QueryType::CONTAINS, "AVENUE");
+    collision_manager->set_num_threads(state.range(0));
+
+    for (auto _ : state) {
+        std::vector<CollisionProxy*> results = collision_manager->searchOpenMp(query);
+        benchmark::DoNotOptimize(results);
+    }
+    collision_manager->set_num_threads(0);
+}
+
+BENCHMARK_DEFINE_F(CollisionManagerBenchmark, SearchDateRange_BoroughThreads)(benchmark::State& state) {
+    std::chrono::year_month_day date{std::chrono::year{2018}, std::chrono::month{1}, std::chrono::day{1}};
+    Query query = Query::create(CollisionField::CRASH_DATE, QueryType::GREATER_THAN, date)
+                       .add(CollisionField::BOROUGH, QueryType::EQUALS, "BROOKLYN");
+    collision_manager->set_num_threads(state.range(0));
+
+    for (auto _ : state) {
+        std::vector<CollisionProxy*> results = collision_manager->searchOpenMp(query);
+        benchmark::DoNotOptimize(results);
+    }
+    collision_manager->set_num_threads(0);
+}
+
+// The query of SearchDateRange_BoroughThreads answered from the query cache after the first
+// iteration, with the conditions in a different order on every other iteration
+BENCHMARK_DEFINE_F(CollisionManagerBenchmark, SearchDateRange_BoroughCached)(benchmark::State& state) {
+    std::chrono::year_month_day date{std::chrono::year{2018}, std::chrono::month{1}, std::chrono::day{1}};
+    const std::vector<Query> queries{
+        Query::create(CollisionField::CRASH_DATE, QueryType::GREATER_THAN, date).add(CollisionField::BOROUGH, QueryType::EQUALS, "BROOKLYN"),
+        Query::create(CollisionField::BOROUGH, QueryType::EQUALS, "BROOKLYN").add(CollisionField::CRASH_DATE, QueryType::GREATER_THAN, date),
+    };
+    collision_manager->set_query_cache_capacity(DEFAULT_QUERY_CACHE_BYTES);
+
+    std::size_t iteration = 0;
+    for (auto _ : state) {
+        std::vector<CollisionProxy*> results = collision_manager->searchOpenMp(queries[iteration++ % queries.size()]);
+        benchmark::DoNotOptimize(results);
+    }
+    collision_manager->set_query_cache_capacity(0);
+}
+
+// The query of SearchDateRange_BoroughThreads answered with the number of matches only
+BENCHMARK_DEFINE_F(CollisionManagerBenchmark, CountDateRange_Borough)(benchmark::State& state) {
+    std::chrono::year_month_day date{std::chrono::year{2018}, std::chrono::month{1}, std::chrono::day{1}};
+    Query query = Query::create(CollisionField::CRASH_DATE, QueryType::GREATER_THAN, date)
+                       .add(CollisionField::BOROUGH, QueryType::EQUALS, "BROOKLYN");
+
+    for (auto _ : state) {
+        std::size_t num_matches = collision_manager->count(query);
+        benchmark::DoNotOptimize(num_matches);
+    }
+}
+
+// Kernel throughput on a synthetic column, per instruction set, without the CSV data
+static void ScanDenseColumn(benchmark::State& state) {
+    std::vector<std::optional<float>> items(1 << 24);
+    for (std::size_t row = 0; row < items.size(); ++row) {
+        items[row] = static_cast<float>(row % 1000);
+    }
+    const DenseColumn<float> column(items);
+    const SimdLevel simd_level = static_cast<SimdLevel>(state.range(0));
+    if (simd_level > supported_simd_level()) {
+        state.SkipWithError("Instruction set not supported");
+        return;
+    }
+
+    std::vector<std::uint64_t> matches(match_words(items.size()));
+    for (auto _ : state) {
+        std::fill(matches.begin(), matches.end(), ~std::uint64_t{0});
+        match_dense_column(column, CompareOp::BETWEEN, 100.0f, 200.0f, false, 0, matches.size(), matches.data(), simd_level);
+        benchmark::DoNotOptimize(matches.data());
+    }
+    state.SetBytesProcessed(state.iterations() * items.size() * sizeof(float));
+}
+
+BENCHMARK(ScanDenseColumn)->DenseRange(static_cast<int>(SimdLevel::SCALAR), static_cast<int>(SimdLevel::AVX512));
+
+// Per row cost of the generic predicate evaluation on columns without kernels, on one thread
+static void ScanUnindexedColumn(benchmark::State& state) {
+    static std::unique_ptr<IndexedCollisions> indexed_collisions;
+    if (indexed_collisions.get() == nullptr) {
+        const std::vector<std::string> boroughs{"BROOKLYN", "QUEENS", "MANHATTAN", "BRONX", "STATEN ISLAND"};
+        Collisions collisions{};
+        for (std::size_t row = 0; row < (1 << 20); ++row) {
+            Collision collision{};
+            collision.crash_time = std::chrono::hh_mm_ss<std::chrono::minutes>{std::chrono::minutes{row % 1440}};
+            collision.borough = CollisionString(std::string_view(boroughs[row % boroughs.size()]));
+            collisions.add(collision);
+        }
+        indexed_collisions = std::make_unique<IndexedCollisions>(collisions);
+    }
+
+    const std::chrono::hh_mm_ss<std::chrono::minutes> crash_time{std::chrono::minutes{720}};
+    const std::vector<Query> queries{
+        Query::create(CollisionField::CRASH_TIME, QueryType::LESS_THAN, crash_time),
+        Query::create(CollisionField::BOROUGH, QueryType::EQUALS, "QUEENS"),
+        Query::create(CollisionField::BOROUGH, Qualifier::NOT, QueryType::EQUALS, "QUEENS"),
+        Query::create(CollisionField::BOROUGH, QueryType::EQUALS, "queens", Qualifier::CASE_INSENSITIVE),
+        Query::create(CollisionField::BOROUGH, QueryType::CONTAINS, "EEN"),
+        Query::create(CollisionField::BOROUGH, QueryType::CONTAINS, "een", Qualifier::CASE_INSENSITIVE),
+    };
+    const FieldQuery& query = queries[state.range(0)].get().front();
+
+    const std::size_t num_rows = indexed_collisions->collisions_.size();
+    std::vector<std::uint64_t> matches(match_words(num_rows));
+    for (auto _ : state) {
+        std::fill(matches.begin(), matches.end(), ~std::uint64_t{0});
+        indexed_collisions->match(query, 0, num_rows, matches);
+        benchmark::DoNotOptimize(matches.data());
+    }
+    state.SetItemsProcessed(state.iterations() * num_rows);
+}
+
+BENCHMARK(ScanUnindexedColumn)->DenseRange(0, 5);
+
 BENCHMARK_REGISTER_F(CollisionManagerBenchmark, SearchSingleStringFieldNoMatches)->Iterations(NUM_ITERATIONS);
 BENCHMARK_REGISTER_F(CollisionManagerBenchmark, SearchSingleStringFieldSomeMatches)->Iterations(NUM_ITERATIONS);
 BENCHMARK_REGISTER_F(CollisionManagerBenchmark, SearchSingleSizeTFieldNoMatches)->Iterations(NUM_ITERATIONS);
@@ -233,5 +352,9 @@ BENCHMARK_REGISTER_F(CollisionManagerBenchmark, SearchRangeofCoordinatesSomeMatc
 BENCHMARK_REGISTER_F(CollisionManagerBenchmark, SearchDatesEqualsSomeMatches)->Iterations(NUM_ITERATIONS);
 BENCHMARK_REGISTER_F(CollisionManagerBenchmark, SearchDatesRangeSomeMatches)->Iterations(NUM_ITERATIONS);
 BENCHMARK_REGISTER_F(CollisionManagerBenchmark, SearchRangeofCoordinates_DateRangeSomeMatches)->Iterations(NUM_ITERATIONS);
+BENCHMARK_REGISTER_F(CollisionManagerBenchmark, SearchStringFieldThreads)->Iterations(NUM_ITERATIONS)->RangeMultiplier(2)->Range(1, 8)->UseRealTime();
+BENCHMARK_REGISTER_F(CollisionManagerBenchmark, SearchDateRange_BoroughThreads)->Iterations(NUM_ITERATIONS)->RangeMultiplier(2)->Range(1, 8)->UseRealTime();
+BENCHMARK_REGISTER_F(CollisionManagerBenchmark, SearchDateRange_BoroughCached)->Iterations(NUM_ITERATIONS)->UseRealTime();
+BENCHMARK_REGISTER_F(CollisionManagerBenchmark, CountDateRange_Borough)->Iterations(NUM_ITERATIONS)->UseRealTime();
 
 BENCHMARK_MAIN();
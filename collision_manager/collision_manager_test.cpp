@@ -1,5 +1,19 @@
+#include "bound_predicate.hpp"
 #include "collision_manager.hpp"
+#include "collision_order.hpp"
+#include "task_scheduler.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cctype>
+#include <cstdio>
 #include <chrono>
+#include <functional>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 #include <gtest/gtest.h>
 
 namespace {
@@ -19,6 +33,10 @@ protected:
         return CollisionManager(filename);
     }
 
+    const IndexedCollisions& get_indexed_collisions(const CollisionManager& collision_manager) {
+        return collision_manager.indexed_collisions_;
+    }
+
     void SetUp(){
         if(!is_initialized_m) {
             std::string filename(kSubsetDataset);
@@ -682,3 +700,1176 @@ TEST_F(CollisionManagerTest, Query_Match_VehicleType) {
 
 }
 
+
+TEST_F(CollisionManagerTest, IndexedMatchNotEquals) {
+    Collision collision1{};
+    collision1.zip_code = 11233;
+    collision1.collision_id = 1;
+
+    Collision collision2{};
+    collision2.zip_code = 10001;
+    collision2.collision_id = 2;
+
+    Collision collision3{};
+    collision3.collision_id = 3;
+
+    std::vector<Collision> collisions{collision1, collision2, collision3};
+
+    CollisionManager collision_manager = create_collision_manager(collisions);
+
+    Query query1 = Query::create(CollisionField::ZIP_CODE, QueryType::EQUALS, 11233U);
+    std::vector<CollisionProxy*> results1 = collision_manager.searchOpenMp(query1);
+    EXPECT_EQ(results1.size(), 1);
+    EXPECT_EQ(*results1[0]->collision_id, 1ULL);
+
+    // Rows without a zip code do not equal it either
+    Query query2 = Query::create(CollisionField::ZIP_CODE, Qualifier::NOT, QueryType::EQUALS, 11233U);
+    std::vector<CollisionProxy*> results2 = collision_manager.searchOpenMp(query2);
+    EXPECT_EQ(results2.size(), 2);
+    EXPECT_EQ(*results2[0]->collision_id, 2ULL);
+    EXPECT_EQ(*results2[1]->collision_id, 3ULL);
+
+    Query query3 = Query::create(CollisionField::ZIP_CODE, QueryType::HAS_VALUE, 0U);
+    std::vector<CollisionProxy*> results3 = collision_manager.searchOpenMp(query3);
+    EXPECT_EQ(results3.size(), 2);
+    EXPECT_EQ(*results3[0]->collision_id, 1ULL);
+    EXPECT_EQ(*results3[1]->collision_id, 2ULL);
+}
+
+TEST_F(CollisionManagerTest, CompoundQuery_IntersectsIndexedRanges) {
+    std::vector<Collision> collisions{};
+    for (std::size_t index = 0; index < 100; ++index) {
+        Collision collision{};
+        collision.collision_id = index;
+        collision.zip_code = 10000 + index % 10;
+        collision.number_of_persons_injured = index % 4;
+        collision.borough = index % 2 == 0 ? "BROOKLYN" : "QUEENS";
+        collisions.push_back(collision);
+    }
+
+    CollisionManager collision_manager = create_collision_manager(collisions);
+
+    Query query = Query::create(CollisionField::ZIP_CODE, QueryType::LESS_THAN, 10004U)
+        .add(CollisionField::NUMBER_OF_PERSONS_INJURED, QueryType::GREATER_THAN, static_cast<std::uint8_t>(1))
+        .add(CollisionField::COLLISION_ID, QueryType::LESS_THAN, 50ULL)
+        .add(CollisionField::BOROUGH, QueryType::EQUALS, "BROOKLYN");
+    std::vector<CollisionProxy*> results = collision_manager.searchOpenMp(query);
+
+    std::vector<std::size_t> expected_ids{};
+    for (std::size_t index = 0; index < 50; ++index) {
+        if (index % 10 < 4 && index % 4 > 1 && index % 2 == 0) {
+            expected_ids.push_back(index);
+        }
+    }
+
+    ASSERT_EQ(results.size(), expected_ids.size());
+    for (std::size_t index = 0; index < results.size(); ++index) {
+        EXPECT_EQ(*results[index]->collision_id, expected_ids[index]);
+    }
+}
+
+TEST_F(CollisionManagerTest, SortedIndexBoundsMatchBinarySearch) {
+    for (std::size_t num_items : {0, 1, 2, 7, 64, 1000}) {
+        std::vector<std::optional<std::uint32_t>> items{};
+        for (std::size_t index = 0; index < num_items; ++index) {
+            if (index % 5 == 3) {
+                items.push_back(std::nullopt);
+            } else {
+                items.push_back(static_cast<std::uint32_t>((index * 7919) % 97));
+            }
+        }
+
+        SortedIndex<std::uint32_t> index(items);
+
+        std::vector<std::uint32_t> sorted_values{};
+        for (const std::uint32_t row : index.values()) {
+            sorted_values.push_back(*items[row]);
+        }
+        ASSERT_TRUE(std::is_sorted(sorted_values.begin(), sorted_values.end()));
+        EXPECT_EQ(index.rows().size(), num_items);
+
+        for (std::uint32_t value = 0; value < 100; ++value) {
+            EXPECT_EQ(index.lower_bound(value),
+                      std::lower_bound(sorted_values.begin(), sorted_values.end(), value) - sorted_values.begin());
+            EXPECT_EQ(index.upper_bound(value),
+                      std::upper_bound(sorted_values.begin(), sorted_values.end(), value) - sorted_values.begin());
+        }
+    }
+}
+
+TEST_F(CollisionManagerTest, StatisticsDescribeColumns) {
+    std::vector<Collision> collisions{};
+    for (std::size_t index = 0; index < 100; ++index) {
+        Collision collision{};
+        collision.collision_id = index;
+        if (index % 4 != 0) {
+            collision.borough = index % 3 == 0 ? "BROOKLYN" : "QUEENS";
+        }
+        collision.number_of_persons_injured = index % 10;
+        collisions.push_back(collision);
+    }
+
+    CollisionManager collision_manager = create_collision_manager(collisions);
+    const CollisionStatistics& statistics = collision_manager.get_statistics();
+    EXPECT_EQ(statistics.get_row_count(), 100);
+
+    const ColumnStatistics& boroughs = statistics.get(CollisionField::BOROUGH);
+    EXPECT_EQ(boroughs.null_count, 25);
+    EXPECT_DOUBLE_EQ(boroughs.null_fraction(), 0.25);
+    EXPECT_EQ(boroughs.distinct_count, 2);
+    ASSERT_EQ(boroughs.most_common_values.size(), 2);
+    EXPECT_EQ(std::get<CollisionString>(boroughs.most_common_values[0].value), "QUEENS");
+    EXPECT_EQ(boroughs.most_common_values[0].count, 50);
+    EXPECT_EQ(boroughs.most_common_values[1].count, 25);
+
+    const ColumnStatistics& collision_ids = statistics.get(CollisionField::COLLISION_ID);
+    EXPECT_EQ(collision_ids.null_count, 0);
+    EXPECT_EQ(collision_ids.distinct_count, 100);
+    EXPECT_TRUE(collision_ids.most_common_values.empty());
+    ASSERT_EQ(collision_ids.histogram_bounds.size(), STATISTICS_HISTOGRAM_BUCKETS + 1);
+    EXPECT_EQ(std::get<std::size_t>(collision_ids.histogram_bounds.front()), 0);
+    EXPECT_EQ(std::get<std::size_t>(collision_ids.histogram_bounds.back()), 99);
+
+    const ColumnStatistics& crash_dates = statistics.get(CollisionField::CRASH_DATE);
+    EXPECT_EQ(crash_dates.null_count, 100);
+    EXPECT_EQ(crash_dates.distinct_count, 0);
+    EXPECT_TRUE(crash_dates.histogram_bounds.empty());
+}
+
+TEST_F(CollisionManagerTest, AppendRefreshesIndexesAndStatistics) {
+    Collision collision1{};
+    collision1.zip_code = 11233;
+    collision1.collision_id = 1;
+
+    std::vector<Collision> collisions{collision1};
+    CollisionManager collision_manager = create_collision_manager(collisions);
+
+    Collision collision2{};
+    collision2.zip_code = 11233;
+    collision2.collision_id = 2;
+    collision_manager.append({collision2});
+
+    EXPECT_EQ(collision_manager.get_num_collisions(), 2);
+    EXPECT_EQ(collision_manager.get_statistics().get_row_count(), 2);
+    EXPECT_EQ(collision_manager.get_statistics().get(CollisionField::COLLISION_ID).distinct_count, 2);
+
+    Query query = Query::create(CollisionField::ZIP_CODE, QueryType::EQUALS, 11233U);
+    std::vector<CollisionProxy*> results = collision_manager.searchOpenMp(query);
+    ASSERT_EQ(results.size(), 2);
+    EXPECT_EQ(*results[1]->collision_id, 2ULL);
+}
+
+TEST_F(CollisionManagerTest, CSV_StatisticsMatchColumnContents) {
+    const CollisionStatistics& statistics = collision_manager_m.get_statistics();
+    EXPECT_EQ(statistics.get_row_count(), collision_manager_m.get_num_collisions());
+
+    Query query = Query::create(CollisionField::BOROUGH, QueryType::HAS_VALUE, "");
+    std::vector<CollisionProxy*> results = collision_manager_m.searchOpenMp(query);
+    EXPECT_EQ(statistics.get(CollisionField::BOROUGH).null_count, collision_manager_m.get_num_collisions() - results.size());
+}
+
+TEST_F(CollisionManagerTest, PlannerDrivesFromSelectiveIndex) {
+    std::vector<Collision> collisions{};
+    for (std::size_t index = 0; index < 1000; ++index) {
+        Collision collision{};
+        collision.collision_id = index;
+        collision.borough = index % 2 == 0 ? "BROOKLYN" : "QUEENS";
+        collision.zip_code = 11000 + index % 100;
+        collisions.push_back(collision);
+    }
+    CollisionManager collision_manager = create_collision_manager(collisions);
+
+    Query query = Query::create(CollisionField::BOROUGH, QueryType::CONTAINS, "O")
+        .add(CollisionField::ZIP_CODE, QueryType::EQUALS, 11042U);
+    QueryPlan plan = collision_manager.explain(query);
+
+    ASSERT_EQ(plan.steps.size(), 2);
+    EXPECT_TRUE(plan.uses_index());
+    EXPECT_EQ(plan.steps[0].query_index, 1);
+    EXPECT_EQ(plan.steps[0].estimated_rows, 10);
+    EXPECT_EQ(plan.steps[1].query_index, 0);
+    EXPECT_EQ(plan.steps[1].access_path, AccessPath::SCAN);
+
+    std::vector<CollisionProxy*> results = collision_manager.searchOpenMp(query);
+    ASSERT_EQ(results.size(), 10);
+    EXPECT_EQ(*results[0]->collision_id, 42ULL);
+}
+
+TEST_F(CollisionManagerTest, PlannerScansPastUnselectiveIndex) {
+    std::vector<Collision> collisions{};
+    for (std::size_t index = 0; index < 1000; ++index) {
+        Collision collision{};
+        collision.collision_id = index;
+        collision.borough = index % 100 == 0 ? "BROOKLYN" : "QUEENS";
+        collision.number_of_persons_killed = 0;
+        collisions.push_back(collision);
+    }
+    CollisionManager collision_manager = create_collision_manager(collisions);
+
+    Query query = Query::create(CollisionField::NUMBER_OF_PERSONS_KILLED, QueryType::EQUALS, static_cast<std::uint8_t>(0))
+        .add(CollisionField::BOROUGH, QueryType::EQUALS, "BROOKLYN");
+    QueryPlan plan = collision_manager.explain(query);
+
+    ASSERT_EQ(plan.steps.size(), 2);
+    EXPECT_FALSE(plan.uses_index());
+    EXPECT_EQ(plan.steps[0].query_index, 1);
+    EXPECT_NEAR(plan.steps[0].selectivity, 0.01, 1e-9);
+    EXPECT_EQ(plan.estimated_rows, 10);
+
+    EXPECT_EQ(collision_manager.searchOpenMp(query).size(), 10);
+}
+
+TEST_F(CollisionManagerTest, PlannerEstimatesSelectivityFromStatistics) {
+    std::vector<Collision> collisions{};
+    for (std::size_t index = 0; index < 1000; ++index) {
+        Collision collision{};
+        if (index % 10 != 0) {
+            const std::string street_name = index % 2 == 0 ? "ATLANTIC AVENUE" : std::format("STREET {}", index);
+            collision.on_street_name = CollisionString(std::string_view(street_name));
+        }
+        collision.crash_time = std::chrono::hh_mm_ss<std::chrono::minutes>{std::chrono::minutes{index % 1000}};
+        collisions.push_back(collision);
+    }
+    CollisionManager collision_manager = create_collision_manager(collisions);
+    QueryPlanner planner{get_indexed_collisions(collision_manager)};
+
+    const auto selectivity = [&planner](const Query& query) {
+        return planner.estimate_selectivity(query.get().front());
+    };
+
+    EXPECT_NEAR(selectivity(Query::create(CollisionField::ON_STREET_NAME, QueryType::HAS_VALUE, "")), 0.9, 1e-9);
+    EXPECT_NEAR(selectivity(Query::create(CollisionField::ON_STREET_NAME, QueryType::EQUALS, "ATLANTIC AVENUE")), 0.4, 1e-9);
+    EXPECT_NEAR(selectivity(Query::create(CollisionField::ON_STREET_NAME, QueryType::EQUALS, "atlantic avenue", Qualifier::CASE_INSENSITIVE)), 0.4, 1e-9);
+    EXPECT_NEAR(selectivity(Query::create(CollisionField::ON_STREET_NAME, QueryType::EQUALS, "STREET 1")), 0.001, 1e-9);
+    EXPECT_NEAR(selectivity(Query::create(CollisionField::ON_STREET_NAME, Qualifier::NOT, QueryType::EQUALS, "ATLANTIC AVENUE")), 0.6, 1e-9);
+
+    std::chrono::hh_mm_ss<std::chrono::minutes> crash_time{std::chrono::minutes{250}};
+    EXPECT_NEAR(selectivity(Query::create(CollisionField::CRASH_TIME, QueryType::LESS_THAN, crash_time)), 0.25, 0.01);
+    EXPECT_NEAR(selectivity(Query::create(CollisionField::CRASH_TIME, QueryType::GREATER_THAN, crash_time)), 0.75, 0.01);
+}
+
+TEST_F(CollisionManagerTest, ParallelSearchMatchesSingleThreadedSearch) {
+    std::vector<Collision> collisions{};
+    for (std::size_t index = 0; index < 20000; ++index) {
+        Collision collision{};
+        collision.collision_id = index;
+        collision.zip_code = 10000 + index % 1000;
+        collision.borough = index % 3 == 0 ? "QUEENS" : "BROOKLYN";
+        collisions.push_back(collision);
+    }
+    CollisionManager collision_manager = create_collision_manager(collisions);
+
+    std::vector<Query> queries{
+        Query::create(CollisionField::BOROUGH, QueryType::EQUALS, "QUEENS"),
+        Query::create(CollisionField::ZIP_CODE, QueryType::EQUALS, 10042U).add(CollisionField::BOROUGH, QueryType::CONTAINS, "EEN"),
+        Query::create(CollisionField::COLLISION_ID, QueryType::GREATER_THAN, std::size_t{1000})
+            .add(CollisionField::BOROUGH, Qualifier::NOT, QueryType::EQUALS, "QUEENS"),
+    };
+    std::vector<std::size_t> expected_sizes{6667, 7, 12666};
+
+    for (std::size_t query_index = 0; query_index < queries.size(); ++query_index) {
+        collision_manager.set_num_threads(1);
+        std::vector<CollisionProxy*> expected = collision_manager.searchOpenMp(queries[query_index]);
+
+        collision_manager.set_num_threads(4);
+        std::vector<CollisionProxy*> results = collision_manager.searchOpenMp(queries[query_index]);
+
+        EXPECT_EQ(results.size(), expected_sizes[query_index]);
+        EXPECT_EQ(results, expected);
+        EXPECT_TRUE(std::is_sorted(results.begin(), results.end(), [](const CollisionProxy* first, const CollisionProxy* second) {
+            return *first->collision_id < *second->collision_id;
+        }));
+    }
+}
+
+namespace {
+
+template<class T>
+void expect_dense_column_matches_rows(const std::vector<std::optional<T>>& items, const T lower, const T upper) {
+    const DenseColumn<T> column(items);
+
+    for (int level = 0; level <= static_cast<int>(supported_simd_level()); ++level) {
+        for (CompareOp op : {CompareOp::EQUALS, CompareOp::LESS_THAN, CompareOp::GREATER_THAN, CompareOp::BETWEEN}) {
+            for (bool invert : {false, true}) {
+                // Every other row starts out matching, the rest must stay unmatched
+                std::vector<std::uint64_t> matches(match_words(items.size()), 0x5555555555555555ULL);
+                matches.back() &= (std::uint64_t{1} << (items.size() % ROWS_PER_MATCH_WORD)) - 1;
+                match_dense_column(column, op, lower, upper, invert, 0, matches.size(), matches.data(), static_cast<SimdLevel>(level));
+
+                for (std::size_t row = 0; row < matches.size() * ROWS_PER_MATCH_WORD; ++row) {
+                    bool expected = false;
+                    if (row < items.size() && items[row].has_value()) {
+                        const T value = *items[row];
+                        expected = op == CompareOp::EQUALS ? value == lower
+                                 : op == CompareOp::LESS_THAN ? value < upper
+                                 : op == CompareOp::GREATER_THAN ? value > lower
+                                 : lower < value && value < upper;
+                    }
+                    expected = row < items.size() && row % 2 == 0 && expected != invert;
+
+                    const bool matched = (matches[row / ROWS_PER_MATCH_WORD] >> (row % ROWS_PER_MATCH_WORD)) & 1;
+                    ASSERT_EQ(matched, expected) << "simd level " << level << " op " << static_cast<int>(op)
+                                                 << " invert " << invert << " row " << row;
+                }
+            }
+        }
+    }
+}
+
+}
+
+TEST_F(CollisionManagerTest, DenseColumnKernelsMatchRowByRow) {
+    const std::size_t num_rows = 1003;
+    std::vector<std::optional<float>> floats(num_rows);
+    std::vector<std::optional<std::uint8_t>> bytes(num_rows);
+    std::vector<std::optional<std::uint32_t>> words(num_rows);
+    std::vector<std::optional<std::size_t>> ids(num_rows);
+    for (std::size_t row = 0; row < num_rows; ++row) {
+        if (row % 5 == 0) {
+            continue;
+        }
+        const std::size_t value = row * 7919 % 256;
+        floats[row] = row % 11 == 0 ? std::numeric_limits<float>::quiet_NaN() : value / 4.0f - 32.0f;
+        bytes[row] = static_cast<std::uint8_t>(value);
+        // Values past the sign bit check the unsigned comparisons
+        words[row] = static_cast<std::uint32_t>(value << 24 | row);
+        ids[row] = value << 56 | row;
+    }
+
+    expect_dense_column_matches_rows(floats, -10.0f, 20.25f);
+    expect_dense_column_matches_rows(bytes, std::uint8_t{100}, std::uint8_t{200});
+    expect_dense_column_matches_rows(words, std::uint32_t{100} << 24, std::uint32_t{200} << 24);
+    expect_dense_column_matches_rows(ids, std::size_t{100} << 56, std::size_t{200} << 56);
+    // Bounds equal to a stored value
+    expect_dense_column_matches_rows(bytes, *bytes[1], *bytes[2]);
+}
+
+TEST_F(CollisionManagerTest, PlannerRunsRangeOnOneFieldAsBetween) {
+    std::vector<Collision> collisions{};
+    for (std::size_t index = 0; index < 1000; ++index) {
+        Collision collision{};
+        collision.collision_id = index;
+        if (index % 10 != 0) {
+            collision.latitude = 40.0f + index / 1000.0f;
+        }
+        collisions.push_back(collision);
+    }
+    CollisionManager collision_manager = create_collision_manager(collisions);
+
+    Query query = Query::create(CollisionField::LATITUDE, QueryType::LESS_THAN, 40.3f)
+        .add(CollisionField::LATITUDE, QueryType::GREATER_THAN, 40.1f);
+    QueryPlan plan = collision_manager.explain(query);
+
+    ASSERT_EQ(plan.steps.size(), 1);
+    EXPECT_EQ(plan.steps[0].query_index, 1);
+    EXPECT_EQ(plan.steps[0].upper_query_index, 0);
+    EXPECT_EQ(plan.estimated_rows, 180);
+    EXPECT_EQ(collision_manager.searchOpenMp(query).size(), 180);
+
+    // The scan checks both bounds at once as well
+    const IndexedCollisions& indexed_collisions = get_indexed_collisions(collision_manager);
+    std::vector<std::uint64_t> matches(match_words(1000), ~std::uint64_t{0});
+    matches.back() = (std::uint64_t{1} << (1000 % ROWS_PER_MATCH_WORD)) - 1;
+    indexed_collisions.match(query.get()[1], 0, 1000, matches, &query.get()[0]);
+
+    std::size_t num_matches = 0;
+    for (const std::uint64_t word : matches) {
+        num_matches += std::popcount(word);
+    }
+    EXPECT_EQ(num_matches, 180);
+}
+
+TEST_F(CollisionManagerTest, BoundPredicatesCoverEveryFlagCombination) {
+    std::vector<Collision> collisions{};
+    const std::vector<std::string> boroughs{"QUEENS", "queens", "BROOKLYN"};
+    for (std::size_t index = 0; index < 100; ++index) {
+        Collision collision{};
+        collision.collision_id = index;
+        if (index % 4 != 3) {
+            collision.borough = CollisionString(std::string_view(boroughs[index % 4]));
+        }
+        collisions.push_back(collision);
+    }
+    CollisionManager collision_manager = create_collision_manager(collisions);
+
+    // 25 rows each of QUEENS, queens and BROOKLYN, and 25 without a borough
+    const auto count = [&collision_manager](const Query& query) {
+        return collision_manager.searchOpenMp(query).size();
+    };
+    EXPECT_EQ(count(Query::create(CollisionField::BOROUGH, QueryType::EQUALS, "QUEENS")), 25);
+    EXPECT_EQ(count(Query::create(CollisionField::BOROUGH, QueryType::EQUALS, "Queens", Qualifier::CASE_INSENSITIVE)), 50);
+    EXPECT_EQ(count(Query::create(CollisionField::BOROUGH, Qualifier::NOT, QueryType::EQUALS, "QUEENS")), 75);
+    EXPECT_EQ(count(Query::create(CollisionField::BOROUGH, Qualifier::NOT, QueryType::EQUALS, "Queens", Qualifier::CASE_INSENSITIVE)), 50);
+    EXPECT_EQ(count(Query::create(CollisionField::BOROUGH, QueryType::CONTAINS, "EEN")), 25);
+    EXPECT_EQ(count(Query::create(CollisionField::BOROUGH, QueryType::CONTAINS, "eEn", Qualifier::CASE_INSENSITIVE)), 50);
+    EXPECT_EQ(count(Query::create(CollisionField::BOROUGH, Qualifier::NOT, QueryType::CONTAINS, "EEN")), 75);
+    EXPECT_EQ(count(Query::create(CollisionField::BOROUGH, Qualifier::NOT, QueryType::CONTAINS, "eEn", Qualifier::CASE_INSENSITIVE)), 50);
+    EXPECT_EQ(count(Query::create(CollisionField::BOROUGH, QueryType::HAS_VALUE, "")), 75);
+    EXPECT_EQ(count(Query::create(CollisionField::BOROUGH, Qualifier::NOT, QueryType::HAS_VALUE, "")), 25);
+}
+
+TEST_F(CollisionManagerTest, FoldAsciiCaseMatchesTolower) {
+    // Every byte value, in strings of every length up to the capacity
+    for (std::size_t first_byte = 1; first_byte < 256; first_byte += COLLISION_STRING_CAPACITY) {
+        std::string value{};
+        for (std::size_t byte = first_byte; byte < first_byte + COLLISION_STRING_CAPACITY && byte < 256; ++byte) {
+            value.push_back(static_cast<char>(byte));
+        }
+
+        for (std::size_t length = 0; length <= value.size(); ++length) {
+            const std::string_view prefix = std::string_view(value).substr(0, length);
+            std::string expected{prefix};
+            std::transform(expected.begin(), expected.end(), expected.begin(), [](const char byte) {
+                return static_cast<char>(std::tolower(static_cast<unsigned char>(byte)));
+            });
+
+            alignas(16) char folded[COLLISION_STRING_CAPACITY];
+            EXPECT_EQ(fold_ascii_case(CollisionString(prefix), folded), expected);
+        }
+    }
+}
+
+TEST_F(CollisionManagerTest, ExpressionQueriesCombineConditions) {
+    std::vector<Collision> collisions{};
+    const std::vector<std::string> boroughs{"QUEENS", "BRONX", "BROOKLYN", "MANHATTAN"};
+    for (std::size_t index = 0; index < 20000; ++index) {
+        Collision collision{};
+        collision.collision_id = index;
+        collision.borough = CollisionString(std::string_view(boroughs[index % boroughs.size()]));
+        if (index % 3 != 0) {
+            collision.number_of_persons_injured = static_cast<std::uint8_t>(index % 5);
+        }
+        collisions.push_back(collision);
+    }
+    CollisionManager collision_manager = create_collision_manager(collisions);
+
+    const Query queens = Query::create(CollisionField::BOROUGH, QueryType::EQUALS, "QUEENS");
+    const Query bronx = Query::create(CollisionField::BOROUGH, QueryType::EQUALS, "BRONX");
+    const Query injured = Query::create(CollisionField::NUMBER_OF_PERSONS_INJURED, QueryType::GREATER_THAN, static_cast<std::uint8_t>(0));
+
+    std::vector<std::pair<Query, std::function<bool(std::size_t)>>> cases{
+        {Query::any_of({queens, bronx}), [](const std::size_t index) {
+            return index % 4 < 2;
+        }},
+        {Query::negate(Query::any_of({queens, bronx})), [](const std::size_t index) {
+            return index % 4 >= 2;
+        }},
+        // NOT of a condition also matches the rows without a value
+        {Query::any_of({queens, bronx}).add(Query::negate(injured)), [](const std::size_t index) {
+            return index % 4 < 2 && (index % 3 == 0 || index % 5 == 0);
+        }},
+        {Query::any_of({Query(queens).add(injured), Query::negate(Query::any_of({queens, injured}))}), [](const std::size_t index) {
+            const bool is_injured = index % 3 != 0 && index % 5 != 0;
+            return index % 4 == 0 ? is_injured : !is_injured;
+        }},
+    };
+
+    for (const auto& [query, expected_match] : cases) {
+        std::vector<std::size_t> expected{};
+        for (std::size_t index = 0; index < collisions.size(); ++index) {
+            if (expected_match(index)) {
+                expected.push_back(index);
+            }
+        }
+
+        EXPECT_FALSE(query.is_conjunction());
+        EXPECT_TRUE(collision_manager.explain(query).evaluates_expression);
+        for (int num_threads : {1, 4}) {
+            collision_manager.set_num_threads(num_threads);
+            std::vector<std::size_t> collision_ids{};
+            for (const CollisionProxy* result : collision_manager.searchOpenMp(query)) {
+                collision_ids.push_back(**result->collision_id);
+            }
+            EXPECT_EQ(collision_ids, expected);
+        }
+    }
+}
+
+TEST_F(CollisionManagerTest, ExpressionQueriesRejectInvalidExpressions) {
+    Query query = Query::create(CollisionField::BOROUGH, QueryType::EQUALS, "QUEENS");
+
+    EXPECT_THROW(query.set_expression(QueryExpression{.op = QueryOperator::CONDITION, .condition_index = 1, .children = {}}),
+                 std::invalid_argument);
+    EXPECT_THROW(query.set_expression(QueryExpression{.op = QueryOperator::OR, .condition_index = 0, .children = {}}),
+                 std::invalid_argument);
+    EXPECT_THROW(Query::any_of({}), std::invalid_argument);
+    EXPECT_TRUE(query.is_conjunction());
+}
+
+TEST_F(CollisionManagerTest, InQueriesMatchAnyValue) {
+    std::vector<Collision> collisions{};
+    const std::vector<std::string> boroughs{"QUEENS", "Bronx", "BROOKLYN", "MANHATTAN"};
+    for (std::size_t index = 0; index < 20000; ++index) {
+        Collision collision{};
+        collision.collision_id = index;
+        collision.borough = CollisionString(std::string_view(boroughs[index % boroughs.size()]));
+        if (index % 7 != 0) {
+            collision.zip_code = static_cast<std::uint32_t>(10000 + index % 50);
+        }
+        collision.number_of_persons_injured = static_cast<std::uint8_t>(index % 5);
+        collisions.push_back(collision);
+    }
+    CollisionManager collision_manager = create_collision_manager(collisions);
+
+    const Query zip_codes = Query::create(CollisionField::ZIP_CODE, QueryType::IN, {10003U, 10042U, 10003U, 12345U});
+    const auto in_zip_codes = [](const std::size_t index) {
+        return index % 7 != 0 && (index % 50 == 3 || index % 50 == 42);
+    };
+
+    std::vector<std::pair<Query, std::function<bool(std::size_t)>>> cases{
+        {zip_codes, in_zip_codes},
+        // NOT IN also matches the rows without a value
+        {Query::create(CollisionField::ZIP_CODE, Qualifier::NOT, QueryType::IN, {10003U, 10042U}), [&in_zip_codes](const std::size_t index) {
+            return !in_zip_codes(index);
+        }},
+        {Query::create(CollisionField::BOROUGH, QueryType::IN, {"QUEENS", "BRONX"}), [](const std::size_t index) {
+            return index % 4 == 0;
+        }},
+        {Query::create(CollisionField::BOROUGH, QueryType::IN, {"queens", "BRONX"}, Qualifier::CASE_INSENSITIVE), [](const std::size_t index) {
+            return index % 4 < 2;
+        }},
+        {Query::create(CollisionField::NUMBER_OF_PERSONS_INJURED, Qualifier::NOT, QueryType::IN,
+                       {static_cast<std::uint8_t>(0), static_cast<std::uint8_t>(4)}), [](const std::size_t index) {
+            return index % 5 != 0 && index % 5 != 4;
+        }},
+        // Keys too far apart for a bitset
+        {Query::create(CollisionField::COLLISION_ID, Qualifier::NOT, QueryType::IN, {std::size_t{7}, std::size_t{1} << 40}), [](const std::size_t index) {
+            return index != 7;
+        }},
+        {Query(zip_codes).add(CollisionField::BOROUGH, QueryType::IN, {"BROOKLYN", "MANHATTAN"}), [&in_zip_codes](const std::size_t index) {
+            return in_zip_codes(index) && index % 4 >= 2;
+        }},
+        {Query::any_of({zip_codes, Query::create(CollisionField::NUMBER_OF_PERSONS_INJURED, QueryType::IN, static_cast<std::uint8_t>(1))}),
+         [&in_zip_codes](const std::size_t index) {
+            return in_zip_codes(index) || index % 5 == 1;
+        }},
+    };
+
+    for (const auto& [query, expected_match] : cases) {
+        std::vector<std::size_t> expected{};
+        for (std::size_t index = 0; index < collisions.size(); ++index) {
+            if (expected_match(index)) {
+                expected.push_back(index);
+            }
+        }
+
+        for (int num_threads : {1, 4}) {
+            collision_manager.set_num_threads(num_threads);
+            std::vector<std::size_t> collision_ids{};
+            for (const CollisionProxy* result : collision_manager.searchOpenMp(query)) {
+                collision_ids.push_back(**result->collision_id);
+            }
+            EXPECT_EQ(collision_ids, expected);
+        }
+    }
+
+    // Each value of an IN on an indexed field is a run of the index, together they drive the query
+    QueryPlan plan = collision_manager.explain(zip_codes);
+    ASSERT_EQ(plan.steps.size(), 1);
+    EXPECT_EQ(plan.steps[0].access_path, AccessPath::INDEX);
+    EXPECT_EQ(plan.steps[0].index_slices.size(), 2);
+    EXPECT_EQ(plan.estimated_rows, static_cast<std::size_t>(std::count_if(collisions.begin(), collisions.end(), [](const Collision& collision) {
+        return collision.zip_code == 10003U || collision.zip_code == 10042U;
+    })));
+}
+
+TEST_F(CollisionManagerTest, InQueriesRejectInvalidValueLists) {
+    EXPECT_THROW(Query::create(CollisionField::ZIP_CODE, QueryType::IN, std::vector<Value>{}), std::invalid_argument);
+    EXPECT_THROW(Query::create(CollisionField::ZIP_CODE, QueryType::EQUALS, {10003U, 10042U}), std::invalid_argument);
+    EXPECT_THROW(Query::create(CollisionField::ZIP_CODE, QueryType::IN, {10003U, 1.0f}), std::invalid_argument);
+
+    // A single value is a list of one
+    const Query query = Query::create(CollisionField::ZIP_CODE, QueryType::IN, 10003U);
+    EXPECT_EQ(query.get().front().get_values().size(), 1);
+}
+
+TEST_F(CollisionManagerTest, OrderedQueriesReturnTopRows) {
+    std::vector<Collision> collisions{};
+    const std::vector<std::string> boroughs{"QUEENS", "BRONX", "BROOKLYN"};
+    for (std::size_t index = 0; index < 20000; ++index) {
+        Collision collision{};
+        collision.collision_id = (index * 7919) % 20000;
+        collision.zip_code = static_cast<std::uint32_t>(10000 + index % 50);
+        if (index % 7 != 0) {
+            collision.number_of_persons_injured = static_cast<std::uint8_t>(index % 5);
+        }
+        if (index % 3 != 0) {
+            collision.borough = CollisionString(std::string_view(boroughs[index % 11 % boroughs.size()]));
+        }
+        collisions.push_back(collision);
+    }
+    CollisionManager collision_manager = create_collision_manager(collisions);
+
+    // Rows without a value last, then ties by collision_id
+    const auto injured_before = [](const bool descending) {
+        return [descending](const Collision& first, const Collision& second) {
+            if (first.number_of_persons_injured.has_value() != second.number_of_persons_injured.has_value()) {
+                return first.number_of_persons_injured.has_value();
+            }
+            if (first.number_of_persons_injured != second.number_of_persons_injured) {
+                return descending ? first.number_of_persons_injured > second.number_of_persons_injured
+                                  : first.number_of_persons_injured < second.number_of_persons_injured;
+            }
+            return first.collision_id < second.collision_id;
+        };
+    };
+    const auto borough_descending = [](const Collision& first, const Collision& second) {
+        if (first.borough.has_value() != second.borough.has_value()) {
+            return first.borough.has_value();
+        }
+        if (first.borough.has_value() && std::string_view(first.borough->c_str()) != std::string_view(second.borough->c_str())) {
+            return std::string_view(first.borough->c_str()) > std::string_view(second.borough->c_str());
+        }
+        return first.collision_id < second.collision_id;
+    };
+
+    const Query broad = Query::create(CollisionField::COLLISION_ID, QueryType::GREATER_THAN, std::size_t{100});
+    const Query narrow = Query::create(CollisionField::ZIP_CODE, QueryType::EQUALS, 10042U);
+    struct OrderCase {
+        Query query;
+        std::function<bool(const Collision&, const Collision&)> sorts_before;
+        std::function<bool(const Collision&)> matches;
+    };
+    const auto all = [](const Collision& collision) {
+        return *collision.collision_id > 100;
+    };
+    const auto zip_code = [](const Collision& collision) {
+        return collision.zip_code == 10042U;
+    };
+    std::vector<OrderCase> cases{
+        // Few rows out of many, found walking the index
+        {Query(broad).order_by(CollisionField::NUMBER_OF_PERSONS_INJURED).set_limit(10), injured_before(false), all},
+        {Query(broad).order_by(CollisionField::NUMBER_OF_PERSONS_INJURED, SortDirection::DESCENDING).set_limit(25), injured_before(true), all},
+        // Walks on into the rows without a value
+        {Query(broad).order_by(CollisionField::NUMBER_OF_PERSONS_INJURED).set_limit(18000), injured_before(false), all},
+        {Query(narrow).order_by(CollisionField::NUMBER_OF_PERSONS_INJURED).set_limit(390), injured_before(false), zip_code},
+        // Many rows out of few, sorted
+        {Query(narrow).order_by(CollisionField::NUMBER_OF_PERSONS_INJURED, SortDirection::DESCENDING).set_limit(300), injured_before(true), zip_code},
+        {Query(broad).order_by(CollisionField::BOROUGH, SortDirection::DESCENDING).set_limit(40), borough_descending, all},
+        {Query(narrow).order_by(CollisionField::BOROUGH, SortDirection::DESCENDING), borough_descending, zip_code},
+        {Query(narrow).order_by(CollisionField::BOROUGH, SortDirection::DESCENDING).set_limit(0), borough_descending, zip_code},
+    };
+
+    for (const OrderCase& order_case : cases) {
+        std::vector<Collision> expected{};
+        std::copy_if(collisions.begin(), collisions.end(), std::back_inserter(expected), order_case.matches);
+        std::sort(expected.begin(), expected.end(), order_case.sorts_before);
+        expected.resize(std::min(order_case.query.get_limit().value_or(expected.size()), expected.size()));
+
+        for (int num_threads : {1, 4}) {
+            collision_manager.set_num_threads(num_threads);
+            std::vector<std::size_t> collision_ids{};
+            for (const CollisionProxy* result : collision_manager.searchOpenMp(order_case.query)) {
+                collision_ids.push_back(**result->collision_id);
+            }
+            std::vector<std::size_t> expected_ids{};
+            for (const Collision& collision : expected) {
+                expected_ids.push_back(*collision.collision_id);
+            }
+            EXPECT_EQ(collision_ids, expected_ids);
+        }
+
+        // Merging the top rows of parts of the table gives the top rows of the whole
+        std::vector<Collision> merged{};
+        for (const std::size_t part : {0, 1, 2}) {
+            std::vector<Collision> part_collisions{};
+            for (std::size_t index = part; index < collisions.size(); index += 3) {
+                if (order_case.matches(collisions[index])) {
+                    part_collisions.push_back(collisions[index]);
+                }
+            }
+            keep_top_collisions(part_collisions, order_case.query.get_order(), order_case.query.get_limit());
+            merged.insert(merged.end(), part_collisions.begin(), part_collisions.end());
+        }
+        keep_top_collisions(merged, order_case.query.get_order(), order_case.query.get_limit());
+        ASSERT_EQ(merged.size(), expected.size());
+        for (std::size_t index = 0; index < merged.size(); ++index) {
+            EXPECT_EQ(merged[index].collision_id, expected[index].collision_id);
+        }
+    }
+
+    // A limit without an order keeps the first matching rows
+    const std::vector<CollisionProxy*> first_rows = collision_manager.searchOpenMp(Query(narrow).set_limit(5));
+    ASSERT_EQ(first_rows.size(), 5);
+    EXPECT_EQ(**first_rows.front()->collision_id, *collisions[42].collision_id);
+
+    EXPECT_THROW(Query(narrow).order_by(CollisionField::UNDEFINED), std::invalid_argument);
+}
+
+
+TEST_F(CollisionManagerTest, AggregateQueriesGroupMatchingRows) {
+    std::vector<Collision> collisions{};
+    const std::vector<std::string> boroughs{"QUEENS", "BRONX", "BROOKLYN"};
+    for (std::size_t index = 0; index < 5000; ++index) {
+        Collision collision{};
+        collision.collision_id = index;
+        collision.zip_code = static_cast<std::uint32_t>(10000 + index % 20);
+        collision.crash_date = std::chrono::year_month_day{
+            std::chrono::year{2020}, std::chrono::month{static_cast<unsigned>(index % 12 + 1)}, std::chrono::day{static_cast<unsigned>(index % 28 + 1)}};
+        if (index % 7 != 0) {
+            collision.number_of_persons_injured = static_cast<std::uint8_t>(index % 5);
+        }
+        if (index % 3 != 0) {
+            collision.borough = CollisionString(std::string_view(boroughs[index % 11 % boroughs.size()]));
+        }
+        collisions.push_back(collision);
+    }
+    CollisionManager collision_manager = create_collision_manager(collisions);
+
+    const Query query = Query::create(CollisionField::ZIP_CODE, QueryType::LESS_THAN, 10015U)
+        .aggregate({
+            .group_by = {{CollisionField::BOROUGH}, {CollisionField::CRASH_DATE, DateBucket::MONTH}},
+            .aggregates = {
+                {AggregateFunction::COUNT},
+                {AggregateFunction::COUNT, CollisionField::NUMBER_OF_PERSONS_INJURED},
+                {AggregateFunction::SUM, CollisionField::NUMBER_OF_PERSONS_INJURED},
+                {AggregateFunction::MIN, CollisionField::NUMBER_OF_PERSONS_INJURED},
+                {AggregateFunction::MAX, CollisionField::NUMBER_OF_PERSONS_INJURED},
+            },
+        });
+    const auto matches = [](const Collision& collision) {
+        return *collision.zip_code < 10015U;
+    };
+    const auto group_key = [](const Collision& collision) {
+        char month[16];
+        std::snprintf(month, sizeof(month), "%04d-%02u", static_cast<int>(collision.crash_date->year()), static_cast<unsigned>(collision.crash_date->month()));
+        return GroupKey{
+            collision.borough.has_value() ? std::optional<std::string>(collision.borough->c_str()) : std::nullopt,
+            std::string(month),
+        };
+    };
+
+    // Same table computed row by row, rows without a borough form a group of their own
+    std::map<GroupKey, std::vector<Collision>> expected{};
+    for (const Collision& collision : collisions) {
+        if (matches(collision)) {
+            expected[group_key(collision)].push_back(collision);
+        }
+    }
+    const auto expect_table = [&expected](const AggregateTable& table) {
+        ASSERT_EQ(table.groups.size(), expected.size());
+        for (const auto& [key, rows] : expected) {
+            const auto group = table.groups.find(key);
+            ASSERT_NE(group, table.groups.end());
+            std::uint64_t count = 0;
+            double sum = 0;
+            std::optional<double> min{};
+            std::optional<double> max{};
+            for (const Collision& collision : rows) {
+                if (collision.number_of_persons_injured.has_value()) {
+                    const double value = *collision.number_of_persons_injured;
+                    ++count;
+                    sum += value;
+                    min = std::min(min.value_or(value), value);
+                    max = std::max(max.value_or(value), value);
+                }
+            }
+            const std::vector<AggregateValue>& values = group->second;
+            ASSERT_EQ(values.size(), 5);
+            EXPECT_EQ(values[0].result(AggregateFunction::COUNT), static_cast<double>(rows.size()));
+            EXPECT_EQ(values[1].result(AggregateFunction::COUNT), static_cast<double>(count));
+            EXPECT_EQ(values[2].result(AggregateFunction::SUM), sum);
+            EXPECT_EQ(values[3].result(AggregateFunction::MIN), min);
+            EXPECT_EQ(values[4].result(AggregateFunction::MAX), max);
+        }
+    };
+    EXPECT_TRUE(expected.contains(GroupKey{std::nullopt, "2020-01"}));
+
+    for (int num_threads : {1, 4}) {
+        collision_manager.set_num_threads(num_threads);
+        expect_table(collision_manager.aggregate(query));
+    }
+
+    // Merging the tables of parts of the rows gives the table of all of them
+    AggregateTable merged{};
+    for (const std::size_t part : {0, 1, 2}) {
+        std::vector<Collision> part_collisions{};
+        for (std::size_t index = part; index < collisions.size(); index += 3) {
+            part_collisions.push_back(collisions[index]);
+        }
+        merged.merge(create_collision_manager(part_collisions).aggregate(query));
+    }
+    expect_table(merged);
+
+    // Without group_by fields there is one group, even when no row matches
+    const AggregateTable empty = collision_manager.aggregate(Query::create(CollisionField::ZIP_CODE, QueryType::EQUALS, 20000U)
+        .aggregate({.group_by = {}, .aggregates = {{AggregateFunction::COUNT}, {AggregateFunction::SUM, CollisionField::ZIP_CODE}}}));
+    ASSERT_EQ(empty.groups.size(), 1);
+    EXPECT_EQ(empty.groups.begin()->first, GroupKey{});
+    EXPECT_EQ(empty.groups.begin()->second.at(0).result(AggregateFunction::COUNT), 0.0);
+    EXPECT_EQ(empty.groups.begin()->second.at(1).result(AggregateFunction::SUM), std::nullopt);
+
+    const Query base = Query::create(CollisionField::ZIP_CODE, QueryType::EQUALS, 10000U);
+    EXPECT_THROW(collision_manager.aggregate(base), std::invalid_argument);
+    EXPECT_THROW(Query(base).aggregate({.group_by = {}, .aggregates = {}}), std::invalid_argument);
+    EXPECT_THROW(Query(base).aggregate({.group_by = {}, .aggregates = {{AggregateFunction::SUM, CollisionField::BOROUGH}}}), std::invalid_argument);
+    EXPECT_THROW(Query(base).aggregate({.group_by = {{CollisionField::BOROUGH, DateBucket::YEAR}}, .aggregates = {{AggregateFunction::COUNT}}}), std::invalid_argument);
+    EXPECT_THROW(Query(base).aggregate({.group_by = {{CollisionField::UNDEFINED}}, .aggregates = {{AggregateFunction::COUNT}}}), std::invalid_argument);
+}
+
+TEST_F(CollisionManagerTest, QueryCacheReusesResultsUntilAppend) {
+    std::vector<Collision> collisions{};
+    const std::vector<std::string> boroughs{"QUEENS", "BRONX", "BROOKLYN"};
+    for (std::size_t index = 0; index < 3000; ++index) {
+        Collision collision{};
+        collision.collision_id = index;
+        collision.zip_code = static_cast<std::uint32_t>(10000 + index % 20);
+        collision.number_of_persons_injured = static_cast<std::uint8_t>(index % 5);
+        collision.borough = CollisionString(std::string_view(boroughs[index % boroughs.size()]));
+        collisions.push_back(collision);
+    }
+    CollisionManager collision_manager = create_collision_manager(collisions);
+
+    const Query queens = Query::create(CollisionField::BOROUGH, QueryType::EQUALS, "QUEENS");
+    const Query zip_code = Query::create(CollisionField::ZIP_CODE, QueryType::LESS_THAN, 10010U);
+    const Query injured = Query::create(CollisionField::NUMBER_OF_PERSONS_INJURED, QueryType::IN,
+                                        std::vector<Value>{std::uint8_t{1}, std::uint8_t{3}});
+    const Query query = Query(queens).add(zip_code);
+
+    // Conditions matching the same rows by construction share a key
+    EXPECT_EQ(canonical_conditions_key(query), canonical_conditions_key(Query(zip_code).add(queens)));
+    EXPECT_EQ(canonical_conditions_key(Query(query).add(injured)), canonical_conditions_key(Query(injured).add(zip_code).add(queens)));
+    EXPECT_EQ(canonical_conditions_key(Query::any_of({queens, zip_code, injured})),
+              canonical_conditions_key(Query::any_of({injured, Query::any_of({zip_code, queens})})));
+    EXPECT_EQ(canonical_conditions_key(injured),
+              canonical_conditions_key(Query::create(CollisionField::NUMBER_OF_PERSONS_INJURED, QueryType::IN,
+                                                     std::vector<Value>{std::uint8_t{3}, std::uint8_t{1}, std::uint8_t{3}})));
+    EXPECT_NE(canonical_conditions_key(query), canonical_conditions_key(Query::any_of({queens, zip_code})));
+    EXPECT_NE(canonical_conditions_key(queens), canonical_conditions_key(Query::negate(queens)));
+    EXPECT_NE(canonical_conditions_key(queens), canonical_conditions_key(Query::create(CollisionField::BOROUGH, QueryType::EQUALS, "BRONX")));
+    EXPECT_EQ(canonical_conditions_key(query), canonical_conditions_key(Query(query).set_limit(5)));
+    EXPECT_NE(canonical_query_key(query), canonical_query_key(Query(query).set_limit(5)));
+
+    const auto collision_ids = [](const std::vector<CollisionProxy*>& results) {
+        std::vector<std::size_t> ids{};
+        for (const CollisionProxy* result : results) {
+            ids.push_back(**result->collision_id);
+        }
+        return ids;
+    };
+
+    const std::vector<std::size_t> expected = collision_ids(collision_manager.searchOpenMp(query));
+    EXPECT_EQ(expected.size(), 500);
+    QueryCacheStatistics statistics = collision_manager.get_query_cache_statistics();
+    EXPECT_EQ(statistics.hits, 0);
+    EXPECT_EQ(statistics.misses, 1);
+    EXPECT_EQ(statistics.entries, 1);
+
+    // The matching rows are shared by queries that only differ in their order, limit or aggregation
+    for (int num_threads : {1, 4}) {
+        collision_manager.set_num_threads(num_threads);
+        EXPECT_EQ(collision_ids(collision_manager.searchOpenMp(Query(zip_code).add(queens))), expected);
+    }
+    const std::vector<std::size_t> top = collision_ids(collision_manager.searchOpenMp(Query(zip_code).add(queens)
+        .order_by(CollisionField::COLLISION_ID, SortDirection::DESCENDING).set_limit(3)));
+    EXPECT_EQ(top, std::vector<std::size_t>(expected.rbegin(), expected.rbegin() + 3));
+    const AggregateTable aggregates = collision_manager.aggregate(Query(query).aggregate({.group_by = {}, .aggregates = {{AggregateFunction::COUNT}}}));
+    EXPECT_EQ(aggregates.groups.begin()->second.at(0).count, expected.size());
+    EXPECT_EQ(collision_manager.get_query_cache_statistics().hits, 4);
+
+    // search() results are cached as they are returned
+    EXPECT_EQ(collision_manager.search(query).size(), expected.size());
+    statistics = collision_manager.get_query_cache_statistics();
+    EXPECT_EQ(collision_manager.search(query).size(), expected.size());
+    EXPECT_EQ(collision_manager.get_query_cache_statistics().hits, statistics.hits + 1);
+    EXPECT_EQ(collision_manager.get_query_cache_statistics().misses, statistics.misses);
+
+    // Appending drops every cached result
+    Collision appended = collisions.front();
+    appended.collision_id = 3000;
+    collision_manager.append({appended});
+    EXPECT_EQ(collision_manager.get_query_cache_statistics().entries, 0);
+    EXPECT_EQ(collision_manager.get_query_cache_statistics().bytes, 0);
+    EXPECT_EQ(collision_manager.searchOpenMp(query).size(), expected.size() + 1);
+    EXPECT_EQ(collision_manager.search(query).size(), expected.size() + 1);
+
+    // Least recently used results are evicted to stay within the capacity
+    collision_manager.set_query_cache_capacity(4096);
+    EXPECT_LE(collision_manager.get_query_cache_statistics().bytes, 4096);
+    statistics = collision_manager.get_query_cache_statistics();
+    collision_manager.searchOpenMp(queens);
+    collision_manager.searchOpenMp(zip_code);
+    collision_manager.searchOpenMp(query);
+    EXPECT_GT(collision_manager.get_query_cache_statistics().evictions, statistics.evictions);
+    EXPECT_LE(collision_manager.get_query_cache_statistics().bytes, 4096);
+    statistics = collision_manager.get_query_cache_statistics();
+    collision_manager.searchOpenMp(query);
+    EXPECT_EQ(collision_manager.get_query_cache_statistics().hits, statistics.hits + 1);
+
+    collision_manager.set_query_cache_capacity(0);
+    EXPECT_EQ(collision_manager.get_query_cache_statistics().entries, 0);
+    statistics = collision_manager.get_query_cache_statistics();
+    EXPECT_EQ(collision_ids(collision_manager.searchOpenMp(query)).size(), expected.size() + 1);
+    EXPECT_EQ(collision_manager.get_query_cache_statistics().misses, statistics.misses);
+}
+
+TEST_F(CollisionManagerTest, CursorReturnsResultsInBatches) {
+    std::vector<Collision> collisions{};
+    for (std::size_t index = 0; index < 2500; ++index) {
+        Collision collision{};
+        collision.collision_id = index;
+        collision.zip_code = static_cast<std::uint32_t>(10000 + index % 10);
+        collisions.push_back(collision);
+    }
+    CollisionManager collision_manager = create_collision_manager(collisions);
+
+    const auto batch_ids = [](CollisionCursor& cursor, const std::size_t batch_size) {
+        std::vector<std::size_t> ids{};
+        std::size_t num_batches = 0;
+        while (cursor.has_next()) {
+            const std::vector<Collision> batch = cursor.next();
+            ++num_batches;
+            EXPECT_LE(batch.size(), batch_size);
+            EXPECT_TRUE(!cursor.has_next() || batch.size() == batch_size);
+            for (const Collision& collision : batch) {
+                ids.push_back(*collision.collision_id);
+            }
+        }
+        EXPECT_EQ(num_batches, cursor.num_batches());
+        EXPECT_EQ(ids.size(), cursor.size());
+        return ids;
+    };
+
+    const Query query = Query::create(CollisionField::ZIP_CODE, QueryType::LESS_THAN, 10008U);
+    const std::vector<Collision> expected = collision_manager.search(query);
+    std::vector<std::size_t> expected_ids{};
+    for (const Collision& collision : expected) {
+        expected_ids.push_back(*collision.collision_id);
+    }
+
+    for (const std::size_t batch_size : {1, 7, 1000, 2000, 5000}) {
+        collision_manager.set_query_cache_capacity(0);
+        CollisionCursor cursor = collision_manager.open_cursor(query, batch_size);
+        EXPECT_EQ(cursor.num_batches(), (expected.size() + batch_size - 1) / batch_size);
+        EXPECT_EQ(batch_ids(cursor, batch_size), expected_ids);
+    }
+
+    // Ordered and limited results come in the same order as from search()
+    const Query top = Query(query).order_by(CollisionField::COLLISION_ID, SortDirection::DESCENDING).set_limit(1500);
+    CollisionCursor top_cursor = collision_manager.open_cursor(top, 400);
+    EXPECT_EQ(top_cursor.num_batches(), 4);
+    const std::vector<std::size_t> top_ids = batch_ids(top_cursor, 400);
+    ASSERT_EQ(top_ids.size(), 1500);
+    EXPECT_EQ(top_ids.front(), 2497);
+    EXPECT_TRUE(std::is_sorted(top_ids.rbegin(), top_ids.rend()));
+
+    // Without results there is one empty batch
+    CollisionCursor empty_cursor = collision_manager.open_cursor(Query::create(CollisionField::ZIP_CODE, QueryType::EQUALS, 20000U), 10);
+    EXPECT_EQ(empty_cursor.num_batches(), 1);
+    ASSERT_TRUE(empty_cursor.has_next());
+    EXPECT_TRUE(empty_cursor.next().empty());
+    EXPECT_FALSE(empty_cursor.has_next());
+    EXPECT_THROW(empty_cursor.next(), std::runtime_error);
+
+    // Results in a single batch are cached
+    collision_manager.set_query_cache_capacity(DEFAULT_QUERY_CACHE_BYTES);
+    CollisionCursor first_cursor = collision_manager.open_cursor(query, 5000);
+    const QueryCacheStatistics statistics = collision_manager.get_query_cache_statistics();
+    CollisionCursor second_cursor = collision_manager.open_cursor(query, 300);
+    EXPECT_EQ(collision_manager.get_query_cache_statistics().hits, statistics.hits + 1);
+    EXPECT_EQ(batch_ids(second_cursor, 300), expected_ids);
+    EXPECT_EQ(batch_ids(first_cursor, 5000), expected_ids);
+
+    EXPECT_THROW(collision_manager.open_cursor(query, 0), std::invalid_argument);
+}
+
+TEST_F(CollisionManagerTest, ProjectedQueriesReturnSelectedFields) {
+    std::vector<Collision> collisions{};
+    for (std::size_t index = 0; index < 100; ++index) {
+        Collision collision{};
+        collision.collision_id = index;
+        collision.zip_code = static_cast<std::uint32_t>(10000 + index % 10);
+        collision.borough = CollisionString("QUEENS");
+        collision.latitude = 40.5f + index / 1000.0f;
+        collision.number_of_persons_injured = static_cast<std::uint8_t>(index % 3);
+        collisions.push_back(collision);
+    }
+    CollisionManager collision_manager = create_collision_manager(collisions);
+
+    // Conditions may be on fields that are not selected
+    const Query query = Query::create(CollisionField::ZIP_CODE, QueryType::EQUALS, 10003U);
+    const Query projected = Query(query).select({CollisionField::BOROUGH, CollisionField::LATITUDE});
+    const std::vector<Collision> results = collision_manager.search(query);
+    const std::vector<Collision> projected_results = collision_manager.search(projected);
+    ASSERT_EQ(projected_results.size(), results.size());
+    for (std::size_t index = 0; index < results.size(); ++index) {
+        EXPECT_EQ(projected_results[index].borough, results[index].borough);
+        EXPECT_EQ(projected_results[index].latitude, results[index].latitude);
+        EXPECT_FALSE(projected_results[index].zip_code.has_value());
+        EXPECT_FALSE(projected_results[index].collision_id.has_value());
+        EXPECT_FALSE(projected_results[index].number_of_persons_injured.has_value());
+    }
+
+    // The whole rows cached for the same conditions are not handed out for the projection
+    EXPECT_TRUE(collision_manager.search(query).front().zip_code.has_value());
+    EXPECT_FALSE(collision_manager.search(projected).front().zip_code.has_value());
+
+    // Ordered rows keep the order field and collision_id, which ranks merge them by
+    const Query top = Query(projected).order_by(CollisionField::NUMBER_OF_PERSONS_INJURED, SortDirection::DESCENDING).set_limit(3);
+    FieldMask expected_fields{};
+    for (const CollisionField field : {CollisionField::BOROUGH, CollisionField::LATITUDE,
+                                       CollisionField::NUMBER_OF_PERSONS_INJURED, CollisionField::COLLISION_ID}) {
+        expected_fields.set(static_cast<std::size_t>(field));
+    }
+    EXPECT_EQ(top.get_result_fields(), expected_fields);
+    CollisionCursor cursor = collision_manager.open_cursor(top, 2);
+    EXPECT_EQ(cursor.get_fields(), expected_fields);
+    while (cursor.has_next()) {
+        for (const Collision& collision : cursor.next()) {
+            EXPECT_EQ(collision.number_of_persons_injured, 2);
+            EXPECT_TRUE(collision.collision_id.has_value());
+            EXPECT_FALSE(collision.zip_code.has_value());
+        }
+    }
+
+    EXPECT_EQ(query.get_result_fields(), all_fields());
+    EXPECT_THROW(Query(query).select({}), std::invalid_argument);
+    EXPECT_THROW(Query(query).select({CollisionField::UNDEFINED}), std::invalid_argument);
+}
+
+TEST_F(CollisionManagerTest, CountOnlyQueriesCountMatchingRows) {
+    std::vector<Collision> collisions{};
+    for (std::size_t index = 0; index < 10000; ++index) {
+        Collision collision{};
+        collision.collision_id = index;
+        collision.zip_code = static_cast<std::uint32_t>(10000 + index % 10);
+        collision.borough = CollisionString(index % 3 == 0 ? "QUEENS" : "BRONX");
+        collisions.push_back(collision);
+    }
+    CollisionManager collision_manager = create_collision_manager(collisions);
+    collision_manager.set_query_cache_capacity(0);
+
+    const std::vector<Query> queries{
+        // Answered from the index alone
+        Query::create(CollisionField::ZIP_CODE, QueryType::LESS_THAN, 10004U),
+        Query::create(CollisionField::ZIP_CODE, QueryType::IN, std::vector<Value>{10001U, 10003U, 10001U}),
+        // Counted from the matches
+        Query::create(CollisionField::BOROUGH, QueryType::EQUALS, "QUEENS"),
+        Query::create(CollisionField::BOROUGH, QueryType::EQUALS, "QUEENS").add(CollisionField::ZIP_CODE, QueryType::GREATER_THAN, 10006U),
+        Query::any_of({Query::create(CollisionField::BOROUGH, QueryType::EQUALS, "BRONX"),
+                       Query::create(CollisionField::ZIP_CODE, QueryType::EQUALS, 10000U)}),
+        Query::create(CollisionField::ZIP_CODE, QueryType::EQUALS, 20000U),
+    };
+    for (const Query& query : queries) {
+        const std::size_t expected = collision_manager.search(query).size();
+        EXPECT_EQ(collision_manager.count(query), expected);
+
+        const Query count_query = Query(query).count_only();
+        EXPECT_TRUE(count_query.is_count_only());
+        const AggregateTable table = collision_manager.aggregate(count_query);
+        ASSERT_EQ(table.groups.size(), 1);
+        EXPECT_EQ(table.groups.begin()->first, GroupKey{});
+        EXPECT_EQ(table.groups.begin()->second.at(0).count, expected);
+    }
+
+    // Matching rows already in the cache are counted without matching again
+    collision_manager.set_query_cache_capacity(DEFAULT_QUERY_CACHE_BYTES);
+    const Query& cached_query = queries[3];
+    const std::size_t expected = collision_manager.search(cached_query).size();
+    const QueryCacheStatistics statistics = collision_manager.get_query_cache_statistics();
+    EXPECT_EQ(collision_manager.count(cached_query), expected);
+    EXPECT_EQ(collision_manager.get_query_cache_statistics().hits, statistics.hits + 1);
+
+    // Counting a field, or counting per group, visits the rows
+    EXPECT_FALSE(Query(queries[0]).aggregate({.group_by = {}, .aggregates = {{AggregateFunction::COUNT, CollisionField::BOROUGH}}}).is_count_only());
+    EXPECT_FALSE(Query(queries[0]).aggregate({.group_by = {{CollisionField::BOROUGH}}, .aggregates = {{AggregateFunction::COUNT}}}).is_count_only());
+    EXPECT_FALSE(queries[0].is_count_only());
+}
+
+TEST_F(CollisionManagerTest, SerializedRowsAreProtobufWireFormat) {
+    Collision first{};
+    first.crash_date = std::chrono::year_month_day{std::chrono::year{2021}, std::chrono::month{1}, std::chrono::day{2}};
+    first.borough = CollisionString("QUEENS");
+    first.zip_code = 11233;
+    first.latitude = 1.0f;
+    first.collision_id = 300;
+    Collision second{};
+    second.crash_time = std::chrono::hh_mm_ss<std::chrono::minutes>{std::chrono::minutes{9 * 60 + 5}};
+    second.number_of_persons_injured = 0;
+    second.collision_id = 301;
+    std::vector<Collision> collisions{first, second};
+    CollisionManager collision_manager = create_collision_manager(collisions);
+
+    const std::vector<std::uint32_t> rows = collision_manager.search_rows(Query::create(CollisionField::COLLISION_ID, QueryType::GREATER_THAN, std::size_t{0}));
+    ASSERT_EQ(rows.size(), 2);
+
+    std::string output{};
+    collision_manager.serialize_rows(rows, all_fields(), output);
+    const std::string expected = std::string("\x22\x20", 2) +
+        std::string("\x0a\x0a") + "01/02/2021" +
+        std::string("\x1a\x06") + "QUEENS" +
+        std::string("\x20\xe1\x57") +
+        std::string("\x2d\x00\x00\x80\x3f", 5) +
+        std::string("\xc0\x01\xac\x02") +
+        std::string("\x22\x0d", 2) +
+        std::string("\x12\x05") + "09:05" +
+        std::string("\x58\x00", 2) +
+        std::string("\xc0\x01\xad\x02");
+    EXPECT_EQ(output, expected);
+
+    // Only the selected fields are written, after what output already holds
+    FieldMask fields{};
+    fields.set(static_cast<std::size_t>(CollisionField::ZIP_CODE));
+    fields.set(static_cast<std::size_t>(CollisionField::COLLISION_ID));
+    std::string projected_output = "header";
+    collision_manager.serialize_rows(std::span(rows).first(1), fields, projected_output);
+    EXPECT_EQ(projected_output, std::string("header\x22\x07\x20\xe1\x57\xc0\x01\xac\x02"));
+}
+
+TEST(TaskSchedulerTest, ParallelForRunsEveryTaskOnce) {
+    TaskScheduler scheduler(3);
+    EXPECT_EQ(scheduler.num_threads(), 3);
+
+    std::vector<std::atomic<int>> runs(1000);
+    scheduler.parallel_for(runs.size(), 4, [&runs](const std::size_t task) { runs[task].fetch_add(1); });
+    for (const std::atomic<int>& task_runs : runs) {
+        EXPECT_EQ(task_runs.load(), 1);
+    }
+
+    // A single thread, or no task at all, runs on the calling thread alone
+    std::vector<std::thread::id> threads{};
+    scheduler.parallel_for(10, 1, [&threads](const std::size_t) { threads.push_back(std::this_thread::get_id()); });
+    EXPECT_EQ(threads, std::vector<std::thread::id>(10, std::this_thread::get_id()));
+    scheduler.parallel_for(0, 4, [](const std::size_t) { FAIL(); });
+}
+
+TEST(TaskSchedulerTest, ParallelForRethrowsOnceEveryTaskRan) {
+    TaskScheduler scheduler(2);
+    std::atomic<std::size_t> ran{0};
+    EXPECT_THROW(scheduler.parallel_for(100, 3, [&ran](const std::size_t task) {
+        ran.fetch_add(1);
+        if (task % 10 == 0) {
+            throw std::runtime_error("task failed");
+        }
+    }), std::runtime_error);
+    EXPECT_EQ(ran.load(), 100);
+
+    // The scheduler is still usable after a job threw
+    std::atomic<std::size_t> sum{0};
+    scheduler.parallel_for(10, 3, [&sum](const std::size_t task) { sum.fetch_add(task); });
+    EXPECT_EQ(sum.load(), 45);
+}
+
+TEST(TaskSchedulerTest, SmallJobFinishesWhileLargeJobRuns) {
+    TaskScheduler scheduler(2);
+    std::atomic<std::size_t> large_ran{0};
+
+    std::thread large([&]() {
+        scheduler.parallel_for(200, 3, [&](const std::size_t) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            large_ran.fetch_add(1);
+        });
+    });
+    while (large_ran.load() == 0) {
+        std::this_thread::yield();
+    }
+
+    // Helpers take turns between the jobs, so the small one never waits for the large one
+    std::atomic<std::size_t> small_ran{0};
+    scheduler.parallel_for(4, 3, [&small_ran](const std::size_t) { small_ran.fetch_add(1); });
+    EXPECT_EQ(small_ran.load(), 4);
+    EXPECT_LT(large_ran.load(), 200);
+
+    large.join();
+    EXPECT_EQ(large_ran.load(), 200);
+}
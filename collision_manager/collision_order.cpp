@@ -0,0 +1,27 @@
+#include "collision_order.hpp"
+
+#include <algorithm>
+
+CollisionOrder::CollisionOrder(const QueryOrder& order)
+  : order_{order}
+{}
+
+bool CollisionOrder::operator()(const Collision& first, const Collision& second) const {
+    const int comparison = visit_collision_member(order_.field, [this, &first, &second](const auto member) {
+        return compare_order_values(first.*member, second.*member, order_.direction);
+    });
+    if (comparison != 0) {
+        return comparison < 0;
+    }
+    return compare_order_values(first.collision_id, second.collision_id, SortDirection::ASCENDING) < 0;
+}
+
+void keep_top_collisions(std::vector<Collision>& collisions,
+                         const std::optional<QueryOrder>& order,
+                         const std::optional<std::size_t>& limit) {
+    const std::size_t num_kept = std::min(limit.value_or(collisions.size()), collisions.size());
+    if (order.has_value()) {
+        std::partial_sort(collisions.begin(), collisions.begin() + num_kept, collisions.end(), CollisionOrder(*order));
+    }
+    collisions.resize(num_kept);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "bound_predicate.hpp"
+#include "collision.hpp"
+#include "query.hpp"
+
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+// Negative, zero or positive as first sorts before, with or after second in direction. Values
+// that are not set sort after every value that is, in either direction.
+template<class T>
+int compare_order_values(const std::optional<T>& first, const std::optional<T>& second, const SortDirection direction) {
+    if (!first.has_value() || !second.has_value()) {
+        return static_cast<int>(!first.has_value()) - static_cast<int>(!second.has_value());
+    }
+
+    const auto first_key = membership_key(*first);
+    const auto second_key = membership_key(*second);
+    const int comparison = first_key < second_key ? -1 : second_key < first_key ? 1 : 0;
+    return direction == SortDirection::DESCENDING ? -comparison : comparison;
+}
+
+// Whether one collision sorts before another by a QueryOrder, ties broken by collision_id
+class CollisionOrder {
+public:
+    explicit CollisionOrder(const QueryOrder& order);
+
+    bool operator()(const Collision& first, const Collision& second) const;
+
+private:
+    QueryOrder order_;
+};
+
+// Sorts collisions by order, when set, and keeps the first limit of them, when set
+void keep_top_collisions(std::vector<Collision>& collisions,
+                         const std::optional<QueryOrder>& order,
+                         const std::optional<std::size_t>& limit);
@@ -0,0 +1,148 @@
+#include "collision_statistics.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+
+namespace {
+
+// Sortable stand-in for a column value, times by their minutes and strings by their characters
+template<class T>
+auto statistics_key(const T& value) {
+    if constexpr (std::is_same_v<T, std::chrono::hh_mm_ss<std::chrono::minutes>>) {
+        return std::chrono::duration_cast<std::chrono::minutes>(value.to_duration()).count();
+    } else if constexpr (std::is_same_v<T, CollisionString>) {
+        return std::string_view(value.data, value.length);
+    } else {
+        return value;
+    }
+}
+
+template<class T, class Key>
+Value statistics_key_to_value(const Key& key) {
+    if constexpr (std::is_same_v<T, std::chrono::hh_mm_ss<std::chrono::minutes>>) {
+        return std::chrono::hh_mm_ss<std::chrono::minutes>{std::chrono::minutes{key}};
+    } else if constexpr (std::is_same_v<T, CollisionString>) {
+        return CollisionString(key);
+    } else {
+        return key;
+    }
+}
+
+}
+
+double ColumnStatistics::null_fraction() const {
+    return row_count == 0 ? 0.0 : static_cast<double>(null_count) / row_count;
+}
+
+std::size_t CollisionStatistics::get_row_count() const {
+    return columns_.front().row_count;
+}
+
+const ColumnStatistics& CollisionStatistics::get(const CollisionField& field) const {
+    if (field == CollisionField::UNDEFINED) {
+        throw std::runtime_error("Unknown CollisionField was provided!");
+    }
+    return columns_[static_cast<std::size_t>(field)];
+}
+
+void CollisionStatistics::set(ColumnStatistics&& column_statistics) {
+    if (column_statistics.field == CollisionField::UNDEFINED) {
+        throw std::runtime_error("Unknown CollisionField was provided!");
+    }
+    columns_[static_cast<std::size_t>(column_statistics.field)] = std::move(column_statistics);
+}
+
+template<class T>
+ColumnStatistics analyze_column(const CollisionField& field, const std::vector<std::optional<T>>& items) {
+    using Key = decltype(statistics_key(std::declval<T>()));
+
+    ColumnStatistics statistics{};
+    statistics.field = field;
+    statistics.row_count = items.size();
+    if (items.empty()) {
+        return statistics;
+    }
+
+    // Systematic sample of every step-th row, which covers the whole column when it is small
+    const std::size_t step = std::max<std::size_t>(1, items.size() / STATISTICS_SAMPLE_SIZE);
+    const bool is_exact = step == 1;
+
+    std::size_t sampled_rows = 0;
+    std::vector<Key> sample{};
+    sample.reserve(items.size() / step + 1);
+    for (std::size_t row = 0; row < items.size(); row += step) {
+        ++sampled_rows;
+        if (items[row].has_value()) {
+            sample.push_back(statistics_key(*items[row]));
+        }
+    }
+
+    const double scale = static_cast<double>(items.size()) / sampled_rows;
+    const auto scale_count = [is_exact, scale](const std::size_t count) -> std::size_t {
+        return is_exact ? count : static_cast<std::size_t>(std::llround(count * scale));
+    };
+
+    statistics.null_count = std::min(items.size(), scale_count(sampled_rows - sample.size()));
+    if (sample.empty()) {
+        return statistics;
+    }
+
+    std::sort(sample.begin(), sample.end());
+
+    // Runs of equal values in the sorted sample as (count, first position)
+    std::vector<std::pair<std::size_t, std::size_t>> runs{};
+    std::size_t singletons = 0;
+    for (std::size_t position = 0; position < sample.size();) {
+        std::size_t run_end = position + 1;
+        while (run_end < sample.size() && sample[run_end] == sample[position]) {
+            ++run_end;
+        }
+        runs.emplace_back(run_end - position, position);
+        singletons += run_end - position == 1 ? 1 : 0;
+        position = run_end;
+    }
+
+    if (is_exact) {
+        statistics.distinct_count = runs.size();
+    } else {
+        // Haas and Stokes' Duj1 estimator, the same one ANALYZE uses
+        const double sample_values = sample.size();
+        const double total_values = std::max<double>(sample_values, items.size() - statistics.null_count);
+        const double estimate = sample_values * runs.size() /
+            (sample_values - singletons + singletons * sample_values / total_values);
+        statistics.distinct_count = static_cast<std::size_t>(
+            std::clamp(std::llround(estimate), static_cast<long long>(runs.size()), static_cast<long long>(total_values)));
+    }
+
+    // Only values seen more than once say anything about frequency
+    const std::size_t num_common_values = std::min(STATISTICS_MOST_COMMON_VALUES, runs.size());
+    std::partial_sort(runs.begin(), runs.begin() + num_common_values, runs.end(), [](const auto& first, const auto& second) {
+        return first.first > second.first;
+    });
+    for (std::size_t index = 0; index < num_common_values && runs[index].first > 1; ++index) {
+        statistics.most_common_values.push_back(MostCommonValue{
+            .value = statistics_key_to_value<T>(sample[runs[index].second]),
+            .count = scale_count(runs[index].first),
+        });
+    }
+
+    const std::size_t num_bounds = std::min(STATISTICS_HISTOGRAM_BUCKETS + 1, sample.size());
+    for (std::size_t bound = 0; bound < num_bounds; ++bound) {
+        const std::size_t position = num_bounds == 1 ? 0 : bound * (sample.size() - 1) / (num_bounds - 1);
+        statistics.histogram_bounds.push_back(statistics_key_to_value<T>(sample[position]));
+    }
+
+    return statistics;
+}
+
+template ColumnStatistics analyze_column(const CollisionField&, const std::vector<std::optional<float>>&);
+template ColumnStatistics analyze_column(const CollisionField&, const std::vector<std::optional<std::size_t>>&);
+template ColumnStatistics analyze_column(const CollisionField&, const std::vector<std::optional<std::chrono::year_month_day>>&);
+template ColumnStatistics analyze_column(const CollisionField&, const std::vector<std::optional<std::chrono::hh_mm_ss<std::chrono::minutes>>>&);
+template ColumnStatistics analyze_column(const CollisionField&, const std::vector<std::optional<std::uint8_t>>&);
+template ColumnStatistics analyze_column(const CollisionField&, const std::vector<std::optional<std::uint32_t>>&);
+template ColumnStatistics analyze_column(const CollisionField&, const std::vector<std::optional<CollisionString>>&);
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "collision_field_enum.hpp"
+#include "query.hpp"
+
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+// Rows sampled per column by the statistics pass. Like ANALYZE, a sample of this size keeps the
+// histogram bounds and common value frequencies accurate to a few percent whatever the column size.
+constexpr std::size_t STATISTICS_SAMPLE_SIZE = 30000;
+constexpr std::size_t STATISTICS_HISTOGRAM_BUCKETS = 32;
+constexpr std::size_t STATISTICS_MOST_COMMON_VALUES = 16;
+
+struct MostCommonValue {
+    Value value;
+    std::size_t count;
+};
+
+struct ColumnStatistics {
+    CollisionField field = CollisionField::UNDEFINED;
+    std::size_t row_count = 0;
+    std::size_t null_count = 0;
+    // Exact when the whole column was sampled, otherwise estimated from the sample
+    std::size_t distinct_count = 0;
+    // Bucket boundaries over the non-null values, every bucket holds about the same number of rows
+    std::vector<Value> histogram_bounds;
+    // Most frequent values first, with counts scaled up to the whole column
+    std::vector<MostCommonValue> most_common_values;
+
+    double null_fraction() const;
+};
+
+class CollisionStatistics {
+public:
+    std::size_t get_row_count() const;
+    const ColumnStatistics& get(const CollisionField& field) const;
+    void set(ColumnStatistics&& column_statistics);
+
+private:
+    std::array<ColumnStatistics, static_cast<std::size_t>(CollisionField::UNDEFINED)> columns_{};
+};
+
+template<class T>
+ColumnStatistics analyze_column(const CollisionField& field, const std::vector<std::optional<T>>& items);
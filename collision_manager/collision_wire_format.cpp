@@ -0,0 +1,175 @@
+#include "collision_wire_format.hpp"
+
+#include <bit>
+#include <cstring>
+#include <format>
+#include <string>
+#include <string_view>
+
+namespace {
+
+enum class WireType : std::uint32_t { VARINT = 0, LENGTH_DELIMITED = 2, FIXED32 = 5 };
+
+// Longest text of a date or time, a year past 9999 or before 0 only makes it longer
+constexpr std::size_t MAX_TEXT_SIZE = 32;
+
+std::size_t varint_size(const std::uint64_t value) {
+    return (std::bit_width(value | 1) + 6) / 7;
+}
+
+char* write_varint(char* output, std::uint64_t value) {
+    while (value >= 0x80) {
+        *output++ = static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    *output++ = static_cast<char>(value);
+    return output;
+}
+
+std::uint32_t tag(const std::uint32_t field_number, const WireType wire_type) {
+    return field_number << 3 | static_cast<std::uint32_t>(wire_type);
+}
+
+char* write_digits(char* output, unsigned value, const std::size_t num_digits) {
+    for (std::size_t digit = num_digits; digit > 0; --digit) {
+        output[digit - 1] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    }
+    return output + num_digits;
+}
+
+// Writes the text CollisionProtoConverter formats value as into text and returns its length
+std::size_t format_text(const std::chrono::year_month_day& value, char* text) {
+    const int year = static_cast<int>(value.year());
+    if (year < 0 || year > 9999) {
+        const std::string formatted = std::format("{:02}/{:02}/{:04}", static_cast<unsigned>(value.month()),
+                                                  static_cast<unsigned>(value.day()), year);
+        std::memcpy(text, formatted.data(), formatted.size());
+        return formatted.size();
+    }
+
+    char* end = write_digits(text, static_cast<unsigned>(value.month()), 2);
+    *end++ = '/';
+    end = write_digits(end, static_cast<unsigned>(value.day()), 2);
+    *end++ = '/';
+    end = write_digits(end, static_cast<unsigned>(year), 4);
+    return end - text;
+}
+
+std::size_t format_text(const std::chrono::hh_mm_ss<std::chrono::minutes>& value, char* text) {
+    const int hours = static_cast<int>(value.hours().count());
+    const int minutes = static_cast<int>(value.minutes().count());
+    if (hours < 0 || hours > 99) {
+        const std::string formatted = std::format("{:02}:{:02}", hours, minutes);
+        std::memcpy(text, formatted.data(), formatted.size());
+        return formatted.size();
+    }
+
+    char* end = write_digits(text, static_cast<unsigned>(hours), 2);
+    *end++ = ':';
+    end = write_digits(end, static_cast<unsigned>(minutes), 2);
+    return end - text;
+}
+
+// Size of the tag and value of a field holding value
+template<class T>
+std::size_t field_size(const std::uint32_t field_number, const T& value) {
+    if constexpr (std::is_same_v<T, float>) {
+        return varint_size(tag(field_number, WireType::FIXED32)) + sizeof(std::uint32_t);
+    } else if constexpr (std::is_same_v<T, CollisionString>) {
+        return varint_size(tag(field_number, WireType::LENGTH_DELIMITED)) + varint_size(value.length) + value.length;
+    } else if constexpr (std::is_integral_v<T>) {
+        return varint_size(tag(field_number, WireType::VARINT)) + varint_size(value);
+    } else {
+        char text[MAX_TEXT_SIZE];
+        const std::size_t length = format_text(value, text);
+        return varint_size(tag(field_number, WireType::LENGTH_DELIMITED)) + varint_size(length) + length;
+    }
+}
+
+template<class T>
+char* write_field(char* output, const std::uint32_t field_number, const T& value) {
+    if constexpr (std::is_same_v<T, float>) {
+        output = write_varint(output, tag(field_number, WireType::FIXED32));
+        // Little endian whatever the byte order of the host
+        const std::uint32_t bits = std::bit_cast<std::uint32_t>(value);
+        for (std::size_t byte = 0; byte < sizeof(bits); ++byte) {
+            *output++ = static_cast<char>(bits >> (8 * byte));
+        }
+        return output;
+    } else if constexpr (std::is_same_v<T, CollisionString>) {
+        output = write_varint(output, tag(field_number, WireType::LENGTH_DELIMITED));
+        output = write_varint(output, value.length);
+        std::memcpy(output, value.data, value.length);
+        return output + value.length;
+    } else if constexpr (std::is_integral_v<T>) {
+        output = write_varint(output, tag(field_number, WireType::VARINT));
+        return write_varint(output, value);
+    } else {
+        char text[MAX_TEXT_SIZE];
+        const std::size_t length = format_text(value, text);
+        output = write_varint(output, tag(field_number, WireType::LENGTH_DELIMITED));
+        output = write_varint(output, length);
+        std::memcpy(output, text, length);
+        return output + length;
+    }
+}
+}
+
+CollisionWireWriter::CollisionWireWriter(const IndexedCollisions& indexed_collisions, const FieldMask& fields) {
+    for (std::size_t field = 0; field < fields.size(); ++field) {
+        if (!fields.test(field)) {
+            continue;
+        }
+        indexed_collisions.visit_column(static_cast<CollisionField>(field), [&](const auto& column, const auto&) {
+            // Fields are numbered from 1 in the order of CollisionField
+            columns_.push_back(FieldColumn{.field_number = static_cast<std::uint32_t>(field + 1), .column = &column});
+        });
+    }
+}
+
+std::size_t CollisionWireWriter::collision_size(const std::uint32_t row) const {
+    std::size_t size = 0;
+    for (const FieldColumn& field_column : columns_) {
+        std::visit([&size, &field_column, row](const auto* column) {
+            const auto& value = (*column)[row];
+            if (value.has_value()) {
+                size += field_size(field_column.field_number, *value);
+            }
+        }, field_column.column);
+    }
+    return size;
+}
+
+char* CollisionWireWriter::write_collision(const std::uint32_t row, char* output) const {
+    for (const FieldColumn& field_column : columns_) {
+        std::visit([&output, &field_column, row](const auto* column) {
+            const auto& value = (*column)[row];
+            if (value.has_value()) {
+                output = write_field(output, field_column.field_number, *value);
+            }
+        }, field_column.column);
+    }
+    return output;
+}
+
+void CollisionWireWriter::append_rows(const std::span<const std::uint32_t> rows, std::string& output) const {
+    const std::uint32_t collision_tag = tag(QUERY_RESPONSE_COLLISION_FIELD_NUMBER, WireType::LENGTH_DELIMITED);
+
+    // Each message is preceded by its length, so sizes are worked out before anything is written
+    std::vector<std::size_t> sizes(rows.size());
+    std::size_t total_size = 0;
+    for (std::size_t index = 0; index < rows.size(); ++index) {
+        sizes[index] = collision_size(rows[index]);
+        total_size += varint_size(collision_tag) + varint_size(sizes[index]) + sizes[index];
+    }
+
+    const std::size_t start = output.size();
+    output.resize(start + total_size);
+    char* position = output.data() + start;
+    for (std::size_t index = 0; index < rows.size(); ++index) {
+        position = write_varint(position, collision_tag);
+        position = write_varint(position, sizes[index]);
+        position = write_collision(rows[index], position);
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "collision.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <variant>
+#include <vector>
+
+// Field number of the repeated collision field of collision_proto::QueryResponse
+constexpr std::uint32_t QUERY_RESPONSE_COLLISION_FIELD_NUMBER = 4;
+
+// Writes collision_proto::Collision messages in the protobuf wire format straight from the columns
+// of a table, without copying rows into Collision or into the generated message classes. The
+// bytes are the ones CollisionProtoConverter::serialize() and SerializeToString() produce for the
+// same rows, dates as MM/DD/YYYY and times as HH:MM.
+class CollisionWireWriter {
+public:
+    // Writes the fields in fields of the rows of indexed_collisions, which must outlive the writer
+    CollisionWireWriter(const IndexedCollisions& indexed_collisions, const FieldMask& fields);
+
+    // Appends each of rows as an entry of the repeated collision field of a
+    // collision_proto::QueryResponse, so output may already hold the other fields of one
+    void append_rows(const std::span<const std::uint32_t> rows, std::string& output) const;
+    // Bytes of the collision_proto::Collision of row, without the tag and length in front of it
+    std::size_t collision_size(const std::uint32_t row) const;
+
+private:
+    using Column = std::variant<
+        const std::vector<std::optional<std::chrono::year_month_day>>*,
+        const std::vector<std::optional<std::chrono::hh_mm_ss<std::chrono::minutes>>>*,
+        const std::vector<std::optional<CollisionString>>*,
+        const std::vector<std::optional<std::uint32_t>>*,
+        const std::vector<std::optional<std::uint8_t>>*,
+        const std::vector<std::optional<std::size_t>>*,
+        const std::vector<std::optional<float>>*>;
+
+    struct FieldColumn {
+        std::uint32_t field_number;
+        Column column;
+    };
+
+    char* write_collision(const std::uint32_t row, char* output) const;
+
+    // In field number order, which is the order the generated classes write fields in
+    std::vector<FieldColumn> columns_;
+};
@@ -0,0 +1,299 @@
+#include "column_kernels.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+template<CompareOp Op, class T>
+bool compare(const T value, const T lower, const T upper) {
+    if constexpr (Op == CompareOp::EQUALS) {
+        return value == lower;
+    } else if constexpr (Op == CompareOp::LESS_THAN) {
+        return value < upper;
+    } else if constexpr (Op == CompareOp::GREATER_THAN) {
+        return value > lower;
+    } else {
+        return lower < value && value < upper;
+    }
+}
+
+template<CompareOp Op, class T>
+std::uint64_t block_mask_scalar(const T* values, const T lower, const T upper) {
+    std::uint64_t mask = 0;
+    for (std::size_t index = 0; index < ROWS_PER_MATCH_WORD; ++index) {
+        mask |= static_cast<std::uint64_t>(compare<Op>(values[index], lower, upper)) << index;
+    }
+    return mask;
+}
+
+template<CompareOp Op, bool Invert, class T>
+void scan_scalar(const DenseColumn<T>& column,
+                 const T lower,
+                 const T upper,
+                 const std::size_t start_word,
+                 const std::size_t end_word,
+                 std::uint64_t* matches) {
+    for (std::size_t word = start_word; word < end_word; ++word) {
+        if (matches[word] != 0) {
+            const std::uint64_t mask = block_mask_scalar<Op>(column.values.data() + word * ROWS_PER_MATCH_WORD, lower, upper) & column.validity[word];
+            matches[word] &= Invert ? ~mask : mask;
+        }
+    }
+}
+
+#if defined(__x86_64__)
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+#define AVX512_TARGET __attribute__((target("avx512f,avx512bw")))
+
+// Per column type loads, broadcasts and comparisons, each comparison returns one bit per lane.
+// AVX2 only compares signed integers, so unsigned ones are compared with their sign bit flipped.
+template<class T>
+struct Avx2Traits;
+
+template<>
+struct Avx2Traits<float> {
+    static constexpr std::size_t lanes = 8;
+    AVX2_TARGET static __m256 broadcast(const float value) { return _mm256_set1_ps(value); }
+    AVX2_TARGET static __m256 load(const float* values) { return _mm256_loadu_ps(values); }
+    AVX2_TARGET static std::uint64_t equal(const __m256 first, const __m256 second) {
+        return static_cast<std::uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(first, second, _CMP_EQ_OQ)));
+    }
+    AVX2_TARGET static std::uint64_t greater(const __m256 first, const __m256 second) {
+        return static_cast<std::uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(first, second, _CMP_GT_OQ)));
+    }
+};
+
+template<>
+struct Avx2Traits<std::uint8_t> {
+    static constexpr std::size_t lanes = 32;
+    AVX2_TARGET static __m256i broadcast(const std::uint8_t value) { return _mm256_set1_epi8(static_cast<char>(value)); }
+    AVX2_TARGET static __m256i load(const std::uint8_t* values) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values)); }
+    AVX2_TARGET static std::uint64_t equal(const __m256i first, const __m256i second) {
+        return static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(first, second)));
+    }
+    AVX2_TARGET static std::uint64_t greater(const __m256i first, const __m256i second) {
+        const __m256i sign = _mm256_set1_epi8(static_cast<char>(0x80));
+        return static_cast<std::uint32_t>(_mm256_movemask_epi8(
+            _mm256_cmpgt_epi8(_mm256_xor_si256(first, sign), _mm256_xor_si256(second, sign))));
+    }
+};
+
+template<>
+struct Avx2Traits<std::uint32_t> {
+    static constexpr std::size_t lanes = 8;
+    AVX2_TARGET static __m256i broadcast(const std::uint32_t value) { return _mm256_set1_epi32(static_cast<int>(value)); }
+    AVX2_TARGET static __m256i load(const std::uint32_t* values) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values)); }
+    AVX2_TARGET static std::uint64_t equal(const __m256i first, const __m256i second) {
+        return static_cast<std::uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(first, second))));
+    }
+    AVX2_TARGET static std::uint64_t greater(const __m256i first, const __m256i second) {
+        const __m256i sign = _mm256_set1_epi32(static_cast<int>(0x80000000U));
+        return static_cast<std::uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(
+            _mm256_cmpgt_epi32(_mm256_xor_si256(first, sign), _mm256_xor_si256(second, sign)))));
+    }
+};
+
+template<>
+struct Avx2Traits<std::uint64_t> {
+    static constexpr std::size_t lanes = 4;
+    AVX2_TARGET static __m256i broadcast(const std::uint64_t value) { return _mm256_set1_epi64x(static_cast<long long>(value)); }
+    AVX2_TARGET static __m256i load(const std::uint64_t* values) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values)); }
+    AVX2_TARGET static std::uint64_t equal(const __m256i first, const __m256i second) {
+        return static_cast<std::uint32_t>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(first, second))));
+    }
+    AVX2_TARGET static std::uint64_t greater(const __m256i first, const __m256i second) {
+        const __m256i sign = _mm256_set1_epi64x(static_cast<long long>(0x8000000000000000ULL));
+        return static_cast<std::uint32_t>(_mm256_movemask_pd(_mm256_castsi256_pd(
+            _mm256_cmpgt_epi64(_mm256_xor_si256(first, sign), _mm256_xor_si256(second, sign)))));
+    }
+};
+
+template<class T>
+struct Avx512Traits;
+
+template<>
+struct Avx512Traits<float> {
+    static constexpr std::size_t lanes = 16;
+    AVX512_TARGET static __m512 broadcast(const float value) { return _mm512_set1_ps(value); }
+    AVX512_TARGET static __m512 load(const float* values) { return _mm512_loadu_ps(values); }
+    AVX512_TARGET static std::uint64_t equal(const __m512 first, const __m512 second) { return _mm512_cmp_ps_mask(first, second, _CMP_EQ_OQ); }
+    AVX512_TARGET static std::uint64_t greater(const __m512 first, const __m512 second) { return _mm512_cmp_ps_mask(first, second, _CMP_GT_OQ); }
+};
+
+template<>
+struct Avx512Traits<std::uint8_t> {
+    static constexpr std::size_t lanes = 64;
+    AVX512_TARGET static __m512i broadcast(const std::uint8_t value) { return _mm512_set1_epi8(static_cast<char>(value)); }
+    AVX512_TARGET static __m512i load(const std::uint8_t* values) { return _mm512_loadu_si512(values); }
+    AVX512_TARGET static std::uint64_t equal(const __m512i first, const __m512i second) { return _mm512_cmpeq_epu8_mask(first, second); }
+    AVX512_TARGET static std::uint64_t greater(const __m512i first, const __m512i second) { return _mm512_cmpgt_epu8_mask(first, second); }
+};
+
+template<>
+struct Avx512Traits<std::uint32_t> {
+    static constexpr std::size_t lanes = 16;
+    AVX512_TARGET static __m512i broadcast(const std::uint32_t value) { return _mm512_set1_epi32(static_cast<int>(value)); }
+    AVX512_TARGET static __m512i load(const std::uint32_t* values) { return _mm512_loadu_si512(values); }
+    AVX512_TARGET static std::uint64_t equal(const __m512i first, const __m512i second) { return _mm512_cmpeq_epu32_mask(first, second); }
+    AVX512_TARGET static std::uint64_t greater(const __m512i first, const __m512i second) { return _mm512_cmpgt_epu32_mask(first, second); }
+};
+
+template<>
+struct Avx512Traits<std::uint64_t> {
+    static constexpr std::size_t lanes = 8;
+    AVX512_TARGET static __m512i broadcast(const std::uint64_t value) { return _mm512_set1_epi64(static_cast<long long>(value)); }
+    AVX512_TARGET static __m512i load(const std::uint64_t* values) { return _mm512_loadu_si512(values); }
+    AVX512_TARGET static std::uint64_t equal(const __m512i first, const __m512i second) { return _mm512_cmpeq_epu64_mask(first, second); }
+    AVX512_TARGET static std::uint64_t greater(const __m512i first, const __m512i second) { return _mm512_cmpgt_epu64_mask(first, second); }
+};
+
+// The block and scan bodies are repeated per instruction set, the intrinsics only inline into
+// functions compiled for the same target
+template<CompareOp Op, class T>
+AVX2_TARGET std::uint64_t block_mask_avx2(const T* values, const T lower, const T upper) {
+    using Traits = Avx2Traits<T>;
+    const auto lower_vector = Traits::broadcast(lower);
+    const auto upper_vector = Traits::broadcast(upper);
+
+    std::uint64_t mask = 0;
+    for (std::size_t index = 0; index < ROWS_PER_MATCH_WORD; index += Traits::lanes) {
+        const auto value = Traits::load(values + index);
+        std::uint64_t lanes_mask;
+        if constexpr (Op == CompareOp::EQUALS) {
+            lanes_mask = Traits::equal(value, lower_vector);
+        } else if constexpr (Op == CompareOp::LESS_THAN) {
+            lanes_mask = Traits::greater(upper_vector, value);
+        } else if constexpr (Op == CompareOp::GREATER_THAN) {
+            lanes_mask = Traits::greater(value, lower_vector);
+        } else {
+            lanes_mask = Traits::greater(value, lower_vector) & Traits::greater(upper_vector, value);
+        }
+        mask |= lanes_mask << index;
+    }
+    return mask;
+}
+
+template<CompareOp Op, bool Invert, class T>
+AVX2_TARGET void scan_avx2(const DenseColumn<T>& column,
+                           const T lower,
+                           const T upper,
+                           const std::size_t start_word,
+                           const std::size_t end_word,
+                           std::uint64_t* matches) {
+    for (std::size_t word = start_word; word < end_word; ++word) {
+        if (matches[word] != 0) {
+            const std::uint64_t mask = block_mask_avx2<Op>(column.values.data() + word * ROWS_PER_MATCH_WORD, lower, upper) & column.validity[word];
+            matches[word] &= Invert ? ~mask : mask;
+        }
+    }
+}
+
+template<CompareOp Op, class T>
+AVX512_TARGET std::uint64_t block_mask_avx512(const T* values, const T lower, const T upper) {
+    using Traits = Avx512Traits<T>;
+    const auto lower_vector = Traits::broadcast(lower);
+    const auto upper_vector = Traits::broadcast(upper);
+
+    std::uint64_t mask = 0;
+    for (std::size_t index = 0; index < ROWS_PER_MATCH_WORD; index += Traits::lanes) {
+        const auto value = Traits::load(values + index);
+        std::uint64_t lanes_mask;
+        if constexpr (Op == CompareOp::EQUALS) {
+            lanes_mask = Traits::equal(value, lower_vector);
+        } else if constexpr (Op == CompareOp::LESS_THAN) {
+            lanes_mask = Traits::greater(upper_vector, value);
+        } else if constexpr (Op == CompareOp::GREATER_THAN) {
+            lanes_mask = Traits::greater(value, lower_vector);
+        } else {
+            lanes_mask = Traits::greater(value, lower_vector) & Traits::greater(upper_vector, value);
+        }
+        mask |= lanes_mask << index;
+    }
+    return mask;
+}
+
+template<CompareOp Op, bool Invert, class T>
+AVX512_TARGET void scan_avx512(const DenseColumn<T>& column,
+                               const T lower,
+                               const T upper,
+                               const std::size_t start_word,
+                               const std::size_t end_word,
+                               std::uint64_t* matches) {
+    for (std::size_t word = start_word; word < end_word; ++word) {
+        if (matches[word] != 0) {
+            const std::uint64_t mask = block_mask_avx512<Op>(column.values.data() + word * ROWS_PER_MATCH_WORD, lower, upper) & column.validity[word];
+            matches[word] &= Invert ? ~mask : mask;
+        }
+    }
+}
+
+#endif
+
+template<class T>
+using ScanFunction = void (*)(const DenseColumn<T>&, T, T, std::size_t, std::size_t, std::uint64_t*);
+
+template<class T, CompareOp Op, bool Invert>
+ScanFunction<T> select_scan(const SimdLevel simd_level) {
+#if defined(__x86_64__)
+    switch(simd_level) {
+    case SimdLevel::AVX512:
+        return scan_avx512<Op, Invert, T>;
+    case SimdLevel::AVX2:
+        return scan_avx2<Op, Invert, T>;
+    case SimdLevel::SCALAR:
+    default:
+        break;
+    }
+#endif
+    return scan_scalar<Op, Invert, T>;
+}
+
+template<class T, bool Invert>
+ScanFunction<T> select_scan(const CompareOp op, const SimdLevel simd_level) {
+    switch(op) {
+    case CompareOp::EQUALS:
+        return select_scan<T, CompareOp::EQUALS, Invert>(simd_level);
+    case CompareOp::LESS_THAN:
+        return select_scan<T, CompareOp::LESS_THAN, Invert>(simd_level);
+    case CompareOp::GREATER_THAN:
+        return select_scan<T, CompareOp::GREATER_THAN, Invert>(simd_level);
+    case CompareOp::BETWEEN:
+    default:
+        return select_scan<T, CompareOp::BETWEEN, Invert>(simd_level);
+    }
+}
+
+}
+
+SimdLevel supported_simd_level() {
+#if defined(__x86_64__)
+    static const SimdLevel simd_level = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") ? SimdLevel::AVX512
+                                      : __builtin_cpu_supports("avx2") ? SimdLevel::AVX2
+                                      : SimdLevel::SCALAR;
+    return simd_level;
+#else
+    return SimdLevel::SCALAR;
+#endif
+}
+
+template<class T>
+void match_dense_column(const DenseColumn<T>& column,
+                        const CompareOp op,
+                        const T lower,
+                        const T upper,
+                        const bool invert,
+                        const std::size_t start_word,
+                        const std::size_t end_word,
+                        std::uint64_t* matches,
+                        const SimdLevel simd_level) {
+    const ScanFunction<T> scan = invert ? select_scan<T, true>(op, simd_level) : select_scan<T, false>(op, simd_level);
+    scan(column, lower, upper, start_word, end_word, matches);
+}
+
+template void match_dense_column(const DenseColumn<float>&, CompareOp, float, float, bool, std::size_t, std::size_t, std::uint64_t*, SimdLevel);
+template void match_dense_column(const DenseColumn<std::uint8_t>&, CompareOp, std::uint8_t, std::uint8_t, bool, std::size_t, std::size_t, std::uint64_t*, SimdLevel);
+template void match_dense_column(const DenseColumn<std::uint32_t>&, CompareOp, std::uint32_t, std::uint32_t, bool, std::size_t, std::size_t, std::uint64_t*, SimdLevel);
+template void match_dense_column(const DenseColumn<std::uint64_t>&, CompareOp, std::uint64_t, std::uint64_t, bool, std::size_t, std::size_t, std::uint64_t*, SimdLevel);
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+// Matches are kept one bit per row, row r is bit r % 64 of word r / 64
+constexpr std::size_t ROWS_PER_MATCH_WORD = 64;
+
+inline std::size_t match_words(const std::size_t num_rows) {
+    return (num_rows + ROWS_PER_MATCH_WORD - 1) / ROWS_PER_MATCH_WORD;
+}
+
+// Copy of a numeric column without the std::optional wrapper, so that a predicate can be checked
+// on a whole vector of values at once. Rows without a value hold T{} and are cleared in validity.
+// Both arrays are padded to a whole match word, so kernels never need a scalar tail loop.
+template<class T>
+struct DenseColumn {
+    std::vector<T> values;
+    std::vector<std::uint64_t> validity;
+
+    DenseColumn() = default;
+
+    explicit DenseColumn(const std::vector<std::optional<T>>& items)
+      : values(match_words(items.size()) * ROWS_PER_MATCH_WORD, T{}),
+        validity(match_words(items.size()), 0)
+    {
+        for (std::size_t row = 0; row < items.size(); ++row) {
+            if (items[row].has_value()) {
+                values[row] = *items[row];
+                validity[row / ROWS_PER_MATCH_WORD] |= std::uint64_t{1} << (row % ROWS_PER_MATCH_WORD);
+            }
+        }
+    }
+};
+
+// EQUALS matches value == lower, LESS_THAN value < upper, GREATER_THAN value > lower and
+// BETWEEN lower < value < upper
+enum class CompareOp { EQUALS, LESS_THAN, GREATER_THAN, BETWEEN };
+
+enum class SimdLevel { SCALAR, AVX2, AVX512 };
+
+// Widest instruction set both the build target and the running CPU support
+SimdLevel supported_simd_level();
+
+// Clears the bits in matches[start_word, end_word) of the rows that do not satisfy op, or that do
+// when invert is set. Rows without a value never satisfy op. Words already zero are skipped.
+template<class T>
+void match_dense_column(const DenseColumn<T>& column,
+                        const CompareOp op,
+                        const T lower,
+                        const T upper,
+                        const bool invert,
+                        const std::size_t start_word,
+                        const std::size_t end_word,
+                        std::uint64_t* matches,
+                        const SimdLevel simd_level = supported_simd_level());
@@ -2,9 +2,11 @@
 
 #include "collision_field_enum.hpp"
 
+#include <algorithm>
 #include <chrono>
 #include <stdexcept>
 #include <string>
+#include <utility>
 
 const CollisionField& FieldQuery::get_name() const {
     return name_;
@@ -18,6 +20,10 @@ const Value& FieldQuery::get_value() const {
     return value_;
 }
 
+const std::vector<Value>& FieldQuery::get_values() const {
+    return values_;
+}
+
 const bool FieldQuery::invert_match() const {
     return invert_match_;
 }
@@ -40,11 +46,38 @@ Value maybe_convert_value_to_fixed_string(const CollisionField& name, const Valu
     }
 }
 
+std::vector<Value> maybe_convert_values_to_fixed_string(const CollisionField& name, const std::vector<Value>& values) {
+    std::vector<Value> new_values{};
+    new_values.reserve(values.size());
+    for (const Value& value : values) {
+        new_values.push_back(maybe_convert_value_to_fixed_string(name, value));
+    }
+    return new_values;
+}
+
 FieldQuery Query::create_field_query(const CollisionField& name,
                                      const Qualifier& not_qualifier,
                                      const QueryType& type,
-                                     const Value value,
+                                     const std::vector<Value>& values,
                                      const Qualifier& case_insensitive_qualifier) {
+    if (values.empty()) {
+        throw std::invalid_argument("No value provided for query!");
+    } else if (values.size() > 1 && type != QueryType::IN) {
+        throw std::invalid_argument("Only QueryType::IN takes more than one value!");
+    }
+
+    for (const Value& value : values) {
+        validate_value(name, value);
+    }
+
+    return FieldQuery(name,
+                      type,
+                      values,
+                      not_qualifier == Qualifier::NOT,
+                      case_insensitive_qualifier == Qualifier::CASE_INSENSITIVE);
+}
+
+void Query::validate_value(const CollisionField& name, const Value& value) {
     std::visit([&name](auto&& val) {
         using T = std::decay_t<decltype(val)>;
 
@@ -89,18 +122,78 @@ FieldQuery Query::create_field_query(const CollisionField& name,
             throw std::invalid_argument("Invalid field_name provided for std::string!");
         }
     }, value);
+}
+
+namespace {
+
+QueryExpression condition_expression(const std::size_t condition_index) {
+    return QueryExpression{.op = QueryOperator::CONDITION, .condition_index = condition_index, .children = {}};
+}
+
+// expression with its conditions moved offset positions further into the query
+QueryExpression shift_conditions(QueryExpression expression, const std::size_t offset) {
+    expression.condition_index += expression.op == QueryOperator::CONDITION ? offset : 0;
+    for (QueryExpression& child : expression.children) {
+        child = shift_conditions(std::move(child), offset);
+    }
+    return expression;
+}
+
+void validate_expression(const QueryExpression& expression, const std::size_t num_conditions) {
+    switch(expression.op) {
+    case QueryOperator::CONDITION:
+        if (expression.condition_index >= num_conditions) {
+            throw std::invalid_argument("Query expression refers to a condition the query does not have!");
+        }
+        return;
+    case QueryOperator::AND:
+    case QueryOperator::OR:
+        if (expression.children.empty()) {
+            throw std::invalid_argument("Query expression AND/OR needs at least one operand!");
+        }
+        break;
+    case QueryOperator::NOT:
+        if (expression.children.size() != 1) {
+            throw std::invalid_argument("Query expression NOT needs exactly one operand!");
+        }
+        break;
+    default:
+        throw std::invalid_argument("Unknown query expression operator!");
+    }
+
+    for (const QueryExpression& child : expression.children) {
+        validate_expression(child, num_conditions);
+    }
+}
 
-    return FieldQuery(name,
-                      type,
-                      value,
-                      not_qualifier == Qualifier::NOT,
-                      case_insensitive_qualifier == Qualifier::CASE_INSENSITIVE);
 }
 
 const std::vector<FieldQuery>& Query::get() const {
     return queries;
 }
 
+bool Query::is_conjunction() const {
+    return !expression.has_value();
+}
+
+QueryExpression Query::get_expression() const {
+    if (expression.has_value()) {
+        return *expression;
+    }
+
+    QueryExpression conjunction{};
+    for (std::size_t condition_index = 0; condition_index < queries.size(); ++condition_index) {
+        conjunction.children.push_back(condition_expression(condition_index));
+    }
+    return conjunction;
+}
+
+Query& Query::set_expression(const QueryExpression& expression) {
+    validate_expression(expression, queries.size());
+    this->expression = expression;
+    return *this;
+}
+
 Query& Query::add(const CollisionField& name, const QueryType& type, const Value value) {
     return add(name, Qualifier::NONE, type, value, Qualifier::NONE);
 }
@@ -114,26 +207,192 @@ Query& Query::add(const CollisionField& name, const QueryType& type, const Value
 }
 
 Query& Query::add(const CollisionField& name, const Qualifier& not_qualifier, const QueryType& type, const Value value, const Qualifier& case_insensitive_qualifier) {
-    Value maybe_new_value = maybe_convert_value_to_fixed_string(name, value);
+    return add(name, not_qualifier, type, std::vector<Value>{value}, case_insensitive_qualifier);
+}
+
+Query& Query::add(const CollisionField& name, const QueryType& type, const std::vector<Value>& values) {
+    return add(name, Qualifier::NONE, type, values, Qualifier::NONE);
+}
+
+Query& Query::add(const CollisionField& name, const Qualifier& not_qualifier, const QueryType& type, const std::vector<Value>& values) {
+    return add(name, not_qualifier, type, values, Qualifier::NONE);
+}
+
+Query& Query::add(const CollisionField& name, const QueryType& type, const std::vector<Value>& values, const Qualifier& case_insensitive_qualifier) {
+    return add(name, Qualifier::NONE, type, values, case_insensitive_qualifier);
+}
+
+Query& Query::add(const CollisionField& name, const Qualifier& not_qualifier, const QueryType& type, const std::vector<Value>& values, const Qualifier& case_insensitive_qualifier) {
     return add(create_field_query(name,
                                   not_qualifier,
                                   type,
-                                  maybe_new_value,
+                                  maybe_convert_values_to_fixed_string(name, values),
                                   case_insensitive_qualifier));
 }
 
+const std::optional<QueryOrder>& Query::get_order() const {
+    return order;
+}
+
+Query& Query::order_by(const CollisionField& field, const SortDirection& direction) {
+    if (field == CollisionField::UNDEFINED) {
+        throw std::invalid_argument("Invalid field_name provided for order_by!");
+    }
+    order = QueryOrder{.field = field, .direction = direction};
+    return *this;
+}
+
+const std::optional<std::size_t>& Query::get_limit() const {
+    return limit;
+}
+
+Query& Query::set_limit(const std::size_t limit) {
+    this->limit = limit;
+    return *this;
+}
+
+const std::optional<Aggregation>& Query::get_aggregation() const {
+    return aggregation;
+}
+
+Query& Query::aggregate(const Aggregation& aggregation) {
+    if (aggregation.aggregates.empty()) {
+        throw std::invalid_argument("Aggregation without aggregates provided!");
+    }
+    if (aggregation.group_by.size() > MAX_GROUP_BY_FIELDS) {
+        throw std::invalid_argument("Too many group_by fields provided for aggregation!");
+    }
+
+    for (const GroupByField& group_by : aggregation.group_by) {
+        if (group_by.field == CollisionField::UNDEFINED) {
+            throw std::invalid_argument("Invalid field_name provided for group_by!");
+        }
+        if (group_by.bucket != DateBucket::DAY && group_by.field != CollisionField::CRASH_DATE) {
+            throw std::invalid_argument("Date bucket provided for group_by of a field that is not a date!");
+        }
+    }
+
+    for (const AggregateSpec& spec : aggregation.aggregates) {
+        if (spec.function == AggregateFunction::COUNT) {
+            continue;
+        }
+        if (spec.field == CollisionField::UNDEFINED) {
+            throw std::invalid_argument("Invalid field_name provided for aggregate!");
+        }
+        switch (field_to_value_type(spec.field)) {
+            case FieldValueType::UINT8_T:
+            case FieldValueType::UINT32_T:
+            case FieldValueType::SIZE_T:
+            case FieldValueType::FLOAT:
+                break;
+            default:
+                throw std::invalid_argument("Aggregate of a field that is not numeric provided!");
+        }
+    }
+
+    this->aggregation = aggregation;
+    return *this;
+}
+
+Query& Query::count_only() {
+    return aggregate({.group_by = {}, .aggregates = {{AggregateFunction::COUNT}}});
+}
+
+bool Query::is_count_only() const {
+    if (!aggregation.has_value() || !aggregation->group_by.empty()) {
+        return false;
+    }
+    return std::all_of(aggregation->aggregates.begin(), aggregation->aggregates.end(), [](const AggregateSpec& spec) {
+        return spec.function == AggregateFunction::COUNT && spec.field == CollisionField::UNDEFINED;
+    });
+}
+
+const std::optional<FieldMask>& Query::get_projection() const {
+    return projection;
+}
+
+Query& Query::select(const std::vector<CollisionField>& fields) {
+    if (fields.empty()) {
+        throw std::invalid_argument("No fields provided to select!");
+    }
+
+    FieldMask mask{};
+    for (const CollisionField field : fields) {
+        if (field == CollisionField::UNDEFINED) {
+            throw std::invalid_argument("Invalid field_name provided to select!");
+        }
+        mask.set(static_cast<std::size_t>(field));
+    }
+    projection = mask;
+    return *this;
+}
+
+FieldMask Query::get_result_fields() const {
+    if (!projection.has_value()) {
+        return all_fields();
+    }
+
+    FieldMask fields = *projection;
+    if (order.has_value()) {
+        fields.set(static_cast<std::size_t>(order->field));
+        fields.set(static_cast<std::size_t>(CollisionField::COLLISION_ID));
+    }
+    return fields;
+}
+
 Query& Query::add(const Query& query) {
-    for (const FieldQuery& field_query : query.queries) {
-        add(std::move(field_query));
+    if (queries.empty()) {
+        queries = query.queries;
+        expression = query.expression;
+        return *this;
+    } else if (is_conjunction() && query.is_conjunction()) {
+        for (const FieldQuery& field_query : query.queries) {
+            add(std::move(field_query));
+        }
+        return *this;
     }
+
+    QueryExpression conjunction{};
+    conjunction.children.push_back(get_expression());
+    conjunction.children.push_back(shift_conditions(query.get_expression(), queries.size()));
+    queries.insert(queries.end(), query.queries.begin(), query.queries.end());
+    expression = std::move(conjunction);
     return *this;
 }
 
 Query& Query::add(const FieldQuery&& field_query) {
+    if (expression.has_value()) {
+        if (expression->op != QueryOperator::AND) {
+            expression = QueryExpression{.op = QueryOperator::AND, .condition_index = 0, .children = {std::move(*expression)}};
+        }
+        expression->children.push_back(condition_expression(queries.size()));
+    }
     queries.push_back(field_query);
     return *this;
 }
 
+Query Query::any_of(const std::vector<Query>& queries) {
+    if (queries.empty()) {
+        throw std::invalid_argument("Query::any_of needs at least one query!");
+    }
+
+    Query disjunction{};
+    QueryExpression expression{.op = QueryOperator::OR, .condition_index = 0, .children = {}};
+    for (const Query& query : queries) {
+        expression.children.push_back(shift_conditions(query.get_expression(), disjunction.queries.size()));
+        disjunction.queries.insert(disjunction.queries.end(), query.queries.begin(), query.queries.end());
+    }
+    disjunction.expression = std::move(expression);
+    return disjunction;
+}
+
+Query Query::negate(const Query& query) {
+    Query negation{};
+    negation.queries = query.queries;
+    negation.expression = QueryExpression{.op = QueryOperator::NOT, .condition_index = 0, .children = {query.get_expression()}};
+    return negation;
+}
+
 Query Query::create(const CollisionField& name, const QueryType& type, const Value value) {
     return create(name, Qualifier::NONE, type, value, Qualifier::NONE);
 }
@@ -147,10 +406,25 @@ Query Query::create(const CollisionField& name, const QueryType& type, const Val
 }
 
 Query Query::create(const CollisionField& name, const Qualifier& not_qualifier, const QueryType& type, const Value value, const Qualifier& case_insensitive_qualifier) {
-    Value maybe_new_value = maybe_convert_value_to_fixed_string(name, value);
+    return create(name, not_qualifier, type, std::vector<Value>{value}, case_insensitive_qualifier);
+}
+
+Query Query::create(const CollisionField& name, const QueryType& type, const std::vector<Value>& values) {
+    return create(name, Qualifier::NONE, type, values, Qualifier::NONE);
+}
+
+Query Query::create(const CollisionField& name, const Qualifier& not_qualifier, const QueryType& type, const std::vector<Value>& values) {
+    return create(name, not_qualifier, type, values, Qualifier::NONE);
+}
+
+Query Query::create(const CollisionField& name, const QueryType& type, const std::vector<Value>& values, const Qualifier& case_insensitive_qualifier) {
+    return create(name, Qualifier::NONE, type, values, case_insensitive_qualifier);
+}
+
+Query Query::create(const CollisionField& name, const Qualifier& not_qualifier, const QueryType& type, const std::vector<Value>& values, const Qualifier& case_insensitive_qualifier) {
     return Query(create_field_query(name,
                                     not_qualifier,
                                     type,
-                                    maybe_new_value,
+                                    maybe_convert_values_to_fixed_string(name, values),
                                     case_insensitive_qualifier));
 }
@@ -5,8 +5,10 @@
 
 #include <cassert>
 #include <chrono>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <vector>
 
 using Value = std::variant<
     float,
@@ -18,21 +20,24 @@ using Value = std::variant<
     std::uint32_t,
     CollisionString>;
 
-enum class QueryType { HAS_VALUE, EQUALS, LESS_THAN, GREATER_THAN, CONTAINS };
+// IN matches a value equal to any one of a list of values
+enum class QueryType { HAS_VALUE, EQUALS, LESS_THAN, GREATER_THAN, CONTAINS, IN };
 enum class Qualifier { NONE, NOT, CASE_INSENSITIVE };
 
 class FieldQuery {
 private:
-    FieldQuery(const CollisionField& name, const QueryType& type, const Value& value, bool invert_match, bool case_insensitive)
+    FieldQuery(const CollisionField& name, const QueryType& type, const std::vector<Value>& values, bool invert_match, bool case_insensitive)
       : name_{name},
         type_{type},
-        value_{value},
+        value_{values.front()},
+        values_{values},
         invert_match_{invert_match},
         case_insensitive_{case_insensitive} {}
 
     CollisionField name_;
     QueryType type_;
     Value value_;
+    std::vector<Value> values_;
     bool invert_match_;
     bool case_insensitive_;
 
@@ -43,10 +48,60 @@ public:
     const CollisionField& get_name() const;
     const QueryType& get_type() const;
     const Value& get_value() const;
+    // Every value of an IN, the single value otherwise
+    const std::vector<Value>& get_values() const;
     const bool invert_match() const;
     const bool case_insensitive() const;
 };
 
+enum class QueryOperator { CONDITION, AND, OR, NOT };
+
+// Node of a boolean expression over the conditions of a Query
+struct QueryExpression {
+    QueryOperator op = QueryOperator::AND;
+    // Position of the condition in Query::get(), for CONDITION
+    std::size_t condition_index = 0;
+    // Operands of AND and OR, or the single operand of NOT
+    std::vector<QueryExpression> children;
+};
+
+enum class SortDirection { ASCENDING, DESCENDING };
+
+// Order of the rows a query returns. Rows without a value for field come last in either
+// direction, and rows with equal values come in ascending collision_id order, so that every
+// rank agrees on a single order.
+struct QueryOrder {
+    CollisionField field;
+    SortDirection direction = SortDirection::ASCENDING;
+};
+
+enum class AggregateFunction { COUNT, SUM, MIN, MAX };
+
+// COUNT counts the rows with a value for field, or every row when field is UNDEFINED. SUM, MIN
+// and MAX take the numeric values of field and skip the rows without one.
+struct AggregateSpec {
+    AggregateFunction function;
+    CollisionField field = CollisionField::UNDEFINED;
+};
+
+// Crash dates can be grouped by the month or the year they fall in
+enum class DateBucket { DAY, MONTH, YEAR };
+
+struct GroupByField {
+    CollisionField field;
+    DateBucket bucket = DateBucket::DAY;
+};
+
+// Most fields a query can group by
+constexpr std::size_t MAX_GROUP_BY_FIELDS = 4;
+
+// Aggregates over the matching rows of a query, one set of them for each distinct combination
+// of values of the group_by fields, or a single set without group_by fields
+struct Aggregation {
+    std::vector<GroupByField> group_by;
+    std::vector<AggregateSpec> aggregates;
+};
+
 class Query {
 public:
     Query() : queries{} {}
@@ -57,16 +112,65 @@ private:
       {}
 
     std::vector<FieldQuery> queries;
+    // Unset while every condition must match
+    std::optional<QueryExpression> expression;
+    // Rows come in any order, and all of them, while unset
+    std::optional<QueryOrder> order;
+    std::optional<std::size_t> limit;
+    // Rows are returned while unset, their aggregates otherwise
+    std::optional<Aggregation> aggregation;
+    // Every field of the rows is returned while unset
+    std::optional<FieldMask> projection;
 
     static FieldQuery create_field_query(const CollisionField& name,
                                          const Qualifier& not_qualifier,
                                          const QueryType& type,
-                                         const Value value,
+                                         const std::vector<Value>& values,
                                          const Qualifier& case_insensitive_qualifier);
+    // Throws std::invalid_argument when value is not of the type stored for name
+    static void validate_value(const CollisionField& name, const Value& value);
 
 public:
+    // Every condition of the query, the expression refers to them by position
     const std::vector<FieldQuery>& get() const;
 
+    // Whether a row must match every condition, as opposed to an arbitrary expression
+    bool is_conjunction() const;
+    // The expression rows must match, an AND of every condition for a conjunction
+    QueryExpression get_expression() const;
+    // Replaces how the conditions combine, throws std::invalid_argument for an expression
+    // that refers to conditions the query does not have or gives NOT other than one operand
+    Query& set_expression(const QueryExpression& expression);
+
+    const std::optional<QueryOrder>& get_order() const;
+    // Sorts the matching rows, see QueryOrder
+    Query& order_by(const CollisionField& field, const SortDirection& direction = SortDirection::ASCENDING);
+    const std::optional<std::size_t>& get_limit() const;
+    // Returns only the first limit matching rows, in the order of the query if it has one
+    Query& set_limit(const std::size_t limit);
+    const std::optional<Aggregation>& get_aggregation() const;
+    // Answers the query with aggregates of the matching rows instead of the rows, which ignores
+    // the order and limit. Throws std::invalid_argument for an aggregation without aggregates,
+    // with more than MAX_GROUP_BY_FIELDS group_by fields, a date bucket on a field other than
+    // CRASH_DATE, or SUM, MIN or MAX of a field that is not numeric.
+    Query& aggregate(const Aggregation& aggregation);
+    // Answers the query with the number of matching rows, as the aggregation of a single COUNT
+    // of every row without group_by fields
+    Query& count_only();
+    // Whether the aggregation of the query only counts the matching rows, which is answered
+    // from the matches without visiting each row
+    bool is_count_only() const;
+
+    const std::optional<FieldMask>& get_projection() const;
+    // Returns only fields of the matching rows, their other fields are left unset. Throws
+    // std::invalid_argument for an empty list of fields or an UNDEFINED field.
+    Query& select(const std::vector<CollisionField>& fields);
+    // The fields the rows of the query carry: the selected fields, along with the order field and
+    // collision_id of an ordered query, which ranks need to merge their rows, or every field
+    FieldMask get_result_fields() const;
+
+    // ANDs the conditions of query, the order, limit, aggregation and projection stay those of
+    // this query
     Query& add(const Query& query);
     Query& add(const CollisionField& name, const QueryType& type, const Value value);
     Query& add(const CollisionField& name, const Qualifier& not_qualifier, const QueryType& type, const Value value);
@@ -78,6 +182,25 @@ public:
     static Query create(const CollisionField& name, const QueryType& type, const Value value, const Qualifier& case_insensitive_qualifier);
     static Query create(const CollisionField& name, const Qualifier& not_qualifier, const QueryType& type, const Value value, const Qualifier& case_insensitive_qualifier);
 
+    // Conditions on a list of values, which only QueryType::IN takes. Throws std::invalid_argument
+    // for an empty list, or a list of more than one value for any other QueryType.
+    Query& add(const CollisionField& name, const QueryType& type, const std::vector<Value>& values);
+    Query& add(const CollisionField& name, const Qualifier& not_qualifier, const QueryType& type, const std::vector<Value>& values);
+    Query& add(const CollisionField& name, const QueryType& type, const std::vector<Value>& values, const Qualifier& case_insensitive_qualifier);
+    Query& add(const CollisionField& name, const Qualifier& not_qualifier, const QueryType& type, const std::vector<Value>& values, const Qualifier& case_insensitive_qualifier);
+
+    static Query create(const CollisionField& name, const QueryType& type, const std::vector<Value>& values);
+    static Query create(const CollisionField& name, const Qualifier& not_qualifier, const QueryType& type, const std::vector<Value>& values);
+    static Query create(const CollisionField& name, const QueryType& type, const std::vector<Value>& values, const Qualifier& case_insensitive_qualifier);
+    static Query create(const CollisionField& name, const Qualifier& not_qualifier, const QueryType& type, const std::vector<Value>& values, const Qualifier& case_insensitive_qualifier);
+
+    // Matches the rows that match at least one of queries, add() ANDs queries instead. Like
+    // negate(), only the conditions are combined, the result has no order, limit, aggregation or
+    // projection.
+    static Query any_of(const std::vector<Query>& queries);
+    // Matches the rows that do not match query
+    static Query negate(const Query& query);
+
 private:
     Query& add(const FieldQuery&& field_query);
 };
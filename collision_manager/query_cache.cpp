@@ -0,0 +1,140 @@
+#include "query_cache.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Strings are prefixed with their length, so that no value can be mistaken for a separator
+void append_text(std::string& key, const std::string_view text) {
+    key += std::to_string(text.size());
+    key += ':';
+    key += text;
+}
+
+void append_value(std::string& key, const Value& value) {
+    key += std::to_string(value.index());
+    key += '=';
+    std::visit([&key](auto&& val) {
+        using T = std::decay_t<decltype(val)>;
+
+        if constexpr (std::is_same_v<T, float>) {
+            char buffer[32];
+            const auto [end, error] = std::to_chars(buffer, buffer + sizeof(buffer), val);
+            key.append(buffer, end);
+        } else if constexpr (std::is_same_v<T, std::string>) {
+            append_text(key, val);
+        } else if constexpr (std::is_same_v<T, CollisionString>) {
+            append_text(key, val.c_str());
+        } else if constexpr (std::is_same_v<T, std::chrono::year_month_day>) {
+            key += std::to_string(std::chrono::sys_days(val).time_since_epoch().count());
+        } else if constexpr (std::is_same_v<T, std::chrono::hh_mm_ss<std::chrono::minutes>>) {
+            key += std::to_string(val.to_duration().count());
+        } else {
+            key += std::to_string(val);
+        }
+    }, value);
+}
+
+std::string condition_key(const FieldQuery& field_query) {
+    std::string key = "(";
+    key += std::to_string(static_cast<int>(field_query.get_name()));
+    key += ' ';
+    key += std::to_string(static_cast<int>(field_query.get_type()));
+    key += field_query.invert_match() ? " not" : "";
+    key += field_query.case_insensitive() ? " ci" : "";
+
+    // An IN matches the same rows whatever the order of its values
+    std::vector<std::string> values{};
+    for (const Value& value : field_query.get_values()) {
+        append_value(values.emplace_back(), value);
+    }
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+    for (const std::string& value : values) {
+        key += ' ';
+        key += value;
+    }
+    return key + ")";
+}
+
+std::string expression_key(const std::vector<FieldQuery>& field_queries, const QueryExpression& expression);
+
+// Keys of the operands of an AND or OR, with the operands of nested operators of the same kind
+// taken in as operands of their own
+void collect_operand_keys(const std::vector<FieldQuery>& field_queries,
+                          const QueryExpression& expression,
+                          const QueryOperator op,
+                          std::vector<std::string>& keys) {
+    for (const QueryExpression& child : expression.children) {
+        if (child.op == op) {
+            collect_operand_keys(field_queries, child, op, keys);
+        } else {
+            keys.push_back(expression_key(field_queries, child));
+        }
+    }
+}
+
+std::string expression_key(const std::vector<FieldQuery>& field_queries, const QueryExpression& expression) {
+    switch(expression.op) {
+    case QueryOperator::CONDITION:
+        return condition_key(field_queries.at(expression.condition_index));
+    case QueryOperator::NOT:
+        return "!" + expression_key(field_queries, expression.children.front());
+    case QueryOperator::AND:
+    case QueryOperator::OR: {
+        std::vector<std::string> keys{};
+        collect_operand_keys(field_queries, expression, expression.op, keys);
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        if (keys.size() == 1) {
+            return keys.front();
+        }
+
+        std::string key = expression.op == QueryOperator::AND ? "&[" : "|[";
+        for (const std::string& operand : keys) {
+            key += operand;
+        }
+        return key + "]";
+    }
+    default:
+        throw std::runtime_error("Unknown query expression operator!");
+    }
+}
+}
+
+std::string canonical_conditions_key(const Query& query) {
+    return expression_key(query.get(), query.get_expression());
+}
+
+std::string canonical_query_key(const Query& query) {
+    std::string key = canonical_conditions_key(query);
+
+    if (query.get_aggregation().has_value()) {
+        // The aggregates are answered in the order of the aggregation, so it is kept
+        key += " group";
+        for (const GroupByField& group_by : query.get_aggregation()->group_by) {
+            key += ' ' + std::to_string(static_cast<int>(group_by.field)) + '/' + std::to_string(static_cast<int>(group_by.bucket));
+        }
+        key += " aggregate";
+        for (const AggregateSpec& aggregate : query.get_aggregation()->aggregates) {
+            key += ' ' + std::to_string(static_cast<int>(aggregate.function)) + '/' + std::to_string(static_cast<int>(aggregate.field));
+        }
+        return key;
+    }
+
+    if (query.get_order().has_value()) {
+        key += " order " + std::to_string(static_cast<int>(query.get_order()->field)) + '/' +
+               std::to_string(static_cast<int>(query.get_order()->direction));
+    }
+    if (query.get_limit().has_value()) {
+        key += " limit " + std::to_string(*query.get_limit());
+    }
+    if (query.get_projection().has_value()) {
+        key += " fields " + query.get_result_fields().to_string();
+    }
+    return key;
+}
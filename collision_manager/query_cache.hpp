@@ -0,0 +1,130 @@
+#pragma once
+
+#include "query.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+// Text of the conditions of query that is the same for every query matching the same rows by
+// construction: operands of AND and OR are sorted and deduplicated, nested ANDs and ORs are
+// flattened and the values of an IN are sorted. The order, limit, aggregation and
+// projection are left out.
+std::string canonical_conditions_key(const Query& query);
+// canonical_conditions_key() followed by the order, limit, aggregation and projection of query
+std::string canonical_query_key(const Query& query);
+
+struct QueryCacheStatistics {
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    std::uint64_t evictions = 0;
+    std::size_t entries = 0;
+    std::size_t bytes = 0;
+    std::size_t capacity_bytes = 0;
+};
+
+// Least recently used cache of query results within a budget of bytes. Values are shared, so a
+// value stays valid for whoever got it after it is evicted. Safe to use from several threads.
+template<class V>
+class QueryCache {
+public:
+    // A cache with a capacity of 0 bytes keeps nothing and counts nothing
+    explicit QueryCache(const std::size_t capacity_bytes = 0) : capacity_bytes_{capacity_bytes} {}
+
+    bool enabled() const {
+        return capacity_bytes_ > 0;
+    }
+
+    // The value cached for key, marked as most recently used, or nullptr
+    std::shared_ptr<const V> get(const std::string& key) {
+        if (!enabled()) {
+            return nullptr;
+        }
+
+        std::lock_guard<std::mutex> lock(*mutex_);
+        const auto entry = index_.find(key);
+        if (entry == index_.end()) {
+            ++statistics_.misses;
+            return nullptr;
+        }
+        ++statistics_.hits;
+        entries_.splice(entries_.begin(), entries_, entry->second);
+        return entry->second->value;
+    }
+
+    // Caches value for key, bytes being the memory it holds, evicting the least recently used
+    // values until it fits. A value larger than the whole capacity is not cached.
+    void put(const std::string& key, std::shared_ptr<const V> value, const std::size_t bytes) {
+        const std::size_t entry_bytes = bytes + key.size();
+        if (!enabled() || entry_bytes > capacity_bytes_) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(*mutex_);
+        if (const auto entry = index_.find(key); entry != index_.end()) {
+            erase(entry->second);
+        }
+        while (statistics_.bytes + entry_bytes > capacity_bytes_) {
+            erase(std::prev(entries_.end()));
+            ++statistics_.evictions;
+        }
+
+        entries_.push_front(Entry{key, std::move(value), entry_bytes});
+        index_.emplace(key, entries_.begin());
+        statistics_.bytes += entry_bytes;
+        ++statistics_.entries;
+    }
+
+    // Drops every value, the counters are kept
+    void clear() {
+        std::lock_guard<std::mutex> lock(*mutex_);
+        entries_.clear();
+        index_.clear();
+        statistics_.bytes = 0;
+        statistics_.entries = 0;
+    }
+
+    // Drops every value that does not fit in the new capacity
+    void set_capacity(const std::size_t capacity_bytes) {
+        std::lock_guard<std::mutex> lock(*mutex_);
+        capacity_bytes_ = capacity_bytes;
+        while (statistics_.bytes > capacity_bytes_) {
+            erase(std::prev(entries_.end()));
+            ++statistics_.evictions;
+        }
+    }
+
+    QueryCacheStatistics get_statistics() const {
+        std::lock_guard<std::mutex> lock(*mutex_);
+        QueryCacheStatistics statistics = statistics_;
+        statistics.capacity_bytes = capacity_bytes_;
+        return statistics;
+    }
+
+private:
+    struct Entry {
+        std::string key;
+        std::shared_ptr<const V> value;
+        std::size_t bytes;
+    };
+
+    void erase(const typename std::list<Entry>::iterator entry) {
+        statistics_.bytes -= entry->bytes;
+        --statistics_.entries;
+        index_.erase(entry->key);
+        entries_.erase(entry);
+    }
+
+    std::size_t capacity_bytes_;
+    // Most recently used first
+    std::list<Entry> entries_;
+    std::unordered_map<std::string, typename std::list<Entry>::iterator> index_;
+    QueryCacheStatistics statistics_;
+    // Held by pointer so that the cache, and the CollisionManager owning it, stay movable
+    std::unique_ptr<std::mutex> mutex_ = std::make_unique<std::mutex>();
+};
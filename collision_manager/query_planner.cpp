@@ -0,0 +1,420 @@
+#include "query_planner.hpp"
+
+#include "bound_predicate.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace {
+
+// Position of a value on a number line, for interpolating inside a histogram bucket
+template<class T>
+double planner_key(const T& value) {
+    if constexpr (std::is_same_v<T, std::chrono::year_month_day>) {
+        return std::chrono::sys_days{value}.time_since_epoch().count();
+    } else if constexpr (std::is_same_v<T, std::chrono::hh_mm_ss<std::chrono::minutes>>) {
+        return std::chrono::duration_cast<std::chrono::minutes>(value.to_duration()).count();
+    } else {
+        return static_cast<double>(value);
+    }
+}
+
+std::string fold_case(const std::string_view value) {
+    std::string folded{value};
+    std::transform(folded.begin(), folded.end(), folded.begin(), ::tolower);
+    return folded;
+}
+
+template<class T>
+bool values_equal(const FieldQuery& query, const T& value, const T& query_value) {
+    if constexpr (std::is_same_v<T, CollisionString>) {
+        const std::string_view first(value.data, value.length);
+        const std::string_view second(query_value.data, query_value.length);
+        return query.case_insensitive() ? fold_case(first) == fold_case(second) : first == second;
+    } else if constexpr (std::is_same_v<T, std::chrono::hh_mm_ss<std::chrono::minutes>>) {
+        return value.to_duration() == query_value.to_duration();
+    } else {
+        return value == query_value;
+    }
+}
+
+// Fraction of the non-null values below value, or not above it when inclusive
+template<class T>
+double fraction_below(const std::vector<Value>& bounds, const T& value, const bool inclusive) {
+    const double key = planner_key(value);
+
+    std::size_t position = 0;
+    while (position < bounds.size()) {
+        const double bound = planner_key(std::get<T>(bounds[position]));
+        if (inclusive ? bound > key : bound >= key) {
+            break;
+        }
+        ++position;
+    }
+
+    if (position == 0) {
+        return 0.0;
+    } else if (position == bounds.size()) {
+        return 1.0;
+    }
+
+    // Every bucket holds the same share of rows, assume values are spread evenly inside one
+    const double lower = planner_key(std::get<T>(bounds[position - 1]));
+    const double upper = planner_key(std::get<T>(bounds[position]));
+    const double within = upper > lower ? std::clamp((key - lower) / (upper - lower), 0.0, 1.0) : 0.0;
+    return (position - 1 + within) / (bounds.size() - 1);
+}
+
+// Fraction of all rows equal to query_value
+template<class T>
+double estimate_equals_selectivity(const FieldQuery& query,
+                                   const T& query_value,
+                                   const ColumnStatistics& statistics,
+                                   const double common_fraction) {
+    const double num_rows = statistics.row_count;
+    const double non_null = 1.0 - statistics.null_fraction();
+
+    double selectivity = 0.0;
+    bool is_common_value = false;
+    for (const MostCommonValue& common_value : statistics.most_common_values) {
+        if (values_equal(query, std::get<T>(common_value.value), query_value)) {
+            selectivity += common_value.count / num_rows;
+            is_common_value = true;
+        }
+    }
+
+    // Otherwise the value is one of the remaining distinct values, which share the remaining rows
+    const std::size_t num_common_values = statistics.most_common_values.size();
+    if (!is_common_value && statistics.distinct_count > num_common_values) {
+        selectivity = std::max(0.0, non_null - common_fraction) / (statistics.distinct_count - num_common_values);
+    }
+    return selectivity;
+}
+
+template<class T>
+double estimate_column_selectivity(const FieldQuery& query, const ColumnStatistics& statistics) {
+    if (statistics.row_count == 0) {
+        return 0.0;
+    }
+
+    const double num_rows = statistics.row_count;
+    const double non_null = 1.0 - statistics.null_fraction();
+
+    double common_fraction = 0.0;
+    for (const MostCommonValue& common_value : statistics.most_common_values) {
+        common_fraction += common_value.count / num_rows;
+    }
+
+    double selectivity = 0.0;
+    switch(query.get_type()) {
+    case QueryType::HAS_VALUE:
+        selectivity = non_null;
+        break;
+    case QueryType::EQUALS:
+        selectivity = estimate_equals_selectivity(query, std::get<T>(query.get_value()), statistics, common_fraction);
+        break;
+    case QueryType::IN:
+        // Duplicate values are counted twice, which the clamp below bounds
+        for (const Value& value : query.get_values()) {
+            selectivity += estimate_equals_selectivity(query, std::get<T>(value), statistics, common_fraction);
+        }
+        selectivity = std::min(selectivity, non_null);
+        break;
+    case QueryType::LESS_THAN:
+    case QueryType::GREATER_THAN:
+        if constexpr (std::is_same_v<T, CollisionString>) {
+            selectivity = non_null / 3;
+        } else {
+            const T& query_value = std::get<T>(query.get_value());
+            selectivity = query.get_type() == QueryType::LESS_THAN
+                ? non_null * fraction_below(statistics.histogram_bounds, query_value, false)
+                : non_null * (1.0 - fraction_below(statistics.histogram_bounds, query_value, true));
+        }
+        break;
+    case QueryType::CONTAINS:
+        if constexpr (std::is_same_v<T, CollisionString>) {
+            const CollisionString& query_value = std::get<T>(query.get_value());
+            std::string needle(query_value.data, query_value.length);
+            needle = query.case_insensitive() ? fold_case(needle) : needle;
+
+            for (const MostCommonValue& common_value : statistics.most_common_values) {
+                const CollisionString& value = std::get<T>(common_value.value);
+                std::string haystack(value.data, value.length);
+                haystack = query.case_insensitive() ? fold_case(haystack) : haystack;
+                if (haystack.find(needle) != std::string::npos) {
+                    selectivity += common_value.count / num_rows;
+                }
+            }
+            selectivity += PLANNER_DEFAULT_CONTAINS_SELECTIVITY * std::max(0.0, non_null - common_fraction);
+        } else {
+            selectivity = non_null * PLANNER_DEFAULT_CONTAINS_SELECTIVITY;
+        }
+        break;
+    }
+
+    // An inverted match also matches the rows without a value
+    selectivity = std::clamp(selectivity, 0.0, 1.0);
+    return query.invert_match() ? 1.0 - selectivity : selectivity;
+}
+
+template<class T>
+double estimate_cost_per_row(const FieldQuery& query) {
+    if constexpr (std::is_same_v<T, CollisionString>) {
+        if (query.get_type() == QueryType::HAS_VALUE) {
+            return PLANNER_NUMERIC_COMPARE_COST;
+        }
+        const double cost = query.get_type() == QueryType::CONTAINS ? PLANNER_STRING_CONTAINS_COST : PLANNER_STRING_COMPARE_COST;
+        return query.case_insensitive() ? cost + PLANNER_CASE_INSENSITIVE_COST : cost;
+    } else {
+        return PLANNER_NUMERIC_COMPARE_COST;
+    }
+}
+
+// Runs steps as filters over num_candidates rows and returns their cost. A scan passes over all
+// num_rows for every step, sorted candidate rows from an index are gathered one by one instead.
+double estimate_filter_cost(std::span<PlanStep> steps, double num_candidates, const double num_rows, const AccessPath access_path) {
+    double cost = 0.0;
+    for (PlanStep& step : steps) {
+        if (access_path == AccessPath::SCAN) {
+            cost += num_rows * PLANNER_SKIP_ROW_COST + num_candidates * step.cost_per_row;
+        } else {
+            cost += num_candidates * step.cost_per_row * PLANNER_RANDOM_ACCESS_FACTOR;
+        }
+        num_candidates *= step.selectivity;
+        step.estimated_rows = static_cast<std::size_t>(std::llround(num_candidates));
+    }
+    return cost;
+}
+
+// Rows in both slices of one sorted index. A lower and an upper bound each select one run of
+// the index, so the rows matching both are where the runs overlap.
+std::span<const std::uint32_t> intersect_slices(const std::span<const std::uint32_t> first,
+                                                const std::span<const std::uint32_t> second) {
+    const std::uint32_t* begin = std::max(first.data(), second.data());
+    const std::uint32_t* end = std::min(first.data() + first.size(), second.data() + second.size());
+    return begin < end ? std::span<const std::uint32_t>(begin, end) : std::span<const std::uint32_t>{};
+}
+
+// For each non-inverted GREATER_THAN, the position of a non-inverted LESS_THAN on the same field
+std::vector<std::optional<std::size_t>> find_upper_queries(const std::vector<FieldQuery>& field_queries) {
+    std::vector<std::optional<std::size_t>> upper_query_indexes(field_queries.size());
+    std::vector<bool> is_upper_query(field_queries.size(), false);
+    for (std::size_t query_index = 0; query_index < field_queries.size(); ++query_index) {
+        const FieldQuery& lower_query = field_queries[query_index];
+        if (lower_query.get_type() != QueryType::GREATER_THAN || lower_query.invert_match()) {
+            continue;
+        }
+
+        for (std::size_t upper_index = 0; upper_index < field_queries.size(); ++upper_index) {
+            const FieldQuery& upper_query = field_queries[upper_index];
+            if (!is_upper_query[upper_index] && upper_query.get_name() == lower_query.get_name() &&
+                upper_query.get_type() == QueryType::LESS_THAN && !upper_query.invert_match()) {
+                upper_query_indexes[query_index] = upper_index;
+                is_upper_query[upper_index] = true;
+                break;
+            }
+        }
+    }
+    return upper_query_indexes;
+}
+
+double estimate_query_cost_per_row(const IndexedCollisions& indexed_collisions, const FieldQuery& query) {
+    return indexed_collisions.visit_column(query.get_name(), [&query](const auto& items, const auto&) {
+        using T = typename std::decay_t<decltype(items)>::value_type::value_type;
+        return estimate_cost_per_row<T>(query);
+    });
+}
+
+// Combines the selectivities of the conditions as if they were independent
+double estimate_expression_selectivity(const QueryExpression& expression, const std::vector<double>& selectivities) {
+    double selectivity = expression.op == QueryOperator::OR ? 0.0 : 1.0;
+    switch(expression.op) {
+    case QueryOperator::CONDITION:
+        return selectivities.at(expression.condition_index);
+    case QueryOperator::AND:
+        for (const QueryExpression& child : expression.children) {
+            selectivity *= estimate_expression_selectivity(child, selectivities);
+        }
+        return selectivity;
+    case QueryOperator::OR:
+        for (const QueryExpression& child : expression.children) {
+            selectivity += (1.0 - selectivity) * estimate_expression_selectivity(child, selectivities);
+        }
+        return selectivity;
+    case QueryOperator::NOT:
+    default:
+        return 1.0 - estimate_expression_selectivity(expression.children.front(), selectivities);
+    }
+}
+
+double estimate_slice_cost(const IndexSlices& slices, const std::size_t num_rows) {
+    const std::size_t slice_size = num_slice_rows(slices);
+    const double probe_cost = 2 * std::log2(num_rows + 1.0) * PLANNER_NUMERIC_COMPARE_COST * std::max<std::size_t>(slices.size(), 1);
+    if (sorts_index_slice(slice_size, num_rows)) {
+        return probe_cost + slice_size * std::log2(slice_size + 1.0);
+    }
+    return probe_cost + num_rows * PLANNER_SKIP_ROW_COST + slice_size;
+}
+
+}
+
+bool QueryPlan::uses_index() const {
+    return !steps.empty() && steps.front().access_path == AccessPath::INDEX;
+}
+
+QueryPlanner::QueryPlanner(const IndexedCollisions& indexed_collisions)
+  : indexed_collisions_{indexed_collisions}
+{}
+
+double QueryPlanner::estimate_selectivity(const FieldQuery& query) const {
+    const ColumnStatistics& statistics = indexed_collisions_.statistics_.get(query.get_name());
+    return indexed_collisions_.visit_column(query.get_name(), [&query, &statistics](const auto& items, const auto&) {
+        using T = typename std::decay_t<decltype(items)>::value_type::value_type;
+        return estimate_column_selectivity<T>(query, statistics);
+    });
+}
+
+QueryPlan QueryPlanner::plan(const Query& query) const {
+    if (!query.is_conjunction()) {
+        return plan_expression(query);
+    }
+
+    const std::vector<FieldQuery>& field_queries = query.get();
+    const std::size_t num_rows = indexed_collisions_.collisions_.size();
+
+    const std::vector<std::optional<std::size_t>> upper_query_indexes = find_upper_queries(field_queries);
+    std::vector<bool> is_upper_query(field_queries.size(), false);
+    for (const std::optional<std::size_t>& upper_query_index : upper_query_indexes) {
+        if (upper_query_index.has_value()) {
+            is_upper_query[*upper_query_index] = true;
+        }
+    }
+
+    const auto query_cost_per_row = [this](const FieldQuery& field_query) {
+        return estimate_query_cost_per_row(indexed_collisions_, field_query);
+    };
+
+    std::vector<PlanStep> steps{};
+    std::vector<std::optional<IndexSlices>> index_slices(field_queries.size());
+    for (std::size_t query_index = 0; query_index < field_queries.size(); ++query_index) {
+        if (is_upper_query[query_index]) {
+            continue;
+        }
+
+        const FieldQuery& field_query = field_queries[query_index];
+        const std::optional<std::size_t>& upper_query_index = upper_query_indexes[query_index];
+        double cost_per_row = query_cost_per_row(field_query);
+        std::optional<IndexSlices> index_slice = indexed_collisions_.match_index(field_query);
+
+        // The index knows exactly how many rows match, the statistics only estimate it
+        double estimated_selectivity = index_slice.has_value() ? 0.0 : estimate_selectivity(field_query);
+
+        // A GREATER_THAN and a LESS_THAN on one field run as a single BETWEEN step
+        if (upper_query_index.has_value()) {
+            const FieldQuery& upper_query = field_queries[*upper_query_index];
+            cost_per_row = std::max(cost_per_row, query_cost_per_row(upper_query));
+
+            // Both are a single slice, a range query is never an IN
+            const std::optional<IndexSlices> upper_slice = indexed_collisions_.match_index(upper_query);
+            if (index_slice.has_value() && upper_slice.has_value()) {
+                index_slice = IndexSlices{intersect_slices(index_slice->front(), upper_slice->front())};
+            } else {
+                // Every row with a value is above the lower bound or below the upper bound
+                const double non_null = 1.0 - indexed_collisions_.statistics_.get(field_query.get_name()).null_fraction();
+                index_slice = std::nullopt;
+                estimated_selectivity = std::max(0.0, estimate_selectivity(field_query) + estimate_selectivity(upper_query) - non_null);
+            }
+        }
+
+        const double selectivity = !index_slice.has_value() ? estimated_selectivity
+                                 : num_rows == 0 ? 0.0
+                                 : static_cast<double>(num_slice_rows(*index_slice)) / num_rows;
+
+        steps.push_back(PlanStep{
+            .query_index = query_index,
+            .upper_query_index = upper_query_index,
+            .access_path = AccessPath::SCAN,
+            .selectivity = selectivity,
+            .cost_per_row = cost_per_row,
+            .estimated_rows = 0,
+            .index_slices = {},
+        });
+        index_slices[query_index] = index_slice;
+    }
+
+    std::stable_sort(steps.begin(), steps.end(), [](const PlanStep& first, const PlanStep& second) {
+        return (first.selectivity - 1.0) / first.cost_per_row < (second.selectivity - 1.0) / second.cost_per_row;
+    });
+
+    QueryPlan plan{};
+    plan.row_count = num_rows;
+    plan.steps = steps;
+    plan.estimated_cost = estimate_filter_cost(plan.steps, num_rows, num_rows, AccessPath::SCAN);
+
+    // Try driving the query from each usable index, filtering its slice with the other steps
+    for (std::size_t driving_step = 0; driving_step < steps.size(); ++driving_step) {
+        const std::optional<IndexSlices>& index_slice = index_slices[steps[driving_step].query_index];
+        if (!index_slice.has_value()) {
+            continue;
+        }
+        const std::size_t slice_size = num_slice_rows(*index_slice);
+
+        std::vector<PlanStep> index_steps = steps;
+        std::rotate(index_steps.begin(), index_steps.begin() + driving_step, index_steps.begin() + driving_step + 1);
+        index_steps.front().access_path = AccessPath::INDEX;
+        index_steps.front().index_slices = *index_slice;
+        index_steps.front().estimated_rows = slice_size;
+
+        const AccessPath filter_access_path = sorts_index_slice(slice_size, num_rows) ? AccessPath::INDEX : AccessPath::SCAN;
+        const double cost = estimate_slice_cost(*index_slice, num_rows) +
+            estimate_filter_cost(std::span(index_steps).subspan(1), slice_size, num_rows, filter_access_path);
+        if (cost < plan.estimated_cost) {
+            plan.steps = std::move(index_steps);
+            plan.estimated_cost = cost;
+        }
+    }
+
+    plan.estimated_rows = plan.steps.empty() ? num_rows : plan.steps.back().estimated_rows;
+    return plan;
+}
+
+QueryPlan QueryPlanner::plan_expression(const Query& query) const {
+    const std::vector<FieldQuery>& field_queries = query.get();
+    const std::size_t num_rows = indexed_collisions_.collisions_.size();
+
+    QueryPlan plan{};
+    plan.row_count = num_rows;
+    plan.evaluates_expression = true;
+
+    std::vector<double> selectivities{};
+    for (std::size_t query_index = 0; query_index < field_queries.size(); ++query_index) {
+        const FieldQuery& field_query = field_queries[query_index];
+        const std::optional<IndexSlices> index_slice = indexed_collisions_.match_index(field_query);
+        const double selectivity = !index_slice.has_value() ? estimate_selectivity(field_query)
+                                 : num_rows == 0 ? 0.0
+                                 : static_cast<double>(num_slice_rows(*index_slice)) / num_rows;
+        const double cost_per_row = estimate_query_cost_per_row(indexed_collisions_, field_query);
+
+        plan.steps.push_back(PlanStep{
+            .query_index = query_index,
+            .upper_query_index = std::nullopt,
+            .access_path = AccessPath::SCAN,
+            .selectivity = selectivity,
+            .cost_per_row = cost_per_row,
+            .estimated_rows = static_cast<std::size_t>(std::llround(selectivity * num_rows)),
+            .index_slices = {},
+        });
+        selectivities.push_back(selectivity);
+
+        // Short circuiting only lowers this, each condition sees at most every row
+        plan.estimated_cost += num_rows * (PLANNER_SKIP_ROW_COST + cost_per_row);
+    }
+
+    const double selectivity = estimate_expression_selectivity(query.get_expression(), selectivities);
+    plan.estimated_rows = static_cast<std::size_t>(std::llround(selectivity * num_rows));
+    return plan;
+}
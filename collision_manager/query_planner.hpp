@@ -0,0 +1,80 @@
+#pragma once
+
+#include "collision.hpp"
+#include "query.hpp"
+
+#include <bit>
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <vector>
+
+enum class AccessPath { SCAN, INDEX };
+
+// Relative cost of evaluating one predicate against one row, a numeric comparison costs 1
+constexpr double PLANNER_NUMERIC_COMPARE_COST = 1.0;
+constexpr double PLANNER_STRING_COMPARE_COST = 8.0;
+constexpr double PLANNER_STRING_CONTAINS_COST = 12.0;
+constexpr double PLANNER_CASE_INSENSITIVE_COST = 8.0;
+// Passing over a row an earlier predicate already rejected
+constexpr double PLANNER_SKIP_ROW_COST = 0.1;
+// Candidate rows are visited out of column order, so each one costs more than in a scan
+constexpr double PLANNER_RANDOM_ACCESS_FACTOR = 2.0;
+// Share of the values outside the most common values a CONTAINS is assumed to match
+constexpr double PLANNER_DEFAULT_CONTAINS_SELECTIVITY = 0.05;
+
+// Whether the rows of an index slice are sorted into candidate row ids, which the remaining
+// steps then filter, or marked in a mask of every row, which the remaining steps then scan.
+// Sorting a small slice is cheaper than walking a mask of every row.
+inline bool sorts_index_slice(const std::size_t slice_size, const std::size_t num_rows) {
+    return slice_size * std::bit_width(slice_size) < num_rows;
+}
+
+struct PlanStep {
+    // Position of the predicate in Query::get()
+    std::size_t query_index;
+    // Position of a LESS_THAN on the same field, set when query_index is a GREATER_THAN and the
+    // step runs both as one BETWEEN
+    std::optional<std::size_t> upper_query_index;
+    AccessPath access_path;
+    // Fraction of all rows the predicate matches on its own
+    double selectivity;
+    double cost_per_row;
+    // Rows expected to be left once this and every earlier step has run
+    std::size_t estimated_rows;
+    // Rows matching the predicate, only set for the INDEX step
+    IndexSlices index_slices;
+};
+
+// Steps run in order. An INDEX step can only come first, it provides the candidate rows that
+// the remaining steps filter. Otherwise every step is a filter over a scan of all rows.
+struct QueryPlan {
+    std::vector<PlanStep> steps;
+    // Set for a query that is not a plain conjunction. Its steps are then its conditions in order
+    // and they are combined by the query expression over a scan of all rows.
+    bool evaluates_expression = false;
+    std::size_t row_count = 0;
+    double estimated_cost = 0.0;
+    std::size_t estimated_rows = 0;
+
+    bool uses_index() const;
+};
+
+// Orders the predicates of a query and picks between driving it from an index or scanning.
+// Selectivity comes from the exact size of the index slice when a predicate can use an index
+// and from the column statistics otherwise. Filters then run in ascending order of
+// (selectivity - 1) / cost_per_row, so cheap predicates that reject many rows go first.
+class QueryPlanner {
+public:
+    explicit QueryPlanner(const IndexedCollisions& indexed_collisions);
+
+    QueryPlan plan(const Query& query) const;
+
+    // Fraction of rows expected to match query, from the column statistics alone
+    double estimate_selectivity(const FieldQuery& query) const;
+
+private:
+    QueryPlan plan_expression(const Query& query) const;
+
+    const IndexedCollisions& indexed_collisions_;
+};
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+// Runs of one sorted index that together hold the rows matching a query, in index order
+using IndexSlices = std::vector<std::span<const std::uint32_t>>;
+
+inline std::size_t num_slice_rows(const IndexSlices& slices) {
+    std::size_t num_rows = 0;
+    for (const std::span<const std::uint32_t> slice : slices) {
+        num_rows += slice.size();
+    }
+    return num_rows;
+}
+
+// Keys are copied out of the column into the search structure, dates as a plain day count
+template<class T>
+auto index_key(const T& value) {
+    if constexpr (std::is_same_v<T, std::chrono::year_month_day>) {
+        return static_cast<std::int32_t>(std::chrono::sys_days{value}.time_since_epoch().count());
+    } else {
+        return value;
+    }
+}
+
+template<class T>
+using IndexKey = decltype(index_key(std::declval<T>()));
+
+// Row ids of a column sorted by value with nulls at the end, plus a copy of the non-null keys
+// laid out in Eytzinger (breadth first) order. A search walks the implicit tree from the root, so
+// the first levels share cache lines and deeper levels are prefetched ahead of the comparison,
+// instead of every binary search probe missing into the column through the row id.
+template<class T>
+class SortedIndex {
+public:
+    using Key = IndexKey<T>;
+
+    SortedIndex() = default;
+
+    explicit SortedIndex(const std::vector<std::optional<T>>& items) {
+        rows_ = std::vector<std::uint32_t>(items.size());
+        std::iota(rows_.begin(), rows_.end(), 0);
+        std::sort(rows_.begin(), rows_.end(), [&items](const std::uint32_t first, const std::uint32_t second) {
+            if (!items[first].has_value()) {
+                return false;
+            } else if (!items[second].has_value()) {
+                return true;
+            } else {
+                return items[first].value() < items[second].value();
+            }
+        });
+
+        const std::size_t num_values = std::partition_point(rows_.begin(), rows_.end(), [&items](const std::uint32_t row) {
+            return items[row].has_value();
+        }) - rows_.begin();
+
+        // Slot 0 is unused so that the children of slot k are 2k and 2k + 1
+        keys_ = std::vector<Key>(num_values + 1);
+        positions_ = std::vector<std::uint32_t>(num_values + 1);
+        fill(items, 0, 1);
+    }
+
+    // Row ids in value order, nulls last
+    std::span<const std::uint32_t> rows() const {
+        return rows_;
+    }
+
+    // Row ids of the rows holding a value
+    std::span<const std::uint32_t> values() const {
+        return {rows_.data(), keys_.size() - 1};
+    }
+
+    // Position in rows() of the first value not less than value
+    std::size_t lower_bound(const T& value) const {
+        return search<false>(index_key(value));
+    }
+
+    // Position in rows() of the first value greater than value
+    std::size_t upper_bound(const T& value) const {
+        return search<true>(index_key(value));
+    }
+
+private:
+    template<class Column>
+    std::size_t fill(const Column& items, std::size_t position, const std::size_t slot) {
+        if (slot < keys_.size()) {
+            position = fill(items, position, 2 * slot);
+            keys_[slot] = index_key(*items[rows_[position]]);
+            positions_[slot] = position;
+            position = fill(items, position + 1, 2 * slot + 1);
+        }
+        return position;
+    }
+
+    template<bool Upper>
+    std::size_t search(const Key& key) const {
+        // Prefetch the slot a cache line's worth of levels below the current one
+        constexpr std::size_t prefetch_stride = std::max<std::size_t>(64 / sizeof(Key), 1);
+
+        const std::size_t num_keys = keys_.size() - 1;
+        const Key* keys = keys_.data();
+        std::size_t slot = 1;
+        while (slot <= num_keys) {
+            __builtin_prefetch(keys + slot * prefetch_stride);
+            if constexpr (Upper) {
+                slot = 2 * slot + (keys[slot] <= key);
+            } else {
+                slot = 2 * slot + (keys[slot] < key);
+            }
+        }
+
+        // Undo the trailing right turns (and the final left turn) to find the last slot that went left
+        slot >>= std::countr_one(slot) + 1;
+        return slot == 0 ? num_keys : positions_[slot];
+    }
+
+    std::vector<std::uint32_t> rows_;
+    std::vector<Key> keys_{Key{}};
+    std::vector<std::uint32_t> positions_{0};
+};
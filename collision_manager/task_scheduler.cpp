@@ -0,0 +1,124 @@
+#include "task_scheduler.hpp"
+
+#include <algorithm>
+
+TaskScheduler::TaskScheduler(const std::size_t num_threads) {
+    for (std::size_t thread = 0; thread < num_threads; ++thread) {
+        threads_.emplace_back(&TaskScheduler::help, this);
+    }
+}
+
+TaskScheduler::~TaskScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    work_cv_.notify_all();
+    for (std::thread& thread : threads_) {
+        thread.join();
+    }
+}
+
+TaskScheduler& TaskScheduler::instance() {
+    static TaskScheduler scheduler(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+    return scheduler;
+}
+
+std::size_t TaskScheduler::num_threads() const {
+    return threads_.size();
+}
+
+void TaskScheduler::parallel_for(const std::size_t num_tasks, const std::size_t max_threads, const std::function<void(std::size_t)>& body) {
+    const std::size_t max_helpers = std::min({max_threads > 0 ? max_threads - 1 : 0, num_tasks > 0 ? num_tasks - 1 : 0, threads_.size()});
+    if (max_helpers == 0) {
+        for (std::size_t task = 0; task < num_tasks; ++task) {
+            body(task);
+        }
+        return;
+    }
+
+    Job job{.body = body, .num_tasks = num_tasks, .max_helpers = max_helpers};
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.push_back(&job);
+    }
+    for (std::size_t helper = 0; helper < max_helpers; ++helper) {
+        work_cv_.notify_one();
+    }
+
+    std::exception_ptr exception{};
+    std::size_t num_finished = 0;
+    while (run_task(job, exception)) {
+        ++num_finished;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    jobs_.erase(std::find(jobs_.begin(), jobs_.end(), &job));
+    job.num_finished += num_finished;
+    if (exception != nullptr && job.exception == nullptr) {
+        job.exception = exception;
+    }
+    // Helpers still hold the job until they let go of it under the mutex
+    done_cv_.wait(lock, [&job]() { return job.num_finished == job.num_tasks && job.num_helpers == 0; });
+
+    if (job.exception != nullptr) {
+        std::rethrow_exception(job.exception);
+    }
+}
+
+bool TaskScheduler::run_task(Job& job, std::exception_ptr& exception) {
+    const std::size_t task = job.next_task.fetch_add(1, std::memory_order_relaxed);
+    if (task >= job.num_tasks) {
+        return false;
+    }
+
+    try {
+        job.body(task);
+    } catch (...) {
+        if (exception == nullptr) {
+            exception = std::current_exception();
+        }
+    }
+    return true;
+}
+
+TaskScheduler::Job* TaskScheduler::next_job() {
+    for (std::size_t offset = 0; offset < jobs_.size(); ++offset) {
+        const std::size_t index = (next_job_index_ + offset) % jobs_.size();
+        Job* job = jobs_[index];
+        if (job->next_task.load(std::memory_order_relaxed) < job->num_tasks && job->num_helpers < job->max_helpers) {
+            next_job_index_ = index + 1;
+            return job;
+        }
+    }
+    return nullptr;
+}
+
+void TaskScheduler::help() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        Job* job = nullptr;
+        work_cv_.wait(lock, [this, &job]() { return stopping_ || (job = next_job()) != nullptr; });
+        if (stopping_) {
+            return;
+        }
+
+        // A single task before moving on to the next job, so that concurrent jobs take turns
+        ++job->num_helpers;
+        lock.unlock();
+        std::exception_ptr exception{};
+        const bool ran = run_task(*job, exception);
+        lock.lock();
+
+        --job->num_helpers;
+        if (ran) {
+            ++job->num_finished;
+        }
+        if (exception != nullptr && job->exception == nullptr) {
+            job->exception = exception;
+        }
+        if (job->num_helpers == 0) {
+            done_cv_.notify_all();
+        }
+    }
+}
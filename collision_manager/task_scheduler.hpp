@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Threads shared by every search of a process, so that concurrent searches split the cores
+// between them instead of each starting threads of its own. A search runs its tasks itself, and
+// idle threads of the scheduler steal tasks from the running searches in turn, one task at a time,
+// so a search of a single task never waits for a thread and a search of many tasks does not hold
+// up the tasks of the searches started after it.
+class TaskScheduler {
+public:
+    // A scheduler with num_threads threads besides the threads that call parallel_for()
+    explicit TaskScheduler(const std::size_t num_threads);
+    ~TaskScheduler();
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    // The scheduler shared by every CollisionManager, with a thread for each core besides the
+    // calling one
+    static TaskScheduler& instance();
+
+    // Calls body(task) for every task in [0, num_tasks), on the calling thread and on up to
+    // max_threads - 1 threads of the scheduler, and returns once every call returned. The first
+    // exception thrown by body is rethrown once every other task ran.
+    void parallel_for(const std::size_t num_tasks, const std::size_t max_threads, const std::function<void(std::size_t)>& body);
+
+    std::size_t num_threads() const;
+
+private:
+    struct Job {
+        const std::function<void(std::size_t)>& body;
+        const std::size_t num_tasks;
+        const std::size_t max_helpers;
+        std::atomic<std::size_t> next_task{0};
+        // Guarded by the mutex of the scheduler
+        std::size_t num_finished = 0;
+        std::size_t num_helpers = 0;
+        std::exception_ptr exception{};
+    };
+
+    // Runs tasks of the jobs until the scheduler is destroyed
+    void help();
+    // The job after the one last helped with that has tasks left and room for another helper
+    Job* next_job();
+    // Runs task of job, false when every task of job was taken already
+    bool run_task(Job& job, std::exception_ptr& exception);
+
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    // Jobs with tasks left, oldest first
+    std::vector<Job*> jobs_;
+    std::size_t next_job_index_ = 0;
+    bool stopping_ = false;
+    std::vector<std::thread> threads_;
+};
@@ -1,6 +1,9 @@
 #include "collision_proto_converter.hpp"
 
 #include <iostream>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
 
 QueryResponse CollisionProtoConverter::deserialize(const collision_proto::QueryResponse& response) {
     std::vector<Collision> collisions{};
@@ -98,6 +101,9 @@ QueryResponse CollisionProtoConverter::deserialize(const collision_proto::QueryR
         }
         collisions.push_back(collision);
     }
+    if (response.has_columns()) {
+        collisions = from_proto_columns(response.columns());
+    }
 
     std::vector<std::uint32_t> requested_by;
     for (int i = 0; i < response.requested_by_size(); ++i) {
@@ -111,18 +117,39 @@ QueryResponse CollisionProtoConverter::deserialize(const collision_proto::QueryR
         .collisions = collisions,
     };
 
+    query_response.batch = response.batch();
+    query_response.num_batches = response.has_num_batches() ? response.num_batches() : 1;
+    if (response.has_fields()) {
+        query_response.fields = FieldMask(response.fields());
+    }
+    if (!response.resume_token().empty()) {
+        query_response.resume_token = from_resume_token(response.resume_token());
+    }
+    query_response.cursor_expired = response.cursor_expired();
+    if (response.has_timeout_ms()) {
+        query_response.deadline = from_timeout_ms(response.timeout_ms());
+    }
+
+    if (response.has_aggregates()) {
+        query_response.aggregates = from_proto_aggregates(response.aggregates());
+        query_response.aggregated_ranks.assign(response.aggregates().ranks().begin(), response.aggregates().ranks().end());
+    }
+
     return query_response;
 }
 
-collision_proto::QueryResponse CollisionProtoConverter::serialize(const QueryResponse& query_response) {
+collision_proto::QueryResponse CollisionProtoConverter::serialize(const QueryResponse& query_response,
+                                                                  const collision_proto::ResponseFormat format) {
     collision_proto::QueryResponse proto_query_response;
 
-    serialize(query_response, proto_query_response);
+    serialize(query_response, proto_query_response, format);
 
     return proto_query_response;
 }
 
-void CollisionProtoConverter::serialize(const QueryResponse& query_response, collision_proto::QueryResponse& proto_query_response) {
+void CollisionProtoConverter::serialize(const QueryResponse& query_response,
+                                        collision_proto::QueryResponse& proto_query_response,
+                                        const collision_proto::ResponseFormat format) {
     proto_query_response.set_id(query_response.id);
     proto_query_response.set_results_from(query_response.results_from);
 
@@ -130,6 +157,30 @@ void CollisionProtoConverter::serialize(const QueryResponse& query_response, col
         proto_query_response.add_requested_by(req_by);
     }
 
+    proto_query_response.set_batch(query_response.batch);
+    proto_query_response.set_num_batches(query_response.num_batches);
+    if (!query_response.fields.all()) {
+        proto_query_response.set_fields(static_cast<std::uint32_t>(query_response.fields.to_ulong()));
+    }
+    if (query_response.resume_token.has_value()) {
+        proto_query_response.set_resume_token(to_resume_token(*query_response.resume_token));
+    }
+    proto_query_response.set_cursor_expired(query_response.cursor_expired);
+    if (query_response.deadline != NO_DEADLINE) {
+        proto_query_response.set_timeout_ms(to_timeout_ms(query_response.deadline));
+    }
+
+    if (query_response.aggregates.has_value()) {
+        to_proto_aggregates(*query_response.aggregates, query_response.aggregated_ranks, proto_query_response.mutable_aggregates());
+    }
+
+    if (format == collision_proto::RESPONSE_COLUMNS) {
+        if (!query_response.collisions.empty()) {
+            to_proto_columns(query_response.collisions, query_response.fields, proto_query_response.mutable_columns());
+        }
+        return;
+    }
+
     for (const Collision& collision : query_response.collisions) {
         collision_proto::Collision* proto_collision = proto_query_response.add_collision();
 
@@ -142,7 +193,7 @@ void CollisionProtoConverter::serialize(const QueryResponse& query_response, col
             proto_collision->set_crash_time(std::format("{:02}:{:02}", (int)time.hours().count(), (int)time.minutes().count()));
         }
         if (collision.borough.has_value()) {
-            proto_collision->set_borough(std::string(collision.borough.value().data, collision.borough.value().length));
+            proto_collision->set_borough(collision.borough.value().data, collision.borough.value().length);
         }
         if (collision.zip_code.has_value()) {
             proto_collision->set_zip_code(collision.zip_code.value());
@@ -154,16 +205,16 @@ void CollisionProtoConverter::serialize(const QueryResponse& query_response, col
             proto_collision->set_longitude(collision.longitude.value());
         }
         if (collision.location.has_value()) {
-            proto_collision->set_location(std::string(collision.location.value().data, collision.location.value().length));
+            proto_collision->set_location(collision.location.value().data, collision.location.value().length);
         }
         if (collision.on_street_name.has_value()) {
-            proto_collision->set_on_street_name(std::string(collision.on_street_name.value().data, collision.on_street_name.value().length));
+            proto_collision->set_on_street_name(collision.on_street_name.value().data, collision.on_street_name.value().length);
         }
         if (collision.cross_street_name.has_value()) {
-            proto_collision->set_cross_street_name(std::string(collision.cross_street_name.value().data, collision.cross_street_name.value().length));
+            proto_collision->set_cross_street_name(collision.cross_street_name.value().data, collision.cross_street_name.value().length);
         }
         if (collision.off_street_name.has_value()) {
-            proto_collision->set_off_street_name(std::string(collision.off_street_name.value().data, collision.off_street_name.value().length));
+            proto_collision->set_off_street_name(collision.off_street_name.value().data, collision.off_street_name.value().length);
         }
         if (collision.number_of_persons_injured.has_value()) {
             proto_collision->set_number_of_persons_injured(collision.number_of_persons_injured.value());
@@ -190,47 +241,242 @@ void CollisionProtoConverter::serialize(const QueryResponse& query_response, col
             proto_collision->set_number_of_motorist_killed(collision.number_of_motorist_killed.value());
         }
         if (collision.contributing_factor_vehicle_1.has_value()) {
-            proto_collision->set_contributing_factor_vehicle_1(std::string(collision.contributing_factor_vehicle_1.value().data,
-                                                                                collision.contributing_factor_vehicle_1.value().length));
+            proto_collision->set_contributing_factor_vehicle_1(collision.contributing_factor_vehicle_1.value().data, collision.contributing_factor_vehicle_1.value().length);
         }
         if (collision.contributing_factor_vehicle_2.has_value()) {
-            proto_collision->set_contributing_factor_vehicle_2(std::string(collision.contributing_factor_vehicle_2.value().data,
-                                                                                collision.contributing_factor_vehicle_2.value().length));
+            proto_collision->set_contributing_factor_vehicle_2(collision.contributing_factor_vehicle_2.value().data, collision.contributing_factor_vehicle_2.value().length);
         }
         if (collision.contributing_factor_vehicle_3.has_value()) {
-            proto_collision->set_contributing_factor_vehicle_3(std::string(collision.contributing_factor_vehicle_3.value().data,
-                                                                                collision.contributing_factor_vehicle_3.value().length));
+            proto_collision->set_contributing_factor_vehicle_3(collision.contributing_factor_vehicle_3.value().data, collision.contributing_factor_vehicle_3.value().length);
         }
         if (collision.contributing_factor_vehicle_4.has_value()) {
-            proto_collision->set_contributing_factor_vehicle_4(std::string(collision.contributing_factor_vehicle_4.value().data,
-                                                                                collision.contributing_factor_vehicle_4.value().length));
+            proto_collision->set_contributing_factor_vehicle_4(collision.contributing_factor_vehicle_4.value().data, collision.contributing_factor_vehicle_4.value().length);
         }
         if (collision.contributing_factor_vehicle_5.has_value()) {
-            proto_collision->set_contributing_factor_vehicle_5(std::string(collision.contributing_factor_vehicle_5.value().data,
-                                                                                collision.contributing_factor_vehicle_5.value().length));
+            proto_collision->set_contributing_factor_vehicle_5(collision.contributing_factor_vehicle_5.value().data, collision.contributing_factor_vehicle_5.value().length);
         }
         if (collision.collision_id.has_value()) {
             proto_collision->set_collision_id(collision.collision_id.value());
         }
         if (collision.vehicle_type_code_1.has_value()) {
-            proto_collision->set_vehicle_type_code_1(std::string(collision.vehicle_type_code_1.value().data,
-                                                                      collision.vehicle_type_code_1.value().length));
+            proto_collision->set_vehicle_type_code_1(collision.vehicle_type_code_1.value().data, collision.vehicle_type_code_1.value().length);
         }
         if (collision.vehicle_type_code_2.has_value()) {
-            proto_collision->set_vehicle_type_code_2(std::string(collision.vehicle_type_code_2.value().data,
-                                                                      collision.vehicle_type_code_2.value().length));
+            proto_collision->set_vehicle_type_code_2(collision.vehicle_type_code_2.value().data, collision.vehicle_type_code_2.value().length);
         }
         if (collision.vehicle_type_code_3.has_value()) {
-            proto_collision->set_vehicle_type_code_3(std::string(collision.vehicle_type_code_3.value().data,
-                                                                      collision.vehicle_type_code_3.value().length));
+            proto_collision->set_vehicle_type_code_3(collision.vehicle_type_code_3.value().data, collision.vehicle_type_code_3.value().length);
         }
         if (collision.vehicle_type_code_4.has_value()) {
-            proto_collision->set_vehicle_type_code_4(std::string(collision.vehicle_type_code_4.value().data,
-                                                                      collision.vehicle_type_code_4.value().length));
+            proto_collision->set_vehicle_type_code_4(collision.vehicle_type_code_4.value().data, collision.vehicle_type_code_4.value().length);
         }
         if (collision.vehicle_type_code_5.has_value()) {
-            proto_collision->set_vehicle_type_code_5(std::string(collision.vehicle_type_code_5.value().data,
-                                                                      collision.vehicle_type_code_5.value().length));
+            proto_collision->set_vehicle_type_code_5(collision.vehicle_type_code_5.value().data, collision.vehicle_type_code_5.value().length);
         }
     }
 }
+
+void to_proto_aggregates(const AggregateTable& aggregates,
+                         const std::vector<std::uint32_t>& aggregated_ranks,
+                         collision_proto::AggregateResult* proto_aggregates) {
+    for (const auto& [key, values] : aggregates.groups) {
+        collision_proto::AggregateGroup* proto_group = proto_aggregates->add_groups();
+        for (const std::optional<std::string>& key_value : key) {
+            collision_proto::GroupKeyValue* proto_key_value = proto_group->add_keys();
+            if (key_value.has_value()) {
+                proto_key_value->set_value(*key_value);
+            }
+        }
+        for (const AggregateValue& value : values) {
+            collision_proto::AggregateValue* proto_value = proto_group->add_values();
+            proto_value->set_count(value.count);
+            proto_value->set_sum(value.sum);
+            if (value.min.has_value()) {
+                proto_value->set_min(*value.min);
+            }
+            if (value.max.has_value()) {
+                proto_value->set_max(*value.max);
+            }
+        }
+    }
+
+    for (const std::uint32_t rank : aggregated_ranks) {
+        proto_aggregates->add_ranks(rank);
+    }
+}
+
+AggregateTable from_proto_aggregates(const collision_proto::AggregateResult& proto_aggregates) {
+    AggregateTable aggregates{};
+    for (const collision_proto::AggregateGroup& proto_group : proto_aggregates.groups()) {
+        GroupKey key{};
+        for (const collision_proto::GroupKeyValue& proto_key_value : proto_group.keys()) {
+            key.push_back(proto_key_value.has_value() ? std::optional(proto_key_value.value()) : std::nullopt);
+        }
+
+        std::vector<AggregateValue> values{};
+        for (const collision_proto::AggregateValue& proto_value : proto_group.values()) {
+            values.push_back(AggregateValue{
+                .count = proto_value.count(),
+                .sum = proto_value.sum(),
+                .min = proto_value.has_min() ? std::optional(proto_value.min()) : std::nullopt,
+                .max = proto_value.has_max() ? std::optional(proto_value.max()) : std::nullopt,
+            });
+        }
+
+        aggregates.groups.emplace(std::move(key), std::move(values));
+    }
+    return aggregates;
+}
+
+void to_proto_columns(const std::vector<Collision>& collisions,
+                      const FieldMask& fields,
+                      collision_proto::CollisionColumns* proto_columns) {
+    proto_columns->set_num_rows(static_cast<std::uint32_t>(collisions.size()));
+
+    for (std::size_t field = 0; field < fields.size(); ++field) {
+        if (!fields.test(field)) {
+            continue;
+        }
+
+        collision_proto::CollisionColumn* proto_column = proto_columns->add_columns();
+        proto_column->set_field(static_cast<collision_proto::QueryFields>(field));
+
+        visit_collision_member(static_cast<CollisionField>(field), [&collisions, proto_column](const auto member) {
+            using T = typename std::remove_cvref_t<decltype(std::declval<Collision>().*member)>::value_type;
+
+            std::string present((collisions.size() + 7) / 8, '\0');
+            std::size_t num_present = 0;
+            // Position in the dictionary of each string added to it
+            std::unordered_map<std::string_view, std::uint32_t> dictionary_indexes{};
+
+            for (std::size_t row = 0; row < collisions.size(); ++row) {
+                const std::optional<T>& value = collisions[row].*member;
+                if (!value.has_value()) {
+                    continue;
+                }
+                present[row / 8] |= static_cast<char>(1 << (row % 8));
+                ++num_present;
+
+                if constexpr (std::is_same_v<T, std::chrono::year_month_day>) {
+                    proto_column->add_dates(std::chrono::sys_days(*value).time_since_epoch().count());
+                } else if constexpr (std::is_same_v<T, std::chrono::hh_mm_ss<std::chrono::minutes>>) {
+                    // Not to_duration(), which some standard libraries get wrong for a precision of minutes
+                    proto_column->add_times(static_cast<std::uint32_t>((value->hours() + value->minutes()).count()));
+                } else if constexpr (std::is_same_v<T, CollisionString>) {
+                    const auto [entry, inserted] = dictionary_indexes.try_emplace(std::string_view(value->data, value->length),
+                                                                                  proto_column->dictionary_size());
+                    if (inserted) {
+                        proto_column->add_dictionary(value->data, value->length);
+                    }
+                    proto_column->add_string_indexes(entry->second);
+                } else if constexpr (std::is_same_v<T, float>) {
+                    proto_column->add_floats(*value);
+                } else {
+                    proto_column->add_integers(*value);
+                }
+            }
+
+            if (num_present < collisions.size()) {
+                proto_column->set_present(std::move(present));
+            }
+        });
+    }
+}
+
+std::vector<Collision> from_proto_columns(const collision_proto::CollisionColumns& proto_columns) {
+    std::vector<Collision> collisions(proto_columns.num_rows());
+
+    for (const collision_proto::CollisionColumn& proto_column : proto_columns.columns()) {
+        if (proto_column.field() < 0 || static_cast<std::size_t>(proto_column.field()) >= NUM_COLLISION_FIELDS) {
+            throw std::runtime_error("Unknown field in collision columns!");
+        }
+        const std::string& present = proto_column.present();
+        if (!present.empty() && present.size() != (collisions.size() + 7) / 8) {
+            throw std::runtime_error("Presence of a collision column does not match its number of rows!");
+        }
+        const auto has_value = [&present](const std::size_t row) {
+            return present.empty() || (present[row / 8] >> (row % 8) & 1) != 0;
+        };
+
+        std::size_t num_present = 0;
+        for (std::size_t row = 0; row < collisions.size(); ++row) {
+            num_present += has_value(row) ? 1 : 0;
+        }
+
+        visit_collision_member(static_cast<CollisionField>(proto_column.field()), [&](const auto member) {
+            using T = typename std::remove_cvref_t<decltype(std::declval<Collision>().*member)>::value_type;
+
+            std::size_t num_values = 0;
+            // Strings are built once for each distinct value instead of once for each row
+            std::vector<CollisionString> dictionary{};
+            if constexpr (std::is_same_v<T, std::chrono::year_month_day>) {
+                num_values = proto_column.dates_size();
+            } else if constexpr (std::is_same_v<T, std::chrono::hh_mm_ss<std::chrono::minutes>>) {
+                num_values = proto_column.times_size();
+            } else if constexpr (std::is_same_v<T, CollisionString>) {
+                num_values = proto_column.string_indexes_size();
+                dictionary.reserve(proto_column.dictionary_size());
+                for (const std::string& value : proto_column.dictionary()) {
+                    dictionary.emplace_back(std::string_view(value));
+                }
+            } else if constexpr (std::is_same_v<T, float>) {
+                num_values = proto_column.floats_size();
+            } else {
+                num_values = proto_column.integers_size();
+            }
+            if (num_values != num_present) {
+                throw std::runtime_error("Values of a collision column do not match its number of rows!");
+            }
+
+            int index = 0;
+            for (std::size_t row = 0; row < collisions.size(); ++row) {
+                if (!has_value(row)) {
+                    continue;
+                }
+
+                if constexpr (std::is_same_v<T, std::chrono::year_month_day>) {
+                    collisions[row].*member = std::chrono::year_month_day(std::chrono::sys_days(std::chrono::days(proto_column.dates(index))));
+                } else if constexpr (std::is_same_v<T, std::chrono::hh_mm_ss<std::chrono::minutes>>) {
+                    collisions[row].*member = std::chrono::hh_mm_ss<std::chrono::minutes>(std::chrono::minutes(proto_column.times(index)));
+                } else if constexpr (std::is_same_v<T, CollisionString>) {
+                    if (proto_column.string_indexes(index) >= dictionary.size()) {
+                        throw std::runtime_error("String of a collision column is not in its dictionary!");
+                    }
+                    collisions[row].*member = dictionary[proto_column.string_indexes(index)];
+                } else if constexpr (std::is_same_v<T, float>) {
+                    collisions[row].*member = proto_column.floats(index);
+                } else {
+                    collisions[row].*member = static_cast<T>(proto_column.integers(index));
+                }
+                ++index;
+            }
+        });
+    }
+    return collisions;
+}
+
+namespace {
+
+google::protobuf::ArenaOptions response_arena_options(char* initial_block, const std::size_t initial_block_size) {
+    google::protobuf::ArenaOptions options{};
+    options.initial_block = initial_block;
+    options.initial_block_size = initial_block_size;
+    // Blocks past the first grow to the size of a batch quickly instead of from a few hundred bytes
+    options.start_block_size = 64 * 1024;
+    options.max_block_size = RESPONSE_ARENA_BLOCK_SIZE;
+    return options;
+}
+}
+
+QueryResponseArena::QueryResponseArena(const std::size_t initial_block_size)
+    : initial_block_(initial_block_size > 0 ? std::make_unique_for_overwrite<char[]>(initial_block_size) : nullptr)
+    , arena_(response_arena_options(initial_block_.get(), initial_block_size)) {}
+
+collision_proto::QueryResponse* QueryResponseArena::reset() {
+    arena_.Reset();
+    return google::protobuf::Arena::CreateMessage<collision_proto::QueryResponse>(&arena_);
+}
+
+std::uint64_t QueryResponseArena::space_used() const {
+    return arena_.SpaceUsed();
+}
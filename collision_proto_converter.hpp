@@ -1,21 +1,81 @@
 #pragma once
 
 #include "collision_manager/collision.hpp"
+#include "collision_manager/collision_aggregate.hpp"
 #include "collision_manager/collision_parser.hpp"
+#include "query_proto_converter.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 
 #include <collision.grpc.pb.h>
+#include <google/protobuf/arena.h>
 #include <grpcpp/grpcpp.h>
 
+// Size of the block a reused QueryResponseArena keeps, enough for a full batch of collisions
+constexpr std::size_t RESPONSE_ARENA_BLOCK_SIZE = 1 << 20;
+
 struct QueryResponse {
     std::size_t id;
     std::vector<std::uint32_t> requested_by;
     std::uint32_t results_from;
     std::vector<Collision> collisions;
+    // Set instead of collisions for an aggregation query, covering the rows of aggregated_ranks
+    std::optional<AggregateTable> aggregates{};
+    std::vector<std::uint32_t> aggregated_ranks{};
+    // Rows of results_from come in num_batches responses, this one being number batch
+    std::uint32_t batch = 0;
+    std::uint32_t num_batches = 1;
+    // Fields the collisions carry, the others are unset in every one of them
+    FieldMask fields = all_fields();
+    // For a page, see QueryRequest::page_size: where the next page starts, unset when the page is
+    // the last, and whether a rank no longer kept the cursor it was asked to resume
+    std::optional<ResumeToken> resume_token{};
+    bool cursor_expired = false;
+    // That of the query, see QueryRequest::deadline
+    std::chrono::system_clock::time_point deadline = NO_DEADLINE;
 };
 
+void to_proto_aggregates(const AggregateTable& aggregates,
+                         const std::vector<std::uint32_t>& aggregated_ranks,
+                         collision_proto::AggregateResult* proto_aggregates);
+AggregateTable from_proto_aggregates(const collision_proto::AggregateResult& proto_aggregates);
+
+// The fields in fields of collisions, one column each
+void to_proto_columns(const std::vector<Collision>& collisions,
+                      const FieldMask& fields,
+                      collision_proto::CollisionColumns* proto_columns);
+// Throws std::runtime_error for columns that do not match their number of rows or dictionary
+std::vector<Collision> from_proto_columns(const collision_proto::CollisionColumns& proto_columns);
+
 class CollisionProtoConverter {
 public:
+    // Takes the rows from whichever of collision and columns is set
     static QueryResponse deserialize(const collision_proto::QueryResponse& proto_query_response);
-    static collision_proto::QueryResponse serialize(const QueryResponse& query_response);
-    static void serialize(const QueryResponse& query_response, collision_proto::QueryResponse& proto_query_response);
+    static collision_proto::QueryResponse serialize(const QueryResponse& query_response,
+                                                    const collision_proto::ResponseFormat format = collision_proto::RESPONSE_ROWS);
+    static void serialize(const QueryResponse& query_response,
+                          collision_proto::QueryResponse& proto_query_response,
+                          const collision_proto::ResponseFormat format = collision_proto::RESPONSE_ROWS);
+};
+
+// Arena that collision_proto::QueryResponse messages are built or parsed on, so that the
+// Collision messages of a batch come out of a few large blocks freed at once instead of one
+// allocation each. Strings longer than the small string buffer still allocate their characters.
+class QueryResponseArena {
+public:
+    // With an initial_block_size the arena owns a first block of that size, which reset() keeps,
+    // so reusing the arena for responses that fit in it allocates nothing
+    explicit QueryResponseArena(const std::size_t initial_block_size = 0);
+
+    // An empty message on the arena, the message of the previous call and everything else on
+    // the arena is destroyed
+    collision_proto::QueryResponse* reset();
+    std::uint64_t space_used() const;
+
+private:
+    std::unique_ptr<char[]> initial_block_;
+    google::protobuf::Arena arena_;
 };
@@ -0,0 +1,197 @@
+#include "allocation_counter.hpp"
+#include "collision_proto_converter.hpp"
+#include "collision_manager/collision_manager.hpp"
+
+#include <benchmark/benchmark.h>
+
+static std::unique_ptr<CollisionManager> collision_manager;
+
+static void report_allocations(benchmark::State& state, const std::size_t allocations_before) {
+    state.counters["allocations"] = benchmark::Counter(static_cast<double>(num_allocations() - allocations_before),
+                                                       benchmark::Counter::kAvgIterations);
+}
+
+// Serialising the rows of a query into the bytes of a collision_proto::QueryResponse, through
+// Collision and the generated classes as the servers do and straight from the columns
+class CollisionSerializationBenchmark : public benchmark::Fixture
+{
+public:
+
+    void SetUp(const ::benchmark::State& state)
+    {
+        if (collision_manager.get() == nullptr) {
+            collision_manager = std::make_unique<CollisionManager>(std::string("../Motor_Vehicle_Collisions_-_Crashes_20250123.csv"));
+            collision_manager->set_query_cache_capacity(0);
+        }
+    }
+
+    static Query query() {
+        return Query::create(CollisionField::BOROUGH, QueryType::EQUALS, "BROOKLYN");
+    }
+};
+
+BENCHMARK_DEFINE_F(CollisionSerializationBenchmark, ConverterAllFields)(benchmark::State& state) {
+    const std::vector<CollisionProxy*> proxies = collision_manager->searchOpenMp(query());
+
+    for (auto _ : state) {
+        QueryResponse query_response{};
+        query_response.collisions.reserve(proxies.size());
+        for (const CollisionProxy* proxy : proxies) {
+            query_response.collisions.push_back(collision_proxy_to_collision(*proxy));
+        }
+        std::string output{};
+        CollisionProtoConverter::serialize(query_response).SerializeToString(&output);
+        benchmark::DoNotOptimize(output);
+    }
+    state.SetItemsProcessed(state.iterations() * proxies.size());
+}
+
+BENCHMARK_DEFINE_F(CollisionSerializationBenchmark, WireWriterAllFields)(benchmark::State& state) {
+    const std::vector<std::uint32_t> rows = collision_manager->search_rows(query());
+
+    for (auto _ : state) {
+        std::string output{};
+        collision_manager->serialize_rows(rows, all_fields(), output);
+        benchmark::DoNotOptimize(output);
+    }
+    state.SetItemsProcessed(state.iterations() * rows.size());
+}
+
+BENCHMARK_DEFINE_F(CollisionSerializationBenchmark, ConverterProjected)(benchmark::State& state) {
+    FieldMask fields{};
+    fields.set(static_cast<std::size_t>(CollisionField::CRASH_DATE));
+    fields.set(static_cast<std::size_t>(CollisionField::ZIP_CODE));
+    fields.set(static_cast<std::size_t>(CollisionField::COLLISION_ID));
+    const std::vector<CollisionProxy*> proxies = collision_manager->searchOpenMp(query());
+
+    for (auto _ : state) {
+        QueryResponse query_response{.fields = fields};
+        query_response.collisions.reserve(proxies.size());
+        for (const CollisionProxy* proxy : proxies) {
+            query_response.collisions.push_back(collision_proxy_to_collision(*proxy, fields));
+        }
+        std::string output{};
+        CollisionProtoConverter::serialize(query_response).SerializeToString(&output);
+        benchmark::DoNotOptimize(output);
+    }
+    state.SetItemsProcessed(state.iterations() * proxies.size());
+}
+
+BENCHMARK_DEFINE_F(CollisionSerializationBenchmark, WireWriterProjected)(benchmark::State& state) {
+    FieldMask fields{};
+    fields.set(static_cast<std::size_t>(CollisionField::CRASH_DATE));
+    fields.set(static_cast<std::size_t>(CollisionField::ZIP_CODE));
+    fields.set(static_cast<std::size_t>(CollisionField::COLLISION_ID));
+    const std::vector<std::uint32_t> rows = collision_manager->search_rows(query());
+
+    for (auto _ : state) {
+        std::string output{};
+        collision_manager->serialize_rows(rows, fields, output);
+        benchmark::DoNotOptimize(output);
+    }
+    state.SetItemsProcessed(state.iterations() * rows.size());
+}
+
+// Building and parsing a batch of collision_proto::QueryResponse on the heap, as messages
+// used to be, and on a QueryResponseArena as the servers do
+class CollisionArenaBenchmark : public CollisionSerializationBenchmark
+{
+public:
+
+    void SetUp(const ::benchmark::State& state)
+    {
+        CollisionSerializationBenchmark::SetUp(state);
+        query_response = QueryResponse{.collisions = collision_manager->search(query())};
+        CollisionProtoConverter::serialize(query_response).SerializeToString(&wire_bytes);
+    }
+
+    QueryResponse query_response{};
+    std::string wire_bytes{};
+};
+
+BENCHMARK_DEFINE_F(CollisionArenaBenchmark, BuildResponseHeap)(benchmark::State& state) {
+    const std::size_t allocations_before = num_allocations();
+    for (auto _ : state) {
+        collision_proto::QueryResponse response{};
+        CollisionProtoConverter::serialize(query_response, response);
+        benchmark::DoNotOptimize(response);
+    }
+    report_allocations(state, allocations_before);
+    state.SetItemsProcessed(state.iterations() * query_response.collisions.size());
+}
+
+BENCHMARK_DEFINE_F(CollisionArenaBenchmark, BuildResponseArena)(benchmark::State& state) {
+    QueryResponseArena arena(RESPONSE_ARENA_BLOCK_SIZE);
+    const std::size_t allocations_before = num_allocations();
+    for (auto _ : state) {
+        collision_proto::QueryResponse* response = arena.reset();
+        CollisionProtoConverter::serialize(query_response, *response);
+        benchmark::DoNotOptimize(response);
+    }
+    report_allocations(state, allocations_before);
+    state.SetItemsProcessed(state.iterations() * query_response.collisions.size());
+}
+
+BENCHMARK_DEFINE_F(CollisionArenaBenchmark, ParseResponseHeap)(benchmark::State& state) {
+    const std::size_t allocations_before = num_allocations();
+    for (auto _ : state) {
+        collision_proto::QueryResponse response{};
+        response.ParseFromString(wire_bytes);
+        benchmark::DoNotOptimize(response);
+    }
+    report_allocations(state, allocations_before);
+    state.SetItemsProcessed(state.iterations() * query_response.collisions.size());
+}
+
+BENCHMARK_DEFINE_F(CollisionArenaBenchmark, ParseResponseArena)(benchmark::State& state) {
+    const std::size_t allocations_before = num_allocations();
+    for (auto _ : state) {
+        // One arena per received response, as ReceiveResponseCallData has
+        QueryResponseArena arena{};
+        collision_proto::QueryResponse* response = arena.reset();
+        response->ParseFromString(wire_bytes);
+        benchmark::DoNotOptimize(response);
+    }
+    report_allocations(state, allocations_before);
+    state.SetItemsProcessed(state.iterations() * query_response.collisions.size());
+}
+
+// A response sent and received in each format, from Collision back to Collision
+template<collision_proto::ResponseFormat format>
+static void round_trip_response(benchmark::State& state, const QueryResponse& query_response) {
+    std::size_t num_bytes = 0;
+    for (auto _ : state) {
+        std::string wire_bytes{};
+        CollisionProtoConverter::serialize(query_response, format).SerializeToString(&wire_bytes);
+        num_bytes = wire_bytes.size();
+
+        collision_proto::QueryResponse response{};
+        response.ParseFromString(wire_bytes);
+        QueryResponse received = CollisionProtoConverter::deserialize(response);
+        benchmark::DoNotOptimize(received);
+    }
+    state.counters["bytes"] = static_cast<double>(num_bytes);
+    state.SetItemsProcessed(state.iterations() * query_response.collisions.size());
+}
+
+BENCHMARK_DEFINE_F(CollisionArenaBenchmark, RoundTripRows)(benchmark::State& state) {
+    round_trip_response<collision_proto::RESPONSE_ROWS>(state, query_response);
+}
+
+BENCHMARK_DEFINE_F(CollisionArenaBenchmark, RoundTripColumns)(benchmark::State& state) {
+    round_trip_response<collision_proto::RESPONSE_COLUMNS>(state, query_response);
+}
+
+BENCHMARK_REGISTER_F(CollisionSerializationBenchmark, ConverterAllFields)->Unit(benchmark::kMillisecond);
+BENCHMARK_REGISTER_F(CollisionSerializationBenchmark, WireWriterAllFields)->Unit(benchmark::kMillisecond);
+BENCHMARK_REGISTER_F(CollisionSerializationBenchmark, ConverterProjected)->Unit(benchmark::kMillisecond);
+BENCHMARK_REGISTER_F(CollisionSerializationBenchmark, WireWriterProjected)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_REGISTER_F(CollisionArenaBenchmark, BuildResponseHeap)->Unit(benchmark::kMillisecond);
+BENCHMARK_REGISTER_F(CollisionArenaBenchmark, BuildResponseArena)->Unit(benchmark::kMillisecond);
+BENCHMARK_REGISTER_F(CollisionArenaBenchmark, ParseResponseHeap)->Unit(benchmark::kMillisecond);
+BENCHMARK_REGISTER_F(CollisionArenaBenchmark, ParseResponseArena)->Unit(benchmark::kMillisecond);
+BENCHMARK_REGISTER_F(CollisionArenaBenchmark, RoundTripRows)->Unit(benchmark::kMillisecond);
+BENCHMARK_REGISTER_F(CollisionArenaBenchmark, RoundTripColumns)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -1,11 +1,17 @@
 #include "collision_query_service_impl.hpp"
 
+#include "explain_proto_converter.hpp"
+#include "ring_buffer.hpp"
+#include "statistics_proto_converter.hpp"
+
 #include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <iostream>
 #include <memory>
 #include <mutex>
+#include <stdexcept>
 #include <string>
 #include <unordered_map>
 
@@ -14,6 +20,7 @@
 
 std::atomic<std::size_t> requestCounter = 1;
 Ringbuffer<std::size_t, 100> latestQueryIDs = {};
+std::mutex latestQueryIDsMutex{};
 
 bool isDuplicateQueryID(const std::size_t query_id) {
     if (latestQueryIDs.is_empty()) {
@@ -37,83 +44,118 @@ void appendQueryID(const std::size_t query_id) {
     latestQueryIDs.push(query_id);
 }
 
+// The earlier of the deadline query_request carries and that of the call it came with. Queries
+// of clients that set neither get DEFAULT_QUERY_TIMEOUT.
+std::chrono::system_clock::time_point query_deadline(const QueryRequest& query_request, const ServerContext& ctx, const bool from_client) {
+    const std::chrono::system_clock::time_point deadline = std::min(query_request.deadline, ctx.deadline());
+    if (from_client && deadline == NO_DEADLINE) {
+        return std::chrono::system_clock::now() + DEFAULT_QUERY_TIMEOUT;
+    }
+    return deadline;
+}
+
 CollisionQueryServiceImpl::CollisionQueryServiceImpl(
     std::uint32_t rank,
-    std::mutex& pending_requests_mutex,
+    CollisionManager& collision_manager,
     std::mutex& pending_client_requests_mutex,
-    std::mutex& pending_responses_mutex,
-    PendingRequestsRingbuffer& pending_requests,
-    PendingResponsesRingbuffer& pending_responses,
-    std::condition_variable& pending_requests_cv,
-    std::condition_variable& pending_responses_cv,
+    PendingRequestsQueue& pending_requests,
+    PendingResponsesQueue& pending_responses,
     std::unordered_map<std::size_t, GetCollisionsClientRequest>& pending_client_requests_map,
-    std::unordered_map<std::size_t, StreamCollisionsClientRequest>& pending_stream_requests_map)
+    std::unordered_map<std::size_t, StreamCollisionsClientRequest>& pending_stream_requests_map,
+    AdmissionController& admission_controller,
+    std::vector<const WorkerPoolStatisticsSource*> worker_pools)
     : rank_{rank}
-    , pending_requests_mutex_{pending_requests_mutex}
+    , collision_manager_{collision_manager}
     , pending_client_requests_mutex_{pending_client_requests_mutex}
-    , pending_responses_mutex_{pending_responses_mutex}
     , pending_requests_{pending_requests}
     , pending_responses_{pending_responses}
-    , pending_requests_cv_{pending_requests_cv}
-    , pending_responses_cv_{pending_responses_cv}
     , pending_client_requests_map_{pending_client_requests_map}
-    , pending_stream_requests_map_{pending_stream_requests_map} {}
+    , pending_stream_requests_map_{pending_stream_requests_map}
+    , admission_controller_{admission_controller}
+    , worker_pools_{std::move(worker_pools)} {}
 
 CollisionQueryServiceImpl::~CollisionQueryServiceImpl() {
     server_->Shutdown();
-    cq_->Shutdown();
+    for (const std::unique_ptr<grpc::ServerCompletionQueue>& cq : cqs_) {
+        cq->Shutdown();
+    }
+    for (std::thread& cq_thread : cq_threads_) {
+        if (cq_thread.joinable()) {
+            cq_thread.join();
+        }
+    }
 }
 
-void CollisionQueryServiceImpl::Run(const std::string server_address ) {
+void CollisionQueryServiceImpl::Run(const std::string server_address, std::size_t num_completion_queues) {
+    if (num_completion_queues == 0) {
+        num_completion_queues = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
      //std::string server_address = "127.0.0.1:" + std::to_string(port);
 //    std::string server_address = "0.0.0.0:" + std::to_string(port);
 
     ServerBuilder builder;
     builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
     builder.RegisterService(this);
-    cq_ = builder.AddCompletionQueue();
+    for (std::size_t index = 0; index < num_completion_queues; ++index) {
+        cqs_.push_back(builder.AddCompletionQueue());
+    }
     server_ = builder.BuildAndStart();
 
-    std::cout << "Server listening on " << server_address << std::endl;
+    std::cout << "Server listening on " << server_address << " with " << num_completion_queues
+              << " completion queues" << std::endl;
 
-    HandleRpcs();
+    for (std::size_t index = 1; index < cqs_.size(); ++index) {
+        cq_threads_.emplace_back(&CollisionQueryServiceImpl::HandleRpcs, this, cqs_[index].get());
+    }
+    HandleRpcs(cqs_[0].get());
+    for (std::thread& cq_thread : cq_threads_) {
+        cq_thread.join();
+    }
 }
 
-void CollisionQueryServiceImpl::HandleRpcs() {
+// Posts one CallData of every RPC on cq, so a call can be accepted on any of the queues, and
+// handles the events of cq until it is shut down
+void CollisionQueryServiceImpl::HandleRpcs(grpc::ServerCompletionQueue* cq) {
     new SendRequestCallData(this,
-                            cq_.get(),
-                            pending_requests_mutex_,
+                            cq,
                             pending_requests_,
-                            pending_requests_cv_);
+                            admission_controller_);
     new ReceiveResponseCallData(this,
-                                cq_.get(),
-                                pending_responses_mutex_,
-                                pending_responses_,
-                                pending_responses_cv_);
+                                cq,
+                                pending_responses_);
+    new GetStatisticsCallData(this,
+                              cq,
+                              rank_,
+                              collision_manager_,
+                              worker_pools_,
+                              admission_controller_);
+    new ExplainQueryCallData(this,
+                             cq,
+                             rank_,
+                             collision_manager_);
 
     if (rank_ == 0) {
         new GetCollisionsCallData(this,
-                                  cq_.get(),
+                                  cq,
                                   rank_,
-                                  pending_requests_mutex_,
                                   pending_client_requests_mutex_,
                                   pending_requests_,
-                                  pending_requests_cv_,
-                                  pending_client_requests_map_);
+                                  pending_client_requests_map_,
+                                  admission_controller_);
         new StreamCollisionsCallData(this,
-                                     cq_.get(),
+                                     cq,
                                      rank_,
-                                     pending_requests_mutex_,
                                      pending_client_requests_mutex_,
                                      pending_requests_,
-                                     pending_requests_cv_,
-                                     pending_stream_requests_map_);
+                                     pending_stream_requests_map_,
+                                     admission_controller_);
     }
 
     void* tag;
     bool ok;
 
-    while (cq_->Next(&tag, &ok)) {
+    while (cq->Next(&tag, &ok)) {
         static_cast<CallDataBase*>(tag)->Proceed(ok);
     }
 }
@@ -123,21 +165,19 @@ GetCollisionsCallData::GetCollisionsCallData(
     CollisionQueryServiceImpl* service,
     ServerCompletionQueue* cq,
     std::uint32_t rank,
-    std::mutex& pending_requests_mutex,
     std::mutex& pending_client_requests_mutex,
-    PendingRequestsRingbuffer& pending_requests,
-    std::condition_variable& pending_requests_cv,
-    std::unordered_map<std::size_t, GetCollisionsClientRequest>& pending_client_requests_map)
+    PendingRequestsQueue& pending_requests,
+    std::unordered_map<std::size_t, GetCollisionsClientRequest>& pending_client_requests_map,
+    AdmissionController& admission_controller)
     : service_(service)
     , cq_(cq)
     , responder_(&ctx_)
     , status_(CREATE)
     , rank_(rank)
-    , pending_requests_mutex_(pending_requests_mutex)
     , pending_client_requests_mutex_(pending_client_requests_mutex)
     , pending_requests_(pending_requests)
-    , pending_requests_cv_(pending_requests_cv)
     , pending_client_requests_map_(pending_client_requests_map)
+    , admission_controller_(admission_controller)
 {
     Proceed(true);
 }
@@ -147,9 +187,23 @@ void GetCollisionsCallData::Proceed(bool ok) {
         status_ = PROCESS;
         service_->RequestGetCollisions(&ctx_, &request_, &responder_, cq_, cq_, this);
     } else if (status_ == PROCESS) {
-        new GetCollisionsCallData(service_, cq_, rank_, pending_requests_mutex_, pending_client_requests_mutex_, pending_requests_, pending_requests_cv_, pending_client_requests_map_);
+        new GetCollisionsCallData(service_, cq_, rank_, pending_client_requests_mutex_, pending_requests_, pending_client_requests_map_,
+                                  admission_controller_);
+
+        QueryRequest query_request{};
+        try {
+            query_request = QueryProtoConverter::deserialize(request_);
+        } catch (const std::invalid_argument& e) {
+            FailRequest(request_.id(), Status(grpc::StatusCode::INVALID_ARGUMENT, e.what()));
+            return;
+        }
 
-        QueryRequest query_request = QueryProtoConverter::deserialize(request_);
+        query_request.deadline = query_deadline(query_request, ctx_, true);
+        const Status admission = admission_controller_.admit(pending_requests_.size_approx(), query_request.deadline);
+        if (!admission.ok()) {
+            FailRequest(request_.id(), admission);
+            return;
+        }
 
         {
             std::lock_guard<std::mutex> pending_client_requests_lock(pending_client_requests_mutex_);
@@ -159,7 +213,13 @@ void GetCollisionsCallData::Proceed(bool ok) {
             GetCollisionsClientRequest client_request {
                 .collisions = {},
                 .ranks = {},
+                .num_batches_received = {},
                 .call_data_base = this,
+                .order = query_request.query.get_order(),
+                .limit = query_request.query.get_limit(),
+                .fields = query_request.query.get_result_fields(),
+                .aggregates = std::nullopt,
+                .deadline = query_request.deadline,
             };
 
             auto [it, inserted] = pending_client_requests_map_.try_emplace(query_request.id, client_request);
@@ -180,9 +240,11 @@ void GetCollisionsCallData::Proceed(bool ok) {
                 return;
             }
 
-            std::lock_guard<std::mutex> pending_requests_lock(pending_requests_mutex_);
-            pending_requests_.push(query_request);
-            pending_requests_cv_.notify_one();
+            if (!pending_requests_.try_push(query_request)) {
+                pending_client_requests_map_.erase(it);
+                FailRequest(query_request.id, Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "Too many pending requests"));
+                return;
+            }
         }
 
         std::cout << "Added request from: 'client' with id: '" << query_request.id <<
@@ -194,39 +256,56 @@ void GetCollisionsCallData::Proceed(bool ok) {
 }
 
 void GetCollisionsCallData::CompleteRequest(const std::size_t id,
-                                            const std::vector<Collision>& collisions) {
+                                            const std::vector<Collision>& collisions,
+                                            const FieldMask& fields,
+                                            const std::optional<AggregateTable>& aggregates,
+                                            const std::optional<ResumeToken>& resume_token) {
     QueryResponse query_response {
         .id = id,
         .requested_by = {},
         .results_from = rank_,
         .collisions = collisions,
+        .aggregates = aggregates,
+        .aggregated_ranks = {},
+        .fields = fields,
+        .resume_token = resume_token,
     };
 
-    collision_proto::QueryResponse response = CollisionProtoConverter::serialize(query_response);
+    collision_proto::QueryResponse* response = arena_.reset();
+    CollisionProtoConverter::serialize(query_response, *response, request_.response_format());
+
+    status_ = FINISH;
+    responder_.Finish(*response, Status::OK, this);
+}
+
+void GetCollisionsCallData::FailRequest(const std::size_t id, const Status& status) {
+    std::cout << "Failing request with id: '" << id << "': " << status.error_message() << std::endl;
+
+    collision_proto::QueryResponse* response = arena_.reset();
+    response->set_id(id);
+    response->set_results_from(rank_);
 
     status_ = FINISH;
-    responder_.Finish(response, Status::OK, this);
+    responder_.Finish(*response, status, this);
 }
 
 StreamCollisionsCallData::StreamCollisionsCallData(
     CollisionQueryServiceImpl* service,
     ServerCompletionQueue* cq,
     std::uint32_t rank,
-    std::mutex& pending_requests_mutex,
     std::mutex& pending_client_requests_mutex,
-    PendingRequestsRingbuffer& pending_requests,
-    std::condition_variable& pending_requests_cv,
-    std::unordered_map<std::size_t, StreamCollisionsClientRequest>& pending_stream_requests_map)
+    PendingRequestsQueue& pending_requests,
+    std::unordered_map<std::size_t, StreamCollisionsClientRequest>& pending_stream_requests_map,
+    AdmissionController& admission_controller)
     : service_(service)
     , cq_(cq)
     , responder_(&ctx_)
     , status_(CREATE)
     , rank_(rank)
-    , pending_requests_mutex_(pending_requests_mutex)
     , pending_client_requests_mutex_(pending_client_requests_mutex)
     , pending_requests_(pending_requests)
-    , pending_requests_cv_(pending_requests_cv)
     , pending_stream_requests_map_(pending_stream_requests_map)
+    , admission_controller_(admission_controller)
 {
     Proceed(true);
 }
@@ -236,16 +315,41 @@ void StreamCollisionsCallData::Proceed(bool ok) {
         status_ = PROCESS;
         service_->RequestStreamCollisions(&ctx_, &request_, &responder_, cq_, cq_, this);
     } else if (status_ == PROCESS) {
-        new StreamCollisionsCallData(service_, cq_, rank_, pending_requests_mutex_, pending_client_requests_mutex_, pending_requests_, pending_requests_cv_, pending_stream_requests_map_);
-
-        QueryRequest query_request = QueryProtoConverter::deserialize(request_);
+        new StreamCollisionsCallData(service_, cq_, rank_, pending_client_requests_mutex_, pending_requests_, pending_stream_requests_map_,
+                                     admission_controller_);
+
+        QueryRequest query_request{};
+        try {
+            query_request = QueryProtoConverter::deserialize(request_);
+        } catch (const std::invalid_argument& e) {
+            std::cout << "Failing request with id: '" << request_.id() << "': " << e.what() << std::endl;
+            status_ = FINISH;
+            responder_.Finish(Status(grpc::StatusCode::INVALID_ARGUMENT, e.what()), this);
+            return;
+        }
+        // A stream already sends every row in batches
+        query_request.page_size = 0;
+        query_request.resume_token = std::nullopt;
+
+        query_request.deadline = query_deadline(query_request, ctx_, true);
+        const Status admission = admission_controller_.admit(pending_requests_.size_approx(), query_request.deadline);
+        if (!admission.ok()) {
+            std::cout << "Failing request with id: '" << request_.id() << "': " << admission.error_message() << std::endl;
+            status_ = FINISH;
+            responder_.Finish(admission, this);
+            return;
+        }
 
         {
             std::lock_guard<std::mutex> pending_client_requests_lock(pending_client_requests_mutex_);
 
             query_request.id = requestCounter.fetch_add(1);
 
-            auto [it, inserted] = pending_stream_requests_map_.try_emplace(query_request.id, this);
+            auto [it, inserted] = pending_stream_requests_map_.try_emplace(query_request.id, this,
+                                                                          query_request.query.get_order(),
+                                                                          query_request.query.get_limit(),
+                                                                          query_request.query.get_result_fields(),
+                                                                          query_request.deadline);
             if (!inserted) {
                 std::cout << "Request with id: '" << query_request.id << "' already in map!" << std::endl;
                 status_ = FINISH;
@@ -266,9 +370,13 @@ void StreamCollisionsCallData::Proceed(bool ok) {
                 return;
             }
 
-            std::lock_guard<std::mutex> pending_requests_lock(pending_requests_mutex_);
-            pending_requests_.push(query_request);
-            pending_requests_cv_.notify_one();
+            if (!pending_requests_.try_push(query_request)) {
+                pending_stream_requests_map_.erase(it);
+                std::cout << "Failing request with id: '" << query_request.id << "': too many pending requests" << std::endl;
+                status_ = FINISH;
+                responder_.Finish(Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "Too many pending requests"), this);
+                return;
+            }
         }
 
         std::cout << "Added request from: 'client' with id: '" << query_request.id <<
@@ -282,25 +390,34 @@ void StreamCollisionsCallData::Proceed(bool ok) {
 void StreamCollisionsCallData::Write(const std::size_t id,
                                      const std::uint32_t results_from,
                                      const std::vector<Collision>& collisions,
-                                     std::unique_lock<std::mutex>&& write_lock) {
+                                     const FieldMask& fields,
+                                     std::unique_lock<std::mutex>&& write_lock,
+                                     const std::optional<AggregateTable>& aggregates) {
     QueryResponse query_response {
         .id = id,
         .requested_by = {},
         .results_from = rank_,
         .collisions = collisions,
+        .aggregates = aggregates,
+        .aggregated_ranks = {},
+        .fields = fields,
     };
 
-    collision_proto::QueryResponse response = CollisionProtoConverter::serialize(query_response);
+    if (arena_ == nullptr) {
+        arena_ = std::make_unique<QueryResponseArena>(RESPONSE_ARENA_BLOCK_SIZE);
+    }
+    collision_proto::QueryResponse* response = arena_->reset();
+    CollisionProtoConverter::serialize(query_response, *response, request_.response_format());
 
     void* write_tag = (void*) new StreamCollisionsWriteTagCallData(id, results_from, std::move(write_lock));
 
-    responder_.Write(response, write_tag);
+    responder_.Write(*response, write_tag);
 }
 
-void StreamCollisionsCallData::Finish(const std::size_t id) {
+void StreamCollisionsCallData::Finish(const std::size_t id, const Status& status) {
     std::cout << "StreamCollisionsCallData::Finish for: " << id << std::endl;
     status_ = FINISH;
-    responder_.Finish(Status::OK, this);
+    responder_.Finish(status, this);
 }
 
 StreamCollisionsWriteTagCallData::StreamCollisionsWriteTagCallData(std::size_t id, std::uint32_t results_from, std::unique_lock<std::mutex>&& lock)
@@ -315,16 +432,14 @@ void StreamCollisionsWriteTagCallData::Proceed(bool ok) {
 SendRequestCallData::SendRequestCallData(
     CollisionQueryServiceImpl* service,
     ServerCompletionQueue* cq,
-    std::mutex& pending_requests_mutex,
-    PendingRequestsRingbuffer& pending_requests,
-    std::condition_variable& pending_requests_cv)
+    PendingRequestsQueue& pending_requests,
+    AdmissionController& admission_controller)
     : service_(service)
     , cq_(cq)
     , responder_(&ctx_)
     , status_(CREATE)
-    , pending_requests_mutex_(pending_requests_mutex)
     , pending_requests_(pending_requests)
-    , pending_requests_cv_(pending_requests_cv)
+    , admission_controller_(admission_controller)
 {
     Proceed(true);
 }
@@ -334,27 +449,35 @@ void SendRequestCallData::Proceed(bool ok) {
         status_ = PROCESS;
         service_->RequestSendRequest(&ctx_, &request_, &responder_, cq_, cq_, this);
     } else if (status_ == PROCESS) {
-        new SendRequestCallData(service_, cq_, pending_requests_mutex_, pending_requests_, pending_requests_cv_);
+        new SendRequestCallData(service_, cq_, pending_requests_, admission_controller_);
 
         QueryRequest query_request = QueryProtoConverter::deserialize(request_);
+        query_request.deadline = query_deadline(query_request, ctx_, false);
 
+        Status status = Status::OK;
         {
-            std::lock_guard<std::mutex> lock(pending_requests_mutex_);
-            if (!isDuplicateQueryID(query_request.id)) {
+            std::lock_guard<std::mutex> lock(latestQueryIDsMutex);
+            if (isDuplicateQueryID(query_request.id)) {
+                std::cout << "Dropping duplicate query with id: " << query_request.id << std::endl;
+                status = Status(grpc::StatusCode::ALREADY_EXISTS, "Query already received");
+            } else if (status = admission_controller_.admit(pending_requests_.size_approx(), query_request.deadline); !status.ok()) {
+                // Not marked as received, so that the sender may hand it over again while it has time left
+                std::cout << "Turning away query with id: " << query_request.id << ", " << status.error_message() << std::endl;
+            } else if (!pending_requests_.try_push(query_request)) {
+                // Not marked as received, so that another neighbour may still hand it over
+                std::cout << "Turning away query with id: " << query_request.id << ", too many pending requests" << std::endl;
+                status = Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "Too many pending requests");
+            } else {
                 appendQueryID(query_request.id);
-                pending_requests_.push(query_request);
-                pending_requests_cv_.notify_one();
-
                 std::cout << "Added request from: '" << static_cast<char>('A' + query_request.requested_by.back()) <<
                              "' with id: '" << query_request.id << "' to the pendingRequests queue" << std::endl;
-            } else {
-                std::cout << "Dropping duplicate query with id: " << query_request.id << std::endl;
             }
         }
 
+        // The sender learns which ranks took the query from it, and so whose results come back to it
         Empty response;
         status_ = FINISH;
-        responder_.Finish(response, Status::OK, this);
+        responder_.Finish(response, status, this);
     } else {
         assert(status_ == FINISH);
         delete this;
@@ -365,16 +488,13 @@ void SendRequestCallData::Proceed(bool ok) {
 ReceiveResponseCallData::ReceiveResponseCallData(
     CollisionQueryServiceImpl* service,
     ServerCompletionQueue* cq,
-    std::mutex& pending_responses_mutex,
-    PendingResponsesRingbuffer& pending_responses,
-    std::condition_variable& pending_responses_cv)
+    PendingResponsesQueue& pending_responses)
     : service_(service)
     , cq_(cq)
+    , response_(arena_.reset())
     , responder_(&ctx_)
     , status_(CREATE)
-    , pending_responses_mutex_(pending_responses_mutex)
     , pending_responses_(pending_responses)
-    , pending_responses_cv_(pending_responses_cv)
 {
     Proceed(true);
 }
@@ -382,28 +502,125 @@ ReceiveResponseCallData::ReceiveResponseCallData(
 void ReceiveResponseCallData::Proceed(bool ok) {
     if (status_ == CREATE) {
         status_ = PROCESS;
-        service_->RequestReceiveResponse(&ctx_, &response_, &responder_, cq_, cq_, this);
+        service_->RequestReceiveResponse(&ctx_, response_, &responder_, cq_, cq_, this);
     } else if (status_ == PROCESS) {
-        new ReceiveResponseCallData(service_, cq_, pending_responses_mutex_, pending_responses_, pending_responses_cv_);
-
-        QueryResponse query_response = CollisionProtoConverter::deserialize(response_);
+        new ReceiveResponseCallData(service_, cq_, pending_responses_);
+
+        QueryResponse query_response{};
+        try {
+            query_response = CollisionProtoConverter::deserialize(*response_);
+        } catch (const std::runtime_error& e) {
+            std::cout << "Turning away response with id: '" << response_->id() << "': " << e.what() << std::endl;
+            Empty response;
+            status_ = FINISH;
+            responder_.Finish(response, Status(grpc::StatusCode::INVALID_ARGUMENT, e.what()), this);
+            return;
+        }
 
         std::cout << "Received response from: '" << static_cast<char>('A' + query_response.requested_by.back()) <<
-                     "' with id: '" << response_.id() <<
+                     "' with id: '" << response_->id() <<
                      "' originally from: '" << static_cast<char>('A' + query_response.results_from) << "'"
                   << std::endl;
 
         query_response.requested_by.pop_back();
 
-        {
-            std::lock_guard<std::mutex> lock(pending_responses_mutex_);
-            pending_responses_.push(query_response);
-            pending_responses_cv_.notify_one();
+        // Waiting for room here would hold up the completion queue, which the response workers
+        // need to finish stream writes, so the sender is told to send the batch again instead
+        Status status = Status::OK;
+        if (!pending_responses_.try_push(std::move(query_response))) {
+            std::cout << "Turning away response with id: '" << response_->id() << "', too many pending responses" << std::endl;
+            status = Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "Too many pending responses");
         }
 
         Empty response;
         status_ = FINISH;
-        responder_.Finish(response, Status::OK, this);
+        responder_.Finish(response, status, this);
+    } else {
+        assert(status_ == FINISH);
+        delete this;
+    }
+}
+
+
+GetStatisticsCallData::GetStatisticsCallData(
+    CollisionQueryServiceImpl* service,
+    ServerCompletionQueue* cq,
+    std::uint32_t rank,
+    const CollisionManager& collision_manager,
+    const std::vector<const WorkerPoolStatisticsSource*>& worker_pools,
+    const AdmissionController& admission_controller)
+    : service_(service)
+    , cq_(cq)
+    , responder_(&ctx_)
+    , status_(CREATE)
+    , rank_(rank)
+    , collision_manager_(collision_manager)
+    , worker_pools_(worker_pools)
+    , admission_controller_(admission_controller)
+{
+    Proceed(true);
+}
+
+void GetStatisticsCallData::Proceed(bool ok) {
+    if (status_ == CREATE) {
+        status_ = PROCESS;
+        service_->RequestGetStatistics(&ctx_, &request_, &responder_, cq_, cq_, this);
+    } else if (status_ == PROCESS) {
+        new GetStatisticsCallData(service_, cq_, rank_, collision_manager_, worker_pools_, admission_controller_);
+
+        std::vector<WorkerPoolStatistics> worker_pool_statistics;
+        for (const WorkerPoolStatisticsSource* worker_pool : worker_pools_) {
+            worker_pool_statistics.push_back(worker_pool->get_statistics());
+        }
+
+        status_ = FINISH;
+        try {
+            collision_proto::StatisticsResponse response = StatisticsProtoConverter::serialize(
+                rank_, collision_manager_.get_statistics(), collision_manager_.get_query_cache_statistics(),
+                worker_pool_statistics, admission_controller_.get_statistics(), request_);
+            responder_.Finish(response, Status::OK, this);
+        } catch (const std::invalid_argument& e) {
+            responder_.FinishWithError(Status(grpc::StatusCode::INVALID_ARGUMENT, e.what()), this);
+        }
+    } else {
+        assert(status_ == FINISH);
+        delete this;
+    }
+}
+
+
+ExplainQueryCallData::ExplainQueryCallData(
+    CollisionQueryServiceImpl* service,
+    ServerCompletionQueue* cq,
+    std::uint32_t rank,
+    const CollisionManager& collision_manager)
+    : service_(service)
+    , cq_(cq)
+    , responder_(&ctx_)
+    , status_(CREATE)
+    , rank_(rank)
+    , collision_manager_(collision_manager)
+{
+    Proceed(true);
+}
+
+void ExplainQueryCallData::Proceed(bool ok) {
+    if (status_ == CREATE) {
+        status_ = PROCESS;
+        service_->RequestExplainQuery(&ctx_, &request_, &responder_, cq_, cq_, this);
+    } else if (status_ == PROCESS) {
+        new ExplainQueryCallData(service_, cq_, rank_, collision_manager_);
+
+        status_ = FINISH;
+        try {
+            // Every rank plans against its own partition, so the plans can differ between ranks
+            QueryRequest query_request = QueryProtoConverter::deserialize(request_);
+            collision_proto::ExplainResponse response = ExplainProtoConverter::serialize(
+                rank_, collision_manager_.explain(query_request.query), query_request.query);
+            responder_.Finish(response, Status::OK, this);
+        } catch (const std::exception& e) {
+            responder_.FinishWithError(Status(grpc::StatusCode::INVALID_ARGUMENT, e.what()), this);
+        }
     } else {
         assert(status_ == FINISH);
         delete this;
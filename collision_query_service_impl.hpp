@@ -1,18 +1,24 @@
 #pragma once
 
+#include "admission_controller.hpp"
 #include "collision_manager/collision.hpp"
+#include "collision_manager/collision_manager.hpp"
 #include "collision_proto_converter.hpp"
+#include "mpmc_queue.hpp"
 #include "query_proto_converter.hpp"
-#include "ring_buffer.hpp"
+#include "worker_pool.hpp"
 
 #include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <iostream>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <queue>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
@@ -32,10 +38,23 @@ using grpc::Status;
 using google::protobuf::Empty;
 
 constexpr std::size_t MAX_CONCURRENT_REQUESTS = 100;
-using PendingRequestsRingbuffer = Ringbuffer<QueryRequest, MAX_CONCURRENT_REQUESTS>;
+// Queries a rank is yet to start on. Queries from clients and peers are turned away by the
+// AdmissionController of the rank once it holds too many, instead of holding up the completion queue.
+using PendingRequestsQueue = MpmcQueue<QueryRequest, MAX_CONCURRENT_REQUESTS>;
 
 constexpr std::size_t MAX_CONCURRENT_RESPONSES = 5 * MAX_CONCURRENT_REQUESTS;
-using PendingResponsesRingbuffer = Ringbuffer<QueryResponse, MAX_CONCURRENT_RESPONSES>;
+// Batches of rows a rank is yet to pass on. When full, the workers of the rank wait for room and
+// peers get RESOURCE_EXHAUSTED, upon which they send the batch again.
+using PendingResponsesQueue = MpmcQueue<QueryResponse, MAX_CONCURRENT_RESPONSES>;
+// Longest a rank waits before sending a turned away query or batch again, the wait doubles from
+// 1 ms until the deadline of the query passes
+constexpr std::chrono::milliseconds MAX_RESEND_BACKOFF{100};
+// Longest rank 0 goes without looking for clients whose deadline passed, so that a client arriving
+// with an earlier deadline than those seen at the last look is answered at most this late
+constexpr std::chrono::milliseconds MAX_EXPIRY_SWEEP_INTERVAL{100};
+
+// Most collisions in one QueryResponse, a rank sends the rows of a query in as many as it needs
+constexpr std::size_t RESPONSE_BATCH_SIZE = 1024;
 
 class CallDataBase {
 public:
@@ -46,52 +65,87 @@ public:
 
 struct GetCollisionsClientRequest {
     std::vector<Collision> collisions;
+    // Ranks that sent every batch of their rows
     std::vector<uint32_t> ranks;
+    std::unordered_map<std::uint32_t, std::uint32_t> num_batches_received;
     CallDataBase* call_data_base;
+    // Applied to collisions once every rank has answered
+    std::optional<QueryOrder> order;
+    std::optional<std::size_t> limit;
+    // Columns the client asked for, the only ones its response carries
+    FieldMask fields = all_fields();
+    // Merged partial aggregates of an aggregation query, which has no collisions
+    std::optional<AggregateTable> aggregates;
+    // For a page, where the next one starts, and whether a rank no longer kept the cursor the
+    // page resumes
+    std::optional<ResumeToken> resume_token = std::nullopt;
+    bool cursor_expired = false;
+    // The client is answered with DEADLINE_EXCEEDED once it passed
+    std::chrono::system_clock::time_point deadline = NO_DEADLINE;
 };
 
 struct StreamCollisionsClientRequest {
     std::mutex write_mutex;
+    // Ranks that sent every batch of their rows
     std::vector<uint32_t> ranks;
+    std::unordered_map<std::uint32_t, std::uint32_t> num_batches_received;
+    // Response workers between counting a batch and handing it to Write, the stream finishes
+    // once none are left
+    std::size_t num_writers = 0;
+    std::condition_variable writers_done_cv;
     CallDataBase* call_data_base;
-
-    StreamCollisionsClientRequest(CallDataBase* call_data_base_ptr)
-      : call_data_base(call_data_base_ptr) {}
+    // Ordered results are held back in collisions and written in one go once every rank has answered
+    std::optional<QueryOrder> order;
+    std::optional<std::size_t> limit;
+    // Columns the client asked for, the only ones its batches carry
+    FieldMask fields;
+    std::vector<Collision> collisions;
+    // The stream is finished with DEADLINE_EXCEEDED once it passed
+    std::chrono::system_clock::time_point deadline;
+
+    StreamCollisionsClientRequest(CallDataBase* call_data_base_ptr,
+                                  const std::optional<QueryOrder>& query_order,
+                                  const std::optional<std::size_t>& query_limit,
+                                  const FieldMask& query_fields,
+                                  const std::chrono::system_clock::time_point query_deadline)
+      : call_data_base(call_data_base_ptr), order(query_order), limit(query_limit), fields(query_fields), deadline(query_deadline) {}
 };
 
 class CollisionQueryServiceImpl final : public collision_proto::CollisionQueryService::AsyncService {
 public:
     CollisionQueryServiceImpl(
         std::uint32_t rank,
-        std::mutex& pending_requests_mutex,
+        CollisionManager& collision_manager,
         std::mutex& pending_client_requests_mutex,
-        std::mutex& pending_responses_mutex,
-        PendingRequestsRingbuffer& pending_requests,
-        PendingResponsesRingbuffer& pending_responses,
-        std::condition_variable& pending_requests_cv,
-        std::condition_variable& pending_responses_cv,
+        PendingRequestsQueue& pending_requests,
+        PendingResponsesQueue& pending_responses,
         std::unordered_map<std::size_t, GetCollisionsClientRequest>& pending_client_requests_map,
-        std::unordered_map<std::size_t, StreamCollisionsClientRequest>& pending_stream_requests_map);
+        std::unordered_map<std::size_t, StreamCollisionsClientRequest>& pending_stream_requests_map,
+        AdmissionController& admission_controller,
+        std::vector<const WorkerPoolStatisticsSource*> worker_pools = {});
     ~CollisionQueryServiceImpl();
 
-    void Run(const std::string server_address);
+    // Serves on num_completion_queues completion queues, 0 for one per core. Each queue has its own
+    // CallData posted and is polled by its own thread, the calling thread polling the first one.
+    void Run(const std::string server_address, const std::size_t num_completion_queues = 1);
 
 private:
-    void HandleRpcs();
+    void HandleRpcs(grpc::ServerCompletionQueue* cq);
 
     std::uint32_t rank_;
+    CollisionManager& collision_manager_;
     std::unique_ptr<grpc::Server> server_;
-    std::unique_ptr<grpc::ServerCompletionQueue> cq_;
+    std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> cqs_;
+    std::vector<std::thread> cq_threads_;
 
-    std::mutex& pending_requests_mutex_;
     std::mutex& pending_client_requests_mutex_;
-    std::mutex& pending_responses_mutex_;
-    PendingRequestsRingbuffer& pending_requests_;
-    PendingResponsesRingbuffer& pending_responses_;
-    std::condition_variable& pending_requests_cv_;
-    std::condition_variable& pending_responses_cv_;
+    PendingRequestsQueue& pending_requests_;
+    PendingResponsesQueue& pending_responses_;
     std::unordered_map<std::size_t, GetCollisionsClientRequest>& pending_client_requests_map_;
     std::unordered_map<std::size_t, StreamCollisionsClientRequest>& pending_stream_requests_map_;
+    AdmissionController& admission_controller_;
+    // Reported by GetStatistics
+    const std::vector<const WorkerPoolStatisticsSource*> worker_pools_;
 };
 
 
@@ -100,30 +154,35 @@ public:
     GetCollisionsCallData(CollisionQueryServiceImpl* service,
                           ServerCompletionQueue* cq,
                           std::uint32_t rank,
-                          std::mutex& pending_requests_mutex,
                           std::mutex& pending_client_requests_mutex,
-                          PendingRequestsRingbuffer& pending_requests,
-                          std::condition_variable& pending_requests_cv,
-                          std::unordered_map<std::size_t, GetCollisionsClientRequest>& pending_client_requests_map);
+                          PendingRequestsQueue& pending_requests,
+                          std::unordered_map<std::size_t, GetCollisionsClientRequest>& pending_client_requests_map,
+                          AdmissionController& admission_controller);
 
     void Proceed(bool ok) override;
     void CompleteRequest(const std::size_t id,
-                         const std::vector<Collision>& collisions);
+                         const std::vector<Collision>& collisions,
+                         const FieldMask& fields,
+                         const std::optional<AggregateTable>& aggregates = std::nullopt,
+                         const std::optional<ResumeToken>& resume_token = std::nullopt);
+    // Answers without rows with status, which is not OK
+    void FailRequest(const std::size_t id, const Status& status);
 
 private:
     CollisionQueryServiceImpl* service_;
     ServerCompletionQueue* cq_;
     ServerContext ctx_;
     collision_proto::QueryRequest request_;
+    // The response is built on it and lives until the call is deleted
+    QueryResponseArena arena_;
     ServerAsyncResponseWriter<collision_proto::QueryResponse> responder_;
     enum CallStatus { CREATE, PROCESS, FINISH };
     CallStatus status_;
     std::uint32_t rank_;
-    std::mutex& pending_requests_mutex_;
     std::mutex& pending_client_requests_mutex_;
-    PendingRequestsRingbuffer& pending_requests_;
-    std::condition_variable& pending_requests_cv_;
+    PendingRequestsQueue& pending_requests_;
     std::unordered_map<std::size_t, GetCollisionsClientRequest>& pending_client_requests_map_;
+    AdmissionController& admission_controller_;
 };
 
 
@@ -132,33 +191,37 @@ public:
     StreamCollisionsCallData(CollisionQueryServiceImpl* service,
                              ServerCompletionQueue* cq,
                              std::uint32_t rank,
-                             std::mutex& pending_requests_mutex,
                              std::mutex& pending_client_requests_mutex,
-                             PendingRequestsRingbuffer& pending_requests,
-                             std::condition_variable& pending_requests_cv,
-                             std::unordered_map<std::size_t, StreamCollisionsClientRequest>& pending_stream_requests_map);
+                             PendingRequestsQueue& pending_requests,
+                             std::unordered_map<std::size_t, StreamCollisionsClientRequest>& pending_stream_requests_map,
+                             AdmissionController& admission_controller);
 
     void Proceed(bool ok) override;
     void Write(const std::size_t id,
                const std::uint32_t results_from,
                const std::vector<Collision>& collisions,
-               std::unique_lock<std::mutex>&& write_lock);
-    void Finish(const std::size_t id);
+               const FieldMask& fields,
+               std::unique_lock<std::mutex>&& write_lock,
+               const std::optional<AggregateTable>& aggregates = std::nullopt);
+    // Ends the stream with status, which is OK once every batch was written
+    void Finish(const std::size_t id, const Status& status = Status::OK);
 
 private:
     CollisionQueryServiceImpl* service_;
     ServerCompletionQueue* cq_;
     ServerContext ctx_;
     collision_proto::QueryRequest request_;
+    // Every batch is built on it, made on the first write so that calls waiting for a client hold
+    // no block. Writes are one at a time, so a batch is only reset once the previous one is sent.
+    std::unique_ptr<QueryResponseArena> arena_;
     ServerAsyncWriter<collision_proto::QueryResponse> responder_;
     enum CallStatus { CREATE, PROCESS, FINISH };
     CallStatus status_;
     std::uint32_t rank_;
-    std::mutex& pending_requests_mutex_;
     std::mutex& pending_client_requests_mutex_;
-    PendingRequestsRingbuffer& pending_requests_;
-    std::condition_variable& pending_requests_cv_;
+    PendingRequestsQueue& pending_requests_;
     std::unordered_map<std::size_t, StreamCollisionsClientRequest>& pending_stream_requests_map_;
+    AdmissionController& admission_controller_;
 };
 
 
@@ -179,9 +242,8 @@ class SendRequestCallData : public CallDataBase {
 public:
     SendRequestCallData(CollisionQueryServiceImpl* service,
                         ServerCompletionQueue* cq,
-                        std::mutex& pending_requests_mutex,
-                        PendingRequestsRingbuffer& pending_requests,
-                        std::condition_variable& pending_requests_cv);
+                        PendingRequestsQueue& pending_requests,
+                        AdmissionController& admission_controller);
 
     void Proceed(bool ok) override;
 
@@ -193,9 +255,8 @@ private:
     ServerAsyncResponseWriter<Empty> responder_;
     enum CallStatus { CREATE, PROCESS, FINISH };
     CallStatus status_;
-    std::mutex& pending_requests_mutex_;
-    PendingRequestsRingbuffer& pending_requests_;
-    std::condition_variable& pending_requests_cv_;
+    PendingRequestsQueue& pending_requests_;
+    AdmissionController& admission_controller_;
 };
 
 
@@ -203,9 +264,7 @@ class ReceiveResponseCallData : public CallDataBase {
 public:
     ReceiveResponseCallData(CollisionQueryServiceImpl* service,
                             ServerCompletionQueue* cq,
-                            std::mutex& pending_responses_mutex,
-                            PendingResponsesRingbuffer& pending_responses,
-                            std::condition_variable& pending_responses_cv);
+                            PendingResponsesQueue& pending_responses);
 
     void Proceed(bool ok) override;
 
@@ -213,11 +272,58 @@ private:
     CollisionQueryServiceImpl* service_;
     ServerCompletionQueue* cq_;
     ServerContext ctx_;
-    collision_proto::QueryResponse response_;
+    // The response of the peer is parsed onto it
+    QueryResponseArena arena_;
+    collision_proto::QueryResponse* response_;
     ServerAsyncResponseWriter<Empty> responder_;
     enum CallStatus { CREATE, PROCESS, FINISH };
     CallStatus status_;
-    std::mutex& pending_responses_mutex_;
-    PendingResponsesRingbuffer& pending_responses_;
-    std::condition_variable& pending_responses_cv_;
+    PendingResponsesQueue& pending_responses_;
+};
+
+
+class GetStatisticsCallData : public CallDataBase {
+public:
+    GetStatisticsCallData(CollisionQueryServiceImpl* service,
+                          ServerCompletionQueue* cq,
+                          std::uint32_t rank,
+                          const CollisionManager& collision_manager,
+                          const std::vector<const WorkerPoolStatisticsSource*>& worker_pools,
+                          const AdmissionController& admission_controller);
+
+    void Proceed(bool ok) override;
+
+private:
+    CollisionQueryServiceImpl* service_;
+    ServerCompletionQueue* cq_;
+    ServerContext ctx_;
+    collision_proto::StatisticsRequest request_;
+    ServerAsyncResponseWriter<collision_proto::StatisticsResponse> responder_;
+    enum CallStatus { CREATE, PROCESS, FINISH };
+    CallStatus status_;
+    std::uint32_t rank_;
+    const CollisionManager& collision_manager_;
+    const std::vector<const WorkerPoolStatisticsSource*>& worker_pools_;
+    const AdmissionController& admission_controller_;
+};
+
+class ExplainQueryCallData : public CallDataBase {
+public:
+    ExplainQueryCallData(CollisionQueryServiceImpl* service,
+                         ServerCompletionQueue* cq,
+                         std::uint32_t rank,
+                         const CollisionManager& collision_manager);
+
+    void Proceed(bool ok) override;
+
+private:
+    CollisionQueryServiceImpl* service_;
+    ServerCompletionQueue* cq_;
+    ServerContext ctx_;
+    collision_proto::QueryRequest request_;
+    ServerAsyncResponseWriter<collision_proto::ExplainResponse> responder_;
+    enum CallStatus { CREATE, PROCESS, FINISH };
+    CallStatus status_;
+    std::uint32_t rank_;
+    const CollisionManager& collision_manager_;
 };
@@ -0,0 +1,97 @@
+#include "cursor_table.hpp"
+
+#include <algorithm>
+
+CursorTable::CursorTable(const std::size_t capacity, const std::chrono::steady_clock::duration time_to_live)
+  : capacity_{capacity},
+    time_to_live_{time_to_live}
+{}
+
+void CursorTable::put(const std::size_t cursor_id, CollisionCursor&& cursor) {
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    drop_expired(now);
+    entries_.erase(cursor_id);
+    if (entries_.size() >= capacity_) {
+        const auto closest_to_expiring = std::min_element(entries_.begin(), entries_.end(), [](const auto& lhs, const auto& rhs) {
+            return lhs.second.expires_at < rhs.second.expires_at;
+        });
+        entries_.erase(closest_to_expiring);
+    }
+    entries_.emplace(cursor_id, Entry{std::move(cursor), now + time_to_live_});
+}
+
+std::optional<CollisionCursor> CursorTable::take(const std::size_t cursor_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    drop_expired(std::chrono::steady_clock::now());
+
+    const auto entry = entries_.find(cursor_id);
+    if (entry == entries_.end()) {
+        return std::nullopt;
+    }
+    std::optional<CollisionCursor> cursor{std::move(entry->second.cursor)};
+    entries_.erase(entry);
+    return cursor;
+}
+
+std::size_t CursorTable::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
+
+void CursorTable::drop_expired(const std::chrono::steady_clock::time_point now) {
+    std::erase_if(entries_, [now](const auto& entry) {
+        return entry.second.expires_at <= now;
+    });
+}
+
+QueryResponse next_page(CollisionManager& collision_manager,
+                        CursorTable& cursors,
+                        const QueryRequest& query_request,
+                        const std::uint32_t rank) {
+    QueryResponse query_response = {
+        .id = query_request.id,
+        .requested_by = query_request.requested_by,
+        .results_from = rank,
+        .collisions = {},
+        .deadline = query_request.deadline,
+    };
+
+    // The first page opens the cursor under the id of its own query
+    const std::optional<ResumeToken>& resume_token = query_request.resume_token;
+    const std::size_t cursor_id = resume_token.has_value() ? resume_token->cursor_id : query_request.id;
+    std::optional<CollisionCursor> cursor{};
+    if (resume_token.has_value()) {
+        // A rank without rows left past the previous page answers the next ones with none
+        if (std::find(resume_token->cursor_ranks.begin(), resume_token->cursor_ranks.end(), rank) == resume_token->cursor_ranks.end()) {
+            return query_response;
+        }
+        cursor = cursors.take(cursor_id);
+        if (!cursor.has_value()) {
+            query_response.cursor_expired = true;
+            return query_response;
+        }
+    } else {
+        cursor.emplace(collision_manager.open_cursor(query_request.query, query_request.page_size));
+    }
+
+    query_response.fields = cursor->get_fields();
+    query_response.collisions = cursor->next();
+    if (cursor->has_next()) {
+        query_response.resume_token = ResumeToken{.cursor_id = cursor_id, .cursor_ranks = {rank}};
+        cursors.put(cursor_id, std::move(*cursor));
+    }
+    return query_response;
+}
+
+void merge_resume_tokens(std::optional<ResumeToken>& resume_token, const std::optional<ResumeToken>& other) {
+    if (!other.has_value()) {
+        return;
+    }
+    if (!resume_token.has_value()) {
+        resume_token = other;
+        return;
+    }
+    resume_token->cursor_ranks.insert(resume_token->cursor_ranks.end(), other->cursor_ranks.begin(), other->cursor_ranks.end());
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "collision_proto_converter.hpp"
+#include "query_proto_converter.hpp"
+
+#include "collision_manager/collision_manager.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+// Most cursors a rank keeps at once and how long one is kept without its next page being asked for
+constexpr std::size_t MAX_OPEN_CURSORS = 100;
+constexpr std::chrono::seconds CURSOR_TIME_TO_LIVE{60};
+
+// Cursors over the rows of paged queries that a rank keeps between pages, each under the id of
+// the query that opened it. A cursor not resumed within the time to live is dropped, and past
+// capacity the one closest to expiring is.
+class CursorTable {
+public:
+    CursorTable(std::size_t capacity, std::chrono::steady_clock::duration time_to_live);
+
+    void put(std::size_t cursor_id, CollisionCursor&& cursor);
+    // Removes the cursor kept under cursor_id, nullopt once it was dropped. A page is read
+    // from a cursor taken out, so two requests for the same page do not both get it.
+    std::optional<CollisionCursor> take(std::size_t cursor_id);
+    std::size_t size() const;
+
+private:
+    struct Entry {
+        CollisionCursor cursor;
+        std::chrono::steady_clock::time_point expires_at;
+    };
+
+    void drop_expired(std::chrono::steady_clock::time_point now);
+
+    std::size_t capacity_;
+    std::chrono::steady_clock::duration time_to_live_;
+    mutable std::mutex mutex_;
+    std::unordered_map<std::size_t, Entry> entries_;
+};
+
+// The page of the rows of rank for query_request, read from the cursor it opens or resumes. The
+// cursor is kept in cursors while rows remain past the page.
+QueryResponse next_page(CollisionManager& collision_manager,
+                        CursorTable& cursors,
+                        const QueryRequest& query_request,
+                        std::uint32_t rank);
+// Adds the ranks of other, a page of the same query, to resume_token
+void merge_resume_tokens(std::optional<ResumeToken>& resume_token, const std::optional<ResumeToken>& other);
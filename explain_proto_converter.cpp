@@ -0,0 +1,32 @@
+#include "explain_proto_converter.hpp"
+
+#include "query_proto_converter.hpp"
+
+collision_proto::ExplainResponse ExplainProtoConverter::serialize(const std::uint32_t rank,
+                                                                  const QueryPlan& query_plan,
+                                                                  const Query& query) {
+    collision_proto::ExplainResponse proto_explain_response;
+    proto_explain_response.set_rank(rank);
+    proto_explain_response.set_row_count(query_plan.row_count);
+    proto_explain_response.set_estimated_cost(query_plan.estimated_cost);
+    proto_explain_response.set_estimated_rows(query_plan.estimated_rows);
+    proto_explain_response.set_evaluates_expression(query_plan.evaluates_expression);
+
+    for (const PlanStep& step : query_plan.steps) {
+        const FieldQuery& field_query = query.get().at(step.query_index);
+
+        collision_proto::PlanStep* proto_step = proto_explain_response.add_steps();
+        proto_step->set_condition_index(step.query_index);
+        proto_step->set_field(to_proto_query_field(field_query.get_name()));
+        proto_step->set_type(to_proto_query_type(field_query.get_type()));
+        proto_step->set_access_path(step.access_path == AccessPath::INDEX ? collision_proto::AccessPath::INDEX
+                                                                          : collision_proto::AccessPath::SCAN);
+        proto_step->set_selectivity(step.selectivity);
+        proto_step->set_estimated_rows(step.estimated_rows);
+        if (step.upper_query_index.has_value()) {
+            proto_step->set_upper_condition_index(*step.upper_query_index);
+        }
+    }
+
+    return proto_explain_response;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "collision_manager/query.hpp"
+#include "collision_manager/query_planner.hpp"
+
+#include <collision.grpc.pb.h>
+#include <grpcpp/grpcpp.h>
+
+class ExplainProtoConverter {
+public:
+    static collision_proto::ExplainResponse serialize(const std::uint32_t rank,
+                                                      const QueryPlan& query_plan,
+                                                      const Query& query);
+};
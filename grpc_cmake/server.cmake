@@ -125,18 +125,26 @@ add_library(
     collision_proto_converters
     collision_proto_converter.cpp
     query_proto_converter.cpp
+    statistics_proto_converter.cpp
+    explain_proto_converter.cpp
 )
 target_link_libraries(
     collision_proto_converters
+    collision_manager
     cm_grpc_proto
 )
 
 add_library(
     collision_query_service_impl
     collision_query_service_impl.cpp
+    admission_controller.cpp
+    aggregate_merger.cpp
+    cursor_table.cpp
+    top_k_merger.cpp
 )
 target_link_libraries(
     collision_query_service_impl
+    collision_manager
     collision_proto_converters
     cm_grpc_proto
 )
@@ -167,3 +175,46 @@ foreach(_target
     ${_GRPC_GRPCPP}
     ${_PROTOBUF_LIBPROTOBUF})
 endforeach()
+
+add_executable(
+  collision_proto_converter_benchmark
+  collision_proto_converter_benchmark.cpp
+  allocation_counter.cpp
+)
+target_link_libraries(
+  collision_proto_converter_benchmark
+  collision_proto_converters
+  collision_manager
+  benchmark::benchmark_main
+)
+
+add_executable(
+  mpmc_queue_benchmark
+  mpmc_queue_benchmark.cpp
+)
+target_link_libraries(
+  mpmc_queue_benchmark
+  benchmark::benchmark_main
+)
+
+add_executable(
+  mpmc_queue_test
+  mpmc_queue_test.cpp
+)
+target_link_libraries(
+  mpmc_queue_test
+  GTest::gtest_main
+)
+
+gtest_discover_tests(mpmc_queue_test)
+
+add_executable(
+  worker_pool_test
+  worker_pool_test.cpp
+)
+target_link_libraries(
+  worker_pool_test
+  GTest::gtest_main
+)
+
+gtest_discover_tests(worker_pool_test)
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <stop_token>
+#include <utility>
+
+// Bytes the positions of a queue are apart, so that producers and consumers do not share a cache line
+constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+// Bounded multi-producer multi-consumer queue without locks, after Dmitry Vyukov's bounded MPMC
+// queue. Every cell carries a sequence number telling whether it is free for the push at its
+// position or holds the value for the pop at it, so producers only contend on the push position
+// and consumers on the pop position.
+//
+// A full queue is backpressure, not an error: try_push() returns false and push() waits for room.
+// Once closed, pushes fail and pops return the values left, then nullopt, so waiting threads can
+// stop. T must be default constructible and move assignable.
+template<class T, std::size_t capacity>
+class MpmcQueue {
+    // With a single cell a full cell would carry the sequence number of a free one a lap later
+    static_assert(capacity >= 2, "MpmcQueue needs at least two cells");
+
+public:
+    MpmcQueue() {
+        for (std::size_t index = 0; index < capacity; ++index) {
+            cells_[index].sequence.store(index, std::memory_order_relaxed);
+        }
+    }
+
+    MpmcQueue(const MpmcQueue&) = delete;
+    MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+    // Adds value unless the queue is full or closed, value is left as it was when it is not added
+    template<class U>
+    [[nodiscard]] bool try_push(U&& value) {
+        if (closed_.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        std::size_t position = push_position_.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells_[position % capacity];
+            const std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            const std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence - position);
+
+            if (difference == 0) {
+                if (push_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    cell.value = std::forward<U>(value);
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    wake(pushes_, waiting_poppers_);
+                    return true;
+                }
+            } else if (difference < 0) {
+                // The cell still holds the value pushed a lap before
+                return false;
+            } else {
+                position = push_position_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Adds value once there is room, false when the queue is closed first
+    template<class U>
+    bool push(U&& value) {
+        while (!try_push(std::forward<U>(value))) {
+            if (closed_.load(std::memory_order_acquire)) {
+                return false;
+            }
+
+            const std::uint32_t pops = pops_.load(std::memory_order_acquire);
+            register_waiting(waiting_pushers_);
+            const bool pushed = try_push(std::forward<U>(value));
+            if (!pushed && !closed_.load(std::memory_order_acquire)) {
+                pops_.wait(pops, std::memory_order_acquire);
+            }
+            waiting_pushers_.fetch_sub(1, std::memory_order_relaxed);
+            if (pushed) {
+                break;
+            }
+        }
+        return true;
+    }
+
+    // The oldest value, nullopt when the queue is empty
+    std::optional<T> try_pop() {
+        std::size_t position = pop_position_.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells_[position % capacity];
+            const std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            const std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence - (position + 1));
+
+            if (difference == 0) {
+                if (pop_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    std::optional<T> value{std::move(cell.value)};
+                    // Free for the push a lap later
+                    cell.sequence.store(position + capacity, std::memory_order_release);
+                    wake(pops_, waiting_pushers_);
+                    return value;
+                }
+            } else if (difference < 0) {
+                // The push of the cell has not finished yet
+                return std::nullopt;
+            } else {
+                position = pop_position_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // The oldest value once there is one, nullopt when the queue is closed and empty
+    std::optional<T> pop() {
+        return pop(std::stop_token{});
+    }
+
+    // As pop(), and nullopt as well once a stop of stop_token is requested while waiting
+    std::optional<T> pop(const std::stop_token& stop_token) {
+        // Changing the counter wakes this thread whether it waits already or is about to
+        std::stop_callback wake_on_stop(stop_token, [this]() {
+            pushes_.fetch_add(1, std::memory_order_release);
+            pushes_.notify_all();
+        });
+
+        while (true) {
+            if (std::optional<T> value = try_pop()) {
+                return value;
+            }
+            if (closed_.load(std::memory_order_acquire)) {
+                // A push may have finished between the two checks
+                return try_pop();
+            }
+            if (stop_token.stop_requested()) {
+                return std::nullopt;
+            }
+
+            const std::uint32_t pushes = pushes_.load(std::memory_order_acquire);
+            register_waiting(waiting_poppers_);
+            std::optional<T> value = try_pop();
+            if (!value.has_value() && !closed_.load(std::memory_order_acquire) && !stop_token.stop_requested()) {
+                pushes_.wait(pushes, std::memory_order_acquire);
+            }
+            waiting_poppers_.fetch_sub(1, std::memory_order_relaxed);
+            if (value.has_value()) {
+                return value;
+            }
+        }
+    }
+
+    // Wakes every waiting thread, later pushes fail
+    void close() {
+        closed_.store(true, std::memory_order_seq_cst);
+        pushes_.fetch_add(1, std::memory_order_release);
+        pops_.fetch_add(1, std::memory_order_release);
+        pushes_.notify_all();
+        pops_.notify_all();
+    }
+
+    bool is_closed() const {
+        return closed_.load(std::memory_order_acquire);
+    }
+
+    // Values in the queue, only a hint while other threads push or pop
+    std::size_t size_approx() const {
+        const std::size_t pop_position = pop_position_.load(std::memory_order_relaxed);
+        const std::size_t push_position = push_position_.load(std::memory_order_relaxed);
+        return push_position > pop_position ? push_position - pop_position : 0;
+    }
+
+private:
+    struct alignas(CACHE_LINE_SIZE) Cell {
+        std::atomic<std::size_t> sequence;
+        T value{};
+    };
+
+    // A thread about to wait registers and then tries once more. With the fence in wake() either
+    // that try sees the value or room the other side made, or the other side sees the thread and
+    // changes the counter it waits on
+    static void register_waiting(std::atomic<std::uint32_t>& waiting) {
+        waiting.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    // Only touches counter when a thread waits on it, so a push or pop no other thread waits for
+    // writes no shared cache line past its position
+    static void wake(std::atomic<std::uint32_t>& counter, const std::atomic<std::uint32_t>& waiting) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting.load(std::memory_order_relaxed) > 0) {
+            counter.fetch_add(1, std::memory_order_release);
+            counter.notify_all();
+        }
+    }
+
+    std::array<Cell, capacity> cells_;
+    alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> push_position_{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> pop_position_{0};
+    // Changed by pushes and pops while threads on the other side wait on them
+    alignas(CACHE_LINE_SIZE) std::atomic<std::uint32_t> pushes_{0};
+    std::atomic<std::uint32_t> waiting_poppers_{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<std::uint32_t> pops_{0};
+    std::atomic<std::uint32_t> waiting_pushers_{0};
+    std::atomic<bool> closed_{false};
+};
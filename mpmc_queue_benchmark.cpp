@@ -0,0 +1,94 @@
+#include "mpmc_queue.hpp"
+#include "ring_buffer.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+
+// Capacity of the pendingRequests queue of the servers
+constexpr std::size_t QUEUE_CAPACITY = 100;
+
+// The pendingRequests and pendingResponses queues as they were before MpmcQueue: a Ringbuffer
+// behind a mutex, with a condition variable for values and one for room
+class LockedRingbuffer {
+public:
+    void push(const std::size_t value) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        space_cv_.wait(lock, [this]() { return !ringbuffer_.is_full(); });
+        ringbuffer_.push(value);
+        values_cv_.notify_one();
+    }
+
+    std::size_t pop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        values_cv_.wait(lock, [this]() { return !ringbuffer_.is_empty(); });
+        const std::size_t value = ringbuffer_.pop();
+        space_cv_.notify_one();
+        return value;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable values_cv_;
+    std::condition_variable space_cv_;
+    Ringbuffer<std::size_t, QUEUE_CAPACITY> ringbuffer_{};
+};
+
+class LockFreeQueue {
+public:
+    void push(const std::size_t value) {
+        queue_.push(value);
+    }
+
+    std::size_t pop() {
+        return *queue_.pop();
+    }
+
+private:
+    MpmcQueue<std::size_t, QUEUE_CAPACITY> queue_;
+};
+
+// Shared by the threads of a benchmark
+template<class Queue>
+Queue& shared_queue() {
+    static Queue queue;
+    return queue;
+}
+
+// Every thread pushes a value and pops one, as the request workers of a rank both take queries
+// and push responses
+template<class Queue>
+static void PushPop(benchmark::State& state) {
+    Queue& queue = shared_queue<Queue>();
+    for (auto _ : state) {
+        queue.push(static_cast<std::size_t>(state.thread_index()));
+        benchmark::DoNotOptimize(queue.pop());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Half of the threads push and the other half pop, as the completion queue and the shared memory
+// worker feed the request and response workers. Every thread runs as many iterations, so the
+// pops match the pushes.
+template<class Queue>
+static void ProducersConsumers(benchmark::State& state) {
+    Queue& queue = shared_queue<Queue>();
+    const bool producer = state.thread_index() % 2 == 0;
+    for (auto _ : state) {
+        if (producer) {
+            queue.push(static_cast<std::size_t>(state.thread_index()));
+        } else {
+            benchmark::DoNotOptimize(queue.pop());
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_TEMPLATE(PushPop, LockedRingbuffer)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK_TEMPLATE(PushPop, LockFreeQueue)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK_TEMPLATE(ProducersConsumers, LockedRingbuffer)->ThreadRange(2, 16)->UseRealTime();
+BENCHMARK_TEMPLATE(ProducersConsumers, LockFreeQueue)->ThreadRange(2, 16)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,225 @@
+#include "mpmc_queue.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+
+namespace {
+    // Long enough for a thread to reach its wait, so that a test sees it blocked rather than racing it
+    constexpr std::chrono::milliseconds kBlockDelay{100};
+}
+
+TEST(MpmcQueueTest, PopsInPushOrder) {
+    MpmcQueue<int, 8> queue;
+    for (int value = 0; value < 8; ++value) {
+        EXPECT_TRUE(queue.try_push(value));
+    }
+    EXPECT_EQ(queue.size_approx(), 8);
+
+    for (int value = 0; value < 8; ++value) {
+        EXPECT_EQ(queue.try_pop(), value);
+    }
+    EXPECT_EQ(queue.try_pop(), std::nullopt);
+    EXPECT_EQ(queue.size_approx(), 0);
+}
+
+TEST(MpmcQueueTest, KeepsOrderAcrossLaps) {
+    MpmcQueue<int, 4> queue;
+    int next_push = 0;
+    int next_pop = 0;
+    for (int lap = 0; lap < 10; ++lap) {
+        while (queue.try_push(next_push)) {
+            ++next_push;
+        }
+        for (int i = 0; i < 3; ++i) {
+            EXPECT_EQ(queue.try_pop(), next_pop);
+            ++next_pop;
+        }
+    }
+    while (std::optional<int> value = queue.try_pop()) {
+        EXPECT_EQ(*value, next_pop);
+        ++next_pop;
+    }
+    EXPECT_EQ(next_pop, next_push);
+}
+
+TEST(MpmcQueueTest, TryPushLeavesValueWhenFull) {
+    MpmcQueue<std::unique_ptr<int>, 2> queue;
+    EXPECT_TRUE(queue.try_push(std::make_unique<int>(1)));
+    EXPECT_TRUE(queue.try_push(std::make_unique<int>(2)));
+
+    std::unique_ptr<int> value = std::make_unique<int>(3);
+    EXPECT_FALSE(queue.try_push(std::move(value)));
+    ASSERT_NE(value, nullptr);
+    EXPECT_EQ(*value, 3);
+
+    EXPECT_EQ(*queue.try_pop().value(), 1);
+    EXPECT_TRUE(queue.try_push(std::move(value)));
+    EXPECT_EQ(value, nullptr);
+    EXPECT_EQ(*queue.try_pop().value(), 2);
+    EXPECT_EQ(*queue.try_pop().value(), 3);
+}
+
+TEST(MpmcQueueTest, TryPushFailsOnceClosed) {
+    MpmcQueue<std::string, 4> queue;
+    queue.close();
+    EXPECT_TRUE(queue.is_closed());
+
+    std::string value = "kept";
+    EXPECT_FALSE(queue.try_push(std::move(value)));
+    EXPECT_EQ(value, "kept");
+    EXPECT_FALSE(queue.push(std::string("blocked")));
+}
+
+TEST(MpmcQueueTest, PushWaitsForRoom) {
+    MpmcQueue<int, 2> queue;
+    EXPECT_TRUE(queue.try_push(1));
+    EXPECT_TRUE(queue.try_push(2));
+
+    std::atomic<bool> pushed{false};
+    std::jthread producer([&]() {
+        EXPECT_TRUE(queue.push(3));
+        pushed = true;
+    });
+
+    std::this_thread::sleep_for(kBlockDelay);
+    EXPECT_FALSE(pushed);
+
+    EXPECT_EQ(queue.pop(), 1);
+    producer.join();
+    EXPECT_TRUE(pushed);
+    EXPECT_EQ(queue.try_pop(), 2);
+    EXPECT_EQ(queue.try_pop(), 3);
+}
+
+TEST(MpmcQueueTest, CloseWakesWaitingPush) {
+    MpmcQueue<int, 2> queue;
+    EXPECT_TRUE(queue.try_push(1));
+    EXPECT_TRUE(queue.try_push(2));
+
+    std::jthread producer([&]() {
+        EXPECT_FALSE(queue.push(3));
+    });
+
+    std::this_thread::sleep_for(kBlockDelay);
+    queue.close();
+    producer.join();
+    EXPECT_EQ(queue.pop(), 1);
+    EXPECT_EQ(queue.pop(), 2);
+    EXPECT_EQ(queue.pop(), std::nullopt);
+}
+
+TEST(MpmcQueueTest, CloseDrainsRemainingValues) {
+    MpmcQueue<int, 8> queue;
+    for (int value = 0; value < 5; ++value) {
+        EXPECT_TRUE(queue.try_push(value));
+    }
+    queue.close();
+
+    for (int value = 0; value < 5; ++value) {
+        EXPECT_EQ(queue.pop(), value);
+    }
+    EXPECT_EQ(queue.pop(), std::nullopt);
+    EXPECT_EQ(queue.pop(), std::nullopt);
+}
+
+TEST(MpmcQueueTest, CloseWakesWaitingPop) {
+    MpmcQueue<int, 4> queue;
+
+    std::jthread consumer([&]() {
+        EXPECT_EQ(queue.pop(), std::nullopt);
+    });
+
+    std::this_thread::sleep_for(kBlockDelay);
+    queue.close();
+    consumer.join();
+}
+
+TEST(MpmcQueueTest, PopWakesOnStopRequest) {
+    MpmcQueue<int, 4> queue;
+    std::stop_source stop_source;
+
+    std::atomic<bool> returned{false};
+    std::jthread consumer([&]() {
+        EXPECT_EQ(queue.pop(stop_source.get_token()), std::nullopt);
+        returned = true;
+    });
+
+    std::this_thread::sleep_for(kBlockDelay);
+    EXPECT_FALSE(returned);
+
+    stop_source.request_stop();
+    consumer.join();
+    EXPECT_TRUE(returned);
+    EXPECT_FALSE(queue.is_closed());
+
+    // The queue is still open after a stop, and a value pushed later is still delivered
+    EXPECT_TRUE(queue.try_push(1));
+    EXPECT_EQ(queue.pop(), 1);
+}
+
+TEST(MpmcQueueTest, DeliversEveryValueExactlyOnce) {
+    constexpr std::size_t kProducers = 4;
+    constexpr std::size_t kConsumers = 4;
+    constexpr std::size_t kValuesPerProducer = 20000;
+
+    // Small, so that producers and consumers keep wrapping around and waiting on each other
+    MpmcQueue<std::size_t, 16> queue;
+    std::vector<std::vector<std::size_t>> popped(kConsumers);
+
+    {
+        std::vector<std::jthread> consumers;
+        for (std::size_t consumer = 0; consumer < kConsumers; ++consumer) {
+            consumers.emplace_back([&queue, &values = popped[consumer]]() {
+                while (std::optional<std::size_t> value = queue.pop()) {
+                    values.push_back(*value);
+                }
+            });
+        }
+
+        std::vector<std::jthread> producers;
+        for (std::size_t producer = 0; producer < kProducers; ++producer) {
+            producers.emplace_back([&queue, producer]() {
+                for (std::size_t i = 0; i < kValuesPerProducer; ++i) {
+                    EXPECT_TRUE(queue.push(producer * kValuesPerProducer + i));
+                }
+            });
+        }
+
+        for (std::jthread& producer : producers) {
+            producer.join();
+        }
+        queue.close();
+    }
+
+    std::vector<std::size_t> values;
+    for (const std::vector<std::size_t>& consumer_values : popped) {
+        // A consumer gets the values of one producer in the order they were pushed
+        for (std::size_t producer = 0; producer < kProducers; ++producer) {
+            std::optional<std::size_t> last;
+            for (const std::size_t value : consumer_values) {
+                if (value / kValuesPerProducer != producer) {
+                    continue;
+                }
+                if (last.has_value()) {
+                    EXPECT_LT(*last, value);
+                }
+                last = value;
+            }
+        }
+        values.insert(values.end(), consumer_values.begin(), consumer_values.end());
+    }
+
+    std::sort(values.begin(), values.end());
+    ASSERT_EQ(values.size(), kProducers * kValuesPerProducer);
+    for (std::size_t i = 0; i < values.size(); ++i) {
+        ASSERT_EQ(values[i], i);
+    }
+}
@@ -69,4 +69,36 @@ std::string MyConfig::getIP(){
     return config.getIP(rank);
 }
 
+int MyConfig::getSearchThreads(){
+    return config.getSearchThreads(rank);
+}
+
+std::size_t MyConfig::getQueryCacheBytes(){
+    return config.getQueryCacheBytes(rank);
+}
+
+int MyConfig::getCompletionQueues(){
+    return config.getCompletionQueues(rank);
+}
+
+int MyConfig::getRequestWorkers(){
+    return config.getRequestWorkers(rank);
+}
+
+int MyConfig::getResponseWorkers(){
+    return config.getResponseWorkers(rank);
+}
+
+int MyConfig::getSharedMemoryWorkers(){
+    return config.getSharedMemoryWorkers(rank);
+}
+
+int MyConfig::getMinWorkers(){
+    return config.getMinWorkers(rank);
+}
+
+int MyConfig::getAdmissionQueueDepth(){
+    return config.getAdmissionQueueDepth(rank);
+}
+
 
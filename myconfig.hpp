@@ -18,6 +18,14 @@ class MyConfig {
         int getTotalNumberofProcess();
         int getPortNumber();
         std::string getIP();
+        int getSearchThreads();
+        std::size_t getQueryCacheBytes();
+        int getCompletionQueues();
+        int getRequestWorkers();
+        int getResponseWorkers();
+        int getSharedMemoryWorkers();
+        int getMinWorkers();
+        int getAdmissionQueueDepth();
         bool isSameNodeProcess(int target_rank);
         
 
@@ -1,6 +1,55 @@
 #include "query_proto_converter.hpp"
 
+#include <algorithm>
+#include <charconv>
 #include <iostream>
+#include <stdexcept>
+
+// The cursor id and the ranks as text, "cursor_id:rank,rank"
+std::string to_resume_token(const ResumeToken& resume_token) {
+    std::string text = std::to_string(resume_token.cursor_id) + ':';
+    for (std::size_t index = 0; index < resume_token.cursor_ranks.size(); ++index) {
+        text += (index > 0 ? "," : "") + std::to_string(resume_token.cursor_ranks[index]);
+    }
+    return text;
+}
+
+ResumeToken from_resume_token(const std::string& resume_token) {
+    const char* position = resume_token.data();
+    const char* const end = resume_token.data() + resume_token.size();
+
+    ResumeToken token{};
+    auto [cursor_id_end, error] = std::from_chars(position, end, token.cursor_id);
+    if (error != std::errc() || cursor_id_end == end || *cursor_id_end != ':') {
+        throw std::invalid_argument("Invalid resume token!");
+    }
+    position = cursor_id_end + 1;
+
+    while (position != end) {
+        std::uint32_t rank = 0;
+        const auto [rank_end, rank_error] = std::from_chars(position, end, rank);
+        if (rank_error != std::errc() || (rank_end != end && (*rank_end != ',' || rank_end + 1 == end))) {
+            throw std::invalid_argument("Invalid resume token!");
+        }
+        token.cursor_ranks.push_back(rank);
+        position = rank_end == end ? end : rank_end + 1;
+    }
+    return token;
+}
+
+std::uint64_t to_timeout_ms(const std::chrono::system_clock::time_point deadline) {
+    const std::chrono::system_clock::duration time_left = deadline - std::chrono::system_clock::now();
+    // Rounded up, so a query with time left does not arrive as expired
+    return static_cast<std::uint64_t>(std::max(std::chrono::ceil<std::chrono::milliseconds>(time_left).count(), std::chrono::milliseconds::rep{0}));
+}
+
+std::chrono::system_clock::time_point from_timeout_ms(const std::uint64_t timeout_ms) {
+    return std::chrono::system_clock::now() + std::chrono::milliseconds(timeout_ms);
+}
+
+bool deadline_passed(const std::chrono::system_clock::time_point deadline) {
+    return deadline != NO_DEADLINE && deadline <= std::chrono::system_clock::now();
+}
 
 collision_proto::QueryFields to_proto_query_field(CollisionField field) {
     switch (field) {
@@ -73,7 +122,9 @@ CollisionField from_proto_query_field(collision_proto::QueryFields field) {
     }
 }
 
-Value from_proto_query_value(const collision_proto::QueryCondition& proto_query_condition, const CollisionField collision_field) {
+// ProtoValue is a QueryCondition or a QueryValue, which hold a value in the same fields
+template<class ProtoValue>
+Value from_proto_query_value(const ProtoValue& proto_query_condition, const CollisionField collision_field) {
     FieldValueType field_value_type = field_to_value_type(collision_field);
     switch(field_value_type) {
         case FieldValueType::UINT8_T:
@@ -107,6 +158,8 @@ QueryType from_proto_query_type(const collision_proto::QueryType& proto_query_ty
             return QueryType::GREATER_THAN;
         case collision_proto::QueryType::CONTAINS:
             return QueryType::CONTAINS;
+        case collision_proto::QueryType::IN:
+            return QueryType::IN;
         default:
             throw std::invalid_argument("Unknown query type");
     }
@@ -124,19 +177,156 @@ collision_proto::QueryType to_proto_query_type(const QueryType& query_type) {
             return collision_proto::QueryType::GREATER_THAN;
         case QueryType::CONTAINS:
             return collision_proto::QueryType::CONTAINS;
+        case QueryType::IN:
+            return collision_proto::QueryType::IN;
         default:
             throw std::invalid_argument("Unknown query type");
     }
 }
 
+Aggregation from_proto_aggregation(const collision_proto::Aggregation& proto_aggregation) {
+    Aggregation aggregation{};
+    for (const collision_proto::GroupByField& proto_group_by : proto_aggregation.group_by()) {
+        DateBucket bucket = DateBucket::DAY;
+        if (proto_group_by.bucket() == collision_proto::DateBucket::MONTH) {
+            bucket = DateBucket::MONTH;
+        } else if (proto_group_by.bucket() == collision_proto::DateBucket::YEAR) {
+            bucket = DateBucket::YEAR;
+        }
+        aggregation.group_by.push_back(GroupByField{.field = from_proto_query_field(proto_group_by.field()), .bucket = bucket});
+    }
+
+    for (const collision_proto::AggregateSpec& proto_spec : proto_aggregation.aggregates()) {
+        AggregateFunction function{};
+        switch (proto_spec.function()) {
+            case collision_proto::AggregateFunction::AGGREGATE_COUNT:
+                function = AggregateFunction::COUNT;
+                break;
+            case collision_proto::AggregateFunction::AGGREGATE_SUM:
+                function = AggregateFunction::SUM;
+                break;
+            case collision_proto::AggregateFunction::AGGREGATE_MIN:
+                function = AggregateFunction::MIN;
+                break;
+            case collision_proto::AggregateFunction::AGGREGATE_MAX:
+                function = AggregateFunction::MAX;
+                break;
+            default:
+                throw std::invalid_argument("Unknown aggregate function provided!");
+        }
+        aggregation.aggregates.push_back(AggregateSpec{
+            .function = function,
+            .field = proto_spec.has_field() ? from_proto_query_field(proto_spec.field()) : CollisionField::UNDEFINED,
+        });
+    }
+    return aggregation;
+}
+
+void to_proto_aggregation(const Aggregation& aggregation, collision_proto::Aggregation* proto_aggregation) {
+    for (const GroupByField& group_by : aggregation.group_by) {
+        collision_proto::GroupByField* proto_group_by = proto_aggregation->add_group_by();
+        proto_group_by->set_field(to_proto_query_field(group_by.field));
+        switch (group_by.bucket) {
+            case DateBucket::MONTH:
+                proto_group_by->set_bucket(collision_proto::DateBucket::MONTH);
+                break;
+            case DateBucket::YEAR:
+                proto_group_by->set_bucket(collision_proto::DateBucket::YEAR);
+                break;
+            default:
+                proto_group_by->set_bucket(collision_proto::DateBucket::DAY);
+                break;
+        }
+    }
+
+    for (const AggregateSpec& spec : aggregation.aggregates) {
+        collision_proto::AggregateSpec* proto_spec = proto_aggregation->add_aggregates();
+        switch (spec.function) {
+            case AggregateFunction::COUNT:
+                proto_spec->set_function(collision_proto::AggregateFunction::AGGREGATE_COUNT);
+                break;
+            case AggregateFunction::SUM:
+                proto_spec->set_function(collision_proto::AggregateFunction::AGGREGATE_SUM);
+                break;
+            case AggregateFunction::MIN:
+                proto_spec->set_function(collision_proto::AggregateFunction::AGGREGATE_MIN);
+                break;
+            case AggregateFunction::MAX:
+                proto_spec->set_function(collision_proto::AggregateFunction::AGGREGATE_MAX);
+                break;
+        }
+        if (spec.field != CollisionField::UNDEFINED) {
+            proto_spec->set_field(to_proto_query_field(spec.field));
+        }
+    }
+}
+
+QueryExpression from_proto_query_expression(const collision_proto::QueryExpression& proto_expression) {
+    QueryExpression expression{};
+    switch (proto_expression.op()) {
+        case collision_proto::QueryOperator::CONDITION:
+            expression.op = QueryOperator::CONDITION;
+            break;
+        case collision_proto::QueryOperator::AND:
+            expression.op = QueryOperator::AND;
+            break;
+        case collision_proto::QueryOperator::OR:
+            expression.op = QueryOperator::OR;
+            break;
+        case collision_proto::QueryOperator::NOT:
+            expression.op = QueryOperator::NOT;
+            break;
+        default:
+            throw std::invalid_argument("Unknown query operator");
+    }
+
+    expression.condition_index = proto_expression.condition_index();
+    for (const collision_proto::QueryExpression& proto_child : proto_expression.children()) {
+        expression.children.push_back(from_proto_query_expression(proto_child));
+    }
+    return expression;
+}
+
+void to_proto_query_expression(const QueryExpression& expression, collision_proto::QueryExpression* proto_expression) {
+    switch (expression.op) {
+        case QueryOperator::CONDITION:
+            proto_expression->set_op(collision_proto::QueryOperator::CONDITION);
+            proto_expression->set_condition_index(expression.condition_index);
+            break;
+        case QueryOperator::AND:
+            proto_expression->set_op(collision_proto::QueryOperator::AND);
+            break;
+        case QueryOperator::OR:
+            proto_expression->set_op(collision_proto::QueryOperator::OR);
+            break;
+        case QueryOperator::NOT:
+            proto_expression->set_op(collision_proto::QueryOperator::NOT);
+            break;
+        default:
+            throw std::invalid_argument("Unknown query operator");
+    }
+
+    for (const QueryExpression& child : expression.children) {
+        to_proto_query_expression(child, proto_expression->add_children());
+    }
+}
+
 QueryRequest QueryProtoConverter::deserialize(const collision_proto::QueryRequest& proto_query_request) {
     std::vector<Query> queries;
 
     for (const auto& proto_query : proto_query_request.queries()) {
         CollisionField field = from_proto_query_field(proto_query.field());
-        Value value = from_proto_query_value(proto_query, field);
         QueryType type = from_proto_query_type(proto_query.type());
 
+        // The values of an IN come as a list, any other condition has its value inline
+        std::vector<Value> values;
+        for (const collision_proto::QueryValue& proto_value : proto_query.in_values()) {
+            values.push_back(from_proto_query_value(proto_value, field));
+        }
+        if (values.empty()) {
+            values.push_back(from_proto_query_value(proto_query, field));
+        }
+
         Qualifier not_ = Qualifier::NONE;
         if (proto_query.not_()) {
             not_ = Qualifier::NOT;
@@ -147,7 +337,7 @@ QueryRequest QueryProtoConverter::deserialize(const collision_proto::QueryReques
             case_insensitive = Qualifier::CASE_INSENSITIVE;
         }
 
-        queries.push_back(Query::create(field, not_, type, value, case_insensitive));
+        queries.push_back(Query::create(field, not_, type, values, case_insensitive));
     }
 
     Query& query = queries.at(0);
@@ -155,6 +345,35 @@ QueryRequest QueryProtoConverter::deserialize(const collision_proto::QueryReques
         query.add(*it);
     }
 
+    if (proto_query_request.has_expression()) {
+        query.set_expression(from_proto_query_expression(proto_query_request.expression()));
+    }
+
+    if (proto_query_request.has_order_by()) {
+        const collision_proto::QueryOrder& proto_order = proto_query_request.order_by();
+        query.order_by(from_proto_query_field(proto_order.field()),
+                       proto_order.direction() == collision_proto::SortDirection::DESCENDING ? SortDirection::DESCENDING
+                                                                                             : SortDirection::ASCENDING);
+    }
+
+    if (proto_query_request.has_limit()) {
+        query.set_limit(proto_query_request.limit());
+    }
+
+    if (proto_query_request.count_only()) {
+        query.count_only();
+    } else if (proto_query_request.has_aggregation()) {
+        query.aggregate(from_proto_aggregation(proto_query_request.aggregation()));
+    }
+
+    if (proto_query_request.fields_size() > 0) {
+        std::vector<CollisionField> fields{};
+        for (const int proto_field : proto_query_request.fields()) {
+            fields.push_back(from_proto_query_field(static_cast<collision_proto::QueryFields>(proto_field)));
+        }
+        query.select(fields);
+    }
+
     std::size_t id = 0;
     if (proto_query_request.id()) {
         id = proto_query_request.id();
@@ -169,12 +388,30 @@ QueryRequest QueryProtoConverter::deserialize(const collision_proto::QueryReques
         .id = id,
         .requested_by = requested_by,
         .query = query,
+        .page_size = proto_query_request.page_size(),
+        .resume_token = std::nullopt,
     };
 
+    if (proto_query_request.has_timeout_ms()) {
+        query_request.deadline = from_timeout_ms(proto_query_request.timeout_ms());
+    }
+    if (!proto_query_request.resume_token().empty()) {
+        query_request.resume_token = from_resume_token(proto_query_request.resume_token());
+    }
+    if (query_request.resume_token.has_value() && query_request.page_size == 0) {
+        throw std::invalid_argument("A resume token needs a page size!");
+    }
+    // Each rank pages through its own rows, so pages can only be put together in no particular order
+    if (query_request.page_size > 0 &&
+        (query.get_order().has_value() || query.get_limit().has_value() || query.get_aggregation().has_value())) {
+        throw std::invalid_argument("Pages of a query with an order, limit or aggregation are not supported!");
+    }
+
     return query_request;
 }
 
-void serialize_proto_data(collision_proto::QueryCondition* condition, const FieldQuery& field_query) {
+template<class ProtoValue>
+void serialize_proto_data(ProtoValue* condition, const Value& value) {
     std::visit([&condition](auto&& val) {
         using T = std::decay_t<decltype(val)>;
 
@@ -195,7 +432,7 @@ void serialize_proto_data(collision_proto::QueryCondition* condition, const Fiel
         } else if constexpr (std::is_same_v<T, std::chrono::hh_mm_ss<std::chrono::minutes>>) {
             throw std::invalid_argument("Time not supported yet!");
         }
-    }, field_query.get_value());
+    }, value);
 }
 
 collision_proto::QueryRequest QueryProtoConverter::serialize(const QueryRequest& query_request) {
@@ -209,7 +446,13 @@ collision_proto::QueryRequest QueryProtoConverter::serialize(const QueryRequest&
         condition->set_field(field);
         condition->set_type(type);
 
-        serialize_proto_data(condition, field_query);
+        if (field_query.get_type() == QueryType::IN) {
+            for (const Value& value : field_query.get_values()) {
+                serialize_proto_data(condition->add_in_values(), value);
+            }
+        } else {
+            serialize_proto_data(condition, field_query.get_value());
+        }
 
         if (field_query.invert_match()) {
             condition->set_not_(true);
@@ -220,7 +463,45 @@ collision_proto::QueryRequest QueryProtoConverter::serialize(const QueryRequest&
         }
     }
 
+    if (!query_request.query.is_conjunction()) {
+        to_proto_query_expression(query_request.query.get_expression(), proto_query_request.mutable_expression());
+    }
+
+    if (query_request.query.get_order().has_value()) {
+        const QueryOrder& order = *query_request.query.get_order();
+        collision_proto::QueryOrder* proto_order = proto_query_request.mutable_order_by();
+        proto_order->set_field(to_proto_query_field(order.field));
+        proto_order->set_direction(order.direction == SortDirection::DESCENDING ? collision_proto::SortDirection::DESCENDING
+                                                                                : collision_proto::SortDirection::ASCENDING);
+    }
+
+    if (query_request.query.get_limit().has_value()) {
+        proto_query_request.set_limit(*query_request.query.get_limit());
+    }
+
+    if (query_request.query.is_count_only() && query_request.query.get_aggregation()->aggregates.size() == 1) {
+        proto_query_request.set_count_only(true);
+    } else if (query_request.query.get_aggregation().has_value()) {
+        to_proto_aggregation(*query_request.query.get_aggregation(), proto_query_request.mutable_aggregation());
+    }
+
+    if (query_request.query.get_projection().has_value()) {
+        const FieldMask& projection = *query_request.query.get_projection();
+        for (std::size_t field = 0; field < projection.size(); ++field) {
+            if (projection.test(field)) {
+                proto_query_request.add_fields(to_proto_query_field(static_cast<CollisionField>(field)));
+            }
+        }
+    }
+
     proto_query_request.set_id(query_request.id);
+    proto_query_request.set_page_size(static_cast<std::uint32_t>(query_request.page_size));
+    if (query_request.resume_token.has_value()) {
+        proto_query_request.set_resume_token(to_resume_token(*query_request.resume_token));
+    }
+    if (query_request.deadline != NO_DEADLINE) {
+        proto_query_request.set_timeout_ms(to_timeout_ms(query_request.deadline));
+    }
 
     for (const uint32_t req_by : query_request.requested_by) {
         proto_query_request.add_requested_by(req_by);
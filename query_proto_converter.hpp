@@ -3,18 +3,59 @@
 #include "collision_manager/collision.hpp"
 #include "collision_manager/query.hpp"
 
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
 #include <collision.grpc.pb.h>
 #include <grpcpp/grpcpp.h>
 
+// Where the next page of a paged query starts: the id every rank keeps its cursor under and the
+// ranks that had rows left past the previous page, the others answer the next pages with none
+struct ResumeToken {
+    std::size_t cursor_id;
+    std::vector<std::uint32_t> cursor_ranks;
+};
+
+// Deadline of a query that has none, as gRPC has it
+constexpr std::chrono::system_clock::time_point NO_DEADLINE = std::chrono::system_clock::time_point::max();
+// Time a query of a client that sets no deadline gets, so that no rank waits on a peer forever
+constexpr std::chrono::seconds DEFAULT_QUERY_TIMEOUT{30};
+
 struct QueryRequest {
     std::size_t id;
     std::vector<std::uint32_t> requested_by;
     Query query;
+    // Most rows each rank answers with for a page, every row at once when 0
+    std::size_t page_size = 0;
+    // Set for every page but the first
+    std::optional<ResumeToken> resume_token{};
+    // When every rank gives up on the query and its results
+    std::chrono::system_clock::time_point deadline = NO_DEADLINE;
 };
 
+// The bytes of a resume token and back, throws std::invalid_argument for bytes that are not one
+std::string to_resume_token(const ResumeToken& resume_token);
+ResumeToken from_resume_token(const std::string& resume_token);
+
+// A deadline as the milliseconds left until it, 0 once it passed, and back. Ranks pass the time
+// left rather than the deadline itself, so their clocks do not need to agree.
+std::uint64_t to_timeout_ms(std::chrono::system_clock::time_point deadline);
+std::chrono::system_clock::time_point from_timeout_ms(std::uint64_t timeout_ms);
+bool deadline_passed(std::chrono::system_clock::time_point deadline);
+
+
+collision_proto::QueryFields to_proto_query_field(CollisionField field);
+CollisionField from_proto_query_field(collision_proto::QueryFields field);
+collision_proto::QueryType to_proto_query_type(const QueryType& query_type);
 
 class QueryProtoConverter {
 public:
+    // Throws std::invalid_argument for a request that cannot be answered, such as a paged one
+    // with an order
     static QueryRequest deserialize(const collision_proto::QueryRequest& proto_query_request);
     static collision_proto::QueryRequest serialize(const QueryRequest& query_request);
 };
@@ -8,12 +8,41 @@
 #include <iostream>
 #include <thread>
 #include <unistd.h>
+#include <utility>
+#include <vector>
 
 const std::size_t MAX_INITIALIZING_WAIT_SECONDS = 30;
 const std::size_t MAX_FREE_LIST_ALLOCATION_WAIT_SECONDS = 10;
 
 std::mutex send_results_mutex;
 
+namespace {
+
+// Byte offset and size within a Collision of each of fields, in field order. A row in a block
+// holds only these bytes, one field after another.
+std::vector<std::pair<std::size_t, std::size_t>> packed_field_layout(const FieldMask& fields) {
+    const Collision collision{};
+    std::vector<std::pair<std::size_t, std::size_t>> layout{};
+    for (std::size_t field = 0; field < fields.size(); ++field) {
+        if (fields.test(field)) {
+            visit_collision_member(static_cast<CollisionField>(field), [&](auto member) {
+                const auto* member_data = reinterpret_cast<const std::uint8_t*>(&(collision.*member));
+                layout.emplace_back(member_data - reinterpret_cast<const std::uint8_t*>(&collision), sizeof(collision.*member));
+            });
+        }
+    }
+    return layout;
+}
+
+std::size_t packed_row_size(const std::vector<std::pair<std::size_t, std::size_t>>& layout) {
+    std::size_t row_size = 0;
+    for (const auto& [offset, size] : layout) {
+        row_size += size;
+    }
+    return row_size;
+}
+}
+
 SharedMemoryManager::SharedMemoryManager(const std::uint64_t rank, const std::size_t block_size)
   : rank_{rank}
   , shared_memory_{rank} {
@@ -154,9 +183,22 @@ QueryResponse SharedMemoryManager::deserialize(SharedMemoryQueryResponse& shared
     std::size_t data_size = shared_memory_query_response.data_size;
     std::size_t requested_by_size = shared_memory_query_response.requested_by_size;
     std::uint32_t results_from = shared_memory_query_response.results_from;
+    bool holds_aggregates = shared_memory_query_response.holds_aggregates;
+    std::uint32_t batch = shared_memory_query_response.batch;
+    std::uint32_t num_batches = shared_memory_query_response.num_batches;
+    std::optional<ResumeToken> resume_token{};
+    if (shared_memory_query_response.has_cursor) {
+        resume_token = ResumeToken{.cursor_id = shared_memory_query_response.cursor_id, .cursor_ranks = {results_from}};
+    }
+    const bool cursor_expired = shared_memory_query_response.cursor_expired;
+    const std::chrono::system_clock::time_point deadline = shared_memory_query_response.deadline;
+
+    const FieldMask fields(shared_memory_query_response.fields);
+    const std::vector<std::pair<std::size_t, std::size_t>> layout = packed_field_layout(fields);
+    const std::size_t row_size = packed_row_size(layout);
 
     // Copy shared_memory_query_response into a query_response
-    if (data_size % sizeof(Collision) != 0) {
+    if (!holds_aggregates && data_size % row_size != 0) {
         std::cerr << "Size of collisions does not match for id: " << id
                   << " from: " << results_from << std::endl;
     }
@@ -168,13 +210,35 @@ QueryResponse SharedMemoryManager::deserialize(SharedMemoryQueryResponse& shared
     shared_memory_query_response.requested_by_size = 0;
     shared_memory_query_response.results_from = -1;
 
-    std::size_t num_collisions = data_size / sizeof(Collision);
-    std::cout << "Num collisions: " << num_collisions << " for id: " << id << " from: " << results_from << std::endl;
-
     std::vector<Collision> collisions;
-    collisions.reserve(num_collisions); // pre-allocate enough space
-    collisions.resize(num_collisions); // ensure vector knows what the size is (technically wasteful because default constructs N elements)
-    std::memcpy(collisions.data(), free_list_memory_pool_.data() + data_offset, data_size);
+    std::optional<AggregateTable> aggregates;
+    std::vector<std::uint32_t> aggregated_ranks;
+    if (holds_aggregates) {
+        collision_proto::AggregateResult proto_aggregates;
+        if (!proto_aggregates.ParseFromArray(free_list_memory_pool_.data() + data_offset, static_cast<int>(data_size))) {
+            std::cerr << "Could not parse aggregates for id: " << id << " from: " << results_from << std::endl;
+        }
+        aggregates = from_proto_aggregates(proto_aggregates);
+        aggregated_ranks.assign(proto_aggregates.ranks().begin(), proto_aggregates.ranks().end());
+    } else {
+        std::size_t num_collisions = data_size / row_size;
+        std::cout << "Num collisions: " << num_collisions << " for id: " << id << " from: " << results_from << std::endl;
+
+        collisions.reserve(num_collisions); // pre-allocate enough space
+        collisions.resize(num_collisions); // ensure vector knows what the size is (technically wasteful because default constructs N elements)
+        if (fields.all()) {
+            std::memcpy(collisions.data(), free_list_memory_pool_.data() + data_offset, data_size);
+        } else {
+            // Fields left out of the block stay unset
+            const std::uint8_t* row_data = free_list_memory_pool_.data() + data_offset;
+            for (Collision& collision : collisions) {
+                for (const auto& [offset, size] : layout) {
+                    std::memcpy(reinterpret_cast<std::uint8_t*>(&collision) + offset, row_data, size);
+                    row_data += size;
+                }
+            }
+        }
+    }
 
     std::vector<std::uint32_t> requested_by(requested_by_size); // pre-allocate enough space
     std::copy_n(shared_memory_query_response.requested_by.begin(),
@@ -195,19 +259,43 @@ QueryResponse SharedMemoryManager::deserialize(SharedMemoryQueryResponse& shared
         .requested_by = requested_by,
         .results_from = results_from,
         .collisions = collisions,
+        .aggregates = aggregates,
+        .aggregated_ranks = aggregated_ranks,
+        .batch = batch,
+        .num_batches = num_batches,
+        .fields = fields,
+        .resume_token = resume_token,
+        .cursor_expired = cursor_expired,
+        .deadline = deadline,
     };
 }
 
-void SharedMemoryManager::send_results(const std::size_t parent_rank, const QueryResponse& query_response) {
+std::size_t SharedMemoryManager::block_size() const {
+    // The free list keeps the offset of the next free block in front of the data
+    return shared_memory_global_data_->memory_blocks_free_list.block_size_ - sizeof(std::size_t);
+}
+
+bool SharedMemoryManager::send_results(const std::size_t parent_rank, const QueryResponse& query_response) {
+    // Aggregates are a handful of groups, so they go through the block as a serialized message
+    std::string serialized_aggregates;
+    if (query_response.aggregates.has_value()) {
+        collision_proto::AggregateResult proto_aggregates;
+        to_proto_aggregates(*query_response.aggregates, query_response.aggregated_ranks, &proto_aggregates);
+        proto_aggregates.SerializeToString(&serialized_aggregates);
+    }
+
+    // Rows hold only the fields of the query
+    const std::vector<std::pair<std::size_t, std::size_t>> layout = packed_field_layout(query_response.fields);
+
     // Check that data will fit in allocated free list blocks
-    std::size_t data_size = sizeof(Collision) * query_response.collisions.size();
+    std::size_t data_size = query_response.aggregates.has_value() ? serialized_aggregates.size()
+                                                                  : packed_row_size(layout) * query_response.collisions.size();
 
-    if (shared_memory_global_data_->memory_blocks_free_list.block_size_ < data_size) {
+    if (block_size() < data_size) {
         std::cerr << std::format("{}: Block size {} too small to store data of size {} for request of id {}!",
-                                 rank_, shared_memory_global_data_->memory_blocks_free_list.block_size_, data_size, query_response.id)
+                                 rank_, block_size(), data_size, query_response.id)
                   << std::endl;
-        shared_memory_control_flags_->stop_requested = true;
-        exit(1);
+        return false;
     }
 
     // Check that the requested_by array will fit
@@ -258,7 +346,19 @@ void SharedMemoryManager::send_results(const std::size_t parent_rank, const Quer
 
     // Copy data to allocated block
     std::size_t data_offset = result_data_ptr - free_list_memory_pool_.data();
-    std::memcpy(result_data_ptr, query_response.collisions.data(), data_size);
+    if (query_response.aggregates.has_value()) {
+        std::memcpy(result_data_ptr, serialized_aggregates.data(), data_size);
+    } else if (query_response.fields.all()) {
+        std::memcpy(result_data_ptr, query_response.collisions.data(), data_size);
+    } else {
+        std::uint8_t* row_data = result_data_ptr;
+        for (const Collision& collision : query_response.collisions) {
+            for (const auto& [offset, size] : layout) {
+                std::memcpy(row_data, reinterpret_cast<const std::uint8_t*>(&collision) + offset, size);
+                row_data += size;
+            }
+        }
+    }
 
     // Copy requested_by vector to array
     std::array<std::uint32_t, MAX_REQUESTED_BY_DEPTH> requested_by{};
@@ -272,17 +372,44 @@ void SharedMemoryManager::send_results(const std::size_t parent_rank, const Quer
         .results_from = query_response.results_from,
         .data_offset = data_offset,
         .data_size = data_size,
+        .holds_aggregates = query_response.aggregates.has_value(),
+        .batch = query_response.batch,
+        .num_batches = query_response.num_batches,
+        .fields = static_cast<std::uint32_t>(query_response.fields.to_ulong()),
+        .has_cursor = query_response.resume_token.has_value(),
+        .cursor_id = query_response.resume_token.has_value() ? query_response.resume_token->cursor_id : 0,
+        .cursor_expired = query_response.cursor_expired,
+        .deadline = query_response.deadline,
     };
 
     send_results(parent_rank, response);
+    return true;
 }
 
 void SharedMemoryManager::send_results(const std::size_t parent_rank, SharedMemoryQueryResponse& query_response) {
-    {
-        std::unique_lock<std::mutex> send_results_lock(send_results_mutex);
-        BakeryMutexGuard guard(shared_memory_global_data_->shared_memory_local_data[parent_rank].mutex, rank_);
-        query_response.requested_by_size--; // pop self rank from end of requested_by list
-        shared_memory_global_data_->shared_memory_local_data[parent_rank].results.push(query_response);
+    query_response.requested_by_size--; // pop self rank from end of requested_by list
+
+    // Rows come a batch at a time, so wait for the parent to make room rather than overrun its
+    // ringbuffer, for as long as anybody waits for them
+    while (true) {
+        if (deadline_passed(query_response.deadline)) {
+            BakeryMutexGuard guard(shared_memory_global_data_->free_list_global_mutex, rank_);
+            shared_memory_global_data_->memory_blocks_free_list.deallocate(free_list_memory_pool_.data() + query_response.data_offset,
+                                                                           free_list_memory_pool_);
+            std::cout << std::format("{}: Dropped response from {} to parent rank: {}, its deadline passed.",
+                rank_, query_response.results_from, parent_rank) << std::endl;
+            return;
+        }
+
+        {
+            std::unique_lock<std::mutex> send_results_lock(send_results_mutex);
+            BakeryMutexGuard guard(shared_memory_global_data_->shared_memory_local_data[parent_rank].mutex, rank_);
+            if (!shared_memory_global_data_->shared_memory_local_data[parent_rank].results.is_full()) {
+                shared_memory_global_data_->shared_memory_local_data[parent_rank].results.push(query_response);
+                break;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
 
     std::cout << std::format("{}: Added response from {} to parent rank: {} shared memory ringbuffer.",
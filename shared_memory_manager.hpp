@@ -27,6 +27,19 @@ struct SharedMemoryQueryResponse {
     std::uint32_t results_from;
     std::size_t data_offset;
     std::size_t data_size;
+    // The data is a serialized collision_proto::AggregateResult instead of an array of Collision
+    bool holds_aggregates;
+    std::uint32_t batch;
+    std::uint32_t num_batches;
+    // Fields of the rows in the data, see QueryResponse::fields. Each row holds only these.
+    std::uint32_t fields;
+    // See QueryResponse::resume_token and QueryResponse::cursor_expired. A page comes from a
+    // single rank, so the token only holds the cursor id.
+    bool has_cursor;
+    std::size_t cursor_id;
+    bool cursor_expired;
+    // See QueryResponse::deadline, the ranks of a machine share the clock
+    std::chrono::system_clock::time_point deadline;
 };
 
 struct SharedMemoryControlFlags {
@@ -62,7 +75,10 @@ public:
     BakeryMutex& get_lock(std::uint32_t rank);
     QueryResponse deserialize(SharedMemoryQueryResponse& shared_memory_query_response);
     void send_results(const std::size_t parent_rank, SharedMemoryQueryResponse& shared_memory_query_response);
-    void send_results(const std::size_t parent_rank, const QueryResponse& query_response);
+    // Returns false without sending when the data does not fit in a block, see block_size()
+    bool send_results(const std::size_t parent_rank, const QueryResponse& query_response);
+    // Most bytes of data one response can hold
+    std::size_t block_size() const;
 
 private:
     void initialize(const std::size_t block_size);
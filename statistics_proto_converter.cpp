@@ -0,0 +1,103 @@
+#include "statistics_proto_converter.hpp"
+
+#include "query_proto_converter.hpp"
+
+#include <chrono>
+#include <format>
+
+void serialize_proto_value(collision_proto::QueryValue* proto_value, const Value& value) {
+    std::visit([&proto_value](auto&& val) {
+        using T = std::decay_t<decltype(val)>;
+
+        if constexpr (std::is_same_v<T, float>) {
+            proto_value->set_float_data(val);
+        } else if constexpr (std::is_same_v<T, std::uint8_t>) {
+            proto_value->set_uint8_data(val);
+        } else if constexpr (std::is_same_v<T, std::uint32_t>) {
+            proto_value->set_uint32_data(val);
+        } else if constexpr (std::is_same_v<T, std::size_t>) {
+            proto_value->set_uint64_data(val);
+        } else if constexpr (std::is_same_v<T, std::string>) {
+            proto_value->set_string_data(val);
+        } else if constexpr (std::is_same_v<T, CollisionString>) {
+            proto_value->set_string_data(val.c_str());
+        } else if constexpr (std::is_same_v<T, std::chrono::year_month_day>) {
+            proto_value->set_string_data(std::format("{:02}/{:02}/{:04}", (unsigned)val.month(), (unsigned)val.day(), (int)val.year()));
+        } else if constexpr (std::is_same_v<T, std::chrono::hh_mm_ss<std::chrono::minutes>>) {
+            proto_value->set_string_data(std::format("{:02}:{:02}", (int)val.hours().count(), (int)val.minutes().count()));
+        }
+    }, value);
+}
+
+void serialize_column_statistics(collision_proto::ColumnStatistics* proto_column, const ColumnStatistics& column) {
+    proto_column->set_field(to_proto_query_field(column.field));
+    proto_column->set_row_count(column.row_count);
+    proto_column->set_null_count(column.null_count);
+    proto_column->set_null_fraction(column.null_fraction());
+    proto_column->set_distinct_count(column.distinct_count);
+
+    for (const Value& bound : column.histogram_bounds) {
+        serialize_proto_value(proto_column->add_histogram_bounds(), bound);
+    }
+
+    for (const MostCommonValue& common_value : column.most_common_values) {
+        collision_proto::MostCommonValue* proto_common_value = proto_column->add_most_common_values();
+        serialize_proto_value(proto_common_value->mutable_value(), common_value.value);
+        proto_common_value->set_count(common_value.count);
+    }
+}
+
+collision_proto::StatisticsResponse StatisticsProtoConverter::serialize(const std::uint32_t rank,
+                                                                        const CollisionStatistics& statistics,
+                                                                        const QueryCacheStatistics& query_cache_statistics,
+                                                                        const std::vector<WorkerPoolStatistics>& worker_pool_statistics,
+                                                                        const std::optional<AdmissionStatistics>& admission_statistics,
+                                                                        const collision_proto::StatisticsRequest& proto_statistics_request) {
+    collision_proto::StatisticsResponse proto_statistics_response;
+    proto_statistics_response.set_rank(rank);
+    proto_statistics_response.set_row_count(statistics.get_row_count());
+
+    collision_proto::QueryCacheStatistics* proto_query_cache = proto_statistics_response.mutable_query_cache();
+    proto_query_cache->set_hits(query_cache_statistics.hits);
+    proto_query_cache->set_misses(query_cache_statistics.misses);
+    proto_query_cache->set_evictions(query_cache_statistics.evictions);
+    proto_query_cache->set_entries(query_cache_statistics.entries);
+    proto_query_cache->set_bytes(query_cache_statistics.bytes);
+    proto_query_cache->set_capacity_bytes(query_cache_statistics.capacity_bytes);
+
+    for (const WorkerPoolStatistics& pool_statistics : worker_pool_statistics) {
+        collision_proto::WorkerPoolStatistics* proto_worker_pool = proto_statistics_response.add_worker_pools();
+        proto_worker_pool->set_name(pool_statistics.name);
+        proto_worker_pool->set_workers(pool_statistics.workers);
+        proto_worker_pool->set_min_workers(pool_statistics.min_workers);
+        proto_worker_pool->set_max_workers(pool_statistics.max_workers);
+        proto_worker_pool->set_busy_workers(pool_statistics.busy_workers);
+        proto_worker_pool->set_queue_depth(pool_statistics.queue_depth);
+        proto_worker_pool->set_utilization(pool_statistics.utilization);
+        proto_worker_pool->set_handled(pool_statistics.handled);
+        proto_worker_pool->set_grown(pool_statistics.grown);
+        proto_worker_pool->set_shrunk(pool_statistics.shrunk);
+    }
+    if (admission_statistics.has_value()) {
+        collision_proto::AdmissionStatistics* proto_admission = proto_statistics_response.mutable_admission();
+        proto_admission->set_max_queue_depth(admission_statistics->max_queue_depth);
+        proto_admission->set_mean_handling_ms(admission_statistics->mean_handling_ms);
+        proto_admission->set_admitted(admission_statistics->admitted);
+        proto_admission->set_rejected_queue_full(admission_statistics->rejected_queue_full);
+        proto_admission->set_rejected_deadline(admission_statistics->rejected_deadline);
+        proto_admission->set_expired(admission_statistics->expired);
+    }
+
+    if (proto_statistics_request.fields_size() == 0) {
+        for (std::size_t field = 0; field < static_cast<std::size_t>(CollisionField::UNDEFINED); ++field) {
+            serialize_column_statistics(proto_statistics_response.add_columns(), statistics.get(static_cast<CollisionField>(field)));
+        }
+    } else {
+        for (const int proto_field : proto_statistics_request.fields()) {
+            CollisionField field = from_proto_query_field(static_cast<collision_proto::QueryFields>(proto_field));
+            serialize_column_statistics(proto_statistics_response.add_columns(), statistics.get(field));
+        }
+    }
+
+    return proto_statistics_response;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "admission_controller.hpp"
+#include "collision_manager/collision_statistics.hpp"
+#include "collision_manager/query_cache.hpp"
+#include "worker_pool.hpp"
+
+#include <optional>
+#include <vector>
+
+#include <collision.grpc.pb.h>
+#include <grpcpp/grpcpp.h>
+
+class StatisticsProtoConverter {
+public:
+    static collision_proto::StatisticsResponse serialize(const std::uint32_t rank,
+                                                         const CollisionStatistics& statistics,
+                                                         const QueryCacheStatistics& query_cache_statistics,
+                                                         const std::vector<WorkerPoolStatistics>& worker_pool_statistics,
+                                                         const std::optional<AdmissionStatistics>& admission_statistics,
+                                                         const collision_proto::StatisticsRequest& proto_statistics_request);
+};
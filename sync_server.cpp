@@ -1,6 +1,10 @@
 #include "collision_manager/collision_manager.hpp"
+#include "collision_manager/collision_order.hpp"
 #include "collision_proto_converter.hpp"
+#include "cursor_table.hpp"
 #include "query_proto_converter.hpp"
+#include "explain_proto_converter.hpp"
+#include "statistics_proto_converter.hpp"
 #include "myconfig.hpp"
 #include <omp.h>
 #include <grpcpp/grpcpp.h>
@@ -20,9 +24,12 @@ static std::unique_ptr<CollisionManager> collision_manager = std::make_unique<Co
 std::mutex queryMutex;
 std::unordered_set<int> processedQueries;
 std::atomic<int> counter(0);
+// Cursors of paged queries, kept between the pages asked for
+CursorTable cursorTable{MAX_OPEN_CURSORS, CURSOR_TIME_TO_LIVE};
 
 
-QueryResponse queryPeer(const std::string peer_address, const collision_proto::QueryRequest &request)
+QueryResponse queryPeer(const std::string peer_address, const collision_proto::QueryRequest &request,
+                        const std::chrono::system_clock::time_point deadline)
 {
     
     std::cout << "Requesting the neighbour : "<< peer_address << std::endl ;
@@ -33,8 +40,7 @@ QueryResponse queryPeer(const std::string peer_address, const collision_proto::Q
     collision_proto::QueryResponse peerResponse;
     grpc::ClientContext clientContext;
 
-    // Set a deadline (e.g., 2 seconds from now)
-    auto deadline = std::chrono::system_clock::now() + std::chrono::seconds(10);
+    // The peer has as long as the query has left
     clientContext.set_deadline(deadline);
 
     grpc::Status status = stub->GetCollisions(&clientContext, request, &peerResponse);
@@ -64,7 +70,20 @@ class CollisionQueryServiceImpl final : public collision_proto::CollisionQuerySe
 
             
             
-            QueryRequest query_request = QueryProtoConverter::deserialize(*request);
+            QueryRequest query_request{};
+            try {
+                query_request = QueryProtoConverter::deserialize(*request);
+            } catch (const std::invalid_argument& e) {
+                return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, e.what());
+            }
+
+            query_request.deadline = std::min(query_request.deadline, context->deadline());
+            if (rank == 0 && query_request.deadline == NO_DEADLINE) {
+                query_request.deadline = std::chrono::system_clock::now() + DEFAULT_QUERY_TIMEOUT;
+            }
+            if (deadline_passed(query_request.deadline)) {
+                return grpc::Status(grpc::StatusCode::DEADLINE_EXCEEDED, "Deadline exceeded");
+            }
 
             if (rank == 0){
                 query_request.id = counter.fetch_add(1);
@@ -89,7 +108,22 @@ class CollisionQueryServiceImpl final : public collision_proto::CollisionQuerySe
             
             
             // Fetch On server Results
-            std::vector<Collision> localResults = collision_manager->search(query_request.query);
+            const bool aggregates = query_request.query.get_aggregation().has_value();
+            const bool paged = query_request.page_size > 0;
+            std::optional<QueryResponse> page{};
+            if (paged) {
+                page = next_page(*collision_manager, cursorTable, query_request, static_cast<std::uint32_t>(rank));
+            }
+            std::vector<Collision> localResults = aggregates ? std::vector<Collision>{}
+                                                  : paged    ? std::move(page->collisions)
+                                                             : collision_manager->search(query_request.query);
+            // The request is resumed under the id of its first page while any rank has rows left
+            std::optional<ResumeToken> resume_token = paged ? page->resume_token : std::nullopt;
+            bool cursor_expired = paged && page->cursor_expired;
+            std::optional<AggregateTable> aggregatedTable{};
+            if (aggregates) {
+                aggregatedTable = collision_manager->aggregate(query_request.query);
+            }
 
             std::cout <<"Process - Rank " << rank << " Local collision size: " << localResults.size() << std::endl;
 
@@ -98,27 +132,70 @@ class CollisionQueryServiceImpl final : public collision_proto::CollisionQuerySe
 
             
             collision_proto::QueryRequest forward_request = QueryProtoConverter::serialize(query_request);
+            // Neighbours answer in columns whatever format the client asked for
+            forward_request.set_response_format(collision_proto::RESPONSE_COLUMNS);
             for (const auto& neighbour : peer_addresses_){
                 
-                QueryResponse results = queryPeer(neighbour, forward_request);
+                QueryResponse results = queryPeer(neighbour, forward_request, query_request.deadline);
                 aggregatedResults.insert(aggregatedResults.end(), results.collisions.begin(), results.collisions.end());
+                if (aggregatedTable.has_value() && results.aggregates.has_value()) {
+                    aggregatedTable->merge(*results.aggregates);
+                }
+                merge_resume_tokens(resume_token, results.resume_token);
+                cursor_expired |= results.cursor_expired;
                 std::cout << "Results from  " <<  neighbour << " Collision size "<<results.collisions.size() << std::endl;
             }
-            
-            
-            
+
+            // Each neighbour already returned the top rows of its part of the tree
+            keep_top_collisions(aggregatedResults, query_request.query.get_order(), query_request.query.get_limit());
+
             std::cout << "Process - Rank " << rank << " Aggregated collision size: " << aggregatedResults.size() << std::endl;
             
 
+            if (rank == 0 && cursor_expired) {
+                return grpc::Status(grpc::StatusCode::NOT_FOUND, "Cursor expired");
+            }
+
             // Build final response.
             QueryResponse query_response = {
                 .id = query_request.id,
                 .requested_by = {},
                 .results_from = static_cast<std::uint32_t>(rank),
                 .collisions = aggregatedResults,
+                .aggregates = aggregatedTable,
+                .aggregated_ranks = {},
+                .resume_token = resume_token,
+                .cursor_expired = cursor_expired,
             };
 
-            CollisionProtoConverter::serialize(query_response, *response);
+            CollisionProtoConverter::serialize(query_response, *response, request->response_format());
+
+            return grpc::Status::OK;
+        }
+
+        grpc::Status GetStatistics(grpc::ServerContext* context,
+                                   const collision_proto::StatisticsRequest* request,
+                                   collision_proto::StatisticsResponse* response) override {
+            try {
+                *response = StatisticsProtoConverter::serialize(rank, collision_manager->get_statistics(),
+                                                                collision_manager->get_query_cache_statistics(), {}, std::nullopt,
+                                                                *request);
+            } catch (const std::invalid_argument& e) {
+                return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, e.what());
+            }
+
+            return grpc::Status::OK;
+        }
+
+        grpc::Status ExplainQuery(grpc::ServerContext* context,
+                                  const collision_proto::QueryRequest* request,
+                                  collision_proto::ExplainResponse* response) override {
+            try {
+                QueryRequest query_request = QueryProtoConverter::deserialize(*request);
+                *response = ExplainProtoConverter::serialize(rank, collision_manager->explain(query_request.query), query_request.query);
+            } catch (const std::exception& e) {
+                return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, e.what());
+            }
 
             return grpc::Status::OK;
         }
@@ -0,0 +1,75 @@
+#include "top_k_merger.hpp"
+
+#include <algorithm>
+
+TopKMerger::TopKMerger(const std::size_t max_tracked_requests)
+  : max_tracked_requests_{max_tracked_requests}
+{}
+
+void TopKMerger::register_request(const QueryRequest& query_request) {
+    // Without a limit every row is part of the result, so there is nothing to drop
+    const Query& query = query_request.query;
+    if (!query.get_limit().has_value()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto [it, inserted] = tracked_requests_.try_emplace(query_request.id, TrackedRequest{
+        .order = query.get_order(),
+        .limit = *query.get_limit(),
+        .num_forwarded = 0,
+        .forwarded = {},
+    });
+    if (!inserted) {
+        return;
+    }
+
+    tracked_ids_.push_back(query_request.id);
+    if (tracked_ids_.size() > max_tracked_requests_) {
+        tracked_requests_.erase(tracked_ids_.front());
+        tracked_ids_.pop_front();
+    }
+}
+
+bool TopKMerger::merges(const std::size_t id) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return tracked_requests_.contains(id);
+}
+
+void TopKMerger::merge(QueryResponse& query_response) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = tracked_requests_.find(query_response.id);
+    if (it == tracked_requests_.end()) {
+        return;
+    }
+    TrackedRequest& tracked_request = it->second;
+
+    std::vector<Collision> kept{};
+    for (Collision& collision : query_response.collisions) {
+        if (tracked_request.num_forwarded < tracked_request.limit) {
+            kept.push_back(collision);
+            ++tracked_request.num_forwarded;
+            // Without an order only the number of rows passed on matters
+            if (tracked_request.order.has_value()) {
+                tracked_request.forwarded.push_back(std::move(collision));
+                std::push_heap(tracked_request.forwarded.begin(), tracked_request.forwarded.end(),
+                               CollisionOrder(*tracked_request.order));
+            }
+            continue;
+        }
+
+        if (!tracked_request.order.has_value() || tracked_request.limit == 0) {
+            break;
+        }
+
+        const CollisionOrder order{*tracked_request.order};
+        if (order(collision, tracked_request.forwarded.front())) {
+            kept.push_back(collision);
+            std::pop_heap(tracked_request.forwarded.begin(), tracked_request.forwarded.end(), order);
+            tracked_request.forwarded.back() = std::move(collision);
+            std::push_heap(tracked_request.forwarded.begin(), tracked_request.forwarded.end(), order);
+        }
+    }
+
+    query_response.collisions = std::move(kept);
+}
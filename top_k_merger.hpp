@@ -0,0 +1,44 @@
+#pragma once
+
+#include "collision_proto_converter.hpp"
+#include "query_proto_converter.hpp"
+
+#include "collision_manager/collision.hpp"
+#include "collision_manager/collision_order.hpp"
+#include "collision_manager/query.hpp"
+
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+// Drops rows of limited queries on their way up to rank 0 once they can no longer be part of the
+// result. Every row a rank passes on reaches rank 0, so after passing on limit rows a row sorting
+// after all of them is dropped, and without an order every further row is.
+class TopKMerger {
+public:
+    explicit TopKMerger(std::size_t max_tracked_requests);
+
+    // Starts tracking the rows passed on for query_request, if its query has a limit
+    void register_request(const QueryRequest& query_request);
+    bool merges(std::size_t id) const;
+    // Removes the rows of query_response that can no longer be part of the result
+    void merge(QueryResponse& query_response);
+
+private:
+    struct TrackedRequest {
+        std::optional<QueryOrder> order;
+        std::size_t limit;
+        std::size_t num_forwarded;
+        // Heap of the rows passed on so far, the last of them in the order at the top
+        std::vector<Collision> forwarded;
+    };
+
+    std::size_t max_tracked_requests_;
+    mutable std::mutex mutex_;
+    std::unordered_map<std::size_t, TrackedRequest> tracked_requests_;
+    // Ids in the order they were registered, the oldest is forgotten once there are too many
+    std::deque<std::size_t> tracked_ids_;
+};
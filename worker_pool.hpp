@@ -0,0 +1,225 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <utility>
+
+// Utilization at or above which a pool adds a worker
+constexpr double GROW_UTILIZATION = 0.75;
+// Utilization at or below which a pool with nothing queued retires a worker
+constexpr double SHRINK_UTILIZATION = 0.25;
+
+struct WorkerPoolOptions {
+    // Fewest workers the pool shrinks to, lowered to max_workers when above it
+    std::size_t min_workers = 1;
+    // Most workers the pool grows to, 0 for one per core
+    std::size_t max_workers = 0;
+    // How often the pool looks at its load to grow or shrink
+    std::chrono::milliseconds adjust_interval{100};
+};
+
+struct WorkerPoolStatistics {
+    std::string name;
+    std::size_t workers = 0;
+    std::size_t min_workers = 0;
+    std::size_t max_workers = 0;
+    // Workers handling a value rather than waiting for one
+    std::size_t busy_workers = 0;
+    std::size_t queue_depth = 0;
+    // Moving average of the fraction of busy workers, sampled every adjust interval
+    double utilization = 0.0;
+    std::uint64_t handled = 0;
+    std::uint64_t grown = 0;
+    std::uint64_t shrunk = 0;
+};
+
+// What GetStatistics needs of a pool, whatever the values it handles
+class WorkerPoolStatisticsSource {
+public:
+    virtual ~WorkerPoolStatisticsSource() = default;
+
+    virtual WorkerPoolStatistics get_statistics() const = 0;
+};
+
+// Threads that each take a value and handle it, over and over. Every adjust interval the pool
+// adds a worker while values queue up or most workers are busy, and retires one while nothing is
+// queued and most workers wait, staying between min_workers and max_workers.
+//
+// take waits for a value and returns nullopt once the worker should end, at the latest when the
+// stop of the stop token it is given is requested, which is how a worker is retired.
+template<class T>
+class WorkerPool final : public WorkerPoolStatisticsSource {
+public:
+    using Take = std::function<std::optional<T>(std::uint32_t worker_id, const std::stop_token& stop_token)>;
+    using Handle = std::function<void(std::uint32_t worker_id, T& value)>;
+    using QueueDepth = std::function<std::size_t()>;
+
+    WorkerPool(std::string name, const WorkerPoolOptions& options, Take take, Handle handle, QueueDepth queue_depth)
+        : name_{std::move(name)}
+        , max_workers_{options.max_workers > 0 ? options.max_workers : std::max<std::size_t>(std::thread::hardware_concurrency(), 1)}
+        , min_workers_{std::clamp<std::size_t>(options.min_workers, 1, max_workers_)}
+        , adjust_interval_{options.adjust_interval}
+        , take_{std::move(take)}
+        , handle_{std::move(handle)}
+        , queue_depth_{std::move(queue_depth)} {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (std::size_t worker = 0; worker < min_workers_; ++worker) {
+            add_worker();
+        }
+        if (min_workers_ < max_workers_) {
+            controller_ = std::jthread([this](std::stop_token stop_token) { adjust_workers(stop_token); });
+        }
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    ~WorkerPool() {
+        stop();
+    }
+
+    // Retires every worker and waits for them to finish the value they are handling
+    void stop() {
+        controller_.request_stop();
+        if (controller_.joinable()) {
+            controller_.join();
+        }
+
+        std::list<Worker> workers;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (Worker& worker : workers_) {
+                worker.thread.request_stop();
+            }
+            workers.splice(workers.end(), workers_);
+        }
+        for (Worker& worker : workers) {
+            if (worker.thread.joinable()) {
+                worker.thread.join();
+            }
+        }
+    }
+
+    WorkerPoolStatistics get_statistics() const override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return WorkerPoolStatistics{
+            .name = name_,
+            .workers = active_workers(),
+            .min_workers = min_workers_,
+            .max_workers = max_workers_,
+            .busy_workers = busy_workers_.load(std::memory_order_relaxed),
+            .queue_depth = queue_depth_(),
+            .utilization = utilization_,
+            .handled = handled_.load(std::memory_order_relaxed),
+            .grown = grown_,
+            .shrunk = shrunk_,
+        };
+    }
+
+private:
+    struct Worker {
+        std::jthread thread;
+        bool retired = false;
+        bool finished = false;
+    };
+
+    void add_worker() {
+        Worker& worker = workers_.emplace_back();
+        const std::uint32_t worker_id = next_worker_id_++;
+        worker.thread = std::jthread([this, &worker, worker_id](std::stop_token stop_token) {
+            run(worker, worker_id, stop_token);
+        });
+    }
+
+    void run(Worker& worker, const std::uint32_t worker_id, const std::stop_token& stop_token) {
+        while (!stop_token.stop_requested()) {
+            std::optional<T> value = take_(worker_id, stop_token);
+            if (!value.has_value()) {
+                break;
+            }
+
+            busy_workers_.fetch_add(1, std::memory_order_relaxed);
+            handle_(worker_id, *value);
+            busy_workers_.fetch_sub(1, std::memory_order_relaxed);
+            handled_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        worker.finished = true;
+    }
+
+    // Workers not asked to stop
+    std::size_t active_workers() const {
+        return std::count_if(workers_.begin(), workers_.end(), [](const Worker& worker) { return !worker.retired; });
+    }
+
+    void adjust_workers(const std::stop_token& stop_token) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            stop_cv_.wait_for(lock, stop_token, adjust_interval_, []() { return false; });
+            if (stop_token.stop_requested()) {
+                return;
+            }
+
+            // Retired workers are joined once they finished, so the controller never waits on a
+            // value being handled
+            for (auto worker = workers_.begin(); worker != workers_.end();) {
+                if (worker->finished) {
+                    worker->thread.join();
+                    worker = workers_.erase(worker);
+                } else {
+                    ++worker;
+                }
+            }
+
+            const std::size_t workers = active_workers();
+            const std::size_t queue_depth = queue_depth_();
+            const std::size_t busy_workers = std::min(busy_workers_.load(std::memory_order_relaxed), workers);
+            utilization_ = (utilization_ + static_cast<double>(busy_workers) / std::max<std::size_t>(workers, 1)) / 2;
+
+            if (workers < max_workers_ && (queue_depth > workers || utilization_ >= GROW_UTILIZATION)) {
+                add_worker();
+                ++grown_;
+            } else if (workers > min_workers_ && queue_depth == 0 && utilization_ <= SHRINK_UTILIZATION) {
+                // The newest worker goes first; ids are never reused, so they only tell workers apart in logs
+                const auto worker = std::find_if(workers_.rbegin(), workers_.rend(), [](const Worker& worker) { return !worker.retired; });
+                worker->retired = true;
+                worker->thread.request_stop();
+                ++shrunk_;
+            }
+        }
+    }
+
+    const std::string name_;
+    const std::size_t max_workers_;
+    const std::size_t min_workers_;
+    const std::chrono::milliseconds adjust_interval_;
+    const Take take_;
+    const Handle handle_;
+    const QueueDepth queue_depth_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable_any stop_cv_;
+    // A list, so that a worker stays where its thread refers to it
+    std::list<Worker> workers_;
+    std::uint32_t next_worker_id_ = 0;
+    // Counted without the mutex, so handling a value takes no lock of the pool
+    std::atomic<std::size_t> busy_workers_{0};
+    std::atomic<std::uint64_t> handled_{0};
+    double utilization_ = 0.0;
+    std::uint64_t grown_ = 0;
+    std::uint64_t shrunk_ = 0;
+    // Last, so that it is stopped before anything it uses is destroyed
+    std::jthread controller_;
+};
@@ -0,0 +1,93 @@
+#include "mpmc_queue.hpp"
+#include "worker_pool.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <stop_token>
+#include <thread>
+#include <gtest/gtest.h>
+
+namespace {
+    constexpr std::chrono::milliseconds kAdjustInterval{10};
+    // Longest a test waits for the pool to reach the number of workers it expects
+    constexpr std::chrono::seconds kSettleTimeout{10};
+
+    // Polls the pool until it runs workers workers, false once kSettleTimeout passed
+    template<class T>
+    bool wait_for_workers(const WorkerPool<T>& pool, const std::size_t workers) {
+        const auto give_up = std::chrono::steady_clock::now() + kSettleTimeout;
+        while (std::chrono::steady_clock::now() < give_up) {
+            if (pool.get_statistics().workers == workers) {
+                return true;
+            }
+            std::this_thread::sleep_for(kAdjustInterval);
+        }
+        return false;
+    }
+}
+
+TEST(WorkerPoolTest, StartsWithMinWorkers) {
+    MpmcQueue<int, 16> queue;
+    WorkerPool<int> pool(
+        "test workers",
+        WorkerPoolOptions{.min_workers = 2, .max_workers = 4, .adjust_interval = kAdjustInterval},
+        [&queue](std::uint32_t, const std::stop_token& stop_token) { return queue.pop(stop_token); },
+        [](std::uint32_t, int&) {},
+        [&queue]() { return queue.size_approx(); });
+
+    const WorkerPoolStatistics statistics = pool.get_statistics();
+    EXPECT_EQ(statistics.workers, 2);
+    EXPECT_EQ(statistics.min_workers, 2);
+    EXPECT_EQ(statistics.max_workers, 4);
+
+    // Nothing queued, so an idle pool neither grows nor shrinks below its minimum
+    std::this_thread::sleep_for(10 * kAdjustInterval);
+    EXPECT_EQ(pool.get_statistics().workers, 2);
+    EXPECT_EQ(pool.get_statistics().grown, 0);
+}
+
+TEST(WorkerPoolTest, GrowsUnderLoadAndShrinksWhenIdle) {
+    constexpr std::size_t kMinWorkers = 1;
+    constexpr std::size_t kMaxWorkers = 4;
+    constexpr int kValues = 32;
+
+    MpmcQueue<int, 64> queue;
+    // Every worker holds on to its value until released, so values keep queueing up meanwhile
+    std::atomic<bool> released{false};
+    std::atomic<int> handled{0};
+
+    WorkerPool<int> pool(
+        "test workers",
+        WorkerPoolOptions{.min_workers = kMinWorkers, .max_workers = kMaxWorkers, .adjust_interval = kAdjustInterval},
+        [&queue](std::uint32_t, const std::stop_token& stop_token) { return queue.pop(stop_token); },
+        [&released, &handled](std::uint32_t, int&) {
+            while (!released.load()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            handled.fetch_add(1);
+        },
+        [&queue]() { return queue.size_approx(); });
+
+    for (int value = 0; value < kValues; ++value) {
+        ASSERT_TRUE(queue.try_push(value));
+    }
+
+    // Released before asserting, so that a pool failing to grow still gets to stop
+    const bool grew = wait_for_workers(pool, kMaxWorkers);
+    WorkerPoolStatistics statistics = pool.get_statistics();
+    released = true;
+    ASSERT_TRUE(grew);
+    EXPECT_GT(statistics.workers, kMinWorkers);
+    EXPECT_GE(statistics.grown, kMaxWorkers - kMinWorkers);
+    EXPECT_EQ(statistics.shrunk, 0);
+
+    ASSERT_TRUE(wait_for_workers(pool, kMinWorkers));
+    statistics = pool.get_statistics();
+    EXPECT_EQ(statistics.workers, kMinWorkers);
+    EXPECT_EQ(statistics.queue_depth, 0);
+    EXPECT_GE(statistics.shrunk, kMaxWorkers - kMinWorkers);
+    EXPECT_EQ(handled.load(), kValues);
+}
@@ -61,3 +61,51 @@ int Config::getTotalWorkers(){
     return total_partitions;
 }
 
+
+int Config::getSearchThreads(int rank){
+
+    return processes[rank].search_threads;
+
+}
+
+std::size_t Config::getQueryCacheBytes(int rank){
+
+    return processes[rank].query_cache_mb << 20;
+
+}
+
+int Config::getCompletionQueues(int rank){
+
+    return processes[rank].completion_queues;
+
+}
+
+int Config::getRequestWorkers(int rank){
+
+    return processes[rank].request_workers;
+
+}
+
+int Config::getResponseWorkers(int rank){
+
+    return processes[rank].response_workers;
+
+}
+
+int Config::getSharedMemoryWorkers(int rank){
+
+    return processes[rank].shared_memory_workers;
+
+}
+
+int Config::getMinWorkers(int rank){
+
+    return processes[rank].min_workers;
+
+}
+
+int Config::getAdmissionQueueDepth(int rank){
+
+    return processes[rank].admission_queue_depth;
+
+}
@@ -18,6 +18,21 @@ struct Process {
     int rank;
     int port;
     std::string ip;
+    // Threads one search may use, 0 for every core
+    int search_threads;
+    // Memory for cached query results, 0 disables the cache
+    std::size_t query_cache_mb;
+    // Completion queues of the async servers, each polled by its own thread, 0 for one per core
+    int completion_queues;
+    // Most workers of the request, response and shared memory pools of the async servers, 0 for
+    // one per core. The pools grow and shrink with their load, down to min_workers each.
+    int request_workers;
+    int response_workers;
+    int shared_memory_workers;
+    int min_workers;
+    // Queries waiting for a request worker at which the async servers turn new ones away, 0 for as
+    // many as fit in the queue
+    int admission_queue_depth;
     std::vector<Neighbor> logical_neighbors;
 };
 
@@ -58,6 +73,14 @@ class Config {
                 process.rank = processNode.second["rank"].as<int>();
                 process.port = processNode.second["port"].as<int>();
                 process.ip = processNode.second["ip"].as<std::string>();
+                process.search_threads = processNode.second["search_threads"] ? processNode.second["search_threads"].as<int>() : 0;
+                process.query_cache_mb = processNode.second["query_cache_mb"] ? processNode.second["query_cache_mb"].as<std::size_t>() : 64;
+                process.completion_queues = processNode.second["completion_queues"] ? processNode.second["completion_queues"].as<int>() : 0;
+                process.request_workers = processNode.second["request_workers"] ? processNode.second["request_workers"].as<int>() : 0;
+                process.response_workers = processNode.second["response_workers"] ? processNode.second["response_workers"].as<int>() : 0;
+                process.shared_memory_workers = processNode.second["shared_memory_workers"] ? processNode.second["shared_memory_workers"].as<int>() : 1;
+                process.min_workers = processNode.second["min_workers"] ? processNode.second["min_workers"].as<int>() : 1;
+                process.admission_queue_depth = processNode.second["admission_queue_depth"] ? processNode.second["admission_queue_depth"].as<int>() : 0;
 
                 // Parse logical neighbors
                 for (const auto& neighborNode : processNode.second["logical_neighbors"]) {
@@ -83,6 +106,14 @@ class Config {
         int getPortNumber(int rank);
         std::string getIP(int rank);
         int getTotalWorkers();
+        int getSearchThreads(int rank);
+        std::size_t getQueryCacheBytes(int rank);
+        int getCompletionQueues(int rank);
+        int getRequestWorkers(int rank);
+        int getResponseWorkers(int rank);
+        int getSharedMemoryWorkers(int rank);
+        int getMinWorkers(int rank);
+        int getAdmissionQueueDepth(int rank);
         std::string getaddress(int rank);
 
         private :